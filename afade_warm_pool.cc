@@ -0,0 +1,145 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
+#include "afade_warm_pool.h"
+
+#include <malloc.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "numa_topology.h"
+
+namespace {
+
+// 堆上已分配的字节数（含 mmap 的大块）；只用来估算，精度受其他线程干扰
+size_t HeapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+#else
+  struct mallinfo mi = mallinfo();
+#endif
+  return static_cast<size_t>(mi.uordblks) + static_cast<size_t>(mi.hblkhd);
+}
+
+} // namespace
+
+AfadeWarmPool &AfadeWarmPool::Instance() {
+  static AfadeWarmPool inst;
+  return inst;
+}
+
+AfadeWarmPool::~AfadeWarmPool() { Stop(); }
+
+void AfadeWarmPool::Start(int depth, size_t max_keys) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!stop_)
+    return;
+  depth_ = depth > 0 ? depth : 1;
+  max_keys_ = max_keys;
+  stop_ = false;
+  refill_ = std::thread(&AfadeWarmPool::RefillLoop, this);
+}
+
+void AfadeWarmPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (stop_)
+      return;
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (refill_.joinable())
+    refill_.join();
+  std::lock_guard<std::mutex> lk(mu_);
+  idle_.clear();
+}
+
+std::unique_ptr<AudioAfade> AfadeWarmPool::Take(const Key &key) {
+  std::unique_ptr<AudioAfade> afade;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (stop_)
+      return nullptr;
+    auto it = idle_.find(key);
+    if (it != idle_.end() && !it->second.empty()) {
+      afade = std::move(it->second.back());
+      it->second.pop_back();
+    } else if (it == idle_.end() && idle_.size() < max_keys_) {
+      idle_.emplace(key, std::vector<std::unique_ptr<AudioAfade>>());
+    }
+  }
+  (afade ? hits_ : misses_).fetch_add(1, std::memory_order_relaxed);
+  cv_.notify_one();
+  return afade;
+}
+
+std::unique_ptr<AudioAfade> AfadeWarmPool::Create(const Key &key) {
+  bool measure;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    measure = footprint_.find(key) == footprint_.end();
+  }
+  if (!measure) {
+    return std::make_unique<AudioAfade>(key.sample_rate, key.channels, key.sample_fmt,
+                                        key.type, key.frames);
+  }
+
+  std::lock_guard<std::mutex> measure_lk(measure_mu_);
+  size_t before = HeapInUse();
+  auto afade = std::make_unique<AudioAfade>(key.sample_rate, key.channels,
+                                            key.sample_fmt, key.type, key.frames);
+  size_t after = HeapInUse();
+  if (afade->state() != AudioAfade::STATE_FAILED) {
+    size_t bytes = after > before ? after - before : 0;
+    std::lock_guard<std::mutex> lk(mu_);
+    footprint_.emplace(key, bytes);
+    LOG_INFO("AudioAfade footprint rate={} channels={} type={} frames={}: {} bytes",
+             key.sample_rate, key.channels, key.type, key.frames, bytes);
+  }
+  return afade;
+}
+
+size_t AfadeWarmPool::FootprintBytes(const Key &key) {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = footprint_.find(key);
+  return it == footprint_.end() ? 0 : it->second;
+}
+
+void AfadeWarmPool::RefillLoop() {
+  pthread_setname_np(pthread_self(), "afade_warm");
+  const NumaTopology &numa = NumaTopology::Instance();
+  const std::vector<int> all_cpus = numa.SortByNode({});
+  int pinned_node = -1;
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stop_) {
+    // 找一组不足 depth 的参数，锁外建实例
+    const Key *want = nullptr;
+    for (auto &[key, list] : idle_) {
+      if (static_cast<int>(list.size()) < depth_) {
+        want = &key;
+        break;
+      }
+    }
+    if (!want) {
+      cv_.wait(lk);
+      continue;
+    }
+    Key key = *want;
+    lk.unlock();
+    // 切到目标节点上再建实例，编解码器和滤镜图的内存随首次写入落在本地
+    if (key.numa_node != pinned_node && numa.nodes() > 1) {
+      if (key.numa_node >= 0)
+        numa.PinCurrentThreadToNode(key.numa_node);
+      else
+        NumaTopology::PinCurrentThread(all_cpus);
+      pinned_node = key.numa_node;
+    }
+    std::unique_ptr<AudioAfade> afade = Create(key);
+    lk.lock();
+    if (afade->state() == AudioAfade::STATE_FAILED) {
+      LOG_ERROR("AfadeWarmPool prewarm failed, dropping key rate={} channels={}",
+                key.sample_rate, key.channels);
+      idle_.erase(key);
+      continue;
+    }
+    idle_[key].push_back(std::move(afade));
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "audio_afade.h"
+
+// 预热的 AudioAfade 池：后台线程按最近用到的参数提前建好实例（打开编解码器、
+// 配好滤镜图），休眠房间收到淡入淡出命令时直接取用，不把初始化放在处理线程上。
+// 每组参数第一次建实例时顺带测量一次常驻内存，供房间估算内存占用。
+class AfadeWarmPool {
+public:
+  struct Key {
+    int sample_rate = 0;
+    int channels = 0;
+    AVSampleFormat sample_fmt = AV_SAMPLE_FMT_NONE;
+    AudioAfade::FadeType type = AudioAfade::FADE_NONE;
+    int frames = 0;
+    int numa_node = -1; // 实例在该节点的 CPU 上构建（首次写入分配到本地内存），-1 = 不限
+
+    bool operator<(const Key &o) const {
+      return std::tie(sample_rate, channels, sample_fmt, type, frames, numa_node) <
+             std::tie(o.sample_rate, o.channels, o.sample_fmt, o.type, o.frames,
+                      o.numa_node);
+    }
+  };
+
+  static AfadeWarmPool &Instance();
+
+  // 启动补充线程：每组参数保持 depth 个空闲实例，最多跟踪 max_keys 组参数。
+  // 不启动时 Take 总是未命中；未命中（包括某组参数第一次用到）时 RoomPipeline::StartFade
+  // 用 Create 在处理线程上同步构建，所以用到房间管线的入口都应先 Start
+  void Start(int depth = 2, size_t max_keys = 16);
+  void Stop();
+
+  // 取一个预热实例；未命中返回 nullptr，并登记该参数以便后台补充
+  std::unique_ptr<AudioAfade> Take(const Key &key);
+  // 同步新建一个实例（未命中时由调用方使用），必要时测量常驻内存
+  std::unique_ptr<AudioAfade> Create(const Key &key);
+  // 单个实例的常驻内存估算（字节），该参数还没建过实例时返回 0
+  size_t FootprintBytes(const Key &key);
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  AfadeWarmPool() = default;
+  ~AfadeWarmPool();
+
+  void RefillLoop();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::map<Key, std::vector<std::unique_ptr<AudioAfade>>> idle_;
+  std::map<Key, size_t> footprint_;
+  int depth_ = 0;
+  size_t max_keys_ = 0;
+  bool stop_ = true;
+  std::thread refill_;
+
+  std::mutex measure_mu_; // 串行化首次测量，避免并发分配互相干扰
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
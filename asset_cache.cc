@@ -0,0 +1,471 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "asset_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+
+#include "audio_afade.h"
+#include "logger.h"
+
+namespace {
+
+std::string AvError(int ret) {
+  char errbuf[128];
+  av_strerror(ret, errbuf, sizeof(errbuf));
+  return errbuf;
+}
+
+// 一次解码/编码用到的 FFmpeg 对象，离开作用域统一释放
+struct CodecScope {
+  AVFormatContext *fmt = nullptr;
+  AVCodecContext *ctx = nullptr;
+  SwrContext *swr = nullptr;
+  AVFrame *frame = nullptr;
+  AVPacket *pkt = nullptr;
+
+  ~CodecScope() {
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    swr_free(&swr);
+    avcodec_free_context(&ctx);
+    if (fmt)
+      avformat_close_input(&fmt);
+  }
+};
+
+// 按声道分开的 float 样本拼成 Pcm（截到最短的声道）
+std::shared_ptr<AssetCache::Pcm> PackPlanes(const std::vector<std::vector<float>> &planes,
+                                            int sample_rate) {
+  auto pcm = std::make_shared<AssetCache::Pcm>();
+  pcm->sample_rate = sample_rate;
+  pcm->channels = static_cast<int>(planes.size());
+  pcm->samples = static_cast<int64_t>(planes[0].size());
+  for (const auto &plane : planes)
+    pcm->samples = std::min<int64_t>(pcm->samples, plane.size());
+  pcm->data.resize(static_cast<size_t>(pcm->channels) * pcm->samples);
+  for (int c = 0; c < pcm->channels; c++)
+    std::copy_n(planes[c].begin(), pcm->samples, pcm->data.begin() + c * pcm->samples);
+  return pcm;
+}
+
+// 经 swr 转换 nb 个输入样本（in 为 nullptr 时冲刷），追加到 planes
+bool ConvertAppend(SwrContext *swr, const uint8_t **in, int nb,
+                   std::vector<std::vector<float>> *planes) {
+  const int cap = swr_get_out_samples(swr, nb);
+  if (cap <= 0)
+    return true;
+  const size_t old = (*planes)[0].size();
+  std::vector<uint8_t *> out(planes->size());
+  for (size_t c = 0; c < planes->size(); c++) {
+    (*planes)[c].resize(old + cap);
+    out[c] = reinterpret_cast<uint8_t *>((*planes)[c].data() + old);
+  }
+  const int got = swr_convert(swr, out.data(), cap, in, nb);
+  for (auto &plane : *planes)
+    plane.resize(old + std::max(got, 0));
+  if (got < 0) {
+    LOG_ERROR("AssetCache resample failed: {}", AvError(got));
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool AssetCache::Aac::Get(size_t i, int64_t pts_offset, AVPacket *out) const {
+  if (i >= packets.size() || !buf)
+    return false;
+  out->buf = av_buffer_ref(buf);
+  if (!out->buf)
+    return false;
+  const Packet &p = packets[i];
+  out->data = buf->data + p.offset;
+  out->size = p.size;
+  out->pts = out->dts = p.pts + pts_offset;
+  out->duration = 1024;
+  out->flags |= AV_PKT_FLAG_KEY;
+  return true;
+}
+
+AssetCache &AssetCache::Instance() {
+  static AssetCache inst;
+  return inst;
+}
+
+void AssetCache::SetBudget(size_t bytes) {
+  std::lock_guard<std::mutex> lk(mu_);
+  budget_ = bytes;
+  EvictLocked(nullptr);
+}
+
+std::shared_ptr<const AssetCache::Pcm> AssetCache::GetPcm(const std::string &path,
+                                                          int sample_rate, int channels) {
+  const Key key{path, sample_rate, channels, 0};
+  const Key native_key{path, 0, 0, 0};
+  auto decode = [&] { return Decode(path); };
+  bool cached;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    cached = entries_.count(key) != 0;
+  }
+  // 目标格式还没有时先拿原始 PCM（必要时解码）；格式正好一致就直接用它，不另存一份
+  std::shared_ptr<const Pcm> native;
+  if (!cached) {
+    native = GetOrLoad<Pcm>(native_key, decode);
+    if (!native)
+      return nullptr;
+    if (native->sample_rate == sample_rate && native->channels == channels)
+      return native;
+  }
+  return GetOrLoad<Pcm>(key, [&]() -> std::shared_ptr<const Pcm> {
+    if (!native)
+      native = GetOrLoad<Pcm>(native_key, decode); // 查询后条目被淘汰
+    return native ? Resample(*native, sample_rate, channels) : nullptr;
+  });
+}
+
+std::shared_ptr<const AssetCache::Aac> AssetCache::GetAac(const std::string &path,
+                                                          int sample_rate, int channels,
+                                                          int64_t bit_rate) {
+  return GetOrLoad<Aac>(Key{path, sample_rate, channels, bit_rate},
+                        [&]() -> std::shared_ptr<const Aac> {
+                          std::shared_ptr<const Pcm> pcm = GetPcm(path, sample_rate, channels);
+                          return pcm ? Encode(*pcm, bit_rate) : nullptr;
+                        });
+}
+
+void AssetCache::Clear() {
+  std::lock_guard<std::mutex> lk(mu_);
+  // 加载中的条目留给加载线程登记结果
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.loaded) {
+      stats_.bytes -= it->second.bytes;
+      lru_.erase(it->second.lru);
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+AssetCache::Stats AssetCache::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  Stats stats = stats_;
+  stats.entries = entries_.size();
+  return stats;
+}
+
+template <typename T, typename Load>
+std::shared_ptr<const T> AssetCache::GetOrLoad(const Key &key, Load load) {
+  std::promise<std::shared_ptr<const void>> promise;
+  std::shared_future<std::shared_ptr<const void>> ready;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      stats_.hits++;
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      ready = it->second.ready;
+    } else {
+      stats_.misses++;
+      Entry &entry = entries_[key];
+      entry.ready = promise.get_future().share();
+      entry.lru = lru_.insert(lru_.begin(), key);
+    }
+  }
+  if (ready.valid())
+    return std::static_pointer_cast<const T>(ready.get());
+
+  // 锁外加载，同一条目的其他请求等在 future 上
+  std::shared_ptr<const T> value = load();
+  promise.set_value(value);
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = entries_.find(key);
+  if (it == entries_.end())
+    return value;
+  if (!value) {
+    // 失败不缓存，下次再试（文件可能稍后才放上来）
+    stats_.failures++;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+    return value;
+  }
+  it->second.bytes = value->bytes();
+  it->second.loaded = true;
+  stats_.bytes += it->second.bytes;
+  EvictLocked(&key);
+  return value;
+}
+
+void AssetCache::EvictLocked(const Key *keep) {
+  auto it = lru_.end();
+  while (stats_.bytes > budget_ && it != lru_.begin()) {
+    --it;
+    auto entry = entries_.find(*it);
+    if (!entry->second.loaded || (keep && *it == *keep))
+      continue;
+    LOG_INFO("AssetCache evict {} rate={} channels={} bit_rate={} bytes={}", it->path,
+             it->sample_rate, it->channels, it->bit_rate, entry->second.bytes);
+    stats_.bytes -= entry->second.bytes;
+    stats_.evictions++;
+    entries_.erase(entry);
+    it = lru_.erase(it);
+  }
+}
+
+std::shared_ptr<const AssetCache::Pcm> AssetCache::Decode(const std::string &path) {
+  CodecScope scope;
+  int ret = avformat_open_input(&scope.fmt, path.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("AssetCache open {} failed: {}", path, AvError(ret));
+    return nullptr;
+  }
+  avformat_find_stream_info(scope.fmt, nullptr);
+  const int index = av_find_best_stream(scope.fmt, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+  if (index < 0) {
+    LOG_ERROR("AssetCache no audio stream in {}", path);
+    return nullptr;
+  }
+  const AVCodecParameters *par = scope.fmt->streams[index]->codecpar;
+  const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+  scope.ctx = codec ? avcodec_alloc_context3(codec) : nullptr;
+  if (!scope.ctx || avcodec_parameters_to_context(scope.ctx, par) < 0 ||
+      (ret = avcodec_open2(scope.ctx, codec, nullptr)) < 0 || scope.ctx->channels <= 0 ||
+      scope.ctx->sample_rate <= 0) {
+    LOG_ERROR("AssetCache open decoder for {} failed: {}", path, AvError(ret));
+    return nullptr;
+  }
+  scope.frame = av_frame_alloc();
+  scope.pkt = av_packet_alloc();
+  if (!scope.frame || !scope.pkt)
+    return nullptr;
+
+  const int sample_rate = scope.ctx->sample_rate;
+  const int channels = scope.ctx->channels;
+  const size_t max_samples = static_cast<size_t>(kMaxAssetSeconds) * sample_rate;
+  std::vector<std::vector<float>> planes(channels);
+  bool ok = true;
+  // 解码输出统一经 swr 转成 FLTP，采样率、声道不变
+  auto drain = [&]() {
+    while (ok && avcodec_receive_frame(scope.ctx, scope.frame) >= 0) {
+      if (!scope.swr) {
+        const int64_t layout = scope.frame->channel_layout
+                                   ? static_cast<int64_t>(scope.frame->channel_layout)
+                                   : av_get_default_channel_layout(channels);
+        scope.swr = swr_alloc_set_opts(nullptr, layout, AV_SAMPLE_FMT_FLTP, sample_rate, layout,
+                                       static_cast<AVSampleFormat>(scope.frame->format),
+                                       scope.frame->sample_rate, 0, nullptr);
+        if (!scope.swr || swr_init(scope.swr) < 0) {
+          LOG_ERROR("AssetCache init converter for {} failed", path);
+          ok = false;
+        }
+      }
+      if (ok)
+        ok = ConvertAppend(scope.swr, const_cast<const uint8_t **>(scope.frame->extended_data),
+                           scope.frame->nb_samples, &planes);
+      av_frame_unref(scope.frame);
+    }
+  };
+  while (ok && planes[0].size() < max_samples && av_read_frame(scope.fmt, scope.pkt) >= 0) {
+    if (scope.pkt->stream_index == index && avcodec_send_packet(scope.ctx, scope.pkt) >= 0)
+      drain();
+    av_packet_unref(scope.pkt);
+  }
+  if (ok && planes[0].size() >= max_samples) {
+    LOG_WARN("AssetCache {} longer than {}s, truncated", path, kMaxAssetSeconds);
+  } else if (ok) {
+    avcodec_send_packet(scope.ctx, nullptr);
+    drain();
+  }
+  if (ok && scope.swr)
+    ok = ConvertAppend(scope.swr, nullptr, 0, &planes);
+  if (!ok || planes[0].empty()) {
+    LOG_ERROR("AssetCache decode {} failed, {} samples", path, planes[0].size());
+    return nullptr;
+  }
+  for (auto &plane : planes)
+    plane.resize(std::min(plane.size(), max_samples));
+
+  std::shared_ptr<Pcm> pcm = PackPlanes(planes, sample_rate);
+  LOG_INFO("AssetCache decoded {}: {}Hz/{}ch {} samples", path, sample_rate, channels,
+           pcm->samples);
+  std::lock_guard<std::mutex> lk(mu_);
+  stats_.decodes++;
+  return pcm;
+}
+
+std::shared_ptr<const AssetCache::Pcm> AssetCache::Resample(const Pcm &src, int sample_rate,
+                                                            int channels) {
+  CodecScope scope;
+  scope.swr = swr_alloc_set_opts(nullptr, av_get_default_channel_layout(channels),
+                                 AV_SAMPLE_FMT_FLTP, sample_rate,
+                                 av_get_default_channel_layout(src.channels),
+                                 AV_SAMPLE_FMT_FLTP, src.sample_rate, 0, nullptr);
+  if (!scope.swr || swr_init(scope.swr) < 0) {
+    LOG_ERROR("AssetCache init resampler {}Hz/{}ch -> {}Hz/{}ch failed", src.sample_rate,
+              src.channels, sample_rate, channels);
+    return nullptr;
+  }
+  std::vector<const uint8_t *> in(src.channels);
+  for (int c = 0; c < src.channels; c++)
+    in[c] = reinterpret_cast<const uint8_t *>(src.plane(c));
+  std::vector<std::vector<float>> planes(channels);
+  if (!ConvertAppend(scope.swr, in.data(), static_cast<int>(src.samples), &planes) ||
+      !ConvertAppend(scope.swr, nullptr, 0, &planes) || planes[0].empty())
+    return nullptr;
+
+  std::shared_ptr<Pcm> pcm = PackPlanes(planes, sample_rate);
+  std::lock_guard<std::mutex> lk(mu_);
+  stats_.resamples++;
+  return pcm;
+}
+
+std::shared_ptr<const AssetCache::Aac> AssetCache::Encode(const Pcm &pcm, int64_t bit_rate) {
+  CodecScope scope;
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  scope.ctx = codec ? avcodec_alloc_context3(codec) : nullptr;
+  if (!scope.ctx) {
+    LOG_ERROR("AssetCache AAC encoder unavailable");
+    return nullptr;
+  }
+  scope.ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  scope.ctx->sample_rate = pcm.sample_rate;
+  scope.ctx->channels = pcm.channels;
+  scope.ctx->channel_layout = av_get_default_channel_layout(pcm.channels);
+  scope.ctx->bit_rate = bit_rate;
+  scope.ctx->time_base = {1, pcm.sample_rate};
+  int ret = avcodec_open2(scope.ctx, codec, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("AssetCache open AAC encoder {}Hz/{}ch failed: {}", pcm.sample_rate, pcm.channels,
+              AvError(ret));
+    return nullptr;
+  }
+  const int frame_size = scope.ctx->frame_size > 0 ? scope.ctx->frame_size : 1024;
+  scope.frame = av_frame_alloc();
+  scope.pkt = av_packet_alloc();
+  if (!scope.frame || !scope.pkt)
+    return nullptr;
+  scope.frame->format = AV_SAMPLE_FMT_FLTP;
+  scope.frame->sample_rate = pcm.sample_rate;
+  scope.frame->channels = pcm.channels;
+  scope.frame->channel_layout = scope.ctx->channel_layout;
+  scope.frame->nb_samples = frame_size;
+  if (av_frame_get_buffer(scope.frame, 0) < 0)
+    return nullptr;
+
+  auto aac = std::make_shared<Aac>();
+  aac->sample_rate = pcm.sample_rate;
+  aac->channels = pcm.channels;
+  aac->bit_rate = bit_rate;
+  aac->samples = pcm.samples;
+  aac->priming = scope.ctx->initial_padding;
+  // 先攒在连续内存里，编完一次性放进 AVBufferRef
+  std::vector<uint8_t> blob;
+  auto drain = [&]() {
+    while (avcodec_receive_packet(scope.ctx, scope.pkt) >= 0) {
+      Aac::Packet p;
+      p.offset = static_cast<int>(blob.size());
+      p.size = scope.pkt->size + 7;
+      p.pts = scope.pkt->pts;
+      blob.resize(blob.size() + p.size);
+      AudioAfade::WriteAdtsHeader(blob.data() + p.offset, scope.pkt->size, 2, pcm.sample_rate,
+                                  pcm.channels);
+      memcpy(blob.data() + p.offset + 7, scope.pkt->data, scope.pkt->size);
+      aac->packets.push_back(p);
+      av_packet_unref(scope.pkt);
+    }
+  };
+  for (int64_t off = 0; off < pcm.samples; off += frame_size) {
+    if (av_frame_make_writable(scope.frame) < 0)
+      return nullptr;
+    const int n = static_cast<int>(std::min<int64_t>(frame_size, pcm.samples - off));
+    for (int c = 0; c < pcm.channels; c++) {
+      float *dst = reinterpret_cast<float *>(scope.frame->data[c]);
+      std::copy_n(pcm.plane(c) + off, n, dst);
+      std::fill(dst + n, dst + frame_size, 0.0f); // 最后一帧补静音
+    }
+    scope.frame->pts = off;
+    if ((ret = avcodec_send_frame(scope.ctx, scope.frame)) < 0) {
+      LOG_ERROR("AssetCache encode failed: {}", AvError(ret));
+      return nullptr;
+    }
+    drain();
+  }
+  avcodec_send_frame(scope.ctx, nullptr);
+  drain();
+  if (blob.empty())
+    return nullptr;
+  aac->buf = av_buffer_alloc(static_cast<int>(blob.size()) + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!aac->buf)
+    return nullptr;
+  memcpy(aac->buf->data, blob.data(), blob.size());
+  memset(aac->buf->data + blob.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  stats_.encodes++;
+  return aac;
+}
+
+AssetInsert::AssetInsert(std::shared_ptr<const AssetCache::Pcm> pcm, float gain,
+                         int64_t fade_in, int64_t fade_out)
+    : pcm_(std::move(pcm)), gain_(gain), fade_in_(std::max<int64_t>(fade_in, 0)),
+      fade_out_(std::max<int64_t>(fade_out, 0)), end_(pcm_ ? pcm_->samples : 0) {}
+
+void AssetInsert::Stop(int64_t fade) {
+  fade = std::max<int64_t>(fade, 0);
+  if (pos_ + fade < end_) {
+    end_ = pos_ + fade;
+    fade_out_ = fade;
+  }
+}
+
+void AssetInsert::Envelope(int nb) {
+  if (static_cast<int>(env_.size()) < nb)
+    env_.resize(nb);
+  for (int i = 0; i < nb; i++) {
+    const int64_t t = pos_ + i;
+    float g = gain_;
+    if (t < fade_in_)
+      g *= static_cast<float>(t) / fade_in_;
+    if (end_ - t < fade_out_)
+      g *= static_cast<float>(end_ - t) / fade_out_;
+    env_[i] = g;
+  }
+}
+
+int AssetInsert::MixInto(float *const *dst, int nb) {
+  const int n = static_cast<int>(std::clamp<int64_t>(end_ - pos_, 0, nb));
+  if (n == 0)
+    return 0;
+  Envelope(n);
+  const float *env = env_.data();
+  for (int c = 0; c < pcm_->channels; c++) {
+    const float *src = pcm_->plane(c) + pos_;
+    float *out = dst[c];
+    for (int i = 0; i < n; i++)
+      out[i] += src[i] * env[i];
+  }
+  pos_ += n;
+  return n;
+}
+
+int AssetInsert::Render(float *const *dst, int nb) {
+  const int n = static_cast<int>(std::clamp<int64_t>(end_ - pos_, 0, nb));
+  Envelope(n);
+  const float *env = env_.data();
+  for (int c = 0; c < (pcm_ ? pcm_->channels : 0); c++) {
+    const float *src = pcm_->plane(c) + pos_;
+    float *out = dst[c];
+    for (int i = 0; i < n; i++)
+      out[i] = src[i] * env[i];
+    std::fill(out + n, out + nb, 0.0f);
+  }
+  pos_ += n;
+  return n;
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+// 插播素材缓存（片头、台标、广告提示音）：同一段素材在进程内只解码一次，之后按房间的
+// 输出格式（采样率/声道）各重采样一次，得到只读共享的 FLTP PCM；同一格式还可缓存预编码好的
+// ADTS AAC。房间插播时只持有引用加上自己的增益包络（AssetInsert），不再打开文件、不再解码。
+// 条目按 LRU 在字节预算内淘汰；被淘汰的数据还有人引用时要等最后一个引用释放，
+// 预算只统计缓存自己持有的部分。并发请求同一条目时只有一个线程加载，其余等它的结果。线程安全。
+class AssetCache {
+public:
+  // 只读 PCM，FLTP，按声道连续存放
+  struct Pcm {
+    int sample_rate = 0;
+    int channels = 0;
+    int64_t samples = 0;
+    std::vector<float> data; // 第 c 声道从 data[c * samples] 起
+
+    const float *plane(int c) const { return data.data() + c * samples; }
+    size_t bytes() const { return data.size() * sizeof(float); }
+  };
+
+  // 预编码 AAC：所有包（含 ADTS 头）在同一块缓冲里，取包只加引用不拷贝
+  struct Aac {
+    struct Packet {
+      int offset = 0;
+      int size = 0;
+      int64_t pts = 0; // 采样点，相对素材起点
+    };
+    int sample_rate = 0;
+    int channels = 0;
+    int64_t bit_rate = 0;
+    int64_t samples = 0; // 素材本身的采样点数
+    int priming = 0;     // 编码器起始延迟，第一个包的 pts 为 -priming
+    std::vector<Packet> packets;
+    AVBufferRef *buf = nullptr;
+
+    ~Aac() { av_buffer_unref(&buf); }
+    // 第 i 个包的引用，pts/dts 加上 pts_offset（采样点）；out 须为空包，调用方负责 unref
+    bool Get(size_t i, int64_t pts_offset, AVPacket *out) const;
+    size_t bytes() const { return buf ? buf->size : 0; }
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t decodes = 0;   // 打开文件并解码
+    uint64_t resamples = 0; // 从已解码的 PCM 转到新格式
+    uint64_t encodes = 0;
+    uint64_t evictions = 0;
+    uint64_t failures = 0;
+    size_t bytes = 0; // 缓存当前持有的字节数
+    size_t entries = 0;
+  };
+
+  static AssetCache &Instance();
+
+  // 字节预算，默认 64MB；调小时立即淘汰
+  void SetBudget(size_t bytes);
+  // 素材按 sample_rate/channels 转换后的 PCM；打不开或解码失败返回 nullptr（之后会重试）
+  std::shared_ptr<const Pcm> GetPcm(const std::string &path, int sample_rate, int channels);
+  // 同一格式、bit_rate 码率的 AAC 编码结果
+  std::shared_ptr<const Aac> GetAac(const std::string &path, int sample_rate, int channels,
+                                    int64_t bit_rate = 128000);
+  void Clear();
+  Stats stats() const;
+
+private:
+  // 单个素材最长时长，防止误把整段节目当素材载入
+  static constexpr int64_t kMaxAssetSeconds = 120;
+
+  struct Key {
+    std::string path;
+    int sample_rate = 0; // 0 = 素材原始格式
+    int channels = 0;
+    int64_t bit_rate = 0; // 0 = PCM，否则为该码率的 AAC
+
+    bool operator<(const Key &o) const {
+      return std::tie(path, sample_rate, channels, bit_rate) <
+             std::tie(o.path, o.sample_rate, o.channels, o.bit_rate);
+    }
+    bool operator==(const Key &o) const {
+      return std::tie(path, sample_rate, channels, bit_rate) ==
+             std::tie(o.path, o.sample_rate, o.channels, o.bit_rate);
+    }
+  };
+
+  struct Entry {
+    std::shared_future<std::shared_ptr<const void>> ready;
+    std::list<Key>::iterator lru;
+    size_t bytes = 0;
+    bool loaded = false; // 加载中的条目不参与淘汰
+  };
+
+  AssetCache() = default;
+
+  // 命中时返回（必要时等待其他线程加载完），未命中时在本线程调用 load 并登记结果
+  template <typename T, typename Load>
+  std::shared_ptr<const T> GetOrLoad(const Key &key, Load load);
+  // 调用时持有 mu_；keep 不淘汰
+  void EvictLocked(const Key *keep);
+
+  std::shared_ptr<const Pcm> Decode(const std::string &path);
+  std::shared_ptr<const Pcm> Resample(const Pcm &src, int sample_rate, int channels);
+  std::shared_ptr<const Aac> Encode(const Pcm &pcm, int64_t bit_rate);
+
+  mutable std::mutex mu_;
+  std::map<Key, Entry> entries_;
+  std::list<Key> lru_; // 前端最近使用
+  size_t budget_ = 64u << 20;
+  Stats stats_;
+};
+
+// 一次插播：持有素材 PCM 的引用、自己的读位置和增益包络。每个房间各自一个，素材数据共享。
+// 包络为 gain × 淡入斜坡 × 淡出斜坡，斜坡线性；非线程安全，与房间同线程使用
+class AssetInsert {
+public:
+  AssetInsert(std::shared_ptr<const AssetCache::Pcm> pcm, float gain = 1.0f,
+              int64_t fade_in = 0, int64_t fade_out = 0);
+
+  // 接下来 nb 个采样点乘上包络后累加到 dst（FLTP，声道数与素材一致），
+  // 返回实际用到的采样点数，素材放完后为 0
+  int MixInto(float *const *dst, int nb);
+  // 同上但覆盖写，素材之后的部分补 0
+  int Render(float *const *dst, int nb);
+  // 提前收尾：从当前位置起 fade 个采样点内淡出后结束
+  void Stop(int64_t fade);
+
+  bool finished() const { return pos_ >= end_; }
+  int64_t position() const { return pos_; }
+  const AssetCache::Pcm &pcm() const { return *pcm_; }
+
+private:
+  // 算出 [pos_, pos_ + nb) 的包络到 env_
+  void Envelope(int nb);
+
+  std::shared_ptr<const AssetCache::Pcm> pcm_;
+  float gain_;
+  int64_t fade_in_;
+  int64_t fade_out_;
+  int64_t pos_ = 0;
+  int64_t end_;
+  std::vector<float> env_;
+};
@@ -1,20 +1,54 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
 #include "audio_afade.h"
+#include "av_metrics.h"
 #include "logger.h"
+#include "polyphase_resampler.h"
+#include "room_buffer_pool.h"
 #include <algorithm>
+#include <cmath>
 #include <iomanip> // std::hex, std::setw, std::setfill
 #include <iostream>
 #include <sstream> // std::ostringstream
 
+std::atomic<int> AudioAfade::state_counts_[AudioAfade::STATE_COUNT];
+
+// 采样率索引（ISO 14496-3 Table 1.16），ADTS 头和 AudioSpecificConfig 共用；
+// 不在表里时取最接近的一项，exact 置 false
+static int SampleRateIndex(int sample_rate, bool *exact = nullptr) {
+  static const int freq_tbl[13] = {96000, 88200, 64000, 48000, 44100,
+                                   32000, 24000, 22050, 16000, 12000,
+                                   11025, 8000,  7350};
+  int freq_idx = 0;
+  for (int i = 1; i < 13; i++) {
+    if (std::abs(freq_tbl[i] - sample_rate) < std::abs(freq_tbl[freq_idx] - sample_rate))
+      freq_idx = i;
+  }
+  if (exact)
+    *exact = freq_tbl[freq_idx] == sample_rate;
+  return freq_idx;
+}
+
 AudioAfade::AudioAfade(int sample_rate, int channels, AVSampleFormat sample_fmt,
-                       FadeType type, int total_frames)
-    : sample_rate_(sample_rate), channels_(channels), sample_fmt_(sample_fmt),
+                       FadeType type, int total_frames, RoomBufferPool *pool)
+    : pool_(pool), sample_rate_(sample_rate), channels_(channels), sample_fmt_(sample_fmt),
       type_(type), total_frames_(total_frames) {
+  state_counts_[state_].fetch_add(1, std::memory_order_relaxed);
+  log_ctx_.fade = libmagic::NextLogFadeId();
+  libmagic::ScopedLogContext log_scope(log_ctx_);
 
   LOG_INFO("AudioAfade Init sample_rate={}, channels={}, total_frames={} "
            "sample_fmt:{} type:{}",
            sample_rate, channels, total_frames,
            av_get_sample_fmt_name(sample_fmt), type);
 
+  bool standard_rate = false;
+  SampleRateIndex(sample_rate_, &standard_rate);
+  if (!standard_rate) {
+    LOG_ERROR("AudioAfade output sample_rate={} is not an AAC sampling frequency",
+              sample_rate_);
+    return;
+  }
+
   const AVCodec *dec = avcodec_find_decoder(AV_CODEC_ID_AAC);
   if (!dec) {
     LOG_ERROR("AudioAfade AAC decoder not found!");
@@ -25,6 +59,8 @@ AudioAfade::AudioAfade(int sample_rate, int channels, AVSampleFormat sample_fmt,
   dec_ctx_->sample_rate = sample_rate_;
   dec_ctx_->channels = channels_;
   dec_ctx_->channel_layout = av_get_default_channel_layout(channels_);
+  if (pool)
+    pool->AttachDecoder(dec_ctx_);
   if (avcodec_open2(dec_ctx_, dec, nullptr) < 0) {
     LOG_ERROR("AudioAfade Failed to open AAC decoder");
     return;
@@ -44,6 +80,8 @@ AudioAfade::AudioAfade(int sample_rate, int channels, AVSampleFormat sample_fmt,
   enc_ctx_->channel_layout = av_get_default_channel_layout(channels_);
   enc_ctx_->bit_rate = 128000;
   enc_ctx_->sample_fmt = sample_fmt_;
+  if (pool)
+    pool->AttachEncoder(enc_ctx_);
   if (avcodec_open2(enc_ctx_, enc, nullptr) < 0) {
     LOG_ERROR("AudioAfade Failed to open MP3 encoder");
     return;
@@ -55,21 +93,62 @@ AudioAfade::AudioAfade(int sample_rate, int channels, AVSampleFormat sample_fmt,
            av_get_sample_fmt_name(enc_ctx_->sample_fmt), enc_ctx_->sample_rate,
            enc_ctx_->channels, enc_ctx_->channel_layout);
 
-  if (dec_ctx_->sample_fmt != enc_ctx_->sample_fmt ||
-      dec_ctx_->sample_rate != enc_ctx_->sample_rate ||
-      dec_ctx_->channels != enc_ctx_->channels) {
-    LOG_ERROR("AudioAfade Warning: decoder and encoder audio formats differ!");
-  } else {
-    LOG_INFO("AudioAfade Input/Output formats are perfectly matched!");
+  // 解码器的采样率要等第一帧才确定；与输出不同时在 Process 里走重采样路径
+  if (dec_ctx_->sample_fmt != enc_ctx_->sample_fmt) {
+    LOG_INFO("AudioAfade decoder sample_fmt {} converted to encoder sample_fmt {}",
+             av_get_sample_fmt_name(dec_ctx_->sample_fmt),
+             av_get_sample_fmt_name(enc_ctx_->sample_fmt));
+  }
+
+  dec_frame_ = av_frame_alloc();
+  filt_frame_ = av_frame_alloc();
+  if (!dec_frame_ || !filt_frame_) {
+    LOG_ERROR("AudioAfade alloc frames failed");
+    return;
   }
 
   // 初始化滤镜
-  InitFilterGraph();
+  if (InitFilterGraph()) {
+    SetState(STATE_READY);
+  }
 }
 
-AudioAfade::~AudioAfade() { Cleanup(); }
+AudioAfade::~AudioAfade() {
+  Cleanup();
+  state_counts_[state_].fetch_sub(1, std::memory_order_relaxed);
+}
+
+void AudioAfade::SetState(State state) {
+  if (state == state_)
+    return;
+  state_counts_[state_].fetch_sub(1, std::memory_order_relaxed);
+  state_counts_[state].fetch_add(1, std::memory_order_relaxed);
+  state_ = state;
+}
+
+const char *AudioAfade::StateName(State state) {
+  switch (state) {
+  case STATE_FAILED:
+    return "failed";
+  case STATE_READY:
+    return "ready";
+  case STATE_FADING:
+    return "fading";
+  case STATE_DONE:
+    return "done";
+  default:
+    return "unknown";
+  }
+}
+
+int AudioAfade::InstanceCount(State state) {
+  return state_counts_[state].load(std::memory_order_relaxed);
+}
 
 void AudioAfade::Cleanup() {
+  for (auto &pkt : out_queue_)
+    av_packet_unref(&pkt);
+  out_queue_.clear();
   if (filter_graph_) {
     if (src_ctx_) {
       avfilter_free(src_ctx_);
@@ -83,6 +162,11 @@ void AudioAfade::Cleanup() {
     avfilter_graph_free(&filter_graph_);
     filter_graph_ = nullptr;
   }
+  av_frame_free(&dec_frame_);
+  av_frame_free(&filt_frame_);
+  av_frame_free(&res_frame_);
+  resampler_.reset();
+  res_fill_ = 0;
   if (dec_ctx_) {
     avcodec_free_context(&dec_ctx_);
     dec_ctx_ = nullptr;
@@ -178,60 +262,141 @@ bool AudioAfade::InitFilterGraph() {
   return true;
 }
 
-bool AudioAfade::Process(AVPacket *src_pkt, AVPacket *dst_pkt) {
-  LOG_INFO("Process start src_pkt size={}, pts={}, dts={}", src_pkt->size,
-           src_pkt->pts, src_pkt->dts);
+bool AudioAfade::Process(AVPacket *src_pkt) {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  LOG_EVERY_N(info, 50, "Process start src_pkt size={}, pts={}, dts={}", src_pkt->size,
+              src_pkt->pts, src_pkt->dts);
+
+  if (!room_id_.empty() && src_pkt->pts != AV_NOPTS_VALUE) {
+    AvMetrics::Instance().UpdateAudioPtsMs(
+        room_id_, av_rescale_q(src_pkt->pts, pkt_time_base_, {1, 1000}));
+  }
 
   if (avcodec_send_packet(dec_ctx_, src_pkt) < 0) {
     LOG_ERROR("Process Failed to send packet to decoder");
     return false;
   }
 
-  AVFrame *frame = av_frame_alloc();
+  AVFrame *frame = dec_frame_;
   while (avcodec_receive_frame(dec_ctx_, frame) == 0) {
-    LOG_INFO("Process Decoded frame: pts={}, nb_samples={}", frame->pts,
-             frame->nb_samples);
+    LOG_EVERY_N(info, 50, "Process Decoded frame: pts={}, nb_samples={}", frame->pts,
+                frame->nb_samples);
+
+    processed_frames_++;
+    SetState(processed_frames_ < total_frames_ ? STATE_FADING : STATE_DONE);
+
+    if (frame->sample_rate != sample_rate_) {
+      // 重采样路径自己按输出采样点维护 pts，增益为精确斜坡（降级模式也一样，本来就不经滤镜图）
+      ResampleAndEncode(frame);
+      SetState(pts_counter_ < static_cast<int64_t>(total_frames_) * 1024 ? STATE_FADING
+                                                                         : STATE_DONE);
+      av_frame_unref(frame);
+      continue;
+    }
 
     // 处理解码后的帧（淡入/淡出）
     frame->pts = pts_counter_;
     pts_counter_ += frame->nb_samples;
+    if (stepped_gain_ && ApplySteppedGain(frame)) {
+      EncodeFrame(frame);
+    } else {
+      SendToFilter(frame);
+      // 从滤镜获取数据
+      ReceiveFromFilter();
+    }
+    LOG_EVERY_N(info, 50, "Process end frame processed, queued packets={}",
+                out_queue_.size());
 
-    SendToFilter(frame);
+    av_frame_unref(frame);
+  }
 
-    // 清理上一次的数据
-    av_packet_unref(dst_pkt);
-    av_init_packet(dst_pkt);
-    dst_pkt->data = nullptr;
-    dst_pkt->size = 0;
+  return true;
+}
 
-    // 从滤镜获取数据
-    ReceiveFromFilter(*dst_pkt); // 填充 dst_pkt
-    LOG_INFO("Process end frame processed, dst_pkt size={} pts={}, dts={}",
-             dst_pkt->size, dst_pkt->pts, dst_pkt->dts);
+bool AudioAfade::ReceivePacket(AVPacket *out) {
+  if (out_queue_.empty())
+    return false;
+  av_packet_move_ref(out, &out_queue_.front());
+  out_queue_.pop_front();
+  return true;
+}
 
-    av_frame_unref(frame);
-  }
+void AudioAfade::Preroll(const AVPacket *pkt) {
+  if (!dec_ctx_ || !dec_frame_ || avcodec_send_packet(dec_ctx_, pkt) < 0)
+    return;
+  while (avcodec_receive_frame(dec_ctx_, dec_frame_) == 0)
+    av_frame_unref(dec_frame_);
+}
+
+void AudioAfade::AttachBufferPool(RoomBufferPool *pool) {
+  pool_ = pool;
+  if (dec_ctx_)
+    pool->AttachDecoder(dec_ctx_);
+  if (enc_ctx_)
+    pool->AttachEncoder(enc_ctx_);
+}
 
-  av_frame_free(&frame);
+bool AudioAfade::SetDecoderConfig(const uint8_t *asc, int size) {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  if (!dec_ctx_ || !asc || size <= 0)
+    return false;
+  const AVCodec *dec = avcodec_find_decoder(AV_CODEC_ID_AAC);
+  AVCodecContext *ctx = avcodec_alloc_context3(dec);
+  if (!ctx)
+    return false;
+  ctx->extradata = static_cast<uint8_t *>(av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE));
+  if (!ctx->extradata) {
+    avcodec_free_context(&ctx);
+    return false;
+  }
+  memcpy(ctx->extradata, asc, size);
+  ctx->extradata_size = size;
+  if (pool_)
+    pool_->AttachDecoder(ctx);
+  if (avcodec_open2(ctx, dec, nullptr) < 0) {
+    LOG_ERROR("AudioAfade Failed to open AAC decoder with AudioSpecificConfig size={}", size);
+    avcodec_free_context(&ctx);
+    return false;
+  }
+  avcodec_free_context(&dec_ctx_);
+  dec_ctx_ = ctx;
+  LOG_INFO("AudioAfade Decoder configured from AudioSpecificConfig: sample_rate: {} "
+           "channels: {}",
+           dec_ctx_->sample_rate, dec_ctx_->channels);
   return true;
 }
 
-void AudioAfade::FlushEncoder(AVFormatContext *out_fmt, int64_t &next_pts) {
-  LOG_INFO("Flushing AAC encoder...");
-  int ret = avcodec_send_frame(enc_ctx_, nullptr); // 发送空帧触发 flush
-  if (ret < 0) {
-    char errbuf[128];
-    av_strerror(ret, errbuf, sizeof(errbuf));
-    LOG_ERROR("Failed to flush encoder: {}", errbuf);
+void AudioAfade::SetMetricsRoom(const std::string &room_id,
+                                AVRational pkt_time_base) {
+  room_id_ = room_id;
+  pkt_time_base_ = pkt_time_base;
+  log_ctx_.room = libmagic::InternLogRoom(room_id);
+}
+
+void AudioAfade::DrainEncoder() {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  if (!enc_ctx_ || enc_drained_)
     return;
+  LOG_INFO("Draining AAC encoder...");
+  // 重采样路径：滤波器尾部和不足一帧的样本先送进编码器
+  if (resampler_ && res_frame_) {
+    resampler_->Flush();
+    DrainResampler(true, [&](AVFrame *frame) { return EncodeFrame(frame); });
   }
+  EncodeFrame(nullptr); // 发送空帧触发 flush
+}
 
+void AudioAfade::FlushEncoder(AVFormatContext *out_fmt, int64_t &next_pts) {
+  DrainEncoder();
+  libmagic::ScopedLogContext log_scope(log_ctx_);
   AVPacket pkt;
   av_init_packet(&pkt);
-  while (avcodec_receive_packet(enc_ctx_, &pkt) >= 0) {
+  while (ReceivePacket(&pkt)) {
     pkt.stream_index = 0;
     pkt.pts = pkt.dts = next_pts;
     next_pts += 1024;
+    // next_pts 以采样点为单位；ADTS 的流时间基正是 1/采样率，其它封装（如 MPEG-TS）需换算
+    av_packet_rescale_ts(&pkt, {1, sample_rate_}, out_fmt->streams[0]->time_base);
 
     LOG_INFO("🎧 Write flush packet: size={}, pts={}, dts={}", pkt.size, pkt.pts,
              pkt.dts);
@@ -242,6 +407,7 @@ void AudioAfade::FlushEncoder(AVFormatContext *out_fmt, int64_t &next_pts) {
 
 bool AudioAfade::ProcessRaw(const char *in_buf, int in_len,
                             std::string &out_buf) {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
   if (!in_buf || in_len <= 0) {
     LOG_ERROR("ProcessRaw invalid input");
     return false;
@@ -252,37 +418,41 @@ bool AudioAfade::ProcessRaw(const char *in_buf, int in_len,
   src_pkt.data = reinterpret_cast<uint8_t *>(const_cast<char *>(in_buf));
   src_pkt.size = in_len;
 
+  if (!Process(&src_pkt)) {
+    LOG_WARN("ProcessRaw Process() failed");
+    return false;
+  }
+
+  // 每个包各自拼接 ADTS + AAC
+  out_buf.clear();
   AVPacket dst_pkt;
   av_init_packet(&dst_pkt);
-
-  bool ok = Process(&src_pkt, &dst_pkt);
-  if (!ok || dst_pkt.size <= 0) {
-    LOG_WARN("ProcessRaw no valid output from Process()");
+  while (ReceivePacket(&dst_pkt)) {
+    if (dst_pkt.size > 0) {
+      uint8_t adts_header[7];
+      int profile = 2; // AAC LC
+      WriteAdtsHeader(adts_header, dst_pkt.size, profile, sample_rate_, channels_);
+      out_buf.append(reinterpret_cast<const char *>(adts_header), 7);
+      out_buf.append(reinterpret_cast<const char *>(dst_pkt.data), dst_pkt.size);
+    }
     av_packet_unref(&dst_pkt);
+  }
+  if (out_buf.empty()) {
+    LOG_WARN("ProcessRaw no valid output from Process()");
     return false;
   }
 
-  uint8_t adts_header[7];
-  int profile = 2; // AAC LC
-  WriteAdtsHeader(adts_header, dst_pkt.size, profile, sample_rate_, channels_);
-
-  // 拼接 ADTS + AAC
-  out_buf.resize(7 + dst_pkt.size);
-  memcpy((void *)out_buf.data(), adts_header, 7);
-  memcpy((void *)(out_buf.data() + 7), dst_pkt.data, dst_pkt.size);
-
   LOG_INFO("ProcessRaw success: input={} bytes -> output={} bytes Hex dump:{}",
            in_len, out_buf.size(), PrintHexPreview(out_buf, 64));
-
-  av_packet_unref(&dst_pkt);
   return true;
 }
 
 bool AudioAfade::SendToFilter(AVFrame *frame) {
-  LOG_INFO("SendToFilter... fmt={}, nb_samples={}, "
-           "channels={}, sample_rate={}",
-           av_get_sample_fmt_name((AVSampleFormat)frame->format),
-           frame->nb_samples, frame->channels, frame->sample_rate);
+  LOG_EVERY_N(info, 50,
+              "SendToFilter... fmt={}, nb_samples={}, "
+              "channels={}, sample_rate={}",
+              av_get_sample_fmt_name((AVSampleFormat)frame->format),
+              frame->nb_samples, frame->channels, frame->sample_rate);
 
   int ret = av_buffersrc_add_frame(src_ctx_, frame);
   if (ret < 0) {
@@ -296,99 +466,203 @@ bool AudioAfade::SendToFilter(AVFrame *frame) {
   return true;
 }
 
-bool AudioAfade::ReceiveFromFilter(AVPacket &out_pkt) {
-  AVFrame *faded_frame = av_frame_alloc();
+bool AudioAfade::ReceiveFromFilter() {
+  AVFrame *faded_frame = filt_frame_;
   int total_frames = 0;
   int total_packets = 0;
   int ret = 0;
 
-  av_packet_unref(&out_pkt);
-
   while ((ret = av_buffersink_get_frame(sink_ctx_, faded_frame)) >= 0) {
     int bytes_per_sample =
         av_get_bytes_per_sample((AVSampleFormat)faded_frame->format);
-    int frame_bytes =
+    [[maybe_unused]] int frame_bytes =
         faded_frame->nb_samples * faded_frame->channels * bytes_per_sample;
-    LOG_INFO("ReceiveFromFilter Got faded frame from filter: nb_samples={}, "
-             "format={}, channels={}, pts={} frame_size=:{}",
-             faded_frame->nb_samples,
-             av_get_sample_fmt_name((AVSampleFormat)faded_frame->format),
-             faded_frame->channels, faded_frame->pts, frame_bytes);
+    LOG_EVERY_N(info, 50,
+                "ReceiveFromFilter Got faded frame from filter: nb_samples={}, "
+                "format={}, channels={}, pts={} frame_size=:{}",
+                faded_frame->nb_samples,
+                av_get_sample_fmt_name((AVSampleFormat)faded_frame->format),
+                faded_frame->channels, faded_frame->pts, frame_bytes);
     total_frames++;
 
-    ret = avcodec_send_frame(enc_ctx_, faded_frame);
-    if (ret < 0) {
-      char errbuf[128];
-      av_strerror(ret, errbuf, sizeof(errbuf));
-      LOG_ERROR("ReceiveFromFilter Failed to send frame to encoder: {}",
-                errbuf);
-      av_frame_unref(faded_frame);
-      continue;
-    }
-
-    while (true) {
-      AVPacket tmp_pkt;
-      av_init_packet(&tmp_pkt);
-      ret = avcodec_receive_packet(enc_ctx_, &tmp_pkt);
-      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-        av_packet_unref(&tmp_pkt);
-        break;
-      } else if (ret < 0) {
-        char errbuf[128];
-        av_strerror(ret, errbuf, sizeof(errbuf));
-        LOG_ERROR("ReceiveFromFilter avcodec_receive_packet returned error: {}",
-                  errbuf);
-        av_packet_unref(&tmp_pkt);
-        break;
-      }
-
-      LOG_INFO("ReceiveFromFilter Encoded packet: size={}, pts={}, dts={}",
-               tmp_pkt.size, tmp_pkt.pts, tmp_pkt.dts);
-
-      LOG_INFO(
-          "Encoded pkt: size={} stream_index={} codec={} keyframe={} flags={}",
-          tmp_pkt.size, tmp_pkt.stream_index,
-          avcodec_get_name(enc_ctx_->codec_id), tmp_pkt.flags & AV_PKT_FLAG_KEY,
-          tmp_pkt.flags);
-
-      av_packet_unref(&out_pkt);
-      av_packet_move_ref(&out_pkt, &tmp_pkt);
-      total_packets++;
-
-      av_packet_unref(&tmp_pkt);
-    }
-
+    total_packets += EncodeFrame(faded_frame);
     av_frame_unref(faded_frame);
   }
 
   // 滤镜结束（但编码器可能还有残留帧）
   if (ret == AVERROR_EOF) {
     LOG_INFO("ReceiveFromFilter Filter reached EOF, flushing encoder...");
-    avcodec_send_frame(enc_ctx_, nullptr);
-
-    AVPacket tmp_pkt;
-    av_init_packet(&tmp_pkt);
-    while (avcodec_receive_packet(enc_ctx_, &tmp_pkt) >= 0) {
-      LOG_INFO(
-          "ReceiveFromFilter Flushed encoded packet: size={}, pts={}, dts={}",
-          tmp_pkt.size, tmp_pkt.pts, tmp_pkt.dts);
-      av_packet_unref(&out_pkt);
-      av_packet_move_ref(&out_pkt, &tmp_pkt);
-      total_packets++;
-      av_packet_unref(&tmp_pkt);
-    }
+    total_packets += EncodeFrame(nullptr);
   } else if (ret != AVERROR(EAGAIN) && ret < 0) {
     char errbuf[128];
     av_strerror(ret, errbuf, sizeof(errbuf));
     LOG_ERROR("ReceiveFromFilter Failed to get frame from filter: {}", errbuf);
   }
 
-  av_frame_free(&faded_frame);
-  LOG_INFO("Filter output done. Total frames={}, encoded packets=={}",
-           total_frames, total_packets);
+  av_frame_unref(faded_frame);
+  LOG_EVERY_N(info, 50, "Filter output done. Total frames={}, encoded packets=={}",
+              total_frames, total_packets);
   return total_packets > 0;
 }
 
+int AudioAfade::EncodeFrame(AVFrame *frame) {
+  if (!frame) {
+    if (enc_drained_)
+      return 0;
+    enc_drained_ = true;
+  }
+  int ret = avcodec_send_frame(enc_ctx_, frame);
+  if (ret < 0) {
+    char errbuf[128];
+    av_strerror(ret, errbuf, sizeof(errbuf));
+    LOG_ERROR("EncodeFrame Failed to send frame to encoder: {}", errbuf);
+    return 0;
+  }
+
+  int packets = 0;
+  while (true) {
+    AVPacket tmp_pkt;
+    av_init_packet(&tmp_pkt);
+    ret = avcodec_receive_packet(enc_ctx_, &tmp_pkt);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      av_packet_unref(&tmp_pkt);
+      break;
+    } else if (ret < 0) {
+      char errbuf[128];
+      av_strerror(ret, errbuf, sizeof(errbuf));
+      LOG_ERROR("EncodeFrame avcodec_receive_packet returned error: {}", errbuf);
+      av_packet_unref(&tmp_pkt);
+      break;
+    }
+
+    LOG_EVERY_N(
+        info, 50,
+        "Encoded pkt: size={} stream_index={} codec={} keyframe={} flags={}",
+        tmp_pkt.size, tmp_pkt.stream_index, avcodec_get_name(enc_ctx_->codec_id),
+        tmp_pkt.flags & AV_PKT_FLAG_KEY, tmp_pkt.flags);
+
+    out_queue_.emplace_back();
+    av_init_packet(&out_queue_.back());
+    av_packet_move_ref(&out_queue_.back(), &tmp_pkt);
+    packets++;
+  }
+  return packets;
+}
+
+int AudioAfade::ResampleAndEncode(const AVFrame *frame) {
+  if (frame->format != AV_SAMPLE_FMT_FLTP || sample_fmt_ != AV_SAMPLE_FMT_FLTP) {
+    LOG_EVERY_N(err, 100, "ResampleAndEncode needs FLTP, got decoder {} encoder {}",
+                av_get_sample_fmt_name(static_cast<AVSampleFormat>(frame->format)),
+                av_get_sample_fmt_name(sample_fmt_));
+    return 0;
+  }
+  if (!resampler_ || resampler_->in_rate() != frame->sample_rate) {
+    if (resampler_) {
+      LOG_WARN("ResampleAndEncode input sample_rate changed {} -> {}, restart resampler",
+               resampler_->in_rate(), frame->sample_rate);
+    }
+    resampler_ =
+        std::make_unique<PolyphaseResampler>(frame->sample_rate, sample_rate_, channels_);
+    LOG_INFO("ResampleAndEncode {}Hz -> {}Hz, {} phases x {} taps, avx2={}", frame->sample_rate,
+             sample_rate_, resampler_->bank().up, resampler_->bank().taps,
+             PolyphaseResampler::UsingAvx2());
+  }
+  if (!res_frame_) {
+    res_frame_ = av_frame_alloc();
+    if (!res_frame_)
+      return 0;
+    res_frame_->format = AV_SAMPLE_FMT_FLTP;
+    res_frame_->sample_rate = sample_rate_;
+    res_frame_->channels = channels_;
+    res_frame_->channel_layout = av_get_default_channel_layout(channels_);
+    res_frame_->nb_samples = enc_ctx_->frame_size > 0 ? enc_ctx_->frame_size : 1024;
+    if (av_frame_get_buffer(res_frame_, 0) < 0) {
+      LOG_ERROR("ResampleAndEncode alloc frame failed");
+      av_frame_free(&res_frame_);
+      return 0;
+    }
+  }
+
+  // 声道数不同时：输入声道少则重复最后一个，多则丢掉多余的
+  const float *in[PolyphaseResampler::kMaxChannels] = {};
+  for (int c = 0; c < channels_ && c < PolyphaseResampler::kMaxChannels; c++)
+    in[c] = reinterpret_cast<const float *>(
+        frame->extended_data[std::min(c, frame->channels - 1)]);
+  resampler_->Push(in, frame->nb_samples);
+  return DrainResampler(false, [&](AVFrame *f) { return EncodeFrame(f); });
+}
+
+template <typename OnFrame> int AudioAfade::DrainResampler(bool flush, OnFrame on_frame) {
+  const int frame_size = res_frame_->nb_samples;
+  const int64_t fade_len = static_cast<int64_t>(total_frames_) * 1024;
+  int packets = 0;
+  int fill = res_fill_; // 上次没攒满的一帧接着填
+  while (true) {
+    if (fill == 0 && av_frame_make_writable(res_frame_) < 0) {
+      LOG_ERROR("DrainResampler frame not writable");
+      break;
+    }
+    // 增益与 afade 默认的线性曲线一致，斜坡在淡入淡出结束处截断，之后为常数
+    const int64_t pos = pts_counter_ + fill;
+    int want = frame_size - fill;
+    float gain = 1.0f;
+    float step = 0.0f;
+    if (type_ != FADE_NONE && pos < fade_len) {
+      want = static_cast<int>(std::min<int64_t>(want, fade_len - pos));
+      const float progress = static_cast<float>(pos) / fade_len;
+      gain = type_ == FADE_IN ? progress : 1.0f - progress;
+      step = (type_ == FADE_IN ? 1.0f : -1.0f) / fade_len;
+    } else if (type_ == FADE_OUT) {
+      gain = 0.0f;
+    }
+    float *dst[PolyphaseResampler::kMaxChannels] = {};
+    for (int c = 0; c < channels_ && c < PolyphaseResampler::kMaxChannels; c++)
+      dst[c] = reinterpret_cast<float *>(res_frame_->extended_data[c]) + fill;
+    const int got = resampler_->Pull(dst, want, gain, step);
+    fill += got;
+    if (fill == frame_size || (flush && got < want && fill > 0)) {
+      // 最后一帧可以不满（AAC 编码器支持短尾帧）
+      res_frame_->nb_samples = fill;
+      res_frame_->pts = pts_counter_;
+      pts_counter_ += fill;
+      packets += on_frame(res_frame_);
+      res_frame_->nb_samples = frame_size;
+      fill = 0;
+      continue;
+    }
+    if (got < want)
+      break;
+  }
+  res_fill_ = fill;
+  return packets;
+}
+
+bool AudioAfade::ApplySteppedGain(AVFrame *frame) {
+  const AVSampleFormat fmt = static_cast<AVSampleFormat>(frame->format);
+  if (fmt != AV_SAMPLE_FMT_FLTP && fmt != AV_SAMPLE_FMT_FLT)
+    return false;
+  if (av_frame_make_writable(frame) < 0)
+    return false;
+
+  // 与 afade 默认的线性曲线一致，按 1/8 取整成阶梯；processed_frames_ 已含本帧
+  double progress =
+      total_frames_ > 0 ? std::min(1.0, double(processed_frames_ - 1) / total_frames_) : 1.0;
+  double gain = type_ == FADE_OUT ? 1.0 - progress : progress;
+  const float step = static_cast<float>(std::floor(gain * 8 + 0.5) / 8);
+  if (step == 1.0f)
+    return true;
+
+  const bool planar = fmt == AV_SAMPLE_FMT_FLTP;
+  const int planes = planar ? frame->channels : 1;
+  const int samples = planar ? frame->nb_samples : frame->nb_samples * frame->channels;
+  for (int p = 0; p < planes; p++) {
+    float *data = reinterpret_cast<float *>(frame->extended_data[p]);
+    for (int i = 0; i < samples; i++)
+      data[i] *= step;
+  }
+  return true;
+}
+
 void AudioAfade::PrintPacketHex(const AVPacket *pkt, int max_bytes) {
   int print_len = std::min(pkt->size, max_bytes);
   std::ostringstream oss;
@@ -404,16 +678,11 @@ void AudioAfade::PrintPacketHex(const AVPacket *pkt, int max_bytes) {
 
 void AudioAfade::WriteAdtsHeader(uint8_t *adts_header, int aac_length,
                                  int profile, int sample_rate, int channels) {
-  // 采样率索引表（ISO 14496-3 Table 1.16）
-  static const int freq_tbl[13] = {96000, 88200, 64000, 48000, 44100,
-                                   32000, 24000, 22050, 16000, 12000,
-                                   11025, 8000,  7350};
-  int freq_idx = 4; // 默认44100Hz
-  for (int i = 0; i < 13; i++) {
-    if (freq_tbl[i] == sample_rate) {
-      freq_idx = i;
-      break;
-    }
+  bool exact;
+  int freq_idx = SampleRateIndex(sample_rate, &exact);
+  if (!exact) {
+    LOG_EVERY_N(warn, 1000, "WriteAdtsHeader sample_rate={} is not an AAC sampling "
+                "frequency, header index {}", sample_rate, freq_idx);
   }
 
   int frame_length = aac_length + 7;
@@ -427,6 +696,19 @@ void AudioAfade::WriteAdtsHeader(uint8_t *adts_header, int aac_length,
   adts_header[6] = 0xFC;
 }
 
+void AudioAfade::WriteAudioSpecificConfig(uint8_t *asc, int profile, int sample_rate,
+                                          int channels) {
+  // 5 位 audioObjectType + 4 位采样率索引 + 4 位声道配置 + 3 位 0
+  bool exact;
+  int freq_idx = SampleRateIndex(sample_rate, &exact);
+  if (!exact) {
+    LOG_WARN("WriteAudioSpecificConfig sample_rate={} is not an AAC sampling frequency, "
+             "index {}", sample_rate, freq_idx);
+  }
+  asc[0] = (profile << 3) | (freq_idx >> 1);
+  asc[1] = ((freq_idx & 1) << 7) | ((channels & 0xF) << 3);
+}
+
 std::string PrintHexPreview(const std::string &buf,
                                         size_t max_bytes) {
   std::ostringstream oss;
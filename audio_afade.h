@@ -12,45 +12,122 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <vector>
 
+#include "log_context.h"
+
+class PolyphaseResampler;
+class RoomBufferPool;
+
 std::string PrintHexPreview(const std::string &buf, size_t max_bytes = 64);
 
 class AudioAfade {
 public:
   enum FadeType { FADE_NONE, FADE_IN, FADE_OUT };
+  // 实例状态，用于资源监控统计各状态下的实例数
+  enum State { STATE_FAILED, STATE_READY, STATE_FADING, STATE_DONE, STATE_COUNT };
 
+  // sample_rate 为输出（编码器）采样率，须是 AAC 支持的标准采样率；输入流的采样率与之不同时
+  // （44.1kHz 源输出 48kHz 等）解码后经多相重采样，淡入淡出在同一遍完成，不经滤镜图。
+  // pool 非空时解码帧和编码包的缓冲从该池取，须比本实例活得久
   AudioAfade(int sample_rate, int channels, AVSampleFormat sample_fmt,
-             FadeType type, int total_frames);
+             FadeType type, int total_frames, RoomBufferPool *pool = nullptr);
   ~AudioAfade();
 
-  // 处理一段 AAC 数据（可能包含多帧）
-  bool Process(AVPacket *src_pkt, AVPacket *dst_pkt);
+  // 处理一段 AAC 数据（可能包含多帧）。编码出的包可能有 0 个或多个（重采样时
+  // 输入输出帧数不一一对应），须在下次 Process 之前用 ReceivePacket 逐个取完
+  bool Process(AVPacket *src_pkt);
+  // 按编码顺序取出一个输出包（调用方 unref），没有了返回 false
+  bool ReceivePacket(AVPacket *out);
+  // 只解码不输出：新建的解码器先吃进淡入淡出开始前的几个包，
+  // 补齐 MDCT 重叠窗口，避免第一帧出现咔哒声
+  void Preroll(const AVPacket *pkt);
+  // 预热好的实例取出后再挂到房间缓冲池。AAC 解码器不走帧线程，
+  // 打开之后切换 get_buffer2 是安全的
+  void AttachBufferPool(RoomBufferPool *pool);
+  // 输入为不带 ADTS 头的裸 AAC（FLV/RTMP）时，用序列头里的 AudioSpecificConfig
+  // 作 extradata 重开解码器；须在第一次 Preroll/Process 之前调用。失败时保留原解码器
+  bool SetDecoderConfig(const uint8_t *asc, int size);
+
+  // 过载降级用的廉价路径：不经滤镜图，按帧计算阶梯增益（1/8 一档）直接乘到
+  // 解码后的样本上再编码。可在淡入淡出中途切换，增益曲线接着已处理的帧数走
+  void SetSteppedGain(bool enable) { stepped_gain_ = enable; }
+  bool stepped_gain() const { return stepped_gain_; }
+  // 输出为本次编码出的所有包，各带 ADTS 头依次拼接
   bool ProcessRaw(const char *in_buf, int in_len, std::string &out_buf);
+  // 冲刷重采样器尾部和编码器，尾包排进输出队列，之后用 ReceivePacket 取；
+  // 重复调用无副作用
+  void DrainEncoder();
+  // DrainEncoder 后把输出队列里的包全部写到 out_fmt
   void FlushEncoder(AVFormatContext *out_fmt, int64_t &next_pts);
   void PrintPacketHex(const AVPacket *pkt, int max_bytes = 64);
-  void WriteAdtsHeader(uint8_t *adts_header, int aac_length, int profile,
-                       int sample_rate, int channels);
+  static void WriteAdtsHeader(uint8_t *adts_header, int aac_length, int profile,
+                              int sample_rate, int channels);
+  // 非标准采样率按最接近的标准采样率写索引并告警
+  // 2 字节 AudioSpecificConfig（profile 同上，2 = LC），用作不带 ADTS 头的 AAC 的 extradata
+  static void WriteAudioSpecificConfig(uint8_t *asc, int profile, int sample_rate,
+                                       int channels);
+
+  // 设置所属房间，Process 时把输入包的真实 PTS 上报给 AvMetrics，
+  // 本实例的日志也带上该 room；pkt_time_base 为输入包 pts 的时间基
+  void SetMetricsRoom(const std::string &room_id, AVRational pkt_time_base);
+
+  State state() const { return state_; }
+  static const char *StateName(State state);
+  // 当前处于某状态的实例数（全进程）
+  static int InstanceCount(State state);
 
 private:
   bool InitFilterGraph();
   bool SendToFilter(AVFrame *frame);
-  bool ReceiveFromFilter(AVPacket &out_pkt);
+  bool ReceiveFromFilter();
+  bool ApplySteppedGain(AVFrame *frame);
+  // 送一帧（nullptr 为冲刷）给编码器，取出的所有包进 out_queue_；返回包数
+  int EncodeFrame(AVFrame *frame);
+  // 解码帧采样率与输出不同：重采样并乘上淡入淡出增益，每攒满一帧送编码器；返回包数
+  int ResampleAndEncode(const AVFrame *frame);
+  // 把重采样器里的样本（flush 时含尾部和不足一帧的部分）送进编码器；
+  // 每攒满一帧调用一次 on_frame(帧)，返回包数之和
+  template <typename OnFrame> int DrainResampler(bool flush, OnFrame on_frame);
   void Cleanup();
+  void SetState(State state);
 
   AVCodecContext *dec_ctx_ = nullptr;
   AVCodecContext *enc_ctx_ = nullptr;
+  bool enc_drained_ = false; // 已送过空帧，编码器不再接受输入
+  RoomBufferPool *pool_ = nullptr; // 重开解码器时重新挂上
 
   AVFilterGraph *filter_graph_ = nullptr;
   AVFilterContext *src_ctx_ = nullptr;
   AVFilterContext *sink_ctx_ = nullptr;
 
+  // 跨调用复用，避免每个包都 av_frame_alloc / av_frame_free
+  AVFrame *dec_frame_ = nullptr;
+  AVFrame *filt_frame_ = nullptr;
+  std::deque<AVPacket> out_queue_; // 已编码、等 ReceivePacket 取走的包
+
   FadeType type_;
   int sample_rate_;
   int channels_;
   AVSampleFormat sample_fmt_;
 
   int total_frames_;        // 多少帧淡入或淡出
-  int64_t pts_counter_ = 0; // 维护连续时间戳
+  int64_t pts_counter_ = 0; // 维护连续时间戳（输出采样点）
+
+  std::unique_ptr<PolyphaseResampler> resampler_; // 输入采样率与输出不同时才建
+  AVFrame *res_frame_ = nullptr; // 重采样后攒编码器输入帧
+  int res_fill_ = 0;
+
+  State state_ = STATE_FAILED;
+  int processed_frames_ = 0; // 已解码处理的帧数
+  bool stepped_gain_ = false;
+
+  std::string room_id_;         // 为空时不上报 metrics
+  AVRational pkt_time_base_{0, 1};
+  libmagic::LogContext log_ctx_;  // 本实例日志的 room / fade id，stream 沿用调用方
+
+  static std::atomic<int> state_counts_[STATE_COUNT];
 };
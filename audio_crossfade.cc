@@ -0,0 +1,607 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
+#include "audio_crossfade.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
+}
+
+#include "audio_afade.h"
+#include "logger.h"
+
+namespace {
+
+// 消费掉的样本攒够这么多再从 pcm 前端删除，避免每帧搬移
+constexpr int64_t kTrimSamples = 4096;
+
+std::string AvError(int ret) {
+  char errbuf[128];
+  av_strerror(ret, errbuf, sizeof(errbuf));
+  return errbuf;
+}
+
+bool HasAdtsHeader(const AVPacket *pkt) {
+  return pkt->size >= 7 && pkt->data[0] == 0xFF && (pkt->data[1] & 0xF0) == 0xF0;
+}
+
+} // namespace
+
+AudioCrossfade::AudioCrossfade(const Options &options) : options_(options) {
+  options_.channels = std::clamp(options_.channels, 1, kMaxChannels);
+}
+
+AudioCrossfade::~AudioCrossfade() {
+  for (auto &src : sides_) {
+    ReleaseSource(&src);
+    avcodec_parameters_free(&src.par);
+  }
+  avcodec_free_context(&enc_);
+  av_frame_free(&enc_frame_);
+  for (auto *pkt : pending_b_)
+    av_packet_free(&pkt);
+  for (auto *pkt : out_)
+    av_packet_free(&pkt);
+}
+
+void AudioCrossfade::ReleaseSource(SourceState *src) {
+  avcodec_free_context(&src->dec);
+  swr_free(&src->swr);
+  for (auto *pkt : src->history)
+    av_packet_free(&pkt);
+  src->history.clear();
+  for (auto &plane : src->pcm)
+    std::vector<float>().swap(plane);
+  src->decoding = false;
+}
+
+bool AudioCrossfade::SetSource(Side side, const AVCodecParameters *par, AVRational time_base) {
+  SourceState &src = sides_[side];
+  if (!par || src.par)
+    return false;
+  src.par = avcodec_parameters_alloc();
+  if (!src.par || avcodec_parameters_copy(src.par, par) < 0) {
+    LOG_ERROR("AudioCrossfade copy codec parameters failed side={}", side);
+    return false;
+  }
+  src.time_base = time_base;
+  src.copyable = par->codec_id == AV_CODEC_ID_AAC && par->sample_rate == options_.sample_rate &&
+                 par->channels == options_.channels &&
+                 (par->profile == FF_PROFILE_UNKNOWN || par->profile == FF_PROFILE_AAC_LOW);
+  LOG_INFO("AudioCrossfade source {} codec_id={} rate={} channels={} copyable={}",
+           side == SIDE_A ? "A" : "B", par->codec_id, par->sample_rate, par->channels,
+           src.copyable);
+  if (!src.copyable)
+    LOG_WARN("AudioCrossfade source {} not {}Hz/{}ch AAC-LC, will be transcoded",
+             side == SIDE_A ? "A" : "B", options_.sample_rate, options_.channels);
+  PlanRegion();
+  return true;
+}
+
+bool AudioCrossfade::Schedule(int64_t at, int64_t duration, int64_t b_pts) {
+  if (scheduled_ || !sides_[SIDE_A].par || !sides_[SIDE_B].par)
+    return false;
+  // 已经输出（直通或编码）的部分改不了，起点最早从这里开始
+  const int64_t now = sides_[SIDE_A].copyable
+                          ? copied_to_
+                          : (enc_pos_ == INT64_MIN ? 0 : enc_pos_ + kFrameSamples);
+  at_ = at == AV_NOPTS_VALUE ? now : std::max(at, now);
+  fade_end_ = at_ + std::max<int64_t>(1, duration);
+  scheduled_ = true;
+  SourceState &b = sides_[SIDE_B];
+  if (b_pts != AV_NOPTS_VALUE) {
+    b.origin = b_pts;
+    b.base = at_;
+  }
+  PlanRegion();
+  AlignB();
+  LOG_INFO("AudioCrossfade scheduled at={} end={} region=[{}, {}) requested_at={}", at_,
+           fade_end_, w0_, w1_ == INT64_MAX ? -1 : w1_, at);
+  Encode();
+  return true;
+}
+
+void AudioCrossfade::PlanRegion() {
+  const SourceState &a = sides_[SIDE_A];
+  const SourceState &b = sides_[SIDE_B];
+  if (a.par && !a.copyable) {
+    w0_ = 0; // A 整段转码，从 A 的第一个采样点起
+  } else if (scheduled_) {
+    // A 的包从 copied_to_ 起按帧连续排列，W0 取 at 所在的那一帧的起点
+    w0_ = copied_to_ + (at_ - copied_to_) / kFrameSamples * kFrameSamples;
+  }
+  if (scheduled_ && b.par && b.copyable) {
+    const int64_t frames = (fade_end_ - w0_ + kFrameSamples - 1) / kFrameSamples;
+    w1_ = w0_ + std::max<int64_t>(1, frames) * kFrameSamples;
+  }
+}
+
+void AudioCrossfade::AlignB() {
+  SourceState &b = sides_[SIDE_B];
+  if (b_aligned_ || b.origin == AV_NOPTS_VALUE || !b.copyable || w1_ == INT64_MAX)
+    return;
+  // B 的帧边界在 base + k·1024，挪到 W1 上，挪动量在 (-512, 512]
+  int64_t r = (w1_ - b.base) % kFrameSamples;
+  if (r < 0)
+    r += kFrameSamples;
+  const int64_t adjust = r <= kFrameSamples / 2 ? r : r - kFrameSamples;
+  b.base += adjust;
+  b_aligned_ = true;
+  LOG_INFO("AudioCrossfade align B by {} samples onto frame grid, base={}", adjust, b.base);
+}
+
+bool AudioCrossfade::RegionActive() const {
+  return !region_done_ && (scheduled_ || (sides_[SIDE_A].par && !sides_[SIDE_A].copyable));
+}
+
+int64_t AudioCrossfade::MapPts(const SourceState &src, int64_t pts) const {
+  return src.base + av_rescale_q(pts - src.origin, src.time_base, {1, options_.sample_rate});
+}
+
+int64_t AudioCrossfade::SnapToFrame(int64_t pos, int64_t grid) {
+  int64_t r = (pos - grid) % kFrameSamples;
+  if (r < 0)
+    r += kFrameSamples;
+  if (r <= kPtsJitterSamples)
+    return pos - r;
+  if (kFrameSamples - r <= kPtsJitterSamples)
+    return pos + kFrameSamples - r;
+  return pos;
+}
+
+int64_t AudioCrossfade::PacketSamples(const SourceState &src, const AVPacket *pkt) const {
+  if (pkt->duration > 0)
+    return av_rescale_q(pkt->duration, src.time_base, {1, options_.sample_rate});
+  int frame_size = src.par->frame_size;
+  if (frame_size <= 0)
+    frame_size = src.par->codec_id == AV_CODEC_ID_MP3 ? 1152 : kFrameSamples;
+  const int rate = src.par->sample_rate > 0 ? src.par->sample_rate : options_.sample_rate;
+  return av_rescale(frame_size, options_.sample_rate, rate);
+}
+
+int64_t AudioCrossfade::PcmEnd(const SourceState &src) const {
+  return src.pcm_begin + static_cast<int64_t>(src.pcm[0].size());
+}
+
+bool AudioCrossfade::Push(Side side, const AVPacket *pkt) {
+  SourceState &src = sides_[side];
+  if (!src.par || src.ended)
+    return false;
+  const int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  if (pts == AV_NOPTS_VALUE) {
+    LOG_EVERY_N(warn, 100, "AudioCrossfade drop packet without pts side={}", side);
+    return false;
+  }
+  bool ok = true;
+  if (side == SIDE_A) {
+    if (src.origin == AV_NOPTS_VALUE)
+      src.origin = pts;
+    const int64_t s = src.copyable ? SnapToFrame(MapPts(src, pts), src.base) : MapPts(src, pts);
+    const int64_t e = s + PacketSamples(src, pkt);
+    if (region_done_ || s >= fade_end_) {
+      stats_.dropped++; // 已完全切到 B
+    } else if (src.copyable && (!scheduled_ || e <= w0_)) {
+      AVPacket *copy = CopyPacket(pkt, s, e - s);
+      ok = copy != nullptr;
+      if (ok) {
+        out_.push_back(copy);
+        copied_to_ = e;
+        stats_.copied_a++;
+      }
+      KeepHistory(&src, pkt);
+    } else {
+      ok = Decode(&src, pkt);
+      stats_.decoded_a++;
+    }
+  } else {
+    if (!scheduled_) {
+      KeepHistory(&src, pkt); // 切换前的 B 只留作解码器的 pre-roll
+      return true;
+    }
+    if (src.origin == AV_NOPTS_VALUE) {
+      src.origin = pts;
+      src.base = at_;
+      AlignB();
+    }
+    const int64_t s = b_aligned_ ? SnapToFrame(MapPts(src, pts), src.base) : MapPts(src, pts);
+    const int64_t e = s + PacketSamples(src, pkt);
+    const bool copy = src.copyable && s >= w1_;
+    // 区间最后一帧编码时要看 [W1, W1 + 1024) 的 B 作前瞻，这一包既直通也解码
+    const bool decode =
+        !region_done_ && e > at_ && (w1_ == INT64_MAX || s < w1_ + kFrameSamples);
+    if (copy) {
+      AVPacket *out = CopyPacket(pkt, s, e - s);
+      ok = out != nullptr;
+      if (ok) {
+        (region_done_ ? out_ : pending_b_).push_back(out);
+        stats_.copied_b++;
+      }
+    }
+    if (decode) {
+      ok = Decode(&src, pkt) && ok;
+      stats_.decoded_b++;
+    }
+    if (!copy && !decode) {
+      KeepHistory(&src, pkt);
+      stats_.dropped++;
+    }
+  }
+  Encode();
+  return ok;
+}
+
+void AudioCrossfade::EndSource(Side side) {
+  SourceState &src = sides_[side];
+  if (src.ended)
+    return;
+  src.ended = true;
+  if (src.decoding)
+    DecodePacket(&src, nullptr); // 取出解码器里剩余的帧
+  Encode();
+}
+
+void AudioCrossfade::KeepHistory(SourceState *src, const AVPacket *pkt) {
+  AVPacket *ref = av_packet_alloc();
+  if (!ref || av_packet_ref(ref, pkt) < 0) {
+    av_packet_free(&ref);
+    return;
+  }
+  src->history.push_back(ref);
+  while (src->history.size() > kHistoryPackets) {
+    av_packet_free(&src->history.front());
+    src->history.pop_front();
+  }
+}
+
+AVPacket *AudioCrossfade::CopyPacket(const AVPacket *pkt, int64_t pos, int64_t samples) const {
+  AVPacket *out = av_packet_alloc();
+  if (!out)
+    return nullptr;
+  int ret;
+  if (HasAdtsHeader(pkt)) {
+    ret = av_packet_ref(out, pkt);
+  } else {
+    // 来自 MP4/FLV 等封装的裸 AAC 帧：补 ADTS 头，负载不变
+    ret = av_new_packet(out, pkt->size + 7);
+    if (ret >= 0) {
+      AudioAfade::WriteAdtsHeader(out->data, pkt->size, 2, options_.sample_rate,
+                                  options_.channels);
+      memcpy(out->data + 7, pkt->data, pkt->size);
+    }
+  }
+  if (ret < 0) {
+    LOG_ERROR("AudioCrossfade copy packet failed: {}", AvError(ret));
+    av_packet_free(&out);
+    return nullptr;
+  }
+  out->stream_index = 0;
+  out->pts = out->dts = pos;
+  out->duration = samples;
+  return out;
+}
+
+bool AudioCrossfade::Decode(SourceState *src, const AVPacket *pkt) {
+  if (!src->dec && !OpenDecoder(src))
+    return false;
+  if (!src->decoding) {
+    // 先喂历史包补齐解码器状态，它们解出的样本落在各自的位置上，用不到的会被裁掉
+    src->decoding = true;
+    for (auto *h : src->history)
+      DecodePacket(src, h);
+    for (auto *h : src->history)
+      av_packet_free(&h);
+    src->history.clear();
+  }
+  return DecodePacket(src, pkt);
+}
+
+bool AudioCrossfade::OpenDecoder(SourceState *src) {
+  const AVCodec *codec = avcodec_find_decoder(src->par->codec_id);
+  if (!codec) {
+    LOG_ERROR("AudioCrossfade no decoder for codec_id={}", src->par->codec_id);
+    return false;
+  }
+  src->dec = avcodec_alloc_context3(codec);
+  if (!src->dec || avcodec_parameters_to_context(src->dec, src->par) < 0) {
+    LOG_ERROR("AudioCrossfade alloc decoder context failed");
+    avcodec_free_context(&src->dec);
+    return false;
+  }
+  src->dec->pkt_timebase = src->time_base;
+  int ret = avcodec_open2(src->dec, codec, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("AudioCrossfade open decoder failed: {}", AvError(ret));
+    avcodec_free_context(&src->dec);
+    return false;
+  }
+  return true;
+}
+
+bool AudioCrossfade::DecodePacket(SourceState *src, const AVPacket *pkt) {
+  int ret = avcodec_send_packet(src->dec, pkt);
+  if (ret < 0 && ret != AVERROR_EOF) {
+    LOG_WARN("AudioCrossfade decode failed pts={}: {}", pkt ? pkt->pts : -1, AvError(ret));
+    return false;
+  }
+  AVFrame *frame = av_frame_alloc();
+  if (!frame)
+    return false;
+  bool ok = true;
+  while (ok && (ret = avcodec_receive_frame(src->dec, frame)) >= 0) {
+    ok = AppendPcm(src, frame);
+    av_frame_unref(frame);
+  }
+  av_frame_free(&frame);
+  return ok;
+}
+
+bool AudioCrossfade::AppendPcm(SourceState *src, const AVFrame *frame) {
+  const int64_t pts =
+      frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+  const bool convert = frame->format != AV_SAMPLE_FMT_FLTP ||
+                       frame->sample_rate != options_.sample_rate ||
+                       frame->channels != options_.channels;
+  const float *planes[kMaxChannels] = {};
+  int64_t pos;
+  int nb;
+  if (!convert) {
+    pos = pts != AV_NOPTS_VALUE ? MapPts(*src, pts)
+          : src->next_pos != AV_NOPTS_VALUE ? src->next_pos
+                                            : PcmEnd(*src);
+    if (src->next_pos != AV_NOPTS_VALUE && std::abs(pos - src->next_pos) <= kPtsJitterSamples)
+      pos = src->next_pos;
+    nb = frame->nb_samples;
+    for (int c = 0; c < options_.channels; c++)
+      planes[c] = reinterpret_cast<const float *>(frame->extended_data[c]);
+  } else {
+    if (!src->swr) {
+      const int64_t in_layout = frame->channel_layout
+                                    ? static_cast<int64_t>(frame->channel_layout)
+                                    : av_get_default_channel_layout(frame->channels);
+      src->swr = swr_alloc_set_opts(nullptr, av_get_default_channel_layout(options_.channels),
+                                    AV_SAMPLE_FMT_FLTP, options_.sample_rate, in_layout,
+                                    static_cast<AVSampleFormat>(frame->format),
+                                    frame->sample_rate, 0, nullptr);
+      if (!src->swr || swr_init(src->swr) < 0) {
+        LOG_ERROR("AudioCrossfade init resampler {}Hz/{}ch -> {}Hz/{}ch failed",
+                  frame->sample_rate, frame->channels, options_.sample_rate,
+                  options_.channels);
+        swr_free(&src->swr);
+        return false;
+      }
+    }
+    // 重采样后的样本按累计数连续排列，起点取第一帧的 pts
+    if (src->next_pos == AV_NOPTS_VALUE)
+      src->next_pos = pts != AV_NOPTS_VALUE ? MapPts(*src, pts) : PcmEnd(*src);
+    pos = src->next_pos;
+    const int cap = swr_get_out_samples(src->swr, frame->nb_samples);
+    uint8_t *outp[kMaxChannels] = {};
+    for (int c = 0; c < options_.channels; c++) {
+      if (static_cast<int>(scratch_[c].size()) < cap)
+        scratch_[c].resize(cap);
+      outp[c] = reinterpret_cast<uint8_t *>(scratch_[c].data());
+    }
+    nb = swr_convert(src->swr, outp, cap, const_cast<const uint8_t **>(frame->extended_data),
+                     frame->nb_samples);
+    if (nb < 0) {
+      LOG_ERROR("AudioCrossfade resample failed: {}", AvError(nb));
+      return false;
+    }
+    for (int c = 0; c < options_.channels; c++)
+      planes[c] = scratch_[c].data();
+  }
+  src->next_pos = pos + nb;
+
+  if (src->pcm[0].empty())
+    src->pcm_begin = pos;
+  const int64_t end = PcmEnd(*src);
+  // 与已有样本重叠的部分保留先到的；中间有空洞时补静音
+  const int64_t skip = std::clamp<int64_t>(end - pos, 0, nb);
+  const int64_t gap = std::max<int64_t>(0, pos - end);
+  for (int c = 0; c < options_.channels; c++) {
+    auto &plane = src->pcm[c];
+    plane.insert(plane.end(), gap, 0.0f);
+    plane.insert(plane.end(), planes[c] + skip, planes[c] + nb);
+  }
+  return true;
+}
+
+float AudioCrossfade::SampleAt(const SourceState &src, int channel, int64_t t) const {
+  const int64_t idx = t - src.pcm_begin;
+  if (idx < 0 || idx >= static_cast<int64_t>(src.pcm[channel].size()))
+    return 0.0f;
+  return src.pcm[channel][idx];
+}
+
+void AudioCrossfade::TrimPcm(SourceState *src) {
+  const int64_t drop = std::min(enc_pos_ - src->pcm_begin, PcmEnd(*src) - src->pcm_begin);
+  if (drop < kTrimSamples)
+    return;
+  for (int c = 0; c < options_.channels; c++)
+    src->pcm[c].erase(src->pcm[c].begin(), src->pcm[c].begin() + drop);
+  src->pcm_begin += drop;
+}
+
+void AudioCrossfade::Gains(int64_t t, float *ga, float *gb) const {
+  if (!scheduled_ || t < at_) {
+    *ga = 1.0f;
+    *gb = 0.0f;
+    return;
+  }
+  const double x =
+      std::min(1.0, static_cast<double>(t - at_) / static_cast<double>(fade_end_ - at_));
+  if (options_.curve == CURVE_LINEAR) {
+    *ga = static_cast<float>(1.0 - x);
+    *gb = static_cast<float>(x);
+  } else {
+    *ga = static_cast<float>(std::cos(x * M_PI / 2));
+    *gb = static_cast<float>(std::sin(x * M_PI / 2));
+  }
+}
+
+bool AudioCrossfade::OpenEncoder() {
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  if (!codec) {
+    LOG_ERROR("AudioCrossfade AAC encoder not found");
+    return false;
+  }
+  enc_ = avcodec_alloc_context3(codec);
+  if (!enc_) {
+    LOG_ERROR("AudioCrossfade alloc encoder context failed");
+    return false;
+  }
+  enc_->sample_rate = options_.sample_rate;
+  enc_->channels = options_.channels;
+  enc_->channel_layout = av_get_default_channel_layout(options_.channels);
+  enc_->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  enc_->bit_rate = options_.bit_rate;
+  enc_->time_base = {1, options_.sample_rate};
+  int ret = avcodec_open2(enc_, codec, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("AudioCrossfade open encoder failed: {}", AvError(ret));
+    avcodec_free_context(&enc_);
+    return false;
+  }
+  enc_frame_ = av_frame_alloc();
+  if (!enc_frame_) {
+    avcodec_free_context(&enc_);
+    return false;
+  }
+  enc_frame_->format = AV_SAMPLE_FMT_FLTP;
+  enc_frame_->nb_samples = kFrameSamples;
+  enc_frame_->channels = options_.channels;
+  enc_frame_->channel_layout = enc_->channel_layout;
+  enc_frame_->sample_rate = options_.sample_rate;
+  if (av_frame_get_buffer(enc_frame_, 0) < 0) {
+    LOG_ERROR("AudioCrossfade alloc encoder frame failed");
+    av_frame_free(&enc_frame_);
+    avcodec_free_context(&enc_);
+    return false;
+  }
+  return true;
+}
+
+void AudioCrossfade::Encode() {
+  if (!RegionActive())
+    return;
+  if (!enc_ && !OpenEncoder()) {
+    // 编码器都起不来：放弃淡化，剩下的 B 直接接上
+    FinishRegion();
+    return;
+  }
+  if (enc_pos_ == INT64_MIN)
+    enc_pos_ = w0_ - kFrameSamples; // 多编一帧给编码器预热，输出时丢掉
+  SourceState &a = sides_[SIDE_A];
+  SourceState &b = sides_[SIDE_B];
+  while (true) {
+    const int64_t p = enc_pos_;
+    const int64_t pe = p + kFrameSamples;
+    // [W1, W1 + 1024) 只作为最后一帧的前瞻，编完即结束
+    if (p > w1_) {
+      FinishRegion();
+      return;
+    }
+    const bool need_a = p < fade_end_;
+    const bool need_b = scheduled_ && pe > at_;
+    const bool ready_a = !need_a || a.ended || PcmEnd(a) >= pe;
+    const bool ready_b = !need_b || b.ended || PcmEnd(b) >= pe;
+    if (!ready_a || !ready_b)
+      break;
+    const bool drained_a = !need_a || (a.ended && PcmEnd(a) <= p);
+    const bool drained_b = !need_b || (b.ended && PcmEnd(b) <= p);
+    if (drained_a && drained_b)
+      break; // 两边都没有数据了，等 Flush
+
+    if (av_frame_make_writable(enc_frame_) < 0)
+      break;
+    for (int c = 0; c < options_.channels; c++) {
+      float *dst = reinterpret_cast<float *>(enc_frame_->data[c]);
+      for (int i = 0; i < kFrameSamples; i++) {
+        float ga, gb;
+        Gains(p + i, &ga, &gb);
+        dst[i] = ga * SampleAt(a, c, p + i) + gb * SampleAt(b, c, p + i);
+      }
+    }
+    enc_frame_->pts = p;
+    if (!EncodeFrame(enc_frame_))
+      break;
+    enc_pos_ = pe;
+    TrimPcm(&a);
+    TrimPcm(&b);
+  }
+}
+
+bool AudioCrossfade::EncodeFrame(const AVFrame *frame) {
+  int ret = avcodec_send_frame(enc_, frame);
+  if (ret < 0) {
+    LOG_ERROR("AudioCrossfade send frame failed: {}", AvError(ret));
+    return false;
+  }
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = nullptr;
+  pkt.size = 0;
+  while (avcodec_receive_packet(enc_, &pkt) >= 0) {
+    // 编码器输出的 pts 已扣除起始延迟；预热帧和前瞻帧落在区间外，丢掉
+    if (pkt.pts >= w0_ && pkt.pts < w1_) {
+      AVPacket *out = av_packet_alloc();
+      if (out && av_new_packet(out, pkt.size + 7) >= 0) {
+        AudioAfade::WriteAdtsHeader(out->data, pkt.size, 2, options_.sample_rate,
+                                    options_.channels);
+        memcpy(out->data + 7, pkt.data, pkt.size);
+        out->pts = out->dts = pkt.pts;
+        out->duration = kFrameSamples;
+        out_.push_back(out);
+        stats_.encoded++;
+      } else {
+        av_packet_free(&out);
+        LOG_ERROR("AudioCrossfade alloc output packet failed");
+      }
+    }
+    av_packet_unref(&pkt);
+  }
+  return true;
+}
+
+void AudioCrossfade::FinishRegion() {
+  if (region_done_)
+    return;
+  region_done_ = true;
+  if (enc_)
+    EncodeFrame(nullptr);
+  avcodec_free_context(&enc_);
+  av_frame_free(&enc_frame_);
+  // A 不再需要；B 能直通时也不再解码
+  ReleaseSource(&sides_[SIDE_A]);
+  if (sides_[SIDE_B].copyable)
+    ReleaseSource(&sides_[SIDE_B]);
+  while (!pending_b_.empty()) {
+    out_.push_back(pending_b_.front());
+    pending_b_.pop_front();
+  }
+  LOG_INFO("AudioCrossfade region done: copied_a={} copied_b={} encoded={} decoded_a={} "
+           "decoded_b={} dropped={}",
+           stats_.copied_a, stats_.copied_b, stats_.encoded, stats_.decoded_a,
+           stats_.decoded_b, stats_.dropped);
+}
+
+bool AudioCrossfade::Receive(AVPacket *out) {
+  if (out_.empty())
+    return false;
+  AVPacket *pkt = out_.front();
+  out_.pop_front();
+  av_packet_move_ref(out, pkt);
+  av_packet_free(&pkt);
+  return true;
+}
+
+void AudioCrossfade::Flush() {
+  EndSource(SIDE_A);
+  EndSource(SIDE_B);
+  if (RegionActive() || enc_)
+    FinishRegion();
+}
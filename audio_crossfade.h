@@ -0,0 +1,139 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/rational.h>
+#include <libswresample/swresample.h>
+}
+
+// 两路压缩音频源之间的交叉淡化切换（如 input.mp3 -> input2.mp3、直播流 -> 垫片循环）。
+// 只解码重叠窗口附近的两路数据，按曲线混合后重新编码这几帧，窗口外两边都原样引用
+// （av_packet_ref，逐字节不变）。输出为 ADTS AAC，pts 以输出采样点为单位，从 A 的第一个包起算。
+//
+// 时间对齐：A 的第一个包对应输出 0；B 的 b_pts 对应输出 at。两边采样率、起始 PTS 可以不同，
+// 统一换算到输出采样点。重编码区间 [W0, W1) 落在 A 的帧网格上；B 能直通时把 B 的位置
+// 挪动不到半帧，使 B 的帧边界正好落在 W1，拼接处时间戳连续。
+// 某一边不是与输出同采样率、同声道的 AAC-LC 时无法逐字节直通，该边整段转码（解码-重采样-编码）。
+// 非线程安全，与房间同线程使用。
+class AudioCrossfade {
+public:
+  enum Side { SIDE_A, SIDE_B };
+  enum Curve {
+    CURVE_LINEAR,      // A = 1 - x, B = x
+    CURVE_EQUAL_POWER, // A = cos(x·π/2), B = sin(x·π/2)，不相关的两路响度不塌陷
+  };
+
+  struct Options {
+    int sample_rate = 44100; // 输出
+    int channels = 2;
+    int64_t bit_rate = 128000; // 重编码帧的码率
+    Curve curve = CURVE_EQUAL_POWER;
+  };
+
+  struct Stats {
+    uint64_t copied_a = 0;
+    uint64_t copied_b = 0;
+    uint64_t encoded = 0; // 重编码输出的包
+    uint64_t decoded_a = 0;
+    uint64_t decoded_b = 0;
+    uint64_t dropped = 0; // 不再需要的包（切换后的 A、切换前的 B）
+  };
+
+  explicit AudioCrossfade(const Options &options);
+  ~AudioCrossfade();
+  AudioCrossfade(const AudioCrossfade &) = delete;
+  AudioCrossfade &operator=(const AudioCrossfade &) = delete;
+
+  // par 为该源的流参数，time_base 为其包 pts 的时间基；须在 Push 之前调用
+  bool SetSource(Side side, const AVCodecParameters *par, AVRational time_base);
+  // 在输出采样点 at 开始、持续 duration 个采样点的交叉淡化。at 为 AV_NOPTS_VALUE 时
+  // 从 A 已输出的位置立即开始；b_pts（B 的时间基）对齐到 at，AV_NOPTS_VALUE 表示
+  // 之后到达的第一个 B 包。只能调用一次
+  bool Schedule(int64_t at, int64_t duration, int64_t b_pts = AV_NOPTS_VALUE);
+
+  // 输入一个包；切换前的 B、切换后的 A 被丢弃
+  bool Push(Side side, const AVPacket *pkt);
+  // 该源不会再有包（结束或断流），还缺的数据按静音处理
+  void EndSource(Side side);
+  // 取出一个输出包（ADTS AAC，stream_index 0），调用方负责 unref
+  bool Receive(AVPacket *out);
+  // 输入全部结束：编完剩余帧并放出所有包
+  void Flush();
+
+  // 是否能逐字节直通（否则整段转码）
+  bool copyable(Side side) const { return sides_[side].copyable; }
+  // 重编码区间已结束，之后只剩 B 的直通
+  bool done() const { return region_done_; }
+  const Stats &stats() const { return stats_; }
+
+private:
+  static constexpr int kFrameSamples = 1024; // AAC 帧长
+  static constexpr int kMaxChannels = 8;
+  // 解码器起步前先喂进的历史包数（补齐 MDCT 重叠，另多一帧给编码器预热）
+  static constexpr size_t kHistoryPackets = 3;
+  // pts 换算误差容忍（90kHz 等时间基换成采样点会差 1），在此之内按连续处理
+  static constexpr int64_t kPtsJitterSamples = 2;
+
+  struct SourceState {
+    AVCodecParameters *par = nullptr;
+    AVRational time_base{1, 1};
+    bool copyable = false;
+    bool ended = false;
+    int64_t origin = AV_NOPTS_VALUE; // 该源时间基下对齐点的 pts
+    int64_t base = 0;                // origin 对应的输出采样点
+    AVCodecContext *dec = nullptr;
+    SwrContext *swr = nullptr;
+    bool decoding = false;            // 已开始解码（历史包已喂进）
+    int64_t next_pos = AV_NOPTS_VALUE; // 重采样时下一个解码样本的输出位置
+    std::deque<AVPacket *> history;
+    std::vector<float> pcm[kMaxChannels]; // 解码并转换后的样本，起点 pcm_begin
+    int64_t pcm_begin = 0;
+  };
+
+  int64_t MapPts(const SourceState &src, int64_t pts) const;
+  // pos 离 grid + k·1024 不超过 kPtsJitterSamples 时吸附到帧边界
+  static int64_t SnapToFrame(int64_t pos, int64_t grid);
+  int64_t PacketSamples(const SourceState &src, const AVPacket *pkt) const;
+  int64_t PcmEnd(const SourceState &src) const;
+  void PlanRegion();
+  void AlignB();
+  bool RegionActive() const;
+  void KeepHistory(SourceState *src, const AVPacket *pkt);
+  // 直通包：引用输入数据，改写为输出时间戳；不带 ADTS 头的补上
+  AVPacket *CopyPacket(const AVPacket *pkt, int64_t pos, int64_t samples) const;
+  bool Decode(SourceState *src, const AVPacket *pkt);
+  bool DecodePacket(SourceState *src, const AVPacket *pkt);
+  bool OpenDecoder(SourceState *src);
+  bool AppendPcm(SourceState *src, const AVFrame *frame);
+  float SampleAt(const SourceState &src, int channel, int64_t t) const;
+  void TrimPcm(SourceState *src);
+  bool OpenEncoder();
+  void Encode();
+  bool EncodeFrame(const AVFrame *frame);
+  void FinishRegion();
+  void Gains(int64_t t, float *ga, float *gb) const;
+  void ReleaseSource(SourceState *src);
+
+  Options options_;
+  SourceState sides_[2];
+
+  bool scheduled_ = false;
+  int64_t at_ = INT64_MAX;       // 淡化起点（输出采样点）
+  int64_t fade_end_ = INT64_MAX; // 淡化终点
+  int64_t w0_ = INT64_MAX;       // 重编码区间起点；A 不能直通时从头开始
+  int64_t w1_ = INT64_MAX;       // 重编码区间终点；B 不能直通时一直转码
+  bool b_aligned_ = false;
+  bool region_done_ = false;
+  int64_t copied_to_ = 0; // A 已直通到的输出位置
+
+  AVCodecContext *enc_ = nullptr;
+  AVFrame *enc_frame_ = nullptr;
+  int64_t enc_pos_ = INT64_MIN; // 下一个送进编码器的帧起点
+
+  std::vector<float> scratch_[kMaxChannels]; // 重采样输出
+  std::deque<AVPacket *> pending_b_; // 重编码区间结束前到达的 B 直通包
+  std::deque<AVPacket *> out_;
+  Stats stats_;
+};
@@ -0,0 +1,363 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
+#include "audio_mixer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_MIXER_X86 1
+#endif
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mathematics.h>
+}
+
+#include "logger.h"
+
+namespace {
+
+constexpr int kMaxChannels = 8;
+
+// dst[i] += src[i] * (gain + step * i)
+using AccumulateFn = void (*)(float *dst, const float *src, int n, float gain, float step);
+// 超过 threshold 的部分按 u / (1 + u) 压缩，拐点处斜率连续，渐近到 ±1
+using SoftClipFn = void (*)(float *p, int n, float threshold);
+
+void AccumulateC(float *dst, const float *src, int n, float gain, float step) {
+  for (int i = 0; i < n; i++)
+    dst[i] += src[i] * (gain + step * i);
+}
+
+void SoftClipC(float *p, int n, float threshold) {
+  const float knee = 1.0f - threshold;
+  for (int i = 0; i < n; i++) {
+    const float a = std::fabs(p[i]);
+    if (a <= threshold)
+      continue;
+    const float u = (a - threshold) / knee;
+    p[i] = std::copysign(threshold + knee * u / (1.0f + u), p[i]);
+  }
+}
+
+#ifdef AUDIO_MIXER_X86
+__attribute__((target("avx2,fma"))) void AccumulateAvx2(float *dst, const float *src,
+                                                        int n, float gain, float step) {
+  const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 vstep = _mm256_set1_ps(step);
+  const __m256 vgain = _mm256_set1_ps(gain);
+  int i = 0;
+  if (step == 0) {
+    for (; i + 8 <= n; i += 8) {
+      __m256 d = _mm256_loadu_ps(dst + i);
+      d = _mm256_fmadd_ps(_mm256_loadu_ps(src + i), vgain, d);
+      _mm256_storeu_ps(dst + i, d);
+    }
+  } else {
+    for (; i + 8 <= n; i += 8) {
+      // 增益按下标重新计算而不是逐次累加，长斜坡上不积累误差
+      __m256 idx = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lane);
+      __m256 g = _mm256_fmadd_ps(idx, vstep, vgain);
+      __m256 d = _mm256_loadu_ps(dst + i);
+      d = _mm256_fmadd_ps(_mm256_loadu_ps(src + i), g, d);
+      _mm256_storeu_ps(dst + i, d);
+    }
+  }
+  AccumulateC(dst + i, src + i, n - i, gain + step * i, step);
+}
+
+__attribute__((target("avx2,fma"))) void SoftClipAvx2(float *p, int n, float threshold) {
+  const float knee = 1.0f - threshold;
+  const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  const __m256 vt = _mm256_set1_ps(threshold);
+  const __m256 vk = _mm256_set1_ps(knee);
+  const __m256 inv_k = _mm256_set1_ps(1.0f / knee);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(p + i);
+    __m256 sign = _mm256_and_ps(x, sign_mask);
+    __m256 a = _mm256_andnot_ps(sign_mask, x);
+    __m256 over = _mm256_cmp_ps(a, vt, _CMP_GT_OQ);
+    if (_mm256_movemask_ps(over) == 0)
+      continue; // 常见情况：整段都在拐点以下
+    __m256 u = _mm256_mul_ps(_mm256_sub_ps(a, vt), inv_k);
+    __m256 y = _mm256_fmadd_ps(vk, _mm256_div_ps(u, _mm256_add_ps(one, u)), vt);
+    y = _mm256_blendv_ps(a, y, over);
+    _mm256_storeu_ps(p + i, _mm256_or_ps(y, sign));
+  }
+  SoftClipC(p + i, n - i, threshold);
+}
+#endif
+
+bool HaveAvx2() {
+#ifdef AUDIO_MIXER_X86
+  const int flags = av_get_cpu_flags();
+  return (flags & AV_CPU_FLAG_AVX2) && (flags & AV_CPU_FLAG_FMA3);
+#else
+  return false;
+#endif
+}
+
+AccumulateFn PickAccumulate() {
+#ifdef AUDIO_MIXER_X86
+  if (HaveAvx2())
+    return AccumulateAvx2;
+#endif
+  return AccumulateC;
+}
+
+SoftClipFn PickSoftClip() {
+#ifdef AUDIO_MIXER_X86
+  if (HaveAvx2())
+    return SoftClipAvx2;
+#endif
+  return SoftClipC;
+}
+
+} // namespace
+
+AudioMixer::AudioMixer(const Options &options) : options_(options) {
+  options_.channels = std::clamp(options_.channels, 1, kMaxChannels);
+  options_.frame_samples = std::max(1, options_.frame_samples);
+  options_.limiter_threshold = std::clamp(options_.limiter_threshold, 0.0f, 0.999f);
+  // 末尾留 32 字节，向量内核不会越界
+  plane_bytes_ = options_.frame_samples * static_cast<int>(sizeof(float)) + 32;
+  pool_ = av_buffer_pool_init(plane_bytes_, nullptr);
+  if (!pool_)
+    LOG_ERROR("AudioMixer alloc buffer pool failed: {} bytes", plane_bytes_);
+}
+
+AudioMixer::~AudioMixer() {
+  for (int id = 0; id < kMaxSources; id++)
+    RemoveSource(id);
+  av_buffer_pool_uninit(&pool_);
+}
+
+int AudioMixer::AddSource(const std::string &name, float gain, int64_t pts_offset) {
+  for (int id = 0; id < kMaxSources; id++) {
+    Source &src = sources_[id];
+    if (src.active)
+      continue;
+    for (auto &frame : src.queue) {
+      frame = av_frame_alloc();
+      if (!frame) {
+        LOG_ERROR("AudioMixer alloc source queue failed name={}", name);
+        RemoveSource(id);
+        return -1;
+      }
+    }
+    src.active = true;
+    src.name = name;
+    src.offset = pts_offset;
+    src.gain = src.target = gain;
+    LOG_INFO("AudioMixer add source id={} name={} gain={} offset={}", id, name, gain,
+             pts_offset);
+    return id;
+  }
+  LOG_ERROR("AudioMixer source limit {} reached, name={}", kMaxSources, name);
+  return -1;
+}
+
+void AudioMixer::RemoveSource(int id) {
+  if (id < 0 || id >= kMaxSources)
+    return;
+  Source &src = sources_[id];
+  for (auto &frame : src.queue)
+    av_frame_free(&frame);
+  if (src.active)
+    LOG_INFO("AudioMixer remove source id={} name={}", id, src.name);
+  src = Source();
+}
+
+int AudioMixer::sources() const {
+  return static_cast<int>(std::count_if(std::begin(sources_), std::end(sources_),
+                                        [](const Source &src) { return src.active; }));
+}
+
+bool AudioMixer::SetGain(int id, float gain, int64_t ramp_samples) {
+  if (id < 0 || id >= kMaxSources || !sources_[id].active)
+    return false;
+  Source &src = sources_[id];
+  src.target = gain;
+  if (ramp_samples <= 0) {
+    src.gain = gain;
+    src.step = 0;
+    src.ramp_left = 0;
+  } else {
+    src.step = (gain - src.gain) / static_cast<float>(ramp_samples);
+    src.ramp_left = ramp_samples;
+  }
+  return true;
+}
+
+bool AudioMixer::Push(int id, AVFrame *frame) {
+  if (id < 0 || id >= kMaxSources || !sources_[id].active)
+    return false;
+  Source &src = sources_[id];
+  if (frame->format != AV_SAMPLE_FMT_FLTP || frame->sample_rate != options_.sample_rate ||
+      (frame->channels != 1 && frame->channels != options_.channels) ||
+      frame->nb_samples <= 0) {
+    LOG_EVERY_N(warn, 1000,
+                "AudioMixer reject frame source={} fmt={} rate={} channels={} samples={}",
+                src.name, frame->format, frame->sample_rate, frame->channels,
+                frame->nb_samples);
+    return false;
+  }
+
+  const int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+  int64_t start;
+  if (pts != AV_NOPTS_VALUE) {
+    start = av_rescale_q(pts + src.offset, options_.time_base, {1, options_.sample_rate});
+  } else {
+    // 没有时间戳：接在该源上一帧之后
+    start = src.end != INT64_MIN ? src.end : std::max<int64_t>(0, next_sample_);
+  }
+  if (next_sample_ == INT64_MIN)
+    next_sample_ = start;
+  if (start + frame->nb_samples <= next_sample_) {
+    stats_.late_frames++;
+    LOG_EVERY_N(warn, 100, "AudioMixer drop late frame source={} start={} mixed_to={}",
+                src.name, start, next_sample_);
+    av_frame_unref(frame);
+    return true;
+  }
+  if (src.count == kQueueFrames) {
+    stats_.overflow_frames++;
+    LOG_EVERY_N(warn, 100, "AudioMixer source={} queue full, drop oldest", src.name);
+    PopFront(&src);
+  }
+  const int slot = (src.head + src.count) % kQueueFrames;
+  av_frame_move_ref(src.queue[slot], frame);
+  src.start[slot] = start;
+  src.count++;
+  src.end = std::max(src.end, start + src.queue[slot]->nb_samples);
+  return true;
+}
+
+void AudioMixer::PopFront(Source *src) {
+  av_frame_unref(src->queue[src->head]);
+  src->head = (src->head + 1) % kQueueFrames;
+  src->count--;
+}
+
+bool AudioMixer::Mix(AVFrame *out, bool flush) {
+  if (next_sample_ == INT64_MIN || !pool_)
+    return false;
+  const int n = options_.frame_samples;
+  const int64_t window_end = next_sample_ + n;
+  int64_t lead = INT64_MIN;
+  bool covered = true;
+  bool any_queued = false;
+  for (const auto &src : sources_) {
+    if (!src.active)
+      continue;
+    lead = std::max(lead, src.end);
+    covered = covered && src.end >= window_end;
+    any_queued = any_queued || src.count > 0;
+  }
+  if (!any_queued)
+    return false;
+  // 有源还没覆盖到窗口末尾：最快的源领先不到上限就继续等
+  if (!covered && !flush && lead - window_end < options_.max_delay_samples)
+    return false;
+
+  AVBufferRef *bufs[kMaxChannels] = {};
+  float *acc[kMaxChannels] = {};
+  for (int c = 0; c < options_.channels; c++) {
+    bufs[c] = av_buffer_pool_get(pool_);
+    if (!bufs[c]) {
+      LOG_ERROR("AudioMixer get output buffer failed");
+      for (int j = 0; j < c; j++)
+        av_buffer_unref(&bufs[j]);
+      return false;
+    }
+    acc[c] = reinterpret_cast<float *>(bufs[c]->data);
+    memset(acc[c], 0, n * sizeof(float));
+  }
+
+  for (auto &src : sources_) {
+    if (src.active)
+      MixSource(&src, acc, next_sample_);
+  }
+  const SoftClipFn soft_clip = PickSoftClip();
+  for (int c = 0; c < options_.channels; c++)
+    soft_clip(acc[c], n, options_.limiter_threshold);
+
+  out->format = AV_SAMPLE_FMT_FLTP;
+  out->nb_samples = n;
+  out->sample_rate = options_.sample_rate;
+  out->channels = options_.channels;
+  out->channel_layout = av_get_default_channel_layout(options_.channels);
+  out->pts = av_rescale_q(next_sample_, {1, options_.sample_rate}, options_.time_base);
+  for (int c = 0; c < options_.channels; c++) {
+    out->buf[c] = bufs[c];
+    out->data[c] = bufs[c]->data;
+  }
+  out->linesize[0] = n * static_cast<int>(sizeof(float));
+  out->extended_data = out->data;
+
+  next_sample_ = window_end;
+  stats_.mixed_frames++;
+  return true;
+}
+
+void AudioMixer::MixSource(Source *src, float *const *acc, int64_t window) {
+  const int n = options_.frame_samples;
+  const int64_t window_end = window + n;
+  const AccumulateFn accumulate = PickAccumulate();
+  int contributed = 0;
+  for (int k = 0; k < src->count; k++) {
+    const int slot = (src->head + k) % kQueueFrames;
+    const AVFrame *frame = src->queue[slot];
+    const int64_t fs = src->start[slot];
+    if (fs >= window_end)
+      break;
+    const int64_t a = std::max(window, fs);
+    const int64_t b = std::min(window_end, fs + frame->nb_samples);
+    if (b <= a)
+      continue;
+    const int len = static_cast<int>(b - a);
+    const int pos = static_cast<int>(a - window);
+    contributed += len;
+    // [pos, pos + ramp) 在增益斜坡内，其余为目标增益
+    const int ramp =
+        static_cast<int>(std::clamp<int64_t>(src->ramp_left - pos, 0, len));
+    const float ramp_gain = src->gain + src->step * pos;
+    for (int c = 0; c < options_.channels; c++) {
+      const int src_ch = std::min(c, frame->channels - 1);
+      const float *in = reinterpret_cast<const float *>(frame->extended_data[src_ch]) + (a - fs);
+      float *dst = acc[c] + pos;
+      if (ramp > 0)
+        accumulate(dst, in, ramp, ramp_gain, src->step);
+      if (len > ramp && src->target != 0)
+        accumulate(dst + ramp, in + ramp, len - ramp, src->target, 0);
+    }
+  }
+  // 已经用完的帧出队
+  while (src->count > 0 &&
+         src->start[src->head] + src->queue[src->head]->nb_samples <= window_end)
+    PopFront(src);
+  if (contributed == 0)
+    stats_.missing_windows++;
+  AdvanceGain(src, n);
+}
+
+void AudioMixer::AdvanceGain(Source *src, int samples) {
+  if (src->ramp_left <= 0)
+    return;
+  const int64_t adv = std::min<int64_t>(samples, src->ramp_left);
+  src->ramp_left -= adv;
+  src->gain = src->ramp_left > 0 ? src->gain + src->step * adv : src->target;
+}
+
+int64_t AudioMixer::next_pts() const {
+  if (next_sample_ == INT64_MIN)
+    return AV_NOPTS_VALUE;
+  return av_rescale_q(next_sample_, {1, options_.sample_rate}, options_.time_base);
+}
+
+bool AudioMixer::UsingAvx2() { return PickAccumulate() != AccumulateC; }
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <string>
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+// 多路音频混音（连麦、背景音乐）：每个房间 2~16 路已解码的 FLTP 源，
+// 按 PTS 对齐到采样点，带增益包络累加，再经软削波限幅输出。
+// 源帧以 move 方式入队（不拷贝数据），输出帧缓冲取自混音器自己的 AVBufferPool，
+// 稳态下不再分配数据缓冲，开销随源数线性增长。
+// 累加和限幅内核按 av_get_cpu_flags 选 AVX2+FMA 或标量实现。
+// 对齐与缺席：输出窗口 [T, T+N) 在所有源都覆盖到 T+N 时混出；有源迟迟不到，
+// 最快的源领先超过 max_delay_samples 后该源在这个窗口按静音处理，之后再到的过期数据丢弃。
+// 源帧长度可以不同（AAC 1024 / MP3 1152），按采样点拼接。非线程安全，与房间同线程使用。
+class AudioMixer {
+public:
+  struct Options {
+    int sample_rate = 44100;
+    int channels = 2;                // 输出声道数（不超过 8）；单声道源铺到所有声道
+    int frame_samples = 1024;        // 每个输出帧的采样点数
+    AVRational time_base{1, 44100};  // 输入帧 pts 的时间基，输出帧沿用
+    int max_delay_samples = 4096;    // 等迟到源的上限，按最快的源领先多少计
+    float limiter_threshold = 0.89f; // 软削波拐点（约 -1 dBFS），之上渐近到 1.0
+  };
+
+  struct Stats {
+    uint64_t mixed_frames = 0;
+    uint64_t late_frames = 0;     // 到达时已整帧过期、被丢弃的源帧
+    uint64_t missing_windows = 0; // 某个源在某个输出窗口没有任何数据（按源计）
+    uint64_t overflow_frames = 0; // 源队列满时丢掉的最旧帧
+  };
+
+  static constexpr int kMaxSources = 16;
+
+  explicit AudioMixer(const Options &options);
+  ~AudioMixer();
+  AudioMixer(const AudioMixer &) = delete;
+  AudioMixer &operator=(const AudioMixer &) = delete;
+
+  // 新增一路源，返回源编号；已满返回 -1。
+  // pts_offset（time_base）加到该源每帧的 pts 上，用于对齐起点不同的输入
+  int AddSource(const std::string &name, float gain = 1.0f, int64_t pts_offset = 0);
+  void RemoveSource(int id);
+  // 从下一个混出的采样点起，在 ramp_samples 个采样点内线性过渡到 gain；0 = 立即生效
+  bool SetGain(int id, float gain, int64_t ramp_samples = 0);
+
+  // 源的一帧解码数据（FLTP，采样率一致），引用被移走、frame 变为空；不符合要求返回 false
+  bool Push(int id, AVFrame *frame);
+  // 混出下一帧到 out（调用方负责 unref）；还要等迟到的源或没有数据时返回 false。
+  // flush = true 表示输入已结束，不再等待
+  bool Mix(AVFrame *out, bool flush = false);
+
+  // 下一个输出帧的 pts（time_base），还没有任何输入时为 AV_NOPTS_VALUE
+  int64_t next_pts() const;
+  int sources() const;
+  const Stats &stats() const { return stats_; }
+
+  // 是否使用 AVX2+FMA 内核（可用 av_force_cpu_flags 关闭做对比）
+  static bool UsingAvx2();
+
+private:
+  // 每路源最多排队的帧数，约 180ms @ 44.1kHz / 1024
+  static constexpr int kQueueFrames = 8;
+
+  struct Source {
+    bool active = false;
+    std::string name;
+    int64_t offset = 0;         // time_base
+    AVFrame *queue[kQueueFrames] = {};
+    int64_t start[kQueueFrames] = {}; // 各帧起点（采样点）
+    int head = 0;
+    int count = 0;
+    int64_t end = INT64_MIN; // 已入队数据的终点（采样点）
+    float gain = 1.0f;       // 下一个输出采样点处的增益
+    float target = 1.0f;
+    float step = 0;          // 每个采样点的增益增量
+    int64_t ramp_left = 0;   // 增益还要过渡的采样点数
+  };
+
+  void PopFront(Source *src);
+  void MixSource(Source *src, float *const *acc, int64_t window);
+  void AdvanceGain(Source *src, int samples);
+
+  Options options_;
+  Source sources_[kMaxSources];
+  AVBufferPool *pool_ = nullptr; // 输出平面缓冲
+  int plane_bytes_ = 0;
+  int64_t next_sample_ = INT64_MIN; // 下一个输出窗口起点（采样点）
+  Stats stats_;
+};
@@ -1,7 +1,22 @@
 #include "av_metrics.h"
 
+#include <pthread.h>
+
+#include <cmath>
 #include <iostream>
 
+namespace {
+
+double ElapsedMs(std::chrono::steady_clock::time_point from,
+                 std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// 漂移恢复时使用的回滞比例，避免在阈值附近反复告警
+constexpr double kDriftRecoverRatio = 0.8;
+
+}  // namespace
+
 AvMetrics& AvMetrics::Instance() {
   static AvMetrics inst;
   return inst;
@@ -22,44 +37,299 @@ void AvMetrics::Init(const std::string& addr) {
                      .Help("Last media presentation timestamp (milliseconds)")
                      .Register(*registry_);
 
+  drift_family_ = &prometheus::BuildGauge()
+                       .Name("libpush_av_drift_milliseconds")
+                       .Help("Audio minus video PTS drift, corrected for arrival time (milliseconds)")
+                       .Register(*registry_);
+
+  drift_hist_family_ = &prometheus::BuildHistogram()
+                            .Name("libpush_av_drift_observed_milliseconds")
+                            .Help("Distribution of audio minus video PTS drift (milliseconds)")
+                            .Register(*registry_);
+
+  stall_family_ = &prometheus::BuildGauge()
+                       .Name("libpush_pts_stall_seconds")
+                       .Help("Seconds since the stream PTS last advanced")
+                       .Register(*registry_);
+
+  resident_family_ = &prometheus::BuildGauge()
+                          .Name("libpush_room_resident_bytes")
+                          .Help("Estimated resident bytes held by the room processing state")
+                          .Register(*registry_);
+
+  lag_family_ = &prometheus::BuildGauge()
+                     .Name("libpush_processing_lag_milliseconds")
+                     .Help("How far audio processing runs behind the wall-clock time implied by PTS")
+                     .Register(*registry_);
+
+  degrade_level_family_ = &prometheus::BuildGauge()
+                               .Name("libpush_degrade_level")
+                               .Help("Overload degradation level (0 = full fidelity, 3 = passthrough)")
+                               .Register(*registry_);
+
+  degrade_family_ = &prometheus::BuildCounter()
+                         .Name("libpush_degrade_transitions_total")
+                         .Help("Overload degradation level transitions by target level")
+                         .Register(*registry_);
+
+  deadline_family_ = &prometheus::BuildCounter()
+                          .Name("libpush_deadline_misses_total")
+                          .Help("Frame tasks that finished after their presentation deadline")
+                          .Register(*registry_);
+
+  placement_family_ = &prometheus::BuildGauge()
+                           .Name("libpush_room_placement")
+                           .Help("Room placement: NUMA node (kind=numa_node) and home CPU (kind=cpu)")
+                           .Register(*registry_);
+
+  remote_family_ = &prometheus::BuildCounter()
+                        .Name("libpush_numa_remote_tasks_total")
+                        .Help("Room tasks that ran on a CPU outside the room's NUMA node")
+                        .Register(*registry_);
+
   exposer_->RegisterCollectable(registry_);
+
+  stop_ = false;
+  watchdog_ = std::thread(&AvMetrics::WatchdogLoop, this);
   inited_ = true;
 }
 
-AvMetrics::StreamMetrics& AvMetrics::GetOrCreate(const std::string& room_id) {
+std::shared_ptr<AvMetrics::StreamMetrics> AvMetrics::Find(const std::string& room_id) {
   std::lock_guard<std::mutex> lk(mu_);
   auto it = rooms_.find(room_id);
-  if (it != rooms_.end()) return *it->second;
+  return it != rooms_.end() ? it->second : nullptr;
+}
+
+void AvMetrics::AddRoom(const std::string& room_id) {
+  if (!inited_) return;
+  std::lock_guard<std::mutex> lk(mu_);
+  if (rooms_.count(room_id)) return;
+
+  static const prometheus::Histogram::BucketBoundaries kDriftBuckets = {
+      -1000, -500, -200, -100, -50, -20, 0, 20, 50, 100, 200, 500, 1000};
 
-  auto sm = std::make_unique<StreamMetrics>();
+  auto sm = std::make_shared<StreamMetrics>();
   sm->audio_fps = &fps_family_->Add({{"room_id", room_id}, {"kind", "audio"}});
   sm->video_fps = &fps_family_->Add({{"room_id", room_id}, {"kind", "video"}});
   sm->audio_pts_sec = &pts_family_->Add({{"room_id", room_id}, {"kind", "audio"}});
   sm->video_pts_sec = &pts_family_->Add({{"room_id", room_id}, {"kind", "video"}});
+  sm->drift_ms = &drift_family_->Add({{"room_id", room_id}});
+  sm->drift_hist = &drift_hist_family_->Add({{"room_id", room_id}}, kDriftBuckets);
+  sm->audio_stall_sec = &stall_family_->Add({{"room_id", room_id}, {"kind", "audio"}});
+  sm->video_stall_sec = &stall_family_->Add({{"room_id", room_id}, {"kind", "video"}});
+  sm->resident_bytes = &resident_family_->Add({{"room_id", room_id}});
+  sm->lag_ms = &lag_family_->Add({{"room_id", room_id}});
+  sm->degrade_level = &degrade_level_family_->Add({{"room_id", room_id}});
+  sm->deadline_misses = &deadline_family_->Add({{"room_id", room_id}});
+  sm->numa_node = &placement_family_->Add({{"room_id", room_id}, {"kind", "numa_node"}});
+  sm->home_cpu = &placement_family_->Add({{"room_id", room_id}, {"kind", "cpu"}});
+  sm->remote_tasks = &remote_family_->Add({{"room_id", room_id}});
 
-  auto& ref = *sm;
   rooms_.emplace(room_id, std::move(sm));
-  return ref;
+}
+
+template <typename F>
+void AvMetrics::WithRoom(const std::string& room_id, F f) {
+  std::shared_ptr<StreamMetrics> m = Find(room_id);
+  if (!m) return;
+  std::lock_guard<std::mutex> lk(m->sync_mu);
+  if (!m->removed) f(*m);
 }
 
 void AvMetrics::SetFps(const std::string& room_id, double audio_fps, double video_fps) {
-  auto& m = GetOrCreate(room_id);
-  m.audio_fps->Set(audio_fps);
-  m.video_fps->Set(video_fps);
+  if (!inited_) return;
+  WithRoom(room_id, [&](StreamMetrics& m) {
+    m.audio_fps->Set(audio_fps);
+    m.video_fps->Set(video_fps);
+  });
 }
 
 void AvMetrics::SetPtsMs(const std::string& room_id, uint64_t audio_pts_ms, uint64_t video_pts_ms) {
-  auto& m = GetOrCreate(room_id);
-  m.audio_pts_sec->Set(static_cast<double>(audio_pts_ms));
-  m.video_pts_sec->Set(static_cast<double>(video_pts_ms));
+  UpdatePts(room_id, true, static_cast<int64_t>(audio_pts_ms));
+  UpdatePts(room_id, false, static_cast<int64_t>(video_pts_ms));
+}
+
+void AvMetrics::UpdateAudioPtsMs(const std::string& room_id, int64_t pts_ms) {
+  UpdatePts(room_id, true, pts_ms);
+}
+
+void AvMetrics::UpdateVideoPtsMs(const std::string& room_id, int64_t pts_ms) {
+  UpdatePts(room_id, false, pts_ms);
+}
+
+void AvMetrics::SetSyncThresholds(double drift_ms, double stall_ms) {
+  drift_threshold_ms_.store(drift_ms, std::memory_order_relaxed);
+  stall_threshold_ms_.store(stall_ms, std::memory_order_relaxed);
+}
+
+void AvMetrics::SetSyncCallback(SyncCallback cb) {
+  std::lock_guard<std::mutex> lk(cb_mu_);
+  sync_cb_ = std::move(cb);
+}
+
+void AvMetrics::SetResidentBytes(const std::string& room_id, int64_t bytes) {
+  if (!inited_) return;
+  WithRoom(room_id, [&](StreamMetrics& m) { m.resident_bytes->Set(static_cast<double>(bytes)); });
+}
+
+void AvMetrics::SetProcessingLagMs(const std::string& room_id, double lag_ms) {
+  if (!inited_) return;
+  WithRoom(room_id, [&](StreamMetrics& m) { m.lag_ms->Set(lag_ms); });
+}
+
+void AvMetrics::OnDegradeTransition(const std::string& room_id, int level,
+                                    const char* level_name) {
+  if (!inited_) return;
+  WithRoom(room_id, [&](StreamMetrics& m) {
+    m.degrade_level->Set(level);
+    auto& slot = m.degrade_transitions[level];
+    if (!slot) slot = &degrade_family_->Add({{"room_id", room_id}, {"to", level_name}});
+    slot->Increment();
+  });
+}
+
+void AvMetrics::IncDeadlineMiss(const std::string& room_id) {
+  if (!inited_) return;
+  WithRoom(room_id, [](StreamMetrics& m) { m.deadline_misses->Increment(); });
+}
+
+void AvMetrics::SetPlacement(const std::string& room_id, int numa_node, int cpu) {
+  if (!inited_) return;
+  WithRoom(room_id, [&](StreamMetrics& m) {
+    m.numa_node->Set(numa_node);
+    m.home_cpu->Set(cpu);
+  });
+}
+
+void AvMetrics::IncRemoteTask(const std::string& room_id) {
+  if (!inited_) return;
+  WithRoom(room_id, [](StreamMetrics& m) { m.remote_tasks->Increment(); });
+}
+
+void AvMetrics::UpdatePts(const std::string& room_id, bool is_audio, int64_t pts_ms) {
+  if (!inited_) return;
+  const auto now = Clock::now();
+  std::vector<SyncEvent> events;
+  WithRoom(room_id, [&](StreamMetrics& m) {
+    TrackState& t = is_audio ? m.audio : m.video;
+    if (!t.seen || pts_ms > t.last_pts_ms) {
+      if (t.stalled) {
+        events.push_back({SyncEvent::STALL_END, room_id, is_audio ? "audio" : "video",
+                          ElapsedMs(t.last_progress, now)});
+        t.stalled = false;
+      }
+      t.last_progress = now;
+    }
+    t.seen = true;
+    t.last_pts_ms = pts_ms;
+    t.last_update = now;
+    (is_audio ? m.audio_pts_sec : m.video_pts_sec)->Set(static_cast<double>(pts_ms));
+
+    // 漂移 = 两路 PTS 之差，再扣除两次上报之间的墙钟间隔（抵消到达先后带来的偏差）
+    if (m.audio.seen && m.video.seen) {
+      double drift = static_cast<double>(m.audio.last_pts_ms - m.video.last_pts_ms) -
+                     ElapsedMs(m.video.last_update, m.audio.last_update);
+      m.drift_ms->Set(drift);
+      m.drift_hist->Observe(drift);
+
+      double threshold = drift_threshold_ms_.load(std::memory_order_relaxed);
+      if (!m.drifting && std::fabs(drift) >= threshold) {
+        m.drifting = true;
+        events.push_back({SyncEvent::DRIFT_EXCEEDED, room_id, "", drift});
+      } else if (m.drifting && std::fabs(drift) < threshold * kDriftRecoverRatio) {
+        m.drifting = false;
+        events.push_back({SyncEvent::DRIFT_RECOVERED, room_id, "", drift});
+      }
+    }
+
+    CheckStalls(room_id, m, now, events);
+  });
+  EmitEvents(events);
+}
+
+void AvMetrics::CheckStalls(const std::string& room_id, StreamMetrics& m,
+                            Clock::time_point now, std::vector<SyncEvent>& events) {
+  const double threshold = stall_threshold_ms_.load(std::memory_order_relaxed);
+  auto check = [&](TrackState& t, prometheus::Gauge* gauge, const char* kind) {
+    if (!t.seen) return;  // 纯音频房间不报告视频停滞
+    double stall_ms = ElapsedMs(t.last_progress, now);
+    gauge->Set(stall_ms / 1000.0);
+    if (!t.stalled && stall_ms >= threshold) {
+      t.stalled = true;
+      events.push_back({SyncEvent::STALL_BEGIN, room_id, kind, stall_ms});
+    }
+  };
+  check(m.audio, m.audio_stall_sec, "audio");
+  check(m.video, m.video_stall_sec, "video");
+}
+
+void AvMetrics::EmitEvents(const std::vector<SyncEvent>& events) {
+  if (events.empty()) return;
+  SyncCallback cb;
+  {
+    std::lock_guard<std::mutex> lk(cb_mu_);
+    cb = sync_cb_;
+  }
+  if (!cb) return;
+  for (const auto& ev : events) cb(ev);
+}
+
+void AvMetrics::WatchdogLoop() {
+  pthread_setname_np(pthread_self(), "av_watchdog");
+  std::unique_lock<std::mutex> wlk(watchdog_mu_);
+  while (!stop_) {
+    watchdog_cv_.wait_for(wlk, std::chrono::milliseconds(100));
+    if (stop_) break;
+
+    const auto now = Clock::now();
+    std::vector<SyncEvent> events;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      for (auto& kv : rooms_) {
+        std::lock_guard<std::mutex> slk(kv.second->sync_mu);
+        CheckStalls(kv.first, *kv.second, now, events);
+      }
+    }
+    EmitEvents(events);
+  }
 }
 
 void AvMetrics::RemoveRoom(const std::string& room_id) {
   std::lock_guard<std::mutex> lk(mu_);
-  rooms_.erase(room_id);
+  auto it = rooms_.find(room_id);
+  if (it == rooms_.end()) return;
+
+  // 正在上报的线程可能还拿着它：标记后再删指标，对象随最后一个引用释放
+  std::shared_ptr<StreamMetrics> keep = it->second; // 比 slk 晚析构
+  auto& sm = *keep;
+  std::lock_guard<std::mutex> slk(sm.sync_mu);
+  sm.removed = true;
+  fps_family_->Remove(sm.audio_fps);
+  fps_family_->Remove(sm.video_fps);
+  pts_family_->Remove(sm.audio_pts_sec);
+  pts_family_->Remove(sm.video_pts_sec);
+  drift_family_->Remove(sm.drift_ms);
+  drift_hist_family_->Remove(sm.drift_hist);
+  stall_family_->Remove(sm.audio_stall_sec);
+  stall_family_->Remove(sm.video_stall_sec);
+  resident_family_->Remove(sm.resident_bytes);
+  lag_family_->Remove(sm.lag_ms);
+  degrade_level_family_->Remove(sm.degrade_level);
+  for (auto& [level, counter] : sm.degrade_transitions) degrade_family_->Remove(counter);
+  deadline_family_->Remove(sm.deadline_misses);
+  placement_family_->Remove(sm.numa_node);
+  placement_family_->Remove(sm.home_cpu);
+  remote_family_->Remove(sm.remote_tasks);
+  rooms_.erase(it);
 }
 
 void AvMetrics::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lk(watchdog_mu_);
+    stop_ = true;
+  }
+  watchdog_cv_.notify_all();
+  if (watchdog_.joinable()) watchdog_.join();
 }
 
 AvMetrics::~AvMetrics() { Shutdown(); }
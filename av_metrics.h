@@ -1,14 +1,33 @@
 #pragma once
+#include <prometheus/counter.h>
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 class AvMetrics {
 public:
+  // 音画同步告警事件（越过阈值 / 恢复时各触发一次）
+  struct SyncEvent {
+    enum Type { DRIFT_EXCEEDED, DRIFT_RECOVERED, STALL_BEGIN, STALL_END };
+    Type type;
+    std::string room_id;
+    std::string kind;  // "audio" / "video"；漂移事件为空
+    double value_ms;   // 漂移（音频 - 视频）或停滞时长，单位毫秒
+  };
+  using SyncCallback = std::function<void(const SyncEvent&)>;
+
   static AvMetrics& Instance();
   void Init(const std::string& addr);
 
@@ -18,29 +37,120 @@ public:
   // 一次设置两个 PTS（单位毫秒）
   void SetPtsMs(const std::string& room_id, uint64_t audio_pts_ms, uint64_t video_pts_ms);
 
+  // 分别上报真实包的 PTS（单位毫秒），增量计算音画漂移和停滞
+  void UpdateAudioPtsMs(const std::string& room_id, int64_t pts_ms);
+  void UpdateVideoPtsMs(const std::string& room_id, int64_t pts_ms);
+
+  // 漂移 / 停滞阈值（毫秒），越过时回调；回调在上报线程或巡检线程中执行
+  void SetSyncThresholds(double drift_ms, double stall_ms);
+  void SetSyncCallback(SyncCallback cb);
+
+  // 房间常驻内存（编解码器、滤镜、缓冲池等的估算值，单位字节）
+  void SetResidentBytes(const std::string& room_id, int64_t bytes);
+
+  // 过载降级：处理滞后（相对 PTS 应到的墙钟时刻，毫秒）和降级档位切换
+  void SetProcessingLagMs(const std::string& room_id, double lag_ms);
+  void OnDegradeTransition(const std::string& room_id, int level, const char* level_name);
+
+  // 帧任务完成时已过截止时间（PTS + 输出延迟目标），由 EdfScheduler 上报
+  void IncDeadlineMiss(const std::string& room_id);
+
+  // 房间的放置：所在 NUMA 节点和主 CPU；任务跑在别的节点上时计一次远程执行
+  void SetPlacement(const std::string& room_id, int numa_node, int cpu);
+  void IncRemoteTask(const std::string& room_id);
+
+  // 房间开始时创建其指标（重复调用无副作用）。上报接口不创建房间：
+  // 未 AddRoom 或 RemoveRoom 之后的上报直接丢弃，迟到的上报不会让已移除的房间复活
+  void AddRoom(const std::string& room_id);
   void RemoveRoom(const std::string& room_id);
   void Shutdown();
 
+  // 供其他采集模块（如 ResourceMetrics）注册到同一个 registry
+  std::shared_ptr<prometheus::Registry> registry() const { return registry_; }
+
 private:
   AvMetrics() = default;
   ~AvMetrics();
 
+  using Clock = std::chrono::steady_clock;
+
+  // 单路（音频或视频）的同步状态
+  struct TrackState {
+    bool seen{false};
+    bool stalled{false};
+    int64_t last_pts_ms{0};
+    Clock::time_point last_update;   // 最近一次上报
+    Clock::time_point last_progress; // 最近一次 PTS 前进
+  };
+
   struct StreamMetrics {
     prometheus::Gauge* audio_fps{nullptr};
     prometheus::Gauge* video_fps{nullptr};
     prometheus::Gauge* audio_pts_sec{nullptr};
     prometheus::Gauge* video_pts_sec{nullptr};
+    prometheus::Gauge* drift_ms{nullptr};
+    prometheus::Histogram* drift_hist{nullptr};
+    prometheus::Gauge* audio_stall_sec{nullptr};
+    prometheus::Gauge* video_stall_sec{nullptr};
+    prometheus::Gauge* resident_bytes{nullptr};
+    prometheus::Gauge* lag_ms{nullptr};
+    prometheus::Gauge* degrade_level{nullptr};
+    std::map<int, prometheus::Counter*> degrade_transitions; // 按目标档位，首次切换时创建
+    prometheus::Counter* deadline_misses{nullptr};
+    prometheus::Gauge* numa_node{nullptr};
+    prometheus::Gauge* home_cpu{nullptr};
+    prometheus::Counter* remote_tasks{nullptr};
+
+    // 保护以下同步状态，以及上面各指标的写入：RemoveRoom 在此锁下置 removed 并从 family
+    // 删除指标，之后还拿着本对象的上报者看到 removed 即放弃
+    std::mutex sync_mu;
+    bool removed{false};
+    TrackState audio;
+    TrackState video;
+    bool drifting{false};
   };
-  StreamMetrics& GetOrCreate(const std::string& room_id);
+  // 返回共享引用：释放 mu_ 之后 RemoveRoom 也不会析构它；房间不存在时返回空
+  std::shared_ptr<StreamMetrics> Find(const std::string& room_id);
+  // 在房间的 sync_mu 下执行 f(m)；房间不存在或已被移除时不执行
+  template <typename F>
+  void WithRoom(const std::string& room_id, F f);
+
+  void UpdatePts(const std::string& room_id, bool is_audio, int64_t pts_ms);
+  // 在 sync_mu 下调用：刷新两路的停滞时长，新产生的事件追加到 events
+  void CheckStalls(const std::string& room_id, StreamMetrics& m,
+                    Clock::time_point now, std::vector<SyncEvent>& events);
+  void EmitEvents(const std::vector<SyncEvent>& events);
+  void WatchdogLoop();
 
   std::unique_ptr<prometheus::Exposer> exposer_;
   std::shared_ptr<prometheus::Registry> registry_;
 
   prometheus::Family<prometheus::Gauge>* fps_family_{nullptr}; // libpush_fps{room_id,kind}
   prometheus::Family<prometheus::Gauge>* pts_family_{nullptr}; // libpush_last_pts_seconds{room_id,kind}
+  prometheus::Family<prometheus::Gauge>* drift_family_{nullptr};          // libpush_av_drift_milliseconds{room_id}
+  prometheus::Family<prometheus::Histogram>* drift_hist_family_{nullptr}; // libpush_av_drift_observed_milliseconds{room_id}
+  prometheus::Family<prometheus::Gauge>* stall_family_{nullptr};          // libpush_pts_stall_seconds{room_id,kind}
+  prometheus::Family<prometheus::Gauge>* resident_family_{nullptr};       // libpush_room_resident_bytes{room_id}
+  prometheus::Family<prometheus::Gauge>* lag_family_{nullptr};            // libpush_processing_lag_milliseconds{room_id}
+  prometheus::Family<prometheus::Gauge>* degrade_level_family_{nullptr};  // libpush_degrade_level{room_id}
+  prometheus::Family<prometheus::Counter>* degrade_family_{nullptr};      // libpush_degrade_transitions_total{room_id,to}
+  prometheus::Family<prometheus::Counter>* deadline_family_{nullptr};     // libpush_deadline_misses_total{room_id}
+  prometheus::Family<prometheus::Gauge>* placement_family_{nullptr};      // libpush_room_placement{room_id,kind}
+  prometheus::Family<prometheus::Counter>* remote_family_{nullptr};       // libpush_numa_remote_tasks_total{room_id}
 
   std::mutex mu_;
-  std::unordered_map<std::string, std::unique_ptr<StreamMetrics>> rooms_;
+  std::unordered_map<std::string, std::shared_ptr<StreamMetrics>> rooms_;
+
+  std::mutex cb_mu_;
+  SyncCallback sync_cb_;
+  std::atomic<double> drift_threshold_ms_{200.0};
+  std::atomic<double> stall_threshold_ms_{2000.0};
+
+  // 巡检线程：房间完全不再上报时也能发现停滞
+  std::thread watchdog_;
+  std::mutex watchdog_mu_;
+  std::condition_variable watchdog_cv_;
+  bool stop_{false};
 
-  bool inited_{false};
+  std::atomic<bool> inited_{false}; // 巡检线程和各上报线程都会读
 };
@@ -0,0 +1,250 @@
+#include "buffered_rotating_sink.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <tuple>
+#include <vector>
+
+namespace libmagic {
+
+namespace {
+
+constexpr size_t kAlign = 4096;
+// 滚动时打开新文件失败，继续写旧文件，隔这么久再试
+constexpr auto kRotateRetryInterval = std::chrono::seconds(5);
+
+// 返回实际写入的字节数，出错时少于 len
+size_t WriteAll(int fd, const char* data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, data + done, len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += n;
+  }
+  return done;
+}
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}  // namespace
+
+BufferedRotatingSink::BufferedRotatingSink(const RotatingFileOptions& options)
+    : options_(options) {
+  mkdir(options_.dir.c_str(), 0755);
+  if (!OpenNext()) {
+    spdlog::throw_spdlog_ex("BufferedRotatingSink: open failed " + options_.dir + "/" +
+                                options_.base_name,
+                            errno);
+  }
+  buf_cap_ = (std::max(options_.buffer_bytes, kAlign) + kAlign - 1) / kAlign * kAlign;
+  if (posix_memalign(reinterpret_cast<void**>(&buf_), kAlign, buf_cap_) != 0) {
+    close(fd_);
+    spdlog::throw_spdlog_ex("BufferedRotatingSink: alloc write buffer failed");
+  }
+  last_sync_ = std::chrono::steady_clock::now();
+  archive_thread_ = std::thread(&BufferedRotatingSink::ArchiveLoop, this);
+}
+
+BufferedRotatingSink::~BufferedRotatingSink() {
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    WriteBuffer();
+    if (fd_ >= 0) {
+      if (options_.sync != LogSyncPolicy::kNone) fdatasync(fd_);
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lk(archive_mu_);
+    stop_ = true;
+  }
+  archive_cv_.notify_one();
+  if (archive_thread_.joinable()) archive_thread_.join();
+  free(buf_);
+}
+
+bool BufferedRotatingSink::OpenNext() {
+  std::string path = fmt::format("{}/{}.{}.log", options_.dir, options_.base_name, seq_);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  seq_++;
+  fd_ = fd;
+  path_ = std::move(path);
+  struct stat st;
+  file_bytes_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+  return true;
+}
+
+void BufferedRotatingSink::WriteBuffer() {
+  if (buf_len_ == 0 || fd_ < 0) return;
+  // 只计入实际落盘的字节，滚动和磁盘预算都以此为准
+  size_t written = WriteAll(fd_, buf_, buf_len_);
+  file_bytes_ += written;
+  if (written < buf_len_) {
+    // 磁盘满等错误：丢掉这批，不阻塞日志线程
+    std::cerr << "BufferedRotatingSink write failed: " << path_ << " "
+              << strerror(errno) << std::endl;
+  }
+  buf_len_ = 0;
+}
+
+void BufferedRotatingSink::Rotate() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < rotate_retry_at_) return;
+  WriteBuffer();
+  // 先打开新文件，成功后旧 fd 连同 sync / close 一起交给后台；
+  // 失败时继续写旧文件（超出 max_file_bytes），稍后重试
+  Archive old{fd_, path_};
+  if (!OpenNext()) {
+    std::cerr << "BufferedRotatingSink rotate failed, keep writing " << path_ << ": "
+              << strerror(errno) << std::endl;
+    rotate_retry_at_ = now + kRotateRetryInterval;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(archive_mu_);
+    pending_.push_back(std::move(old));
+  }
+  archive_cv_.notify_one();
+}
+
+void BufferedRotatingSink::sink_it_(const spdlog::details::log_msg& msg) {
+  formatted_.clear();
+  formatter_->format(msg, formatted_);
+  const size_t len = formatted_.size();
+
+  if (file_bytes_ + buf_len_ + len > options_.max_file_bytes && file_bytes_ + buf_len_ > 0) {
+    Rotate();
+  }
+  if (buf_len_ + len > buf_cap_) {
+    WriteBuffer();
+    if (len > buf_cap_) {
+      // 超过整个缓冲的单条日志直接写
+      file_bytes_ += WriteAll(fd_, formatted_.data(), len);
+      return;
+    }
+  }
+  memcpy(buf_ + buf_len_, formatted_.data(), len);
+  buf_len_ += len;
+}
+
+void BufferedRotatingSink::flush_() {
+  WriteBuffer();
+  if (options_.sync == LogSyncPolicy::kInterval && fd_ >= 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sync_ >= std::chrono::milliseconds(options_.sync_interval_ms)) {
+      fdatasync(fd_);
+      last_sync_ = now;
+    }
+  }
+}
+
+void BufferedRotatingSink::ArchiveLoop() {
+  pthread_setname_np(pthread_self(), "log_archive");
+  // 压缩线程降到最低 CPU 优先级（Linux 上 setpriority 对单个线程生效）
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+
+  // 先登记目录里已有的同前缀归档，按修改时间从旧到新参与总大小控制。
+  // 之前的进程崩溃时来不及压缩的 .log（以及 compress 关闭时的归档）同样计入，
+  // 原样保留不再压缩；本进程自己的文件（<base_name>.）除外，它们滚动时另行登记
+  const std::string& prefix =
+      options_.archive_prefix.empty() ? options_.base_name : options_.archive_prefix;
+  const std::string own = options_.base_name + ".";
+  std::vector<std::tuple<time_t, std::string, size_t>> existing;
+  if (DIR* d = opendir(options_.dir.c_str())) {
+    while (dirent* ent = readdir(d)) {
+      std::string name = ent->d_name;
+      if (name.compare(0, prefix.size(), prefix) != 0 ||
+          !(EndsWith(name, ".log.gz") || EndsWith(name, ".log")))
+        continue;
+      if (name.compare(0, own.size(), own) == 0) continue;
+      struct stat st;
+      std::string path = options_.dir + "/" + name;
+      if (stat(path.c_str(), &st) == 0) existing.emplace_back(st.st_mtime, path, st.st_size);
+    }
+    closedir(d);
+  }
+  std::sort(existing.begin(), existing.end());
+  for (auto& e : existing) {
+    archive_bytes_ += std::get<2>(e);
+    archives_.emplace_back(std::get<1>(e), std::get<2>(e));
+  }
+
+  std::unique_lock<std::mutex> lk(archive_mu_);
+  while (true) {
+    archive_cv_.wait(lk, [this] { return stop_ || !pending_.empty(); });
+    if (pending_.empty()) break;  // stop_ 且已处理完
+    Archive job = pending_.front();
+    pending_.pop_front();
+    lk.unlock();
+    ArchiveOne(job);
+    lk.lock();
+  }
+}
+
+void BufferedRotatingSink::ArchiveOne(const Archive& job) {
+  if (options_.sync != LogSyncPolicy::kNone) fdatasync(job.fd);
+  close(job.fd);
+
+  std::string archived = job.path;
+  if (options_.compress) {
+    std::string gz_path = job.path + ".gz";
+    int in = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%d", options_.compress_level);
+    gzFile out = gzopen(gz_path.c_str(), mode);
+    bool ok = in >= 0 && out != nullptr;
+    if (ok) {
+      gzbuffer(out, 256 * 1024);
+      std::vector<char> chunk(256 * 1024);
+      ssize_t n;
+      while (ok && (n = read(in, chunk.data(), chunk.size())) > 0) {
+        ok = gzwrite(out, chunk.data(), static_cast<unsigned>(n)) == n;
+      }
+    }
+    if (out && gzclose(out) != Z_OK) ok = false;
+    if (in >= 0) close(in);
+
+    if (ok) {
+      unlink(job.path.c_str());
+      archived = gz_path;
+    } else {
+      // 压缩失败时保留原文件
+      unlink(gz_path.c_str());
+      std::cerr << "BufferedRotatingSink compress failed: " << job.path << std::endl;
+    }
+  }
+  EnforceRetention(archived);
+}
+
+void BufferedRotatingSink::EnforceRetention(const std::string& new_archive) {
+  struct stat st;
+  size_t size = stat(new_archive.c_str(), &st) == 0 ? st.st_size : 0;
+  archives_.emplace_back(new_archive, size);
+  archive_bytes_ += size;
+  // 至少保留最新的一个
+  while (archive_bytes_ > options_.max_archive_bytes && archives_.size() > 1) {
+    unlink(archives_.front().first.c_str());
+    archive_bytes_ -= archives_.front().second;
+    archives_.pop_front();
+  }
+}
+
+}  // namespace libmagic
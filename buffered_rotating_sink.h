@@ -0,0 +1,91 @@
+#ifndef UTILS_BUFFERED_ROTATING_SINK_H_
+#define UTILS_BUFFERED_ROTATING_SINK_H_
+
+// 大缓冲滚动文件 sink：日志先攒进对齐的大块内存，满了才一次 write 落盘；
+// 滚动时只关闭旧 fd、打开新文件，旧文件的 fdatasync、gzip 压缩和过期删除
+// 都交给低优先级的后台线程，写日志的线程不会被滚动阻塞。
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "spdlog/sinks/base_sink.h"
+
+namespace libmagic {
+
+enum class LogSyncPolicy {
+  kNone,      // 只 write，不主动 fdatasync
+  kOnRotate,  // 文件滚动时在后台线程 fdatasync
+  kInterval,  // 每 sync_interval_ms 在 flush 时 fdatasync 一次，滚动时也会 sync
+};
+
+struct RotatingFileOptions {
+  std::string dir;
+  std::string base_name;             // 文件名为 <base_name>.<seq>.log
+  size_t max_file_bytes = 100 * 1024 * 1024;
+  size_t buffer_bytes = 4 * 1024 * 1024;  // 写缓冲大小，按 4K 向上对齐
+  LogSyncPolicy sync = LogSyncPolicy::kOnRotate;
+  int sync_interval_ms = 1000;
+  bool compress = true;              // 滚动出的文件压缩成 .log.gz
+  int compress_level = 6;
+  // 滚动出的文件（压缩后）总大小上限，超出时从最旧的开始删除
+  size_t max_archive_bytes = 1000ull * 1024 * 1024;
+  // 启动时目录里以此为前缀的 .log.gz 和未压缩的 .log 也计入总大小（为空时用 base_name），
+  // 用于跨进程重启（包括崩溃）延续同一份磁盘预算
+  std::string archive_prefix;
+};
+
+class BufferedRotatingSink : public spdlog::sinks::base_sink<std::mutex> {
+ public:
+  explicit BufferedRotatingSink(const RotatingFileOptions& options);
+  ~BufferedRotatingSink() override;
+
+  BufferedRotatingSink(const BufferedRotatingSink&) = delete;
+  BufferedRotatingSink& operator=(const BufferedRotatingSink&) = delete;
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg& msg) override;
+  void flush_() override;
+
+ private:
+  // 待后台处理的旧文件
+  struct Archive {
+    int fd;
+    std::string path;
+  };
+
+  // 打开下一个序号的文件，成功才替换 fd_ / path_；失败返回 false，原文件照常可写
+  bool OpenNext();
+  void Rotate();
+  void WriteBuffer();
+  void ArchiveLoop();
+  void ArchiveOne(const Archive& job);
+  void EnforceRetention(const std::string& new_archive);
+
+  RotatingFileOptions options_;
+  int fd_{-1};
+  std::string path_;
+  size_t seq_{0};
+  size_t file_bytes_{0};  // 当前文件已落盘的字节数
+  char* buf_{nullptr};    // 4K 对齐的写缓冲
+  size_t buf_cap_{0};
+  size_t buf_len_{0};
+  spdlog::memory_buf_t formatted_;
+  std::chrono::steady_clock::time_point last_sync_;
+  std::chrono::steady_clock::time_point rotate_retry_at_;  // 打开新文件失败后的重试时刻
+
+  std::mutex archive_mu_;
+  std::condition_variable archive_cv_;
+  std::deque<Archive> pending_;
+  bool stop_{false};
+  std::deque<std::pair<std::string, size_t>> archives_;  // 只由后台线程访问
+  size_t archive_bytes_{0};
+  std::thread archive_thread_;
+};
+
+}  // namespace libmagic
+
+#endif  // UTILS_BUFFERED_ROTATING_SINK_H_
@@ -0,0 +1,365 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "capture_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "logger.h"
+
+namespace capture {
+
+namespace {
+
+constexpr char kFileMagic[8] = {'L', 'P', 'C', 'A', 'P', '0', '0', '1'};
+constexpr char kTrailerMagic[8] = {'L', 'P', 'C', 'A', 'P', 'I', 'D', 'X'};
+constexpr uint32_t kVersion = 1;
+// 积压到这个大小就唤醒写线程
+constexpr size_t kFlushBytes = 1 << 20;
+// 单条记录上限，超出视为文件损坏
+constexpr uint32_t kMaxRecordBytes = 64 << 20;
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+// ---- CaptureWriter ----
+
+CaptureWriter::~CaptureWriter() { Close(); }
+
+bool CaptureWriter::Open(const std::string &path, int index_granularity_ms,
+                         size_t max_pending_bytes) {
+  Close();
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    LOG_ERROR("CaptureWriter open failed: {}", path);
+    return false;
+  }
+  granularity_ms_ = index_granularity_ms > 0 ? index_granularity_ms : 1000;
+  max_pending_ = max_pending_bytes;
+
+  FileHeader hdr;
+  memcpy(hdr.magic, kFileMagic, sizeof(hdr.magic));
+  hdr.version = kVersion;
+  hdr.index_granularity_ms = granularity_ms_;
+  hdr.start_unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+  fwrite(&hdr, sizeof(hdr), 1, file_);
+  offset_ = sizeof(hdr);
+  index_.clear();
+  rooms_.clear();
+  pending_.clear();
+  dropped_ = 0;
+  start_ns_ = NowNs();
+  stop_ = false;
+  writer_ = std::thread(&CaptureWriter::WriterLoop, this);
+  LOG_INFO("CaptureWriter recording to {}", path);
+  return true;
+}
+
+void CaptureWriter::Close() {
+  if (!file_)
+    return;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (writer_.joinable())
+    writer_.join();
+
+  // 索引块：粒度、偏移数组、房间表
+  uint64_t index_offset = offset_;
+  uint32_t gran = granularity_ms_;
+  uint32_t count = static_cast<uint32_t>(index_.size());
+  uint32_t room_count = static_cast<uint32_t>(rooms_.size());
+  fwrite(&gran, sizeof(gran), 1, file_);
+  fwrite(&count, sizeof(count), 1, file_);
+  if (count)
+    fwrite(index_.data(), sizeof(uint64_t), count, file_);
+  fwrite(&room_count, sizeof(room_count), 1, file_);
+  for (auto &room : rooms_)
+    fwrite(room.data(), 1, room.size(), file_);
+
+  Trailer trailer;
+  trailer.index_offset = index_offset;
+  memcpy(trailer.magic, kTrailerMagic, sizeof(trailer.magic));
+  fwrite(&trailer, sizeof(trailer), 1, file_);
+  fclose(file_);
+  file_ = nullptr;
+  if (dropped_)
+    LOG_WARN("CaptureWriter dropped {} records (writer backlog)", dropped_);
+}
+
+void CaptureWriter::Append(RecordType type, const void *a, size_t a_len,
+                           const void *b, size_t b_len) {
+  RecordHeader hdr;
+  hdr.type = type;
+  hdr.reserved = 0;
+  hdr.size = static_cast<uint32_t>(a_len + b_len);
+
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!file_ || stop_)
+      return;
+    if (pending_.size() + sizeof(hdr) + hdr.size > max_pending_) {
+      dropped_++;
+      return;
+    }
+    // 在锁内取时间，保证文件中 t_ns 单调
+    hdr.t_ns = NowNs() - start_ns_;
+    size_t pos = pending_.size();
+    pending_.resize(pos + sizeof(hdr) + hdr.size);
+    char *p = pending_.data() + pos;
+    memcpy(p, &hdr, sizeof(hdr));
+    memcpy(p + sizeof(hdr), a, a_len);
+    if (b_len)
+      memcpy(p + sizeof(hdr) + a_len, b, b_len);
+    wake = pending_.size() >= kFlushBytes;
+  }
+  if (wake)
+    cv_.notify_one();
+}
+
+uint32_t CaptureWriter::AddRoom(const RoomInfo &info) {
+  RoomRecord rec;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    rec.room = static_cast<uint32_t>(rooms_.size());
+    rooms_.emplace_back();
+  }
+  rec.sample_rate = info.sample_rate;
+  rec.channels = info.channels;
+  rec.sample_fmt = info.sample_fmt;
+  rec.tb_num = info.time_base.num;
+  rec.tb_den = info.time_base.den;
+  rec.name_len = static_cast<uint16_t>(std::min<size_t>(info.name.size(), UINT16_MAX));
+
+  // 索引块里的副本带完整记录头，读取端按普通记录解析
+  RecordHeader hdr{kRoom, 0, static_cast<uint32_t>(sizeof(rec) + rec.name_len), 0};
+  std::vector<char> full(sizeof(hdr) + hdr.size);
+  memcpy(full.data(), &hdr, sizeof(hdr));
+  memcpy(full.data() + sizeof(hdr), &rec, sizeof(rec));
+  memcpy(full.data() + sizeof(hdr) + sizeof(rec), info.name.data(), rec.name_len);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    rooms_[rec.room] = std::move(full);
+  }
+  Append(kRoom, &rec, sizeof(rec), info.name.data(), rec.name_len);
+  return rec.room;
+}
+
+void CaptureWriter::TapPacket(uint32_t room, PacketKind kind, const AVPacket *pkt,
+                              AVRational time_base) {
+  PacketRecord rec;
+  rec.room = room;
+  rec.kind = kind;
+  rec.reserved = 0;
+  rec.stream_index = static_cast<uint16_t>(pkt->stream_index);
+  rec.flags = pkt->flags;
+  rec.pts = pkt->pts;
+  rec.dts = pkt->dts;
+  rec.tb_num = time_base.num;
+  rec.tb_den = time_base.den;
+  rec.data_size = pkt->size > 0 ? pkt->size : 0;
+  Append(kPacket, &rec, sizeof(rec), pkt->data, rec.data_size);
+}
+
+void CaptureWriter::TapFade(uint32_t room, int fade_type, int frames) {
+  FadeRecord rec{room, fade_type, frames};
+  Append(kFade, &rec, sizeof(rec), nullptr, 0);
+}
+
+void CaptureWriter::WriterLoop() {
+  std::vector<char> chunk;
+  std::unique_lock<std::mutex> lk(mu_);
+  while (true) {
+    cv_.wait_for(lk, std::chrono::milliseconds(100),
+                 [this] { return stop_ || pending_.size() >= kFlushBytes; });
+    chunk.swap(pending_);
+    bool stop = stop_;
+    lk.unlock();
+    WriteChunk(chunk);
+    chunk.clear();
+    lk.lock();
+    if (stop && pending_.empty())
+      break;
+  }
+}
+
+void CaptureWriter::WriteChunk(const std::vector<char> &chunk) {
+  if (chunk.empty())
+    return;
+  // 逐条登记索引：index_[i] 为 t_ns >= i * 粒度的第一条记录
+  const int64_t gran_ns = int64_t(granularity_ms_) * 1000000;
+  size_t pos = 0;
+  while (pos + sizeof(RecordHeader) <= chunk.size()) {
+    RecordHeader hdr;
+    memcpy(&hdr, chunk.data() + pos, sizeof(hdr));
+    size_t slot = static_cast<size_t>(hdr.t_ns / gran_ns);
+    while (index_.size() <= slot)
+      index_.push_back(offset_ + pos);
+    pos += sizeof(hdr) + hdr.size;
+  }
+  fwrite(chunk.data(), 1, chunk.size(), file_);
+  offset_ += chunk.size();
+}
+
+// ---- CaptureReader ----
+
+CaptureReader::~CaptureReader() {
+  if (file_)
+    fclose(file_);
+}
+
+bool CaptureReader::Open(const std::string &path) {
+  file_ = fopen(path.c_str(), "rb");
+  if (!file_) {
+    LOG_ERROR("CaptureReader open failed: {}", path);
+    return false;
+  }
+  if (fread(&header_, sizeof(header_), 1, file_) != 1 ||
+      memcmp(header_.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      header_.version != kVersion) {
+    LOG_ERROR("CaptureReader bad header: {}", path);
+    return false;
+  }
+  if (header_.index_granularity_ms == 0)
+    header_.index_granularity_ms = 1000;
+  if (!LoadIndex()) {
+    LOG_WARN("CaptureReader no index in {}, scanning", path);
+    RebuildIndex();
+  }
+  fseek(file_, sizeof(header_), SEEK_SET);
+  return true;
+}
+
+bool CaptureReader::ReadRecord(RecordHeader *hdr) {
+  if (static_cast<uint64_t>(ftell(file_)) + sizeof(*hdr) > data_end_)
+    return false;
+  if (fread(hdr, sizeof(*hdr), 1, file_) != 1 || hdr->size > kMaxRecordBytes)
+    return false;
+  buf_.resize(hdr->size);
+  return hdr->size == 0 || fread(buf_.data(), 1, hdr->size, file_) == hdr->size;
+}
+
+void CaptureReader::ParseRoom() {
+  RoomRecord rec;
+  if (buf_.size() < sizeof(rec))
+    return;
+  memcpy(&rec, buf_.data(), sizeof(rec));
+  if (buf_.size() < sizeof(rec) + rec.name_len)
+    return;
+  if (rooms_.size() <= rec.room)
+    rooms_.resize(rec.room + 1);
+  RoomInfo &info = rooms_[rec.room];
+  info.name.assign(reinterpret_cast<const char *>(buf_.data()) + sizeof(rec),
+                   rec.name_len);
+  info.sample_rate = rec.sample_rate;
+  info.channels = rec.channels;
+  info.sample_fmt = static_cast<AVSampleFormat>(rec.sample_fmt);
+  info.time_base = {rec.tb_num, rec.tb_den};
+}
+
+bool CaptureReader::LoadIndex() {
+  Trailer trailer;
+  if (fseek(file_, -static_cast<long>(sizeof(trailer)), SEEK_END) != 0 ||
+      fread(&trailer, sizeof(trailer), 1, file_) != 1 ||
+      memcmp(trailer.magic, kTrailerMagic, sizeof(kTrailerMagic)) != 0) {
+    return false;
+  }
+  if (fseek(file_, static_cast<long>(trailer.index_offset), SEEK_SET) != 0)
+    return false;
+  uint32_t gran = 0, count = 0, room_count = 0;
+  if (fread(&gran, sizeof(gran), 1, file_) != 1 ||
+      fread(&count, sizeof(count), 1, file_) != 1)
+    return false;
+  index_.resize(count);
+  if (count && fread(index_.data(), sizeof(uint64_t), count, file_) != count)
+    return false;
+  if (fread(&room_count, sizeof(room_count), 1, file_) != 1)
+    return false;
+
+  data_end_ = UINT64_MAX; // 房间表按普通记录读取
+  for (uint32_t i = 0; i < room_count; i++) {
+    RecordHeader hdr;
+    if (!ReadRecord(&hdr) || hdr.type != kRoom)
+      return false;
+    ParseRoom();
+  }
+  data_end_ = trailer.index_offset;
+  return true;
+}
+
+void CaptureReader::RebuildIndex() {
+  index_.clear();
+  rooms_.clear();
+  data_end_ = UINT64_MAX;
+  fseek(file_, sizeof(header_), SEEK_SET);
+  const int64_t gran_ns = int64_t(header_.index_granularity_ms) * 1000000;
+  uint64_t pos = sizeof(header_);
+  RecordHeader hdr;
+  while (ReadRecord(&hdr)) {
+    if (hdr.type == kRoom)
+      ParseRoom();
+    size_t slot = static_cast<size_t>(hdr.t_ns / gran_ns);
+    while (index_.size() <= slot)
+      index_.push_back(pos);
+    pos = ftell(file_);
+  }
+  // 截断处之后的内容不再读取
+  data_end_ = pos;
+}
+
+bool CaptureReader::Next(Record *rec) {
+  RecordHeader hdr;
+  while (ReadRecord(&hdr)) {
+    rec->type = static_cast<RecordType>(hdr.type);
+    rec->t_ns = hdr.t_ns;
+    if (hdr.type == kRoom) {
+      ParseRoom();
+      continue;
+    }
+    if (hdr.type == kPacket && buf_.size() >= sizeof(PacketRecord)) {
+      PacketRecord p;
+      memcpy(&p, buf_.data(), sizeof(p));
+      if (buf_.size() < sizeof(p) + p.data_size)
+        return false;
+      rec->room = p.room;
+      rec->kind = static_cast<PacketKind>(p.kind);
+      rec->stream_index = p.stream_index;
+      rec->flags = p.flags;
+      rec->pts = p.pts;
+      rec->dts = p.dts;
+      rec->time_base = {p.tb_num, p.tb_den};
+      rec->data = buf_.data() + sizeof(p);
+      rec->size = static_cast<int>(p.data_size);
+      return true;
+    }
+    if (hdr.type == kFade && buf_.size() >= sizeof(FadeRecord)) {
+      FadeRecord f;
+      memcpy(&f, buf_.data(), sizeof(f));
+      rec->room = f.room;
+      rec->fade_type = f.fade_type;
+      rec->frames = f.frames;
+      return true;
+    }
+    // 未知类型跳过，便于以后扩展
+  }
+  return false;
+}
+
+bool CaptureReader::SeekMs(int64_t ms) {
+  size_t slot = static_cast<size_t>(std::max<int64_t>(ms, 0) /
+                                    header_.index_granularity_ms);
+  uint64_t off = slot < index_.size() ? index_[slot] : data_end_;
+  return fseek(file_, static_cast<long>(off), SEEK_SET) == 0;
+}
+
+} // namespace capture
@@ -0,0 +1,182 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// 录制 / 回放文件格式（主机字节序）：
+//   文件头 | 记录 ... | 索引块 | 尾部
+// 每条记录为 RecordHeader + 负载，t_ns 为相对录制开始的墙钟时间。
+// 房间用文件内编号引用，kRoom 记录在该房间第一个包之前写入，索引块里再存一份，
+// 以便 seek 后不必从头扫描。索引按固定时间粒度记录偏移，定位到任意时刻为 O(1)。
+// 尾部缺失（进程崩溃）时读取端顺序扫描重建索引。
+namespace capture {
+
+enum RecordType : uint16_t {
+  kRoom = 1,
+  kPacket = 2,
+  kFade = 3,
+};
+
+enum PacketKind : uint8_t {
+  kAudio = 0,
+  kVideo = 1,
+};
+
+#pragma pack(push, 1)
+struct FileHeader {
+  char magic[8]; // "LPCAP001"
+  uint32_t version;
+  uint32_t index_granularity_ms;
+  int64_t start_unix_ms;
+};
+
+struct RecordHeader {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t size; // 负载字节数
+  int64_t t_ns;
+};
+
+struct RoomRecord {
+  uint32_t room;
+  int32_t sample_rate;
+  int32_t channels;
+  int32_t sample_fmt;
+  int32_t tb_num;
+  int32_t tb_den;
+  uint16_t name_len; // 后跟房间名
+};
+
+struct PacketRecord {
+  uint32_t room;
+  uint8_t kind;
+  uint8_t reserved;
+  uint16_t stream_index;
+  uint32_t flags;
+  int64_t pts;
+  int64_t dts;
+  int32_t tb_num;
+  int32_t tb_den;
+  uint32_t data_size; // 后跟包数据
+};
+
+struct FadeRecord {
+  uint32_t room;
+  int32_t fade_type;
+  int32_t frames;
+};
+
+struct Trailer {
+  uint64_t index_offset;
+  char magic[8]; // "LPCAPIDX"
+};
+#pragma pack(pop)
+
+// 房间的音频参数，回放时用来重建 RoomPipeline
+struct RoomInfo {
+  std::string name;
+  int sample_rate = 0;
+  int channels = 0;
+  AVSampleFormat sample_fmt = AV_SAMPLE_FMT_NONE;
+  AVRational time_base{1, 1000};
+};
+
+// 录制端：业务线程只做一次内存拷贝，后台线程成块写盘。
+// 积压超过上限时丢弃新记录并计数，不阻塞处理链路
+class CaptureWriter {
+public:
+  CaptureWriter() = default;
+  ~CaptureWriter();
+
+  bool Open(const std::string &path, int index_granularity_ms = 1000,
+            size_t max_pending_bytes = 64 << 20);
+  // 写索引和尾部并关闭
+  void Close();
+  bool is_open() const { return file_ != nullptr; }
+
+  // 登记房间，返回文件内房间编号
+  uint32_t AddRoom(const RoomInfo &info);
+  void TapPacket(uint32_t room, PacketKind kind, const AVPacket *pkt,
+                 AVRational time_base);
+  void TapFade(uint32_t room, int fade_type, int frames);
+
+  uint64_t dropped() const { return dropped_; }
+
+private:
+  void Append(RecordType type, const void *a, size_t a_len, const void *b,
+              size_t b_len);
+  void WriterLoop();
+  void WriteChunk(const std::vector<char> &chunk);
+
+  FILE *file_ = nullptr;
+  int64_t start_ns_ = 0;
+  int granularity_ms_ = 1000;
+  size_t max_pending_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<char> pending_;
+  bool stop_ = false;
+  uint64_t dropped_ = 0;
+  std::vector<std::vector<char>> rooms_; // 每个房间的完整 kRoom 记录，写入索引块
+  std::thread writer_;
+
+  // 仅写线程访问
+  uint64_t offset_ = 0;
+  std::vector<uint64_t> index_;
+};
+
+// 回放端读到的一条记录；data / room 指向读取器内部缓冲，下次 Next 前有效
+struct Record {
+  RecordType type;
+  int64_t t_ns = 0;
+  uint32_t room = 0;
+  // kPacket
+  PacketKind kind = kAudio;
+  int stream_index = 0;
+  int flags = 0;
+  int64_t pts = 0;
+  int64_t dts = 0;
+  AVRational time_base{1, 1000};
+  const uint8_t *data = nullptr;
+  int size = 0;
+  // kFade
+  int fade_type = 0;
+  int frames = 0;
+};
+
+class CaptureReader {
+public:
+  ~CaptureReader();
+
+  bool Open(const std::string &path);
+  // 读下一条记录，文件结束返回 false；kRoom 记录由读取器消化，不会返回
+  bool Next(Record *rec);
+  // 定位到录制时刻 ms 之后的第一条记录（O(1)，按索引粒度对齐）
+  bool SeekMs(int64_t ms);
+
+  const std::vector<RoomInfo> &rooms() const { return rooms_; }
+  int64_t start_unix_ms() const { return header_.start_unix_ms; }
+
+private:
+  bool ReadRecord(RecordHeader *hdr);
+  void ParseRoom();
+  bool LoadIndex();
+  void RebuildIndex();
+
+  FILE *file_ = nullptr;
+  FileHeader header_{};
+  uint64_t data_end_ = 0; // 记录区结束位置（索引块起点）
+  std::vector<uint64_t> index_;
+  std::vector<RoomInfo> rooms_;
+  std::vector<uint8_t> buf_;
+};
+
+} // namespace capture
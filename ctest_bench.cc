@@ -0,0 +1,496 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+// 热路径基准测试：AudioAfade 编解码 / 淡入淡出 / 重采样、VideoFade、AudioMixer、插播素材缓存、输入打开与读包、ADTS 头、十六进制预览、
+// LOG_* 宏在不同级别下的开销、AvMetrics 多线程上报。
+// 输入由内置的 AAC 生成器合成，不依赖外部文件；结果输出为 JSON，便于不同构建之间比对。
+//
+// 用法：ctest_bench [--threads N] [--seconds S] [--out result.json]
+//                    [--log-dir DIR] [--metrics-addr HOST:PORT]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asset_cache.h"
+#include "audio_afade.h"
+#include "audio_mixer.h"
+#include "av_metrics.h"
+#include "logger.h"
+#include "media_input.h"
+#include "polyphase_resampler.h"
+#include "resource_metrics.h"
+#include "room_buffer_pool.h"
+#include "synthetic_aac.h"
+#include "video_fade.h"
+
+using namespace std::chrono;
+
+namespace {
+
+struct BenchConfig {
+  int threads = 4;
+  double seconds = 1.0;  // 每项测试的目标时长
+  std::string out = "ctest_bench.json";
+  std::string log_dir = "./bench_log";
+  std::string metrics_addr = "127.0.0.1:18099";
+};
+
+struct BenchResult {
+  std::string name;
+  int threads = 1;
+  uint64_t ops = 0;
+  double ops_per_sec = 0;
+  double p50_ns = 0;
+  double p90_ns = 0;
+  double p99_ns = 0;
+  double max_ns = 0;
+};
+
+double Percentile(std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t idx = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[idx];
+}
+
+// 每个线程循环调用 fn(thread_idx, i)，每 batch 次调用计一次耗时（均摊到单次），
+// 直到达到目标时长。很快的操作用较大的 batch，避免计时本身的开销盖过被测代码
+BenchResult RunBench(const std::string& name, int threads, int batch,
+                     const BenchConfig& cfg,
+                     const std::function<void(int, uint64_t)>& fn) {
+  std::vector<std::vector<double>> samples(threads);
+  std::vector<uint64_t> ops(threads, 0);
+  std::atomic<bool> go{false};
+  const auto budget = duration_cast<nanoseconds>(duration<double>(cfg.seconds));
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      auto begin = steady_clock::now();
+      uint64_t i = 0;
+      while (steady_clock::now() - begin < budget) {
+        auto t0 = steady_clock::now();
+        for (int b = 0; b < batch; b++) fn(t, i++);
+        auto t1 = steady_clock::now();
+        samples[t].push_back(duration<double, std::nano>(t1 - t0).count() / batch);
+      }
+      ops[t] = i;
+    });
+  }
+  auto wall0 = steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& w : workers) w.join();
+  double wall = duration<double>(steady_clock::now() - wall0).count();
+
+  std::vector<double> all;
+  BenchResult r;
+  r.name = name;
+  r.threads = threads;
+  for (int t = 0; t < threads; t++) {
+    all.insert(all.end(), samples[t].begin(), samples[t].end());
+    r.ops += ops[t];
+  }
+  std::sort(all.begin(), all.end());
+  r.ops_per_sec = wall > 0 ? r.ops / wall : 0;
+  r.p50_ns = Percentile(all, 0.50);
+  r.p90_ns = Percentile(all, 0.90);
+  r.p99_ns = Percentile(all, 0.99);
+  r.max_ns = all.empty() ? 0 : all.back();
+
+  std::cout << fmt::format("{:<28} threads={:<3} ops/s={:>14.0f} p50={:>10.1f}ns "
+                           "p99={:>10.1f}ns",
+                           r.name, r.threads, r.ops_per_sec, r.p50_ns, r.p99_ns)
+            << std::endl;
+  return r;
+}
+
+void WriteJson(const BenchConfig& cfg, const std::vector<BenchResult>& results) {
+  fmt::memory_buffer out;
+  fmt::format_to(fmt::appender(out), "{{\n  \"threads\": {},\n  \"seconds\": {},\n",
+                 cfg.threads, cfg.seconds);
+#ifdef NDEBUG
+  fmt::format_to(fmt::appender(out), "  \"build\": \"release\",\n");
+#else
+  fmt::format_to(fmt::appender(out), "  \"build\": \"debug\",\n");
+#endif
+  fmt::format_to(fmt::appender(out), "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    fmt::format_to(fmt::appender(out),
+                   "    {{\"name\": \"{}\", \"threads\": {}, \"ops\": {}, "
+                   "\"ops_per_sec\": {:.1f}, \"p50_ns\": {:.1f}, \"p90_ns\": {:.1f}, "
+                   "\"p99_ns\": {:.1f}, \"max_ns\": {:.1f}}}{}\n",
+                   r.name, r.threads, r.ops, r.ops_per_sec, r.p50_ns, r.p90_ns,
+                   r.p99_ns, r.max_ns, i + 1 < results.size() ? "," : "");
+  }
+  fmt::format_to(fmt::appender(out), "  ]\n}}\n");
+
+  std::ofstream f(cfg.out);
+  f.write(out.data(), out.size());
+  std::cout << "Results written to " << cfg.out << std::endl;
+}
+
+bool ParseArgs(int argc, char** argv, BenchConfig* cfg) {
+  // std::stoi 等遇到非数字或越界会抛异常，当作参数错误打印用法
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) return false;
+      std::string val = argv[++i];
+      if (arg == "--threads") {
+        cfg->threads = std::max(1, std::stoi(val));
+      } else if (arg == "--seconds") {
+        cfg->seconds = std::stod(val);
+      } else if (arg == "--out") {
+        cfg->out = val;
+      } else if (arg == "--log-dir") {
+        cfg->log_dir = val;
+      } else if (arg == "--metrics-addr") {
+        cfg->metrics_addr = val;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  } catch (const std::logic_error&) {
+    return false;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchConfig cfg;
+  if (!ParseArgs(argc, argv, &cfg)) {
+    std::cout << "usage: " << argv[0]
+              << " [--threads N] [--seconds S] [--out FILE] [--log-dir DIR]"
+                 " [--metrics-addr HOST:PORT]"
+              << std::endl;
+    return 1;
+  }
+  av_log_set_level(AV_LOG_ERROR);
+  // 写文件而不是终端，避免终端输出速度影响结果；afade 的逐帧日志关掉
+  if (!LOGGER_INS->Init("info,afade=error", cfg.log_dir, 0, false, true)) return 1;
+
+  std::vector<BenchResult> results;
+  const int kSampleRate = 44100;
+  const int kChannels = 2;
+
+  // ---- 编解码 / 淡入淡出 ----
+  {
+    std::vector<std::string> frames = GenerateAdtsFrames(kSampleRate, kChannels, 500);
+    if (frames.empty()) {
+      std::cout << "AAC encoder unavailable, codec benchmarks skipped" << std::endl;
+    } else {
+      // 淡入帧数足够大，整个测试期间都在淡入路径上
+      AudioAfade afade(kSampleRate, kChannels, AV_SAMPLE_FMT_FLTP,
+                       AudioAfade::FADE_IN, 1 << 30);
+      // 每次都取走全部输出包，和 RoomPipeline 的用法一致
+      AVPacket dst;
+      av_init_packet(&dst);
+      auto drain = [&dst](AudioAfade& a) {
+        while (a.ReceivePacket(&dst)) av_packet_unref(&dst);
+      };
+      results.push_back(RunBench("afade_process", 1, 1, cfg, [&](int, uint64_t i) {
+        const std::string& f = frames[i % frames.size()];
+        AVPacket src;
+        av_init_packet(&src);
+        src.data = reinterpret_cast<uint8_t*>(const_cast<char*>(f.data()));
+        src.size = static_cast<int>(f.size());
+        src.pts = static_cast<int64_t>(i) * 1024;
+        afade.Process(&src);
+        drain(afade);
+      }));
+
+      // 同样的路径，解码帧和编码包缓冲取自房间缓冲池
+      RoomBufferPool pool;
+      AudioAfade afade_pooled(kSampleRate, kChannels, AV_SAMPLE_FMT_FLTP,
+                              AudioAfade::FADE_IN, 1 << 30, &pool);
+      results.push_back(RunBench("afade_process_pooled", 1, 1, cfg, [&](int, uint64_t i) {
+        const std::string& f = frames[i % frames.size()];
+        AVPacket src;
+        av_init_packet(&src);
+        src.data = reinterpret_cast<uint8_t*>(const_cast<char*>(f.data()));
+        src.size = static_cast<int>(f.size());
+        src.pts = static_cast<int64_t>(i) * 1024;
+        afade_pooled.Process(&src);
+        drain(afade_pooled);
+      }));
+
+      AudioAfade afade_raw(kSampleRate, kChannels, AV_SAMPLE_FMT_FLTP,
+                           AudioAfade::FADE_IN, 1 << 30);
+      std::string out;
+      results.push_back(RunBench("afade_process_raw", 1, 1, cfg, [&](int, uint64_t i) {
+        const std::string& f = frames[i % frames.size()];
+        afade_raw.ProcessRaw(f.data(), static_cast<int>(f.size()), out);
+      }));
+
+      // 44.1kHz 输入、48kHz 输出：解码 -> 多相重采样（同一遍淡入）-> 编码
+      AudioAfade afade_resample(48000, kChannels, AV_SAMPLE_FMT_FLTP,
+                                AudioAfade::FADE_IN, 1 << 30);
+      results.push_back(RunBench("afade_process_resample", 1, 1, cfg, [&](int, uint64_t i) {
+        const std::string& f = frames[i % frames.size()];
+        AVPacket src;
+        av_init_packet(&src);
+        src.data = reinterpret_cast<uint8_t*>(const_cast<char*>(f.data()));
+        src.size = static_cast<int>(f.size());
+        src.pts = static_cast<int64_t>(i) * 1024;
+        afade_resample.Process(&src);
+        drain(afade_resample);
+      }));
+    }
+
+    uint8_t header[7];
+    results.push_back(RunBench("write_adts_header", 1, 256, cfg, [&](int, uint64_t i) {
+      AudioAfade::WriteAdtsHeader(header, 300 + (i & 255), 2, kSampleRate, kChannels);
+    }));
+
+    // 输出包缓冲：每次新分配 vs 房间缓冲池复用
+    results.push_back(RunBench("packet_buffer_heap", cfg.threads, 16, cfg, [&](int, uint64_t) {
+      AVBufferRef* buf = ResourceMetrics::AllocTrackedBuffer(400);
+      av_buffer_unref(&buf);
+    }));
+    std::vector<std::unique_ptr<RoomBufferPool>> pools;
+    for (int t = 0; t < cfg.threads; t++) pools.push_back(std::make_unique<RoomBufferPool>());
+    results.push_back(RunBench("packet_buffer_pooled", cfg.threads, 16, cfg, [&](int t, uint64_t) {
+      AVBufferRef* buf = pools[t]->GetPacketBuffer(400);
+      av_buffer_unref(&buf);
+    }));
+  }
+
+  {
+    // 1080p YUV420P 淡入：斜坡足够长，整个测试期间都在斜坡内
+    std::vector<AVFrame*> frames;
+    for (int i = 0; i < 4; i++) {
+      AVFrame* f = av_frame_alloc();
+      f->format = AV_PIX_FMT_YUV420P;
+      f->width = 1920;
+      f->height = 1080;
+      av_frame_get_buffer(f, 32);
+      for (int p = 0; p < 3; p++)
+        memset(f->data[p], p ? 128 : 180, f->linesize[p] * (p ? 540 : 1080));
+      frames.push_back(f);
+    }
+    VideoFade vfade(AudioAfade::FADE_IN, 0, int64_t(1) << 40, {1, 90000});
+    auto video_bench = [&](const std::string& name) {
+      results.push_back(RunBench(name, 1, 1, cfg, [&](int, uint64_t i) {
+        frames[0]->pts = static_cast<int64_t>(i % 1000 + 1) * 3000;
+        vfade.Process(frames[0], {1, 90000});
+      }));
+      results.push_back(RunBench(name + "_batch4", 1, 1, cfg, [&](int, uint64_t i) {
+        for (int k = 0; k < 4; k++) frames[k]->pts = static_cast<int64_t>(i % 1000 + k + 1) * 3000;
+        vfade.ProcessBatch(frames.data(), 4, {1, 90000});
+      }));
+    };
+    if (VideoFade::UsingAvx2()) video_bench("video_fade_1080p_avx2");
+    // 关掉 SIMD 跑一遍标量内核做对比
+    av_force_cpu_flags(0);
+    video_bench("video_fade_1080p_c");
+    av_force_cpu_flags(-1);
+    for (AVFrame*& f : frames) av_frame_free(&f);
+  }
+
+  {
+    // 2 路 / 16 路 FLTP 立体声混音，每路一帧 1024 采样点；源帧 av_frame_ref 后入队
+    AVFrame* src = av_frame_alloc();
+    src->format = AV_SAMPLE_FMT_FLTP;
+    src->sample_rate = kSampleRate;
+    src->channels = kChannels;
+    src->channel_layout = av_get_default_channel_layout(kChannels);
+    src->nb_samples = 1024;
+    av_frame_get_buffer(src, 32);
+    for (int c = 0; c < kChannels; c++) {
+      float* p = reinterpret_cast<float*>(src->data[c]);
+      for (int i = 0; i < 1024; i++) p[i] = 0.3f * static_cast<float>((i * 37 + c * 11) % 200 - 100) / 100;
+    }
+    auto mixer_bench = [&](const std::string& name, int sources) {
+      AudioMixer mixer(AudioMixer::Options{});
+      std::vector<int> ids;
+      for (int s = 0; s < sources; s++) ids.push_back(mixer.AddSource("src" + std::to_string(s), 0.5f));
+      AVFrame* in = av_frame_alloc();
+      AVFrame* out = av_frame_alloc();
+      results.push_back(RunBench(name, 1, 1, cfg, [&](int, uint64_t i) {
+        for (int id : ids) {
+          av_frame_ref(in, src);
+          in->pts = static_cast<int64_t>(i) * 1024;
+          mixer.Push(id, in);
+        }
+        if (mixer.Mix(out)) av_frame_unref(out);
+      }));
+      av_frame_free(&in);
+      av_frame_free(&out);
+    };
+    const std::string isa = AudioMixer::UsingAvx2() ? "_avx2" : "_c";
+    mixer_bench("audio_mixer_2src" + isa, 2);
+    mixer_bench("audio_mixer_16src" + isa, 16);
+    if (AudioMixer::UsingAvx2()) {
+      av_force_cpu_flags(0);
+      mixer_bench("audio_mixer_16src_c", 16);
+      av_force_cpu_flags(-1);
+    }
+    av_frame_free(&src);
+  }
+
+  {
+    // 重采样本身：每次处理 1 秒立体声，单次耗时即每秒音频的开销
+    auto resample_bench = [&](const std::string& name, int in_rate, int out_rate) {
+      PolyphaseResampler resampler(in_rate, out_rate, kChannels);
+      std::vector<float> in_buf(in_rate), out_buf(out_rate + 1);
+      for (int i = 0; i < in_rate; i++) in_buf[i] = 0.5f * static_cast<float>(std::sin(i * 0.07));
+      const float* in[2] = {in_buf.data(), in_buf.data()};
+      float* out[2] = {out_buf.data(), out_buf.data()};
+      results.push_back(RunBench(name, 1, 1, cfg, [&](int, uint64_t) {
+        resampler.Push(in, in_rate);
+        while (resampler.Pull(out, out_rate + 1, 0.8f, 0) > 0) {
+        }
+      }));
+    };
+    const std::string isa = PolyphaseResampler::UsingAvx2() ? "_avx2" : "_c";
+    resample_bench("resample_1s_44100_48000" + isa, 44100, 48000);
+    resample_bench("resample_1s_48000_44100" + isa, 48000, 44100);
+    if (PolyphaseResampler::UsingAvx2()) {
+      av_force_cpu_flags(0);
+      resample_bench("resample_1s_44100_48000_c", 44100, 48000);
+      av_force_cpu_flags(-1);
+    }
+  }
+
+  {
+    // 插播素材：合成 5 秒 AAC 写到日志目录，对比每次重新解码与缓存命中，以及按包络混入一帧的开销
+    std::vector<std::string> frames = GenerateAdtsFrames(48000, 1, 235);
+    const std::string path = cfg.log_dir + "/bench_asset.aac";
+    std::ofstream asset(path, std::ios::binary);
+    for (const std::string& f : frames) asset.write(f.data(), f.size());
+    asset.close();
+    AssetCache& cache = AssetCache::Instance();
+    if (!frames.empty() && cache.GetPcm(path, kSampleRate, kChannels)) {
+      results.push_back(RunBench("asset_decode_cold", 1, 1, cfg, [&](int, uint64_t) {
+        cache.Clear();
+        cache.GetPcm(path, kSampleRate, kChannels);
+      }));
+      results.push_back(RunBench("asset_cache_hit", cfg.threads, 16, cfg, [&](int, uint64_t) {
+        cache.GetPcm(path, kSampleRate, kChannels);
+      }));
+      auto pcm = cache.GetPcm(path, kSampleRate, kChannels);
+      std::vector<float> l(1024), r(1024);
+      float* dst[2] = {l.data(), r.data()};
+      std::unique_ptr<AssetInsert> insert;
+      results.push_back(RunBench("asset_insert_mix_1024", 1, 1, cfg, [&](int, uint64_t) {
+        if (!insert || insert->finished()) insert = std::make_unique<AssetInsert>(pcm, 0.8f, 4410, 4410);
+        insert->MixInto(dst, 1024);
+      }));
+      cache.Clear();
+    }
+  }
+
+  {
+    // 输入：完整探测与探测缓存命中的打开开销，映射文件上零拷贝切 ADTS 帧与经 avformat 读包
+    std::vector<std::string> frames = GenerateAdtsFrames(kSampleRate, kChannels, 500);
+    const std::string path = cfg.log_dir + "/bench_input.aac";
+    std::ofstream file(path, std::ios::binary);
+    for (const std::string& f : frames) file.write(f.data(), f.size());
+    file.close();
+    auto open_close = [&](const std::string& key) {
+      std::unique_ptr<MediaInput> input = MediaInput::MapFile(path);
+      AVFormatContext* fmt = nullptr;
+      if (input && input->Open(key, &fmt)) avformat_close_input(&fmt);
+    };
+    results.push_back(RunBench("input_open_probe", 1, 1, cfg, [&](int, uint64_t) {
+      MediaInput::ClearProbeCache();
+      open_close("bench");
+    }));
+    results.push_back(RunBench("input_open_cached", 1, 1, cfg, [&](int, uint64_t) {
+      open_close("bench");
+    }));
+    std::unique_ptr<MediaInput> input = MediaInput::MapFile(path);
+    AVFormatContext* fmt = nullptr;
+    if (input && input->is_adts() && input->Open("bench", &fmt)) {
+      const AVRational tb = fmt->streams[0]->time_base;
+      AVPacket pkt;
+      av_init_packet(&pkt);
+      std::unique_ptr<MediaInput> direct = MediaInput::MapFile(path);
+      results.push_back(RunBench("input_read_adts_direct", 1, 16, cfg, [&](int, uint64_t) {
+        if (!direct->ReadAdts(&pkt, tb)) {
+          direct = MediaInput::MapFile(path);
+          direct->ReadAdts(&pkt, tb);
+        }
+        av_packet_unref(&pkt);
+      }));
+      results.push_back(RunBench("input_read_avformat", 1, 16, cfg, [&](int, uint64_t) {
+        if (av_read_frame(fmt, &pkt) < 0) {
+          av_seek_frame(fmt, -1, 0, AVSEEK_FLAG_BYTE);
+          av_read_frame(fmt, &pkt);
+        }
+        av_packet_unref(&pkt);
+      }));
+      avformat_close_input(&fmt);
+    }
+  }
+
+  {
+    std::string buf(1024, '\0');
+    for (size_t i = 0; i < buf.size(); i++) buf[i] = static_cast<char>(i * 31);
+    results.push_back(RunBench("print_hex_preview_64", 1, 16, cfg, [&](int, uint64_t) {
+      std::string s = PrintHexPreview(buf, 64);
+      (void)s;
+    }));
+  }
+
+  // ---- 日志 ----
+  LOGGER_INS->SetLevels("info");
+  results.push_back(RunBench("log_info_enabled", cfg.threads, 64, cfg,
+                             [](int t, uint64_t i) {
+                               LOG_INFO("bench thread={} seq={} value={}", t, i, 0.5);
+                             }));
+  results.push_back(RunBench("log_info_no_args", cfg.threads, 64, cfg,
+                             [](int, uint64_t) { LOG_INFO("bench constant message"); }));
+  results.push_back(RunBench("log_debug_filtered", cfg.threads, 256, cfg,
+                             []([[maybe_unused]] int t, [[maybe_unused]] uint64_t i) {
+                               // 编译期关掉 debug 时宏展开为空，参数不再被引用
+                               LOG_DEBUG("bench thread={} seq={}", t, i);
+                             }));
+  results.push_back(RunBench("log_every_n_1000", cfg.threads, 256, cfg,
+                             [](int t, uint64_t i) {
+                               LOG_EVERY_N(info, 1000, "bench thread={} seq={}", t, i);
+                             }));
+  LOGGER_INS->SetLevels("warn");
+  results.push_back(RunBench("log_info_runtime_off", cfg.threads, 256, cfg,
+                             [](int t, uint64_t i) {
+                               LOG_INFO("bench thread={} seq={}", t, i);
+                             }));
+  LOGGER_INS->SetLevels("info,afade=error");
+
+  // ---- metrics ----
+  AvMetrics::Instance().Init(cfg.metrics_addr);
+  std::vector<std::string> rooms;
+  for (int t = 0; t < cfg.threads; t++) rooms.push_back("bench_room_" + std::to_string(t));
+  for (const auto& room : rooms) AvMetrics::Instance().AddRoom(room);
+
+  results.push_back(RunBench("metrics_set_fps", cfg.threads, 16, cfg,
+                             [&](int t, uint64_t i) {
+                               AvMetrics::Instance().SetFps(rooms[t], 50.0, 25.0 + (i & 1));
+                             }));
+  results.push_back(RunBench("metrics_set_pts_ms", cfg.threads, 16, cfg,
+                             [&](int t, uint64_t i) {
+                               AvMetrics::Instance().SetPtsMs(rooms[t], i * 20, i * 40);
+                             }));
+  // 所有线程写同一个房间，看锁竞争
+  results.push_back(RunBench("metrics_set_pts_ms_shared", cfg.threads, 16, cfg,
+                             [&](int, uint64_t i) {
+                               AvMetrics::Instance().SetPtsMs(rooms[0], i * 20, i * 40);
+                             }));
+  for (const auto& room : rooms) AvMetrics::Instance().RemoveRoom(room);
+  AvMetrics::Instance().Shutdown();
+
+  WriteJson(cfg, results);
+  return 0;
+}
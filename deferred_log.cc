@@ -0,0 +1,321 @@
+#include "deferred_log.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+#include "spdlog/details/os.h"
+
+namespace libmagic {
+namespace deferred {
+
+namespace {
+
+// 空闲时把缓冲写出的最小间隔：断续的低流量日志不至于每条都触发一次 write
+constexpr auto kIdleFlushInterval = std::chrono::milliseconds(200);
+
+size_t RoundUpPow2(size_t n) {
+  size_t cap = 4096;
+  while (cap < n) cap <<= 1;
+  return cap;
+}
+
+// 线程退出时标记其环为退役，后台线程读空后回收
+struct RingHolder {
+  std::shared_ptr<ThreadRing> ring;
+  ~RingHolder() {
+    if (ring) ring->Retire();
+  }
+};
+
+thread_local RingHolder tls_ring;
+
+}  // namespace
+
+// ---- ThreadRing ----
+
+ThreadRing::ThreadRing(size_t capacity, size_t thread_id)
+    : capacity_(RoundUpPow2(capacity)), mask_(capacity_ - 1), thread_id_(thread_id) {
+  buf_ = static_cast<char*>(::operator new(capacity_, std::align_val_t(64)));
+}
+
+ThreadRing::~ThreadRing() { ::operator delete(buf_, std::align_val_t(64)); }
+
+char* ThreadRing::Reserve(uint32_t size) {
+  uint64_t h = head_.load(std::memory_order_relaxed);
+  size_t off = h & mask_;
+  size_t contig = capacity_ - off;
+  // 尾部剩余空间不够时，跳过尾部从头开始写
+  size_t need = size + (contig < size ? contig : 0);
+
+  if (h + need - cached_tail_ > capacity_) {
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    while (h + need - cached_tail_ > capacity_) {
+      OverflowPolicy policy = Backend::overflow_policy();
+      if (policy == OverflowPolicy::kOverwriteOldest) {
+        EvictOldest();
+        continue;
+      }
+      if (policy == OverflowPolicy::kDropNewest || !Backend::Running()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      std::this_thread::yield();
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+  }
+
+  if (contig < size) {
+    uint32_t marker = kWrapMarker;
+    memcpy(buf_ + off, &marker, sizeof(marker));
+    h += contig;
+  }
+  reserve_pos_ = h;
+  return buf_ + (h & mask_);
+}
+
+void ThreadRing::EvictOldest() {
+  uint64_t t = cached_tail_;
+  // tail 处的记录由本线程写入，读取是安全的
+  uint32_t size;
+  memcpy(&size, buf_ + (t & mask_), sizeof(size));
+  bool wrap = size == kWrapMarker;
+  uint64_t next = wrap ? t + (capacity_ - (t & mask_)) : t + size;
+  if (tail_.compare_exchange_strong(t, next, std::memory_order_acq_rel)) {
+    if (!wrap) evicted_.fetch_add(1, std::memory_order_relaxed);
+    cached_tail_ = next;
+  } else {
+    cached_tail_ = t;  // 消费者已推进，t 为最新值
+  }
+}
+
+bool ThreadRing::PeekTime(int64_t* time_ns) {
+  uint64_t t = tail_.load(std::memory_order_acquire);
+  while (t < head_.load(std::memory_order_acquire)) {
+    uint32_t size;
+    memcpy(&size, buf_ + (t & mask_), sizeof(size));
+    if (size == kWrapMarker) {
+      uint64_t next = t + (capacity_ - (t & mask_));
+      if (tail_.compare_exchange_strong(t, next, std::memory_order_acq_rel)) t = next;
+      continue;
+    }
+    memcpy(time_ns, buf_ + (t & mask_) + offsetof(RecordHeader, time_ns),
+           sizeof(*time_ns));
+    return true;
+  }
+  return false;
+}
+
+bool ThreadRing::Take(std::vector<char>& out) {
+  uint64_t t = tail_.load(std::memory_order_acquire);
+  if (t >= head_.load(std::memory_order_acquire)) return false;
+
+  size_t off = t & mask_;
+  uint32_t size;
+  memcpy(&size, buf_ + off, sizeof(size));
+  // 读到的长度可能正被覆盖，先做合法性检查
+  if (size == kWrapMarker || size < sizeof(RecordHeader) || (size & 7) ||
+      off + size > capacity_) {
+    return false;
+  }
+  out.resize(size);
+  memcpy(out.data(), buf_ + off, size);
+  // CAS 成功说明拷贝期间这条记录没有被生产者淘汰
+  if (!tail_.compare_exchange_strong(t, t + size, std::memory_order_acq_rel))
+    return false;
+  consumed_.store(consumed_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  return true;
+}
+
+// ---- Backend ----
+
+std::atomic<bool> Backend::running_{false};
+std::atomic<OverflowPolicy> Backend::overflow_{OverflowPolicy::kDropNewest};
+
+Backend& Backend::Instance() {
+  static Backend inst;
+  return inst;
+}
+
+Backend::~Backend() { Stop(); }
+
+void Backend::Start(std::shared_ptr<spdlog::logger> target,
+                    const QueueOptions& options) {
+  Stop();
+  target_ = std::move(target);
+  ring_bytes_.store(options.ring_bytes);
+  overflow_.store(options.overflow);
+  stop_.store(false);
+  running_.store(true);
+  thread_ = std::thread(&Backend::Run, this);
+}
+
+void Backend::Stop() {
+  if (!thread_.joinable()) return;
+  stop_.store(true);
+  thread_.join();
+  running_.store(false);
+  FlushSinks();
+}
+
+ThreadRing* Backend::LocalRing() {
+  if (!tls_ring.ring) {
+    tls_ring.ring = std::make_shared<ThreadRing>(ring_bytes_.load(), spdlog::details::os::thread_id());
+    std::lock_guard<std::mutex> lk(rings_mu_);
+    rings_.push_back(tls_ring.ring);
+    rings_version_.fetch_add(1, std::memory_order_release);
+  }
+  return tls_ring.ring.get();
+}
+
+Backend::Stats Backend::stats() {
+  Stats st;
+  st.dropped_records = retired_dropped_.load(std::memory_order_relaxed);
+  st.high_water_bytes = high_water_bytes_.load(std::memory_order_relaxed);
+  st.sink_errors = sink_errors_.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lk(rings_mu_);
+  st.threads = rings_.size();
+  for (auto& r : rings_) {
+    // 各计数分开读取，可能短暂不一致
+    int64_t pending = static_cast<int64_t>(r->pending());
+    if (pending > 0) st.pending_records += pending;
+    st.dropped_records += r->dropped();
+  }
+  return st;
+}
+
+void Backend::Run() {
+  pthread_setname_np(pthread_self(), "log_backend");
+
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  uint64_t version = ~uint64_t(0);
+  int idle_rounds = 0;
+
+  while (true) {
+    uint64_t v = rings_version_.load(std::memory_order_acquire);
+    if (v != version) {
+      std::lock_guard<std::mutex> lk(rings_mu_);
+      rings = rings_;
+      version = rings_version_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t high_water = high_water_bytes_.load(std::memory_order_relaxed);
+    for (auto& r : rings) high_water = std::max(high_water, r->used());
+    high_water_bytes_.store(high_water, std::memory_order_relaxed);
+
+    // 多路归并：每次取时间戳最早的一条，保证跨线程输出有序
+    size_t processed = 0;
+    while (true) {
+      ThreadRing* best = nullptr;
+      int64_t best_time = 0;
+      for (auto& r : rings) {
+        int64_t t;
+        if (r->PeekTime(&t) && (!best || t < best_time)) {
+          best = r.get();
+          best_time = t;
+        }
+      }
+      if (!best) break;
+      // 记录在拷贝期间被覆盖时直接跳过
+      if (best->Take(scratch_)) {
+        Process(reinterpret_cast<const RecordHeader*>(scratch_.data()));
+        processed++;
+      }
+    }
+
+    // 回收已退出且读空的线程环
+    bool reclaimed = false;
+    for (auto& r : rings) {
+      int64_t t;
+      if (r->retired() && !r->PeekTime(&t)) {
+        retired_dropped_.fetch_add(r->dropped(), std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(rings_mu_);
+        rings_.erase(std::remove(rings_.begin(), rings_.end(), r), rings_.end());
+        reclaimed = true;
+      }
+    }
+    if (reclaimed) rings_version_.fetch_add(1, std::memory_order_release);
+
+    if (processed > 0) {
+      idle_rounds = 0;
+      continue;
+    }
+    if (stop_.load()) break;
+
+    // 空闲时（限频）刷盘并逐步退避
+    if (dirty_ && std::chrono::steady_clock::now() - last_flush_ >= kIdleFlushInterval)
+      FlushSinks();
+    if (++idle_rounds < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+void Backend::Process(const RecordHeader* rec) {
+  buf_.clear();
+  try {
+    rec->decode(rec->fmt, rec->fmt_len, reinterpret_cast<const char*>(rec + 1), buf_);
+  } catch (const std::exception& ex) {
+    buf_.clear();
+    fmt::format_to(fmt::appender(buf_), "[log format error: {}] {}", ex.what(),
+                   fmt::string_view(rec->fmt, rec->fmt_len));
+  }
+
+  auto level = static_cast<spdlog::level::level_enum>(rec->level);
+  spdlog::log_clock::time_point tp(
+      std::chrono::duration_cast<spdlog::log_clock::duration>(
+          std::chrono::nanoseconds(rec->time_ns)));
+  spdlog::details::log_msg msg(tp, rec->loc, target_->name(), level,
+                               spdlog::string_view_t(buf_.data(), buf_.size()));
+  msg.thread_id = rec->thread_id;
+
+  SetFormattingLogContext(&rec->ctx);
+  // 与 spdlog 的 logger 一样逐个 sink 捕获异常（磁盘满、轮转失败等），
+  // 不能让异常逃出后台线程把进程 terminate 掉
+  for (auto& sink : target_->sinks()) {
+    if (!sink->should_log(level)) continue;
+    try {
+      sink->log(msg);
+    } catch (const std::exception& ex) {
+      OnSinkError(ex.what());
+    } catch (...) {
+      OnSinkError("unknown exception");
+    }
+  }
+  SetFormattingLogContext(nullptr);
+  dirty_ = true;
+  if (level >= target_->flush_level()) FlushSinks();
+}
+
+void Backend::FlushSinks() {
+  if (!target_) return;
+  for (auto& sink : target_->sinks()) {
+    try {
+      sink->flush();
+    } catch (const std::exception& ex) {
+      OnSinkError(ex.what());
+    } catch (...) {
+      OnSinkError("unknown exception");
+    }
+  }
+  dirty_ = false;
+  last_flush_ = std::chrono::steady_clock::now();
+}
+
+void Backend::OnSinkError(const char* what) {
+  uint64_t n = sink_errors_.fetch_add(1, std::memory_order_relaxed) + 1;
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_error_report_ < std::chrono::seconds(1)) return;
+  last_error_report_ = now;
+  fprintf(stderr, "[*** LOG ERROR #%04llu ***] [%s] %s\n",
+          static_cast<unsigned long long>(n), target_->name().c_str(), what);
+}
+
+}  // namespace deferred
+}  // namespace libmagic
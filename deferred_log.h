@@ -0,0 +1,370 @@
+#ifndef UTILS_DEFERRED_LOG_H_
+#define UTILS_DEFERRED_LOG_H_
+
+// NanoLog 风格的延迟格式化日志后端：
+// 业务线程只把格式串指针和参数的原始字节写入本线程的无锁环形缓冲区，
+// fmt 格式化、pattern 和 sink 写入全部在后台日志线程完成。
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "log_context.h"
+#include "spdlog/spdlog.h"
+
+namespace libmagic {
+namespace deferred {
+
+// 后台线程用来还原参数并格式化的函数，每种参数组合实例化一个
+using DecodeFn = void (*)(const char* fmt, uint32_t fmt_len, const char* args,
+                          fmt::memory_buffer& out);
+
+// 环形缓冲区中的一条记录，参数字节紧跟其后，整条按 8 字节对齐
+struct RecordHeader {
+  uint32_t size;      // 整条记录的字节数；kWrapMarker 表示此处回绕到缓冲区开头
+  int32_t level;
+  int64_t time_ns;    // spdlog::log_clock 纪元起的纳秒数
+  size_t thread_id;
+  spdlog::source_loc loc;
+  const char* fmt;    // 静态格式串
+  uint32_t fmt_len;
+  DecodeFn decode;
+  LogContext ctx;     // 写入时线程上的日志上下文
+};
+
+constexpr uint32_t kWrapMarker = 0xFFFFFFFFu;
+
+inline size_t Align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// ---- 参数编码 ----
+// 字符串保存长度 + 内容；其余可平凡拷贝的类型（数值、枚举、指针、chrono 时长等）
+// 按原始字节保存，后台用原值格式化，{:.2f} 之类的格式说明符照常生效。
+// 含不可平凡拷贝参数的调用（较少见）整条在调用线程上格式化，见 Backend::Capture。
+// 按字节保存的类型，其 formatter 不应解引用调用返回后可能失效的内存。
+
+template <typename T>
+struct IsStringLike
+    : std::integral_constant<
+          bool, std::is_same<T, std::string>::value ||
+                    std::is_same<T, std::string_view>::value ||
+                    std::is_same<T, fmt::string_view>::value> {};
+
+template <typename T>
+struct IsCString
+    : std::integral_constant<bool, std::is_same<T, char*>::value ||
+                                       std::is_same<T, const char*>::value> {};
+
+// 能否不经格式化直接存入记录
+template <typename T>
+struct IsCapturable
+    : std::integral_constant<
+          bool, IsCString<T>::value || IsStringLike<T>::value ||
+                    (std::is_trivially_copyable<T>::value &&
+                     std::is_default_constructible<T>::value)> {};
+
+template <typename T>
+auto ToCapturable(const T& v) {
+  using D = std::decay_t<T>;
+  static_assert(IsCapturable<D>::value, "argument must be formatted by the caller");
+  if constexpr (IsCString<D>::value) {
+    const char* s = v;
+    return fmt::string_view(s ? s : "");
+  } else if constexpr (IsStringLike<D>::value) {
+    return fmt::string_view(v.data(), v.size());
+  } else {
+    return D(v);
+  }
+}
+
+template <typename V>
+using Decoded = std::conditional_t<std::is_same<V, fmt::string_view>::value ||
+                                       std::is_same<V, std::string>::value,
+                                   fmt::string_view, V>;
+
+template <typename V>
+size_t EncodedSize(const V& v) {
+  if constexpr (std::is_same<Decoded<V>, fmt::string_view>::value) {
+    return sizeof(uint32_t) + v.size();
+  } else {
+    return sizeof(V);
+  }
+}
+
+template <typename V>
+char* EncodeArg(char* p, const V& v) {
+  if constexpr (std::is_same<Decoded<V>, fmt::string_view>::value) {
+    uint32_t len = static_cast<uint32_t>(v.size());
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), v.data(), len);
+    return p + sizeof(len) + len;
+  } else {
+    memcpy(p, &v, sizeof(V));
+    return p + sizeof(V);
+  }
+}
+
+template <typename V>
+Decoded<V> DecodeArg(const char*& p) {
+  if constexpr (std::is_same<Decoded<V>, fmt::string_view>::value) {
+    uint32_t len;
+    memcpy(&len, p, sizeof(len));
+    fmt::string_view sv(p + sizeof(len), len);
+    p += sizeof(len) + len;
+    return sv;
+  } else {
+    V v;
+    memcpy(&v, p, sizeof(V));
+    p += sizeof(V);
+    return v;
+  }
+}
+
+template <typename... Vs>
+void DecodeAndFormat(const char* fmt_str, uint32_t fmt_len, const char* p,
+                     fmt::memory_buffer& out) {
+  if constexpr (sizeof...(Vs) == 0) {
+    // 与 spdlog 一致：无参数时原样输出，不做 {} 解析
+    out.append(fmt_str, fmt_str + fmt_len);
+  } else {
+    // 花括号初始化保证从左到右依次解码
+    std::tuple<Decoded<Vs>...> vals{DecodeArg<Vs>(p)...};
+    std::apply(
+        [&](const auto&... a) {
+          fmt::vformat_to(fmt::appender(out), fmt::string_view(fmt_str, fmt_len),
+                          fmt::make_format_args(a...));
+        },
+        vals);
+  }
+}
+
+// 计算编码后的记录长度（已对齐），并在 dst 上写入完整记录
+template <typename... Vs>
+class RecordEncoder {
+ public:
+  RecordEncoder(const std::tuple<Vs...>& caps) : caps_(caps) {
+    size_t args = std::apply(
+        [](const auto&... v) { return (size_t(0) + ... + EncodedSize(v)); }, caps_);
+    size_ = Align8(sizeof(RecordHeader) + args);
+  }
+
+  size_t size() const { return size_; }
+
+  void Write(char* dst, const spdlog::source_loc& loc, spdlog::level::level_enum level,
+             int64_t time_ns, size_t thread_id, const char* fmt_str,
+             uint32_t fmt_len, const LogContext& ctx) const {
+    RecordHeader hdr;
+    hdr.size = static_cast<uint32_t>(size_);
+    hdr.level = level;
+    hdr.time_ns = time_ns;
+    hdr.thread_id = thread_id;
+    hdr.loc = loc;
+    hdr.fmt = fmt_str;
+    hdr.fmt_len = fmt_len;
+    hdr.decode = &DecodeAndFormat<Vs...>;
+    hdr.ctx = ctx;
+    memcpy(dst, &hdr, sizeof(hdr));
+    char* p = dst + sizeof(hdr);
+    std::apply([&](const auto&... v) { ((p = EncodeArg(p, v)), ...); }, caps_);
+  }
+
+ private:
+  const std::tuple<Vs...>& caps_;
+  size_t size_;
+};
+
+// 队列满时的处理方式
+enum class OverflowPolicy {
+  kBlock,            // 让出 CPU 等待后台线程腾出空间
+  kDropNewest,       // 丢弃当前这条
+  kOverwriteOldest,  // 覆盖最早的记录
+};
+
+// ---- 每线程字节环：单生产者写入，后台线程消费 ----
+// 所有线程的环合起来构成一个无锁 MPSC 队列。
+// kOverwriteOldest 下生产者也会推进 tail，因此消费者先拷贝记录再 CAS 提交
+class ThreadRing {
+ public:
+  ThreadRing(size_t capacity, size_t thread_id);
+  ~ThreadRing();
+
+  // 生产者：预留 size 字节的连续空间；按溢出策略处理满的情况，丢弃时返回 nullptr
+  char* Reserve(uint32_t size);
+  void Commit(uint32_t size) {
+    head_.store(reserve_pos_ + size, std::memory_order_release);
+    produced_.store(produced_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+  }
+
+  // 消费者：最早一条记录的时间戳（只用于跨线程归并排序）
+  bool PeekTime(int64_t* time_ns);
+  // 消费者：取出最早一条记录拷贝到 out；记录已被覆盖时返回 false
+  bool Take(std::vector<char>& out);
+  // 消费者：当前占用字节数
+  uint64_t used() const {
+    return head_.load(std::memory_order_relaxed) -
+           tail_.load(std::memory_order_relaxed);
+  }
+
+  size_t thread_id() const { return thread_id_; }
+  size_t capacity() const { return capacity_; }
+  void Retire() { retired_.store(true, std::memory_order_release); }
+  bool retired() const { return retired_.load(std::memory_order_acquire); }
+  uint64_t pending() const {
+    return produced_.load(std::memory_order_relaxed) -
+           consumed_.load(std::memory_order_relaxed) -
+           evicted_.load(std::memory_order_relaxed);
+  }
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed) +
+           evicted_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // 生产者：淘汰最早一条记录
+  void EvictOldest();
+
+  char* buf_;
+  size_t capacity_;
+  size_t mask_;
+  size_t thread_id_;
+
+  alignas(64) std::atomic<uint64_t> head_{0};
+  uint64_t reserve_pos_ = 0;   // 仅生产者
+  uint64_t cached_tail_ = 0;   // 仅生产者
+  std::atomic<uint64_t> produced_{0};
+  std::atomic<uint64_t> dropped_{0};   // 丢弃的新记录
+  std::atomic<uint64_t> evicted_{0};   // 被覆盖的旧记录
+
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<uint64_t> consumed_{0};
+
+  std::atomic<bool> retired_{false};
+};
+
+struct QueueOptions {
+  OverflowPolicy overflow = OverflowPolicy::kDropNewest;
+  size_t ring_bytes = 1 << 20;  // 每个线程的环大小
+  // 非延迟模式（spdlog 异步队列）满时的处理：spdlog 只支持 kBlock 和 kOverwriteOldest
+  OverflowPolicy async_overflow = OverflowPolicy::kOverwriteOldest;
+};
+
+// ---- 后台日志线程 ----
+class Backend {
+ public:
+  struct Stats {
+    uint64_t pending_records{0};
+    uint64_t dropped_records{0};
+    uint64_t high_water_bytes{0};  // 单个线程环的最高占用
+    uint64_t sink_errors{0};       // sink 写入或 flush 抛出的异常数
+    size_t threads{0};
+  };
+
+  static Backend& Instance();
+
+  // 热路径判断：后台是否在运行
+  static bool Running() { return running_.load(std::memory_order_relaxed); }
+  static OverflowPolicy overflow_policy() {
+    return overflow_.load(std::memory_order_relaxed);
+  }
+
+  // 开始把记录写入 target 的 sinks（使用 target 的 pattern / level / flush_level）
+  // ring_bytes 只影响之后新建的线程环
+  void Start(std::shared_ptr<spdlog::logger> target,
+             const QueueOptions& options = QueueOptions());
+  // 处理完剩余记录后停止
+  void Stop();
+
+  // 当前线程的环，首次调用时创建并注册
+  ThreadRing* LocalRing();
+
+  Stats stats();
+
+  template <size_t N, typename... Args>
+  void Capture(const spdlog::source_loc& loc, spdlog::level::level_enum level,
+               const char (&fmt_str)[N], const Args&... args) {
+    if constexpr (!(IsCapturable<std::decay_t<Args>>::value && ...)) {
+      // 有参数无法按字节保存：在调用线程格式化成一个字符串参数
+      CaptureFormatted(loc, level, fmt_str, args...);
+    } else {
+      auto caps = std::make_tuple(ToCapturable(args)...);
+      RecordEncoder<std::decay_t<decltype(ToCapturable(args))>...> enc(caps);
+      ThreadRing* ring = LocalRing();
+      if (enc.size() > ring->capacity() / 2) {
+        // 超大记录：同样先格式化，再截断
+        CaptureFormatted(loc, level, fmt_str, args...);
+        return;
+      }
+      char* dst = ring->Reserve(static_cast<uint32_t>(enc.size()));
+      if (!dst) return;
+      enc.Write(dst, loc, level, spdlog::log_clock::now().time_since_epoch() /
+                                     std::chrono::nanoseconds(1),
+                ring->thread_id(), fmt_str, N - 1, CurrentLogContext());
+      ring->Commit(static_cast<uint32_t>(enc.size()));
+    }
+  }
+
+ private:
+  Backend() = default;
+  ~Backend();
+
+  // 在调用线程格式化整条消息，截断到环容量的 1/4 后作为单个字符串参数写入
+  template <size_t N, typename... Args>
+  void CaptureFormatted(const spdlog::source_loc& loc, spdlog::level::level_enum level,
+                        const char (&fmt_str)[N], const Args&... args);
+
+  void Run();
+  void Process(const RecordHeader* rec);
+  void FlushSinks();
+  // sink 抛异常时计数，并像 spdlog 默认的错误处理一样每秒最多往 stderr 报一条
+  void OnSinkError(const char* what);
+
+  static std::atomic<bool> running_;
+  static std::atomic<OverflowPolicy> overflow_;
+
+  std::shared_ptr<spdlog::logger> target_;
+  std::atomic<size_t> ring_bytes_{1 << 20};
+
+  std::mutex rings_mu_;
+  std::vector<std::shared_ptr<ThreadRing>> rings_;
+  std::atomic<uint64_t> rings_version_{0};
+
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+  fmt::memory_buffer buf_;
+  std::vector<char> scratch_;  // 从环中拷出的当前记录
+  bool dirty_{false};  // 自上次 flush 后是否写过
+  std::chrono::steady_clock::time_point last_flush_;
+
+  std::atomic<uint64_t> high_water_bytes_{0};
+  std::atomic<uint64_t> retired_dropped_{0};  // 已回收线程环的丢弃数
+  std::atomic<uint64_t> sink_errors_{0};
+  std::chrono::steady_clock::time_point last_error_report_;
+};
+
+template <size_t N, typename... Args>
+void Backend::CaptureFormatted(const spdlog::source_loc& loc,
+                               spdlog::level::level_enum level,
+                               const char (&fmt_str)[N], const Args&... args) {
+  std::string msg;
+  if constexpr (sizeof...(Args) == 0) {
+    msg.assign(fmt_str, N - 1);
+  } else {
+    msg = fmt::format(fmt::runtime(fmt_str), args...);
+  }
+  msg.resize(std::min(msg.size(), LocalRing()->capacity() / 4));
+  Capture(loc, level, "{}", msg);
+}
+
+}  // namespace deferred
+}  // namespace libmagic
+
+#endif  // UTILS_DEFERRED_LOG_H_
@@ -0,0 +1,328 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "edf_scheduler.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+#include "av_metrics.h"
+#include "logger.h"
+#include "numa_topology.h"
+
+namespace {
+
+// 相邻帧媒体时间跳变超过 10 秒视为时间戳重置，重新定基线
+constexpr int64_t kMediaJumpNs = 10LL * 1000000000;
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             EdfScheduler::Clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+class EdfScheduler::Room {
+public:
+  std::string id;
+  int64_t latency_ns = 0;
+  int home = 0;
+  int node = 0;
+
+  std::mutex mu;
+  std::deque<std::pair<int64_t, Task>> tasks; // (截止时间, 任务)
+  bool scheduled = false; // 在运行队列中或正在执行
+  bool closed = false;
+  bool anchored = false;
+  int64_t anchor_ns = 0;
+  int64_t last_media_ns = 0;
+
+  std::atomic<uint64_t> misses{0};
+};
+
+EdfScheduler::EdfScheduler(const Options &options) : options_(options) {
+  int n = options_.threads > 0 ? options_.threads
+                               : static_cast<int>(std::thread::hardware_concurrency());
+  n = std::max(1, n);
+  // 线程少于 CPU 时隔几个取一个，让各节点分到的线程数与 CPU 数成比例
+  const NumaTopology &numa = NumaTopology::Instance();
+  const std::vector<int> cpus = numa.SortByNode(options_.cpus);
+  int max_node = 0;
+  for (int i = 0; i < n; i++) {
+    auto q = std::make_unique<RunQueue>();
+    if (!cpus.empty()) {
+      q->cpu = cpus[static_cast<size_t>(i) * cpus.size() / n % cpus.size()];
+      q->node = std::max(0, numa.NodeOfCpu(q->cpu));
+    }
+    if (!queues_.empty() && q->node != queues_[0]->node)
+      multi_node_ = true;
+    max_node = std::max(max_node, q->node);
+    queues_.push_back(std::move(q));
+  }
+  // 每个节点一个计数，最后一个给不指定节点的房间
+  next_home_.assign(max_node + 2, 0);
+  for (int i = 0; i <= max_node; i++)
+    idle_.push_back(std::make_unique<IdleGroup>());
+  for (int i = 0; i < n; i++)
+    workers_.emplace_back(&EdfScheduler::WorkerLoop, this, i);
+  LOG_INFO("EdfScheduler started threads={} pin={} cpus={} nodes={} steal_slack={}us", n,
+           options_.pin_threads, cpus.size(), max_node + 1,
+           options_.steal_slack.count() / 1000);
+}
+
+EdfScheduler::~EdfScheduler() {
+  stop_.store(true);
+  for (auto &group : idle_) {
+    std::lock_guard<std::mutex> lk(group->mu);
+    group->cv.notify_all();
+  }
+  for (auto &t : workers_)
+    t.join();
+}
+
+EdfScheduler::Room *EdfScheduler::AddRoom(const std::string &room_id,
+                                          std::chrono::nanoseconds latency_target,
+                                          int numa_node) {
+  auto room = std::make_unique<Room>();
+  room->id = room_id;
+  room->latency_ns = latency_target.count();
+  std::vector<int> candidates;
+  for (int i = 0; i < static_cast<int>(queues_.size()); i++) {
+    if (numa_node < 0 || queues_[i]->node == numa_node)
+      candidates.push_back(i);
+  }
+  if (candidates.empty()) {
+    LOG_WARN("EdfScheduler no worker on node {} for room {}, placing anywhere", numa_node,
+             room_id);
+    for (int i = 0; i < static_cast<int>(queues_.size()); i++)
+      candidates.push_back(i);
+    numa_node = -1;
+  }
+  Room *ret;
+  {
+    std::lock_guard<std::mutex> lk(rooms_mu_);
+    int &next = next_home_[numa_node < 0 ? next_home_.size() - 1 : numa_node];
+    room->home = candidates[next++ % candidates.size()];
+    room->node = queues_[room->home]->node;
+    rooms_.push_back(std::move(room));
+    ret = rooms_.back().get();
+  }
+  if (!room_id.empty()) {
+    AvMetrics::Instance().AddRoom(room_id);
+    AvMetrics::Instance().SetPlacement(room_id, ret->node, queues_[ret->home]->cpu);
+  }
+  return ret;
+}
+
+void EdfScheduler::RemoveRoom(Room *room) {
+  {
+    std::lock_guard<std::mutex> lk(room->mu);
+    room->closed = true;
+    inflight_.fetch_sub(static_cast<int64_t>(room->tasks.size()),
+                        std::memory_order_relaxed);
+    room->tasks.clear();
+  }
+  // 已在运行队列里的房间由工作线程弹出后丢弃
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lk(room->mu);
+      if (!room->scheduled)
+        break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::lock_guard<std::mutex> lk(rooms_mu_);
+  for (auto it = rooms_.begin(); it != rooms_.end(); ++it) {
+    if (it->get() == room) {
+      rooms_.erase(it);
+      break;
+    }
+  }
+}
+
+void EdfScheduler::Submit(Room *room, int64_t pts, AVRational time_base, Task task) {
+  const int64_t now_ns = NowNs();
+  const int64_t media_ns = av_rescale_q(pts, time_base, {1, 1000000000});
+  int64_t deadline_ns;
+  {
+    std::lock_guard<std::mutex> lk(room->mu);
+    if (!room->anchored || std::abs(media_ns - room->last_media_ns) > kMediaJumpNs) {
+      room->anchor_ns = now_ns - media_ns;
+      room->anchored = true;
+    }
+    room->last_media_ns = media_ns;
+    // 比基线到得早（突发到达），基线前移
+    if (now_ns < room->anchor_ns + media_ns)
+      room->anchor_ns = now_ns - media_ns;
+    deadline_ns = room->anchor_ns + media_ns + room->latency_ns;
+  }
+  Enqueue(room, deadline_ns, std::move(task));
+}
+
+void EdfScheduler::SubmitAt(Room *room, Clock::time_point deadline, Task task) {
+  Enqueue(room,
+          std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch())
+              .count(),
+          std::move(task));
+}
+
+void EdfScheduler::Enqueue(Room *room, int64_t deadline_ns, Task task) {
+  bool push;
+  {
+    std::lock_guard<std::mutex> lk(room->mu);
+    if (room->closed)
+      return;
+    room->tasks.emplace_back(deadline_ns, std::move(task));
+    inflight_.fetch_add(1, std::memory_order_relaxed);
+    push = !room->scheduled;
+    room->scheduled = true;
+  }
+  if (push)
+    Push(room->home, room, deadline_ns);
+}
+
+void EdfScheduler::Push(int queue, Room *room, int64_t deadline_ns) {
+  RunQueue &q = *queues_[queue];
+  {
+    std::lock_guard<std::mutex> lk(q.mu);
+    q.heap.push({deadline_ns, seq_.fetch_add(1, std::memory_order_relaxed), room});
+    q.head_ns.store(q.heap.top().deadline_ns, std::memory_order_relaxed);
+  }
+  IdleGroup &group = GroupOf(q.node);
+  group.queued.fetch_add(1, std::memory_order_release);
+  group.cv.notify_one();
+}
+
+bool EdfScheduler::Pop(int worker, Entry *entry) {
+  // 默认取本队列；别的队列队首明显更早时去抢，保证全局上接近 EDF
+  const int64_t slack = options_.steal_slack.count();
+  int best = worker;
+  int64_t best_ns = queues_[worker]->head_ns.load(std::memory_order_relaxed);
+  const int node = queues_[worker]->node;
+  for (int i = 0; i < static_cast<int>(queues_.size()); i++) {
+    if (i == worker || (!options_.steal_across_nodes && queues_[i]->node != node))
+      continue;
+    int64_t h = queues_[i]->head_ns.load(std::memory_order_relaxed);
+    if (h != INT64_MAX && (best_ns == INT64_MAX || h < best_ns - slack)) {
+      best = i;
+      best_ns = h;
+    }
+  }
+  if (best_ns == INT64_MAX)
+    return false;
+
+  RunQueue &q = *queues_[best];
+  {
+    std::lock_guard<std::mutex> lk(q.mu);
+    if (q.heap.empty())
+      return false;
+    *entry = q.heap.top();
+    q.heap.pop();
+    q.head_ns.store(q.heap.empty() ? INT64_MAX : q.heap.top().deadline_ns,
+                    std::memory_order_relaxed);
+  }
+  GroupOf(q.node).queued.fetch_sub(1, std::memory_order_relaxed);
+  if (best != worker)
+    steals_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void EdfScheduler::Run(const Entry &entry) {
+  Room *room = entry.room;
+  Task task;
+  int64_t deadline_ns;
+  {
+    std::lock_guard<std::mutex> lk(room->mu);
+    if (room->closed || room->tasks.empty()) {
+      room->scheduled = false;
+      return;
+    }
+    deadline_ns = room->tasks.front().first;
+    task = std::move(room->tasks.front().second);
+    room->tasks.pop_front();
+  }
+
+  // 房间只在本节点内执行；绑核失败或允许跨节点窃取时才会发生
+  if (multi_node_ && NumaTopology::Instance().CurrentNode() != room->node) {
+    remote_tasks_.fetch_add(1, std::memory_order_relaxed);
+    if (!room->id.empty())
+      AvMetrics::Instance().IncRemoteTask(room->id);
+  }
+  task();
+  // 先释放任务再计数，Drain 返回后调用方可以安全回收任务引用的对象
+  task = nullptr;
+  inflight_.fetch_sub(1, std::memory_order_release);
+  if (NowNs() > deadline_ns) {
+    room->misses.fetch_add(1, std::memory_order_relaxed);
+    if (!room->id.empty())
+      AvMetrics::Instance().IncDeadlineMiss(room->id);
+  }
+
+  int64_t next_ns = 0;
+  bool push = false;
+  {
+    std::lock_guard<std::mutex> lk(room->mu);
+    if (!room->closed && !room->tasks.empty()) {
+      next_ns = room->tasks.front().first;
+      push = true;
+    } else {
+      room->scheduled = false;
+    }
+  }
+  // 被窃取的房间执行完回到自己的队列
+  if (push)
+    Push(room->home, room, next_ns);
+}
+
+void EdfScheduler::WorkerLoop(int worker) {
+  char name[16];
+  snprintf(name, sizeof(name), "edf_%d", worker);
+  pthread_setname_np(pthread_self(), name);
+  const int cpu = queues_[worker]->cpu;
+  if (options_.pin_threads && cpu >= 0) {
+    if (!NumaTopology::PinCurrentThread({cpu}))
+      LOG_WARN("EdfScheduler pin worker {} to cpu {} failed", worker, cpu);
+  } else if (multi_node_) {
+    // 不绑核时至少留在本节点
+    NumaTopology::Instance().PinCurrentThreadToNode(queues_[worker]->node);
+  }
+
+  // 只等 Pop 能取到的队列：本节点的（允许跨节点窃取时为全部）
+  IdleGroup &group = GroupOf(queues_[worker]->node);
+  Entry entry;
+  while (true) {
+    if (Pop(worker, &entry)) {
+      Run(entry);
+      continue;
+    }
+    // 本组已经取空才退出，停止前提交的任务都会执行
+    std::unique_lock<std::mutex> lk(group.mu);
+    if (stop_)
+      break;
+    // 超时兜底：Push 的通知可能落在检查队列与开始等待之间
+    group.cv.wait_for(lk, std::chrono::milliseconds(1), [this, &group] {
+      return stop_ || group.queued.load(std::memory_order_acquire) > 0;
+    });
+  }
+}
+
+void EdfScheduler::Drain() {
+  while (inflight_.load(std::memory_order_acquire) > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+uint64_t EdfScheduler::deadline_misses(const Room *room) const {
+  return room->misses.load(std::memory_order_relaxed);
+}
+
+int EdfScheduler::node(const Room *room) const { return room->node; }
+
+int EdfScheduler::home_cpu(const Room *room) const { return queues_[room->home]->cpu; }
@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+// 按截止时间最早优先（EDF）调度各房间的逐帧任务。
+// 同一房间的任务串行、按提交顺序执行；房间之间按队首任务的截止时间排序。
+// 每个工作线程一个运行队列，房间固定落在一个队列上以保持缓存亲和；
+// 本队列为空，或别的队列队首早于本队列超过 steal_slack 时跨队列窃取。
+// 截止时间 = 房间基线 + PTS 对应的媒体时间 + 房间的输出延迟目标，基线取最早到达的帧。
+// 任务完成时已过截止时间计一次丢失，并通过 AvMetrics 按房间上报。
+// 多 NUMA 节点时工作线程按节点分组绑核，房间固定在一个节点上，默认只在同节点内窃取，
+// 房间的编解码状态和缓冲应在其主线程上（首次写入）或按 node() 绑定分配。
+class EdfScheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Task = std::function<void()>;
+
+  struct Options {
+    int threads = 0;         // 0 = 硬件线程数
+    bool pin_threads = true; // 每个工作线程绑到一个 CPU
+    // 工作线程可用的 CPU，空 = 进程可用的全部；按节点排序后均匀分给各工作线程
+    std::vector<int> cpus;
+    std::chrono::nanoseconds steal_slack{1000000};
+    bool steal_across_nodes = false; // 允许跨节点窃取（房间状态会被远程访问）
+  };
+
+  class Room;
+
+  explicit EdfScheduler(const Options &options);
+  // 工作线程把已提交的任务执行完后退出，等待其全部退出
+  ~EdfScheduler();
+
+  // latency_target：该房间的输出延迟目标（抖动缓冲越小越紧）；
+  // numa_node >= 0 时房间落在该节点的工作线程上，否则在全部工作线程间轮流分配
+  Room *AddRoom(const std::string &room_id, std::chrono::nanoseconds latency_target,
+                int numa_node = -1);
+  // 丢弃房间未执行的任务，等正在执行的任务结束后释放
+  void RemoveRoom(Room *room);
+
+  // 按帧的 PTS 推算截止时间后排队
+  void Submit(Room *room, int64_t pts, AVRational time_base, Task task);
+  void SubmitAt(Room *room, Clock::time_point deadline, Task task);
+  // 等待已提交的任务全部执行完
+  void Drain();
+
+  int threads() const { return static_cast<int>(workers_.size()); }
+  // 已提交未完成的任务数
+  int64_t inflight() const { return inflight_.load(std::memory_order_relaxed); }
+  uint64_t deadline_misses(const Room *room) const;
+  uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+  // 房间所在节点和主 CPU（未绑核时为 -1）
+  int node(const Room *room) const;
+  int home_cpu(const Room *room) const;
+  // 跑在房间节点之外的任务数
+  uint64_t remote_tasks() const { return remote_tasks_.load(std::memory_order_relaxed); }
+
+private:
+  struct Entry {
+    int64_t deadline_ns;
+    uint64_t seq; // 截止时间相同时先来先服务
+    Room *room;
+    bool operator>(const Entry &o) const {
+      return deadline_ns != o.deadline_ns ? deadline_ns > o.deadline_ns : seq > o.seq;
+    }
+  };
+
+  struct RunQueue {
+    std::mutex mu;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    std::atomic<int64_t> head_ns{INT64_MAX}; // 队首截止时间，供其他线程无锁比较
+    int cpu = -1;
+    int node = 0;
+  };
+
+  // 空闲等待按节点分组：工作线程只等自己能取到的队列，别的节点积压时不会被空唤醒。
+  // 允许跨节点窃取时全部共用第 0 组
+  struct IdleGroup {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::atomic<int64_t> queued{0}; // 本组运行队列中的房间数
+  };
+  IdleGroup &GroupOf(int node) { return *idle_[options_.steal_across_nodes ? 0 : node]; }
+
+  void Enqueue(Room *room, int64_t deadline_ns, Task task);
+  void Push(int queue, Room *room, int64_t deadline_ns);
+  bool Pop(int worker, Entry *entry);
+  void Run(const Entry &entry);
+  void WorkerLoop(int worker);
+
+  Options options_;
+  std::vector<std::unique_ptr<RunQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex rooms_mu_;
+  std::vector<std::unique_ptr<Room>> rooms_;
+  std::vector<int> next_home_; // 按节点轮流分配主队列的计数
+
+  std::vector<std::unique_ptr<IdleGroup>> idle_; // 下标为节点号
+  std::atomic<bool> stop_{false};
+
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<int64_t> inflight_{0};
+  std::atomic<uint64_t> steals_{0};
+  std::atomic<uint64_t> remote_tasks_{0};
+  bool multi_node_ = false;
+};
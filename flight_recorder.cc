@@ -0,0 +1,392 @@
+#include "flight_recorder.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "spdlog/fmt/bundled/args.h"
+
+namespace libmagic {
+
+namespace {
+
+constexpr char kMagic[8] = {'F', 'L', 'T', 'R', 'E', 'C', '0', '2'};
+constexpr int kFatalSignals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+// error 日志触发 dump 的最小间隔，避免错误风暴时反复写盘
+constexpr auto kAutoDumpInterval = std::chrono::seconds(5);
+// 截断的记录最多补这么多个占位参数
+constexpr int kMaxMissingArgs = 16;
+// dump 时攒够这么多再 write
+constexpr size_t kDumpWriteBytes = 64 * 1024;
+
+void WriteAll(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n <= 0) return;
+    data += n;
+    len -= n;
+  }
+}
+
+// 按 Slot::data 的布局顺序读取，越界返回 false
+class SlotReader {
+ public:
+  SlotReader(const char* p, size_t n) : p_(p), end_(p + n) {}
+
+  template <typename T>
+  bool Get(T* v) {
+    if (size_t(end_ - p_) < sizeof(T)) return false;
+    memcpy(v, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+  template <typename LenT>
+  bool GetString(fmt::string_view* sv) {
+    LenT len;
+    if (!Get(&len) || size_t(end_ - p_) < len) return false;
+    *sv = fmt::string_view(p_, len);
+    p_ += len;
+    return true;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+}  // namespace
+
+std::atomic<int> FlightRecorder::level_{spdlog::level::off};
+
+FlightRecorder& FlightRecorder::Instance() {
+  static FlightRecorder inst;
+  return inst;
+}
+
+FlightRecorder::~FlightRecorder() { Close(); }
+
+bool FlightRecorder::Open(const std::string& dir, size_t slots,
+                          spdlog::level::level_enum level) {
+  Close();
+  if (slots == 0) return false;
+
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "FlightRecorder mkdir failed: " << dir << " " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  // 匿名映射：记录只在内存里，没有脏页回写，只在 dump 时落盘
+  size_t bytes = kSlotSize + slots * kSlotSize;  // 文件头占一个槽位
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+  if (p == MAP_FAILED) {
+    std::cerr << "FlightRecorder mmap failed: " << bytes << " bytes " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  auto* header = static_cast<FileHeader*>(p);
+  memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->slot_size = kSlotSize;
+  header->slots = static_cast<uint32_t>(slots);
+  header->cursor.store(0, std::memory_order_relaxed);
+  map_bytes_ = bytes;
+
+  dir_ = dir;
+  crash_path_ = dir + "/flight_crash_" + std::to_string(getpid()) + ".ring";
+
+  stop_ = false;
+  dump_thread_ = std::thread(&FlightRecorder::DumpLoop, this);
+  InstallSignalHandlers();
+  header_.store(header, std::memory_order_seq_cst);
+
+  level_.store(level, std::memory_order_relaxed);
+  return true;
+}
+
+void FlightRecorder::Close() {
+  level_.store(spdlog::level::off, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lk(req_mu_);
+    stop_ = true;
+  }
+  req_cv_.notify_all();
+  if (dump_thread_.joinable()) dump_thread_.join();
+
+  std::lock_guard<std::mutex> lk(dump_mu_);
+  FileHeader* header = header_.exchange(nullptr, std::memory_order_seq_cst);
+  if (!header) return;
+  // 摘下之后新的写者进不来，等已经进来的写完
+  while (writers_.load(std::memory_order_seq_cst) > 0) std::this_thread::yield();
+  munmap(header, map_bytes_);
+}
+
+FlightRecorder::Slot* FlightRecorder::BeginSlot(FileHeader* header, uint64_t* seq) {
+  *seq = header->cursor.fetch_add(1, std::memory_order_relaxed);
+  Slot* slot = &SlotsOf(header)[*seq % header->slots];
+  slot->seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return slot;
+}
+
+void FlightRecorder::RenderRecord(const Slot& rec, fmt::memory_buffer& out) {
+  SlotReader r(rec.data, std::min<size_t>(rec.len, sizeof(rec.data)));
+  uint32_t line;
+  fmt::string_view file, room, fmt_str;
+  if (!r.Get(&line) || !r.GetString<uint8_t>(&file) || !r.GetString<uint8_t>(&room) ||
+      !r.GetString<uint16_t>(&fmt_str)) {
+    return;
+  }
+  if (file.size() > 0) fmt::format_to(fmt::appender(out), "[{}:{}] ", file, line);
+
+  // 与 FormatLogContext 相同的格式，房间名取自槽位
+  if (room.size() > 0 || rec.stream >= 0 || rec.fade) {
+    out.push_back('[');
+    const char* sep = "";
+    if (room.size() > 0) {
+      fmt::format_to(fmt::appender(out), "room={}", room);
+      sep = " ";
+    }
+    if (rec.stream >= 0) {
+      fmt::format_to(fmt::appender(out), "{}stream={}", sep, rec.stream);
+      sep = " ";
+    }
+    if (rec.fade) fmt::format_to(fmt::appender(out), "{}fade={}", sep, rec.fade);
+    out.push_back(']');
+    out.push_back(' ');
+  }
+
+  fmt::dynamic_format_arg_store<fmt::format_context> store;
+  int nargs = 0;
+  uint8_t tag;
+  bool ok = true;
+  while (ok && r.Get(&tag)) {
+    switch (tag) {
+      case kArgI64: {
+        int64_t v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgU64: {
+        uint64_t v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgF32: {
+        float v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgF64: {
+        double v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgBool: {
+        bool v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgChar: {
+        char v;
+        if ((ok = r.Get(&v))) store.push_back(v);
+        break;
+      }
+      case kArgPtr: {
+        uint64_t v;
+        if ((ok = r.Get(&v)))
+          store.push_back(reinterpret_cast<const void*>(static_cast<uintptr_t>(v)));
+        break;
+      }
+      case kArgStr: {
+        fmt::string_view v;
+        if ((ok = r.GetString<uint16_t>(&v))) store.push_back(v);
+        break;
+      }
+      default:
+        ok = false;
+        break;
+    }
+    if (ok) nargs++;
+  }
+
+  // 与 spdlog 一致：无参数时原样输出。截断丢掉的参数补占位符；仍然格式化失败
+  // （格式串与参数不符）时输出格式串
+  const size_t mark = out.size();
+  for (int i = 0; nargs > 0 && i <= (rec.truncated ? kMaxMissingArgs : 0); i++) {
+    try {
+      fmt::vformat_to(fmt::appender(out), fmt_str, store);
+      return;
+    } catch (const std::exception&) {
+      out.resize(mark);
+      store.push_back(fmt::string_view("<truncated>"));
+    }
+  }
+  out.append(fmt_str.data(), fmt_str.data() + fmt_str.size());
+}
+
+void FlightRecorder::WriteRecords(const FileHeader* header, int fd, uint32_t room) {
+  const Slot* ring = SlotsOf(header);
+  const uint64_t slots = header->slots;
+  const uint64_t cur = header->cursor.load(std::memory_order_acquire);
+  const uint64_t begin = cur > slots ? cur - slots : 0;
+
+  Slot rec;
+  fmt::memory_buffer out;
+  for (uint64_t i = begin; i < cur; i++) {
+    const Slot& slot = ring[i % slots];
+    // seqlock 读：前后两次 seq 一致才说明拷贝期间没有被改写
+    uint64_t s1 = slot.seq.load(std::memory_order_acquire);
+    if (s1 != i + 1) continue;
+    memcpy(reinterpret_cast<char*>(&rec) + sizeof(rec.seq),
+           reinterpret_cast<const char*>(&slot) + sizeof(slot.seq),
+           sizeof(Slot) - sizeof(slot.seq));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != s1) continue;
+    if (room && rec.room != room) continue;
+
+    // 与 kLogPattern 相同的行格式
+    time_t sec = static_cast<time_t>(rec.time_ns / 1000000000);
+    tm t;
+    localtime_r(&sec, &t);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &t);
+    auto level = static_cast<spdlog::level::level_enum>(
+        std::min<int>(std::max<int>(rec.level, 0), spdlog::level::off));
+    auto name = spdlog::level::to_string_view(level);
+    fmt::format_to(fmt::appender(out), "{}.{:06} <tid:{}> [{}] ", ts,
+                   rec.time_ns % 1000000000 / 1000, rec.thread_id,
+                   fmt::string_view(name.data(), name.size()));
+    RenderRecord(rec, out);
+    out.push_back('\n');
+    if (out.size() >= kDumpWriteBytes) {
+      WriteAll(fd, out.data(), out.size());
+      out.clear();
+    }
+  }
+  WriteAll(fd, out.data(), out.size());
+}
+
+bool FlightRecorder::Decode(const std::string& path, int out_fd) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kSlotSize) {
+    close(fd);
+    return false;
+  }
+  const size_t bytes = st.st_size;
+  void* p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  const auto* header = static_cast<const FileHeader*>(p);
+  const bool ok = memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+                  header->slot_size == kSlotSize && header->slots > 0 &&
+                  bytes >= kSlotSize + size_t(header->slots) * kSlotSize;
+  if (ok) WriteRecords(header, out_fd, 0);
+  munmap(p, bytes);
+  return ok;
+}
+
+std::string FlightRecorder::NewDumpPath(const std::string& room_id) const {
+  static std::atomic<int> counter{0};
+  time_t now = time(nullptr);
+  tm t;
+  localtime_r(&now, &t);
+  char ts[32];
+  strftime(ts, sizeof(ts), "%Y%m%d_%H%M%S", &t);
+  return dir_ + "/flight_" + (room_id.empty() ? "all" : room_id) + "_" + ts + "_" +
+         std::to_string(counter.fetch_add(1)) + ".log";
+}
+
+std::string FlightRecorder::DumpRecent(const std::string& room_id) {
+  std::lock_guard<std::mutex> lk(dump_mu_);
+  // 持有 dump_mu_ 时 Close 不会 munmap
+  FileHeader* header = header_.load(std::memory_order_acquire);
+  if (!header) return "";
+  uint32_t room = 0;
+  if (!room_id.empty()) {
+    room = FindLogRoom(room_id);
+    if (!room) return "";
+  }
+
+  std::string path = NewDumpPath(room_id);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return "";
+  std::string title = "# flight recorder dump room=" + room_id + "\n";
+  WriteAll(fd, title.data(), title.size());
+  WriteRecords(header, fd, room);
+  close(fd);
+  return path;
+}
+
+void FlightRecorder::RequestDump(const std::string& room_id) {
+  std::lock_guard<std::mutex> lk(req_mu_);
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_auto_dump_ < kAutoDumpInterval) return;
+  last_auto_dump_ = now;
+  requests_.push_back(room_id);
+  req_cv_.notify_one();
+}
+
+void FlightRecorder::DumpLoop() {
+  pthread_setname_np(pthread_self(), "flight_dump");
+  std::unique_lock<std::mutex> lk(req_mu_);
+  while (true) {
+    req_cv_.wait(lk, [this] { return stop_ || !requests_.empty(); });
+    if (stop_) break;
+    std::string room_id = std::move(requests_.front());
+    requests_.pop_front();
+    lk.unlock();
+    DumpRecent(room_id);
+    lk.lock();
+  }
+}
+
+void FlightRecorder::OnFatalSignal(int sig) {
+  FlightRecorder& inst = Instance();
+  // 只用 async-signal-safe 的 open / write / close：原样拷出整个映射（文件头 + 槽位），
+  // 不格式化、不分配内存，事后用 Decode（myapp --flight）读
+  if (FileHeader* header = inst.Enter()) {
+    int fd = open(inst.crash_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      WriteAll(fd, reinterpret_cast<const char*>(header), inst.map_bytes_);
+      close(fd);
+    }
+    inst.Leave();
+  }
+  // SA_RESETHAND 已恢复默认处理，重新触发以保留 core dump
+  raise(sig);
+}
+
+void FlightRecorder::InstallSignalHandlers() {
+  static bool installed = false;
+  if (installed) return;
+  installed = true;
+
+  // 独立信号栈（仅安装线程），栈溢出时也能执行处理函数
+  static char alt_stack[64 * 1024];
+  stack_t ss;
+  ss.ss_sp = alt_stack;
+  ss.ss_size = sizeof(alt_stack);
+  ss.ss_flags = 0;
+  sigaltstack(&ss, nullptr);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &FlightRecorder::OnFatalSignal;
+  sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+  for (int sig : kFatalSignals) sigaction(sig, &sa, nullptr);
+}
+
+}  // namespace libmagic
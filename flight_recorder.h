@@ -0,0 +1,301 @@
+#ifndef UTILS_FLIGHT_RECORDER_H_
+#define UTILS_FLIGHT_RECORDER_H_
+
+// 飞行记录仪：在匿名 mmap 内存上保留最近 N 条 debug/info 级日志，
+// 平时不落盘，只在致命信号、显式 DumpRecent 或出现 error 日志时写出；
+// 致命信号时只把映射原样写到 flight_crash_<pid>.ring，不在信号处理函数里格式化。
+// 写入时只拷贝格式串和参数的原始字节（带类型标签），不做 fmt 格式化，
+// 文本在 dump 或 Decode 时才还原。槽位自描述、不含进程内指针，
+// 崩溃时写出的 .ring 文件可离线用 Decode（myapp --flight）读出。
+// 进程被 kill -9 时没有机会写出，记录随之丢失。
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "deferred_log.h"
+#include "log_context.h"
+#include "spdlog/details/os.h"
+#include "spdlog/spdlog.h"
+
+namespace libmagic {
+
+class FlightRecorder {
+ public:
+  static constexpr size_t kSlotSize = 256;
+
+  static FlightRecorder& Instance();
+
+  // 热路径：是否需要记录该级别
+  static bool Accepts(spdlog::level::level_enum level) {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+  static spdlog::level::level_enum level() {
+    return static_cast<spdlog::level::level_enum>(
+        level_.load(std::memory_order_relaxed));
+  }
+
+  // 分配 slots 条记录的环，dump 和崩溃文件写到 dir 下
+  bool Open(const std::string& dir, size_t slots, spdlog::level::level_enum level);
+  void Close();
+
+  template <size_t N, typename... Args>
+  void Append(const spdlog::source_loc& loc, spdlog::level::level_enum level,
+              const char (&fmt_str)[N], const Args&... args);
+
+  // 同步把当前保留的记录写到 dir 下的新文件，返回文件路径（失败返回空串）
+  // room_id 非空时只写该房间的记录
+  std::string DumpRecent(const std::string& room_id);
+  // 异步请求 dump（用于 error 日志触发，有最小间隔），不阻塞调用线程
+  void RequestDump(const std::string& room_id);
+
+  // 离线读取崩溃时写出的 .ring 文件，按时间顺序把记录写入 out_fd
+  static bool Decode(const std::string& path, int out_fd);
+
+ private:
+  // 映射头部（崩溃文件的文件头）
+  struct FileHeader {
+    char magic[8];
+    uint32_t slot_size;
+    uint32_t slots;
+    std::atomic<uint64_t> cursor;  // 已分配的记录序号
+  };
+
+  // 定长槽位：seq 为 序号+1 表示内容完整，0 表示正在写。
+  // data 依次为：u32 行号、u8 长度 + 文件名、u8 长度 + 房间名、u16 长度 + 格式串，
+  // 之后每个参数是 u8 类型标签 + 原始字节（字符串为 u16 长度 + 内容）。
+  // 放不下时截断，截断处之后的参数丢弃
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    int64_t time_ns;     // spdlog::log_clock 纪元起的纳秒数
+    uint64_t thread_id;
+    uint32_t room;       // 进程内的房间 ID，只用于 DumpRecent 按房间过滤
+    int32_t stream;
+    uint32_t fade;
+    int8_t level;
+    uint8_t truncated;   // data 放不下，截断处之后的参数丢弃
+    uint16_t len;        // data 的有效长度
+    char data[kSlotSize - 40];
+  };
+  static_assert(sizeof(Slot) == kSlotSize, "Slot size mismatch");
+
+  // 参数类型标签
+  enum ArgTag : uint8_t {
+    kArgI64 = 1,
+    kArgU64,
+    kArgF32,
+    kArgF64,
+    kArgBool,
+    kArgChar,
+    kArgPtr,
+    kArgStr,
+  };
+
+  // 能按原始字节保存的参数；其余类型（chrono、自定义 formatter 等）整条在调用线程格式化
+  template <typename T>
+  struct IsRawArg
+      : std::integral_constant<
+            bool, std::is_arithmetic<T>::value || std::is_pointer<T>::value ||
+                      deferred::IsStringLike<T>::value ||
+                      (std::is_enum<T>::value && std::is_convertible<T, int>::value)> {};
+
+  // 在 slot->data 上顺序追加，空间不够时截断并忽略之后的内容
+  class SlotWriter {
+   public:
+    explicit SlotWriter(Slot* slot)
+        : begin_(slot->data), p_(slot->data), end_(slot->data + sizeof(slot->data)) {}
+
+    template <typename T>
+    void Put(const T& v) {
+      if (full_ || size_t(end_ - p_) < sizeof(T)) {
+        full_ = true;
+        return;
+      }
+      memcpy(p_, &v, sizeof(T));
+      p_ += sizeof(T);
+    }
+    template <typename LenT>
+    void PutString(const char* s, size_t n) {
+      if (full_ || size_t(end_ - p_) < sizeof(LenT)) {
+        full_ = true;
+        return;
+      }
+      const size_t room = end_ - p_ - sizeof(LenT);
+      if (n > room) {
+        n = room;
+        full_ = true;
+      }
+      n = std::min<size_t>(n, std::numeric_limits<LenT>::max());
+      const LenT len = static_cast<LenT>(n);
+      memcpy(p_, &len, sizeof(len));
+      memcpy(p_ + sizeof(len), s, n);
+      p_ += sizeof(len) + n;
+    }
+    template <typename T>
+    void PutArg(const T& v);
+
+    uint16_t size() const { return static_cast<uint16_t>(p_ - begin_); }
+    bool full() const { return full_; }
+
+   private:
+    template <typename T>
+    void PutTagged(ArgTag tag, const T& v) {
+      if (size_t(end_ - p_) < 1 + sizeof(T)) full_ = true;
+      Put(static_cast<uint8_t>(tag));
+      Put(v);
+    }
+
+    char* begin_;
+    char* p_;
+    char* end_;
+    bool full_{false};
+  };
+
+  FlightRecorder() = default;
+  ~FlightRecorder();
+
+  // 写者（Append、信号处理函数）进出映射：Close 先摘下 header_，
+  // 等进行中的写者全部退出后才 munmap。返回 nullptr 表示未打开
+  FileHeader* Enter() {
+    writers_.fetch_add(1, std::memory_order_seq_cst);
+    FileHeader* header = header_.load(std::memory_order_seq_cst);
+    if (!header) Leave();
+    return header;
+  }
+  void Leave() { writers_.fetch_sub(1, std::memory_order_release); }
+  static Slot* SlotsOf(FileHeader* header) {
+    return reinterpret_cast<Slot*>(reinterpret_cast<char*>(header) + kSlotSize);
+  }
+  static const Slot* SlotsOf(const FileHeader* header) {
+    return reinterpret_cast<const Slot*>(reinterpret_cast<const char*>(header) + kSlotSize);
+  }
+
+  Slot* BeginSlot(FileHeader* header, uint64_t* seq);
+  void EndSlot(Slot* slot, uint64_t seq) {
+    slot->seq.store(seq + 1, std::memory_order_release);
+  }
+
+  // 把有效记录格式化写入 fd，room 非 0 时只写该房间
+  static void WriteRecords(const FileHeader* header, int fd, uint32_t room);
+  // 按 Slot::data 的布局把一条记录还原成 "[file:line] [room=xx ...] msg"
+  static void RenderRecord(const Slot& rec, fmt::memory_buffer& out);
+  // 在 slot->data 上写入二进制记录，返回长度
+  template <size_t N, typename... Args>
+  static uint16_t Encode(Slot* slot, const spdlog::source_loc& loc,
+                         const LogContext& ctx, const char (&fmt_str)[N],
+                         const Args&... args);
+  std::string NewDumpPath(const std::string& room_id) const;
+  void DumpLoop();
+
+  static void OnFatalSignal(int sig);
+  void InstallSignalHandlers();
+
+  static std::atomic<int> level_;
+
+  std::atomic<FileHeader*> header_{nullptr};
+  alignas(64) std::atomic<int> writers_{0};
+  size_t map_bytes_{0};
+  std::string dir_;
+  std::string crash_path_;  // 预先生成，信号处理函数里不拼路径
+
+  std::mutex dump_mu_;  // 串行化 dump
+  std::mutex req_mu_;
+  std::condition_variable req_cv_;
+  std::deque<std::string> requests_;
+  std::chrono::steady_clock::time_point last_auto_dump_;
+  bool stop_{false};
+  std::thread dump_thread_;
+};
+
+template <typename T>
+void FlightRecorder::SlotWriter::PutArg(const T& v) {
+  using D = std::decay_t<T>;
+  if constexpr (std::is_same<D, bool>::value) {
+    PutTagged(kArgBool, v);
+  } else if constexpr (std::is_same<D, char>::value) {
+    PutTagged(kArgChar, v);
+  } else if constexpr (deferred::IsCString<D>::value || deferred::IsStringLike<D>::value) {
+    fmt::string_view sv = deferred::ToCapturable(v);
+    if (size_t(end_ - p_) < 1 + sizeof(uint16_t)) full_ = true;
+    Put(static_cast<uint8_t>(kArgStr));
+    PutString<uint16_t>(sv.data(), sv.size());
+  } else if constexpr (std::is_pointer<D>::value) {
+    PutTagged(kArgPtr, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v)));
+  } else if constexpr (std::is_same<D, float>::value) {
+    PutTagged(kArgF32, v);
+  } else if constexpr (std::is_floating_point<D>::value) {
+    PutTagged(kArgF64, static_cast<double>(v));
+  } else if constexpr (std::is_enum<D>::value) {
+    PutArg(static_cast<std::underlying_type_t<D>>(v));
+  } else if constexpr (std::is_signed<D>::value) {
+    PutTagged(kArgI64, static_cast<int64_t>(v));
+  } else {
+    PutTagged(kArgU64, static_cast<uint64_t>(v));
+  }
+}
+
+template <size_t N, typename... Args>
+uint16_t FlightRecorder::Encode(Slot* slot, const spdlog::source_loc& loc,
+                                const LogContext& ctx, const char (&fmt_str)[N],
+                                const Args&... args) {
+  // 只有 memcpy，不格式化、不分配堆内存
+  SlotWriter w(slot);
+  w.Put(static_cast<uint32_t>(loc.line));
+  const char* file = "";
+  if (!loc.empty()) {
+    const char* slash = strrchr(loc.filename, '/');
+    file = slash ? slash + 1 : loc.filename;
+  }
+  w.PutString<uint8_t>(file, strlen(file));
+  const std::string& room = LogRoomName(ctx.room);
+  w.PutString<uint8_t>(room.data(), room.size());
+  if constexpr ((IsRawArg<std::decay_t<Args>>::value && ...)) {
+    w.PutString<uint16_t>(fmt_str, N - 1);
+    (w.PutArg(args), ...);
+  } else {
+    // 少见的参数类型：在调用线程格式化成一个字符串参数（栈上缓冲，过长才上堆）
+    spdlog::memory_buf_t msg;
+    try {
+      fmt::format_to(fmt::appender(msg), fmt::runtime(fmt_str), args...);
+    } catch (const std::exception&) {
+      msg.clear();
+      msg.append(fmt_str, fmt_str + N - 1);
+    }
+    w.PutString<uint16_t>("{}", 2);
+    w.PutArg(fmt::string_view(msg.data(), msg.size()));
+  }
+  slot->truncated = w.full();
+  return w.size();
+}
+
+template <size_t N, typename... Args>
+void FlightRecorder::Append(const spdlog::source_loc& loc,
+                            spdlog::level::level_enum level,
+                            const char (&fmt_str)[N], const Args&... args) {
+  FileHeader* header = Enter();
+  if (!header) return;
+  const LogContext& ctx = CurrentLogContext();
+  uint64_t seq;
+  Slot* slot = BeginSlot(header, &seq);
+  slot->time_ns = spdlog::log_clock::now().time_since_epoch() / std::chrono::nanoseconds(1);
+  slot->thread_id = spdlog::details::os::thread_id();
+  slot->room = ctx.room;
+  slot->stream = ctx.stream;
+  slot->fade = ctx.fade;
+  slot->level = static_cast<int8_t>(level);
+  slot->len = Encode(slot, loc, ctx, fmt_str, args...);
+  EndSlot(slot, seq);
+  Leave();
+}
+
+}  // namespace libmagic
+
+#endif  // UTILS_FLIGHT_RECORDER_H_
@@ -0,0 +1,395 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "flv_aac.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "logger.h"
+
+namespace {
+
+constexpr int kTagAudio = 8;
+constexpr int kTagVideo = 9;
+constexpr int kTagScript = 18;
+constexpr uint32_t kFlvTagHeaderSize = 11;
+constexpr int kSoundFormatAac = 10;
+// SoundFormat=AAC，其余位（44kHz/16bit/stereo）按规范对 AAC 固定
+constexpr uint8_t kAacSoundByte = 0xAF;
+constexpr int kAacSequenceHeader = 0;
+constexpr int kAacRaw = 1;
+
+const int kSampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                            22050, 16000, 12000, 11025, 8000,  7350};
+
+uint32_t ReadU24(const uint8_t *p) { return (p[0] << 16) | (p[1] << 8) | p[2]; }
+uint32_t ReadU32(const uint8_t *p) { return (uint32_t(p[0]) << 24) | ReadU24(p + 1); }
+
+void WriteU24(uint8_t *p, uint32_t v) {
+  p[0] = v >> 16;
+  p[1] = v >> 8;
+  p[2] = v;
+}
+
+void WriteU32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  WriteU24(p + 1, v);
+}
+
+class BitReader {
+public:
+  BitReader(const uint8_t *data, int size) : data_(data), bits_(size * 8) {}
+
+  uint32_t Read(int n) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++, pos_++) {
+      v <<= 1;
+      if (pos_ < bits_)
+        v |= (data_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1;
+    }
+    return v;
+  }
+  bool overrun() const { return pos_ > bits_; }
+
+private:
+  const uint8_t *data_;
+  int bits_;
+  int pos_ = 0;
+};
+
+int ReadObjectType(BitReader &br) {
+  const int aot = br.Read(5);
+  return aot == 31 ? 32 + static_cast<int>(br.Read(6)) : aot;
+}
+
+int ReadSampleRate(BitReader &br) {
+  const int idx = br.Read(4);
+  if (idx == 0xF)
+    return br.Read(24);
+  return idx < static_cast<int>(sizeof(kSampleRates) / sizeof(kSampleRates[0])) ? kSampleRates[idx]
+                                                                                 : 0;
+}
+
+// 包一个引用 buf 内 [data, data + size) 的 AVPacket。解码器要求负载后有
+// AV_INPUT_BUFFER_PADDING_SIZE 字节可读，切片到了缓冲末尾时只能拷贝一份带填充的
+AVPacket *MakePacket(AVBufferRef *buf, const uint8_t *data, int size, bool *copied) {
+  AVPacket *pkt = av_packet_alloc();
+  if (!pkt)
+    return nullptr;
+  const uint8_t *end = buf->data + buf->size;
+  if (data + size + AV_INPUT_BUFFER_PADDING_SIZE <= end) {
+    pkt->buf = av_buffer_ref(buf);
+    pkt->data = const_cast<uint8_t *>(data);
+    pkt->size = size;
+    *copied = false;
+  } else if (av_new_packet(pkt, size) == 0) {
+    memcpy(pkt->data, data, size);
+    *copied = true;
+  }
+  if (!pkt->buf) {
+    av_packet_free(&pkt);
+    return nullptr;
+  }
+  return pkt;
+}
+
+} // namespace
+
+bool AacConfig::Parse(const uint8_t *data, int size, AacConfig *out) {
+  if (!data || size < 2)
+    return false;
+  BitReader br(data, size);
+  AacConfig cfg;
+  cfg.object_type = ReadObjectType(br);
+  cfg.sample_rate = ReadSampleRate(br);
+  cfg.channels = br.Read(4);
+  // 显式 SBR/PS 信令：后面还有扩展采样率和真正的核心对象类型
+  if (cfg.object_type == 5 || cfg.object_type == 29) {
+    ReadSampleRate(br);
+    ReadObjectType(br);
+  }
+  if (br.overrun() || cfg.object_type == 0 || cfg.sample_rate <= 0 || cfg.channels > 7)
+    return false;
+  cfg.asc.assign(data, data + size);
+  *out = std::move(cfg);
+  return true;
+}
+
+FlvAacDemuxer::~FlvAacDemuxer() {
+  Reset();
+  for (AVPacket *pkt : out_)
+    av_packet_free(&pkt);
+}
+
+bool FlvAacDemuxer::Peek(uint8_t *dst, size_t n) const {
+  if (buffered_ < n)
+    return false;
+  for (const Chunk &c : chunks_) {
+    const size_t take = std::min(n, static_cast<size_t>(c.buf->size - c.pos));
+    memcpy(dst, c.buf->data + c.pos, take);
+    dst += take;
+    n -= take;
+    if (n == 0)
+      break;
+  }
+  return true;
+}
+
+void FlvAacDemuxer::Skip(size_t n) {
+  buffered_ -= n;
+  while (n > 0) {
+    Chunk &c = chunks_.front();
+    const size_t take = std::min(n, static_cast<size_t>(c.buf->size - c.pos));
+    c.pos += take;
+    n -= take;
+    if (c.pos == c.buf->size) {
+      av_buffer_unref(&c.buf);
+      chunks_.pop_front();
+    }
+  }
+}
+
+bool FlvAacDemuxer::Slice(size_t n, AVBufferRef **buf, const uint8_t **data) {
+  const Chunk &front = chunks_.front();
+  if (static_cast<size_t>(front.buf->size - front.pos) >= n) {
+    *buf = av_buffer_ref(front.buf);
+    *data = front.buf->data + front.pos;
+  } else {
+    *buf = av_buffer_alloc(n + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (*buf) {
+      Peek((*buf)->data, n);
+      memset((*buf)->data + n, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+      *data = (*buf)->data;
+    }
+    stats_.joined_tags++;
+  }
+  Skip(n);
+  return *buf != nullptr;
+}
+
+void FlvAacDemuxer::Reset() {
+  for (Chunk &c : chunks_)
+    av_buffer_unref(&c.buf);
+  chunks_.clear();
+  buffered_ = 0;
+  header_checked_ = false;
+}
+
+int64_t FlvAacDemuxer::Unwrap(uint32_t timestamp) {
+  if (!have_ts_) {
+    have_ts_ = true;
+    last_ts_ = timestamp;
+    return ts_epoch_ + timestamp;
+  }
+  // 差值超过半个周期视为跨越回绕：向前跨一次加 2^32，迟到的回绕前数据仍算在上一周期
+  if (timestamp < last_ts_ && last_ts_ - timestamp > 0x80000000u) {
+    ts_epoch_ += int64_t(1) << 32;
+  } else if (timestamp > last_ts_ && timestamp - last_ts_ > 0x80000000u) {
+    return ts_epoch_ - (int64_t(1) << 32) + timestamp;
+  }
+  last_ts_ = timestamp;
+  return ts_epoch_ + timestamp;
+}
+
+bool FlvAacDemuxer::Feed(AVBufferRef *chunk) {
+  if (!chunk || chunk->size <= 0)
+    return true;
+  AVBufferRef *ref = av_buffer_ref(chunk);
+  if (!ref)
+    return false;
+  chunks_.push_back({ref, 0});
+  buffered_ += ref->size;
+
+  if (!header_checked_) {
+    uint8_t head[kFileHeaderSize];
+    if (!Peek(head, 3))
+      return true;
+    if (memcmp(head, "FLV", 3) == 0) {
+      if (!Peek(head, kFileHeaderSize))
+        return true;
+      const uint32_t data_offset = ReadU32(head + 5);
+      if (data_offset < kFileHeaderSize || data_offset > 1024) {
+        LOG_WARN("FlvAacDemuxer bad file header data_offset={}", data_offset);
+        stats_.errors++;
+        Reset();
+        return false;
+      }
+      // 文件头之后紧跟 PreviousTagSize0
+      if (buffered_ < data_offset + 4)
+        return true;
+      Skip(data_offset + 4);
+    }
+    header_checked_ = true;
+  }
+
+  uint8_t head[kTagHeaderSize];
+  while (Peek(head, kTagHeaderSize)) {
+    const int type = head[0] & 0x1f;
+    const bool encrypted = head[0] & 0x20;
+    const uint32_t size = ReadU24(head + 1);
+    const uint32_t timestamp = ReadU24(head + 4) | (uint32_t(head[7]) << 24);
+    if ((type != kTagAudio && type != kTagVideo && type != kTagScript) || size >= kMaxTagSize) {
+      LOG_WARN("FlvAacDemuxer bad tag type={} size={}, dropping {} buffered bytes", type, size,
+               buffered_);
+      stats_.errors++;
+      Reset();
+      // 丢弃后从下一块起按 tag 边界重新开始
+      header_checked_ = true;
+      return false;
+    }
+    // 整个 tag 连同 PreviousTagSize 到齐了再处理
+    if (buffered_ < kTagHeaderSize + size + 4)
+      break;
+    Skip(kTagHeaderSize);
+    stats_.tags++;
+    const int64_t pts = Unwrap(timestamp);
+    if (type == kTagAudio && !encrypted && size > 0) {
+      AVBufferRef *buf = nullptr;
+      const uint8_t *body = nullptr;
+      if (Slice(size, &buf, &body))
+        HandleAudio(buf, body, size, pts);
+      av_buffer_unref(&buf);
+    } else {
+      stats_.skipped_tags++;
+      Skip(size);
+    }
+    uint8_t prev[4];
+    Peek(prev, sizeof(prev));
+    Skip(sizeof(prev));
+    if (ReadU32(prev) != kTagHeaderSize + size)
+      LOG_EVERY_N(warn, 1000, "FlvAacDemuxer PreviousTagSize {} != {}", ReadU32(prev),
+                  kTagHeaderSize + size);
+  }
+  return true;
+}
+
+bool FlvAacDemuxer::FeedAudioTag(AVBufferRef *buf, const uint8_t *data, int size,
+                                 int64_t timestamp_ms) {
+  if (!buf || !data || size <= 0 || data < buf->data || data + size > buf->data + buf->size)
+    return false;
+  stats_.tags++;
+  return HandleAudio(buf, data, size, Unwrap(static_cast<uint32_t>(timestamp_ms)));
+}
+
+bool FlvAacDemuxer::HandleAudio(AVBufferRef *buf, const uint8_t *body, int size, int64_t pts) {
+  const int sound_format = body[0] >> 4;
+  if (sound_format != kSoundFormatAac || size < 2) {
+    LOG_EVERY_N(warn, 1000, "FlvAacDemuxer skip non-AAC audio tag format={} size={}",
+                sound_format, size);
+    stats_.skipped_tags++;
+    return true;
+  }
+
+  if (body[1] == kAacSequenceHeader) {
+    AacConfig config;
+    if (!AacConfig::Parse(body + 2, size - 2, &config)) {
+      LOG_WARN("FlvAacDemuxer bad AudioSpecificConfig size={}", size - 2);
+      stats_.errors++;
+      return false;
+    }
+    stats_.sequence_headers++;
+    if (!(config == config_)) {
+      LOG_INFO("FlvAacDemuxer AAC config aot={} {}Hz {}ch pts={}", config.object_type,
+               config.sample_rate, config.channels, pts);
+      config_ = std::move(config);
+      config_changed_ = true;
+    }
+    return true;
+  }
+
+  if (body[1] != kAacRaw || size == 2) {
+    stats_.skipped_tags++;
+    return true;
+  }
+  // 没有 AudioSpecificConfig 的裸帧无法解码
+  if (!has_config()) {
+    LOG_EVERY_N(warn, 100, "FlvAacDemuxer drop AAC frame before sequence header pts={}", pts);
+    stats_.skipped_tags++;
+    return true;
+  }
+  bool copied = false;
+  AVPacket *pkt = MakePacket(buf, body + 2, size - 2, &copied);
+  if (!pkt) {
+    LOG_ERROR("FlvAacDemuxer alloc packet failed size={}", size - 2);
+    return false;
+  }
+  if (copied)
+    stats_.joined_tags++;
+  pkt->pts = pkt->dts = pts;
+  pkt->flags |= AV_PKT_FLAG_KEY;
+  out_.push_back(pkt);
+  stats_.audio_frames++;
+  return true;
+}
+
+bool FlvAacDemuxer::Receive(AVPacket *out) {
+  if (out_.empty())
+    return false;
+  AVPacket *pkt = out_.front();
+  out_.pop_front();
+  av_packet_move_ref(out, pkt);
+  av_packet_free(&pkt);
+  return true;
+}
+
+bool FlvAacDemuxer::TakeConfigChange() {
+  const bool changed = config_changed_;
+  config_changed_ = false;
+  return changed;
+}
+
+void FlvTag::AppendTo(std::string *out) const {
+  out->append(reinterpret_cast<const char *>(head), head_size);
+  out->append(reinterpret_cast<const char *>(data), size);
+  out->append(reinterpret_cast<const char *>(tail), sizeof(tail));
+}
+
+void FlvAacMuxer::WriteFileHeader(std::string *out) {
+  // 签名、版本 1、只有音频、头长 9，之后是 PreviousTagSize0
+  static const uint8_t kHeader[] = {'F', 'L', 'V', 1, 0x04, 0, 0, 0, 9, 0, 0, 0, 0};
+  out->append(reinterpret_cast<const char *>(kHeader), sizeof(kHeader));
+}
+
+void FlvAacMuxer::Fill(FlvTag *tag, int packet_type, int64_t timestamp_ms) {
+  const uint32_t ts = static_cast<uint32_t>(timestamp_ms);
+  const uint32_t data_size = 2 + tag->size;
+  tag->head[0] = kTagAudio;
+  WriteU24(tag->head + 1, data_size);
+  WriteU24(tag->head + 4, ts & 0xffffff);
+  tag->head[7] = ts >> 24;
+  WriteU24(tag->head + 8, 0);
+  tag->head[11] = kAacSoundByte;
+  tag->head[12] = packet_type;
+  tag->head_size = sizeof(tag->head);
+  WriteU32(tag->tail, kFlvTagHeaderSize + data_size);
+}
+
+void FlvAacMuxer::SequenceHeader(int64_t timestamp_ms, FlvTag *tag) const {
+  av_buffer_unref(&tag->buf);
+  tag->data = config_.asc.data();
+  tag->size = static_cast<int>(config_.asc.size());
+  Fill(tag, kAacSequenceHeader, timestamp_ms);
+}
+
+bool FlvAacMuxer::Frame(const AVPacket *pkt, int64_t timestamp_ms, FlvTag *tag) const {
+  if (!pkt || !pkt->buf || pkt->size <= 0)
+    return false;
+  const uint8_t *data = pkt->data;
+  int size = pkt->size;
+  // ADTS 同步字 0xFFF；protection_absent=0 时头后还有 2 字节 CRC
+  if (size >= 7 && data[0] == 0xFF && (data[1] & 0xF6) == 0xF0) {
+    const int header = (data[1] & 0x01) ? 7 : 9;
+    if (size <= header)
+      return false;
+    data += header;
+    size -= header;
+  }
+  av_buffer_unref(&tag->buf);
+  tag->buf = av_buffer_ref(pkt->buf);
+  if (!tag->buf)
+    return false;
+  tag->data = data;
+  tag->size = size;
+  Fill(tag, kAacRaw, timestamp_ms);
+  return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+// 直播接入的 FLV / RTMP 音频：AAC 以 FLV 音频 tag 到达（一个序列头 + 裸帧），不是 ADTS。
+// 这里不经 avformat（没有每路流的格式上下文和探测开销），直接在内存里拆 tag：
+// 序列头里的 AudioSpecificConfig 交给解码器作 extradata，裸帧带时间戳送处理链，
+// 输出再拼回 FLV tag。输入输出都按缓冲切片引用，不拷贝负载。
+
+// AudioSpecificConfig（ISO 14496-3 1.6.2.1）中用到的字段
+struct AacConfig {
+  int object_type = 0; // 2 = LC，5 = SBR（HE-AAC），29 = PS（HE-AACv2）
+  int sample_rate = 0; // 核心采样率，HE-AAC 为输出的一半
+  int channels = 0;    // 0 = 由码流内的 PCE 给出
+  std::vector<uint8_t> asc; // 原始字节，作解码器 extradata
+
+  static bool Parse(const uint8_t *data, int size, AacConfig *out);
+  bool operator==(const AacConfig &o) const { return asc == o.asc; }
+};
+
+class FlvAacDemuxer {
+public:
+  struct Stats {
+    uint64_t tags = 0;
+    uint64_t audio_frames = 0;
+    uint64_t sequence_headers = 0;
+    uint64_t skipped_tags = 0; // 视频、脚本、非 AAC 音频
+    uint64_t joined_tags = 0;  // 跨输入块、只能拷贝拼接的帧
+    uint64_t errors = 0;       // 格式错误后丢弃已缓冲数据重新同步
+  };
+
+  FlvAacDemuxer() = default;
+  ~FlvAacDemuxer();
+  FlvAacDemuxer(const FlvAacDemuxer &) = delete;
+  FlvAacDemuxer &operator=(const FlvAacDemuxer &) = delete;
+
+  // 一段 FLV 字节流（文件或 HTTP-FLV，可带或不带 9 字节文件头），可在任意位置切开。
+  // chunk 只加引用，整帧落在同一块里时输出包直接引用它
+  bool Feed(AVBufferRef *chunk);
+  // RTMP：已拆好的音频消息，即 FLV 音频 tag 的 body（声音格式字节 + AACPacketType + 数据），
+  // data 须位于 buf 内
+  bool FeedAudioTag(AVBufferRef *buf, const uint8_t *data, int size, int64_t timestamp_ms);
+  // 取出一帧裸 AAC，pts/dts 为毫秒（time_base 1/1000），调用方负责 unref
+  bool Receive(AVPacket *out);
+
+  bool has_config() const { return !config_.asc.empty(); }
+  const AacConfig &config() const { return config_; }
+  // 收到新的（或与之前不同的）序列头后返回一次 true
+  bool TakeConfigChange();
+  const Stats &stats() const { return stats_; }
+
+private:
+  static constexpr int kTagHeaderSize = 11;
+  static constexpr int kFileHeaderSize = 9;
+  static constexpr uint32_t kMaxTagSize = 1 << 24;
+
+  struct Chunk {
+    AVBufferRef *buf;
+    int pos; // 已消费到的位置
+  };
+
+  // 从队首拷出 n 个字节（不消费）；不够返回 false
+  bool Peek(uint8_t *dst, size_t n) const;
+  void Skip(size_t n);
+  // 消费 n 个字节并返回其引用：队首块够用时零拷贝，否则拷贝拼接
+  bool Slice(size_t n, AVBufferRef **buf, const uint8_t **data);
+  void Reset();
+  // 处理一个音频 tag 的 body；body 位于 buf 内
+  bool HandleAudio(AVBufferRef *buf, const uint8_t *body, int size, int64_t pts);
+  int64_t Unwrap(uint32_t timestamp);
+
+  std::deque<Chunk> chunks_;
+  size_t buffered_ = 0;
+  bool header_checked_ = false;
+  std::deque<AVPacket *> out_;
+  AacConfig config_;
+  bool config_changed_ = false;
+  bool have_ts_ = false;
+  uint32_t last_ts_ = 0;
+  int64_t ts_epoch_ = 0; // 32 位毫秒时间戳回绕的累计
+  Stats stats_;
+};
+
+// 一个输出 tag 的三段：头（tag 头 + 音频头）、负载引用、PreviousTagSize。
+// 写 socket 时可直接 writev 三段，负载不拷贝
+struct FlvTag {
+  uint8_t head[13];
+  int head_size = 0;
+  AVBufferRef *buf = nullptr; // 负载所在缓冲的引用，序列头为空（指向 muxer 自己的数据）
+  const uint8_t *data = nullptr;
+  int size = 0;
+  uint8_t tail[4];
+
+  FlvTag() = default;
+  ~FlvTag() { av_buffer_unref(&buf); }
+  FlvTag(const FlvTag &) = delete;
+  FlvTag &operator=(const FlvTag &) = delete;
+
+  size_t bytes() const { return head_size + size + sizeof(tail); }
+  void AppendTo(std::string *out) const;
+};
+
+class FlvAacMuxer {
+public:
+  explicit FlvAacMuxer(const AacConfig &config) : config_(config) {}
+
+  // FLV 文件头（只含音频）+ PreviousTagSize0
+  static void WriteFileHeader(std::string *out);
+  // AAC 序列头 tag，开始推流和配置变化时发；tag 引用本对象的数据，不能比它活得久
+  void SequenceHeader(int64_t timestamp_ms, FlvTag *tag) const;
+  // 一帧 AAC 的 tag，负载引用 pkt 的缓冲；带 ADTS 头的包去掉头。pkt 不是引用计数的返回 false
+  bool Frame(const AVPacket *pkt, int64_t timestamp_ms, FlvTag *tag) const;
+
+  const AacConfig &config() const { return config_; }
+
+private:
+  static void Fill(FlvTag *tag, int packet_type, int64_t timestamp_ms);
+
+  AacConfig config_;
+};
@@ -0,0 +1,515 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "gop_splicer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+#include "logger.h"
+
+namespace {
+
+// 帧率未知时按 25fps 估算包时长
+constexpr AVRational kDefaultFrameRate{25, 1};
+// 拿不到码率时重编码 GOP 的目标码率
+constexpr int64_t kDefaultBitRate = 2000000;
+
+int64_t PacketPts(const AVPacket *pkt) {
+  return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+}
+
+std::string AvError(int ret) {
+  char errbuf[128];
+  av_strerror(ret, errbuf, sizeof(errbuf));
+  return errbuf;
+}
+
+struct Nal {
+  const uint8_t *data;
+  int size;
+};
+
+bool HasNalFraming(AVCodecID codec_id) {
+  return codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_HEVC;
+}
+
+const uint8_t *FindStartCode(const uint8_t *p, const uint8_t *end) {
+  for (; end - p >= 3; p++) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p;
+  }
+  return end;
+}
+
+// 拆出 Annex B 码流中的 NAL（不含起始码和尾部补零）
+std::vector<Nal> SplitAnnexB(const uint8_t *data, int size) {
+  std::vector<Nal> nals;
+  const uint8_t *end = data + size;
+  const uint8_t *p = FindStartCode(data, end);
+  while (p < end) {
+    p += 3;
+    const uint8_t *next = FindStartCode(p, end);
+    const uint8_t *nal_end = next;
+    while (nal_end > p && nal_end[-1] == 0)
+      nal_end--;
+    if (nal_end > p)
+      nals.push_back({p, static_cast<int>(nal_end - p)});
+    p = next;
+  }
+  return nals;
+}
+
+uint32_t ReadBE(const uint8_t *p, int n) {
+  uint32_t v = 0;
+  for (int i = 0; i < n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+// 解析 avcC / hvcC：返回 NAL 长度前缀字节数并取出其中的参数集，格式不对返回 0
+int ParseNalConfig(const AVCodecParameters *par, std::vector<Nal> *param_sets) {
+  const uint8_t *p = par->extradata;
+  const uint8_t *end = p + par->extradata_size;
+  if (!p || par->extradata_size < 7 || p[0] != 1)
+    return 0;
+  auto read_nals = [&](int count) {
+    for (int i = 0; i < count; i++) {
+      if (end - p < 2)
+        return false;
+      const int len = static_cast<int>(ReadBE(p, 2));
+      p += 2;
+      if (end - p < len)
+        return false;
+      param_sets->push_back({p, len});
+      p += len;
+    }
+    return true;
+  };
+
+  int length_size = 0;
+  if (par->codec_id == AV_CODEC_ID_H264) {
+    // 版本 profile 兼容性 level | 长度前缀-1 | SPS 个数 {长度 SPS}... | PPS 个数 {长度 PPS}...
+    length_size = (p[4] & 3) + 1;
+    const int sps_count = p[5] & 0x1f;
+    p += 6;
+    if (!read_nals(sps_count) || p >= end || !read_nals(*p++))
+      return 0;
+  } else {
+    // hvcC：22 字节头（第 21 字节低 2 位为长度前缀-1），之后按 NAL 类型分组
+    if (par->extradata_size < 23)
+      return 0;
+    length_size = (p[21] & 3) + 1;
+    const int arrays = p[22];
+    p += 23;
+    for (int i = 0; i < arrays; i++) {
+      if (end - p < 3)
+        return 0;
+      const int count = static_cast<int>(ReadBE(p + 1, 2));
+      p += 3;
+      if (!read_nals(count))
+        return 0;
+    }
+  }
+  return length_size == 3 ? 0 : length_size;
+}
+
+// 按封装写出 NAL：length_size 为 0 写 4 字节起始码，否则写大端长度前缀
+void AppendNal(const Nal &nal, int length_size, std::vector<uint8_t> *out) {
+  if (length_size == 0) {
+    out->insert(out->end(), {0, 0, 0, 1});
+  } else {
+    for (int i = length_size - 1; i >= 0; i--)
+      out->push_back(static_cast<uint8_t>(nal.size >> (8 * i)));
+  }
+  out->insert(out->end(), nal.data, nal.data + nal.size);
+}
+
+// 用 data 替换包的负载，保留时间戳等属性
+bool ReplacePayload(AVPacket *pkt, const std::vector<uint8_t> &data) {
+  AVPacket *tmp = av_packet_alloc();
+  if (!tmp || av_new_packet(tmp, static_cast<int>(data.size())) < 0 ||
+      av_packet_copy_props(tmp, pkt) < 0) {
+    av_packet_free(&tmp);
+    return false;
+  }
+  memcpy(tmp->data, data.data(), data.size());
+  av_packet_unref(pkt);
+  av_packet_move_ref(pkt, tmp);
+  av_packet_free(&tmp);
+  return true;
+}
+
+} // namespace
+
+GopSplicer::GopSplicer(const AVCodecParameters *par, AVRational time_base,
+                       AVRational frame_rate)
+    : time_base_(time_base), frame_rate_(frame_rate) {
+  par_ = avcodec_parameters_alloc();
+  if (par_ && par)
+    avcodec_parameters_copy(par_, par);
+  if (frame_rate_.num <= 0 || frame_rate_.den <= 0)
+    frame_rate_ = kDefaultFrameRate;
+  frame_duration_ =
+      std::max<int64_t>(1, av_rescale_q(1, av_inv_q(frame_rate_), time_base_));
+
+  if (par_ && HasNalFraming(par_->codec_id) && par_->extradata_size > 0) {
+    std::vector<Nal> param_sets;
+    nal_length_size_ = ParseNalConfig(par_, &param_sets);
+    // extradata 不是 avcC/hvcC 时就是 Annex B 的参数集
+    if (nal_length_size_ == 0)
+      param_sets = SplitAnnexB(par_->extradata, par_->extradata_size);
+    for (const auto &nal : param_sets)
+      AppendNal(nal, nal_length_size_, &param_sets_);
+    LOG_INFO("GopSplicer source framing={} param_sets={} bytes",
+             nal_length_size_ ? "length-prefixed" : "annexb", param_sets_.size());
+  }
+}
+
+GopSplicer::~GopSplicer() {
+  FreePackets(&current_.packets);
+  for (auto &gop : closed_)
+    FreePackets(&gop.packets);
+  for (auto *pkt : out_)
+    av_packet_free(&pkt);
+  avcodec_free_context(&dec_ctx_);
+  avcodec_parameters_free(&par_);
+}
+
+void GopSplicer::FreePackets(std::vector<AVPacket *> *packets) {
+  for (auto *pkt : *packets)
+    av_packet_free(&pkt);
+  packets->clear();
+}
+
+void GopSplicer::AddFade(const VideoFade &fade) {
+  if (!fade.anchored())
+    return;
+  fades_.push_back(fade);
+}
+
+void GopSplicer::SetAudioClock(int64_t pts, AVRational time_base) {
+  if (pts == AV_NOPTS_VALUE)
+    return;
+  const int64_t clock = av_rescale_q(pts, time_base, time_base_);
+  if (audio_clock_ == AV_NOPTS_VALUE || clock > audio_clock_)
+    audio_clock_ = clock;
+  Decide(false);
+}
+
+bool GopSplicer::Push(const AVPacket *pkt) {
+  AVPacket *ref = av_packet_alloc();
+  if (!ref || av_packet_ref(ref, pkt) < 0) {
+    av_packet_free(&ref);
+    LOG_ERROR("GopSplicer ref packet failed pts={}", pkt->pts);
+    return false;
+  }
+  const bool key = pkt->flags & AV_PKT_FLAG_KEY;
+  // 超长 GOP 截断：后半段不以关键帧开头，只能直通
+  if ((key && !current_.packets.empty()) || current_.packets.size() >= kMaxBufferedPackets)
+    CloseGop();
+  if (current_.packets.empty())
+    current_.keyframe = key;
+
+  const int64_t pts = PacketPts(ref);
+  if (pts != AV_NOPTS_VALUE) {
+    const int64_t end = pts + (ref->duration > 0 ? ref->duration : frame_duration_);
+    current_.begin_pts =
+        current_.begin_pts == AV_NOPTS_VALUE ? pts : std::min(current_.begin_pts, pts);
+    current_.end_pts =
+        current_.end_pts == AV_NOPTS_VALUE ? end : std::max(current_.end_pts, end);
+  }
+  current_.packets.push_back(ref);
+  buffered_++;
+  Decide(false);
+  return true;
+}
+
+bool GopSplicer::Receive(AVPacket *out) {
+  if (out_.empty())
+    return false;
+  AVPacket *pkt = out_.front();
+  out_.pop_front();
+  av_packet_move_ref(out, pkt);
+  av_packet_free(&pkt);
+  return true;
+}
+
+void GopSplicer::Flush() {
+  CloseGop();
+  Decide(true);
+  LOG_INFO("GopSplicer flushed: copied_gops={} reencoded_gops={} copied_packets={} "
+           "encoded_packets={} forced_gops={}",
+           stats_.copied_gops, stats_.reencoded_gops, stats_.copied_packets,
+           stats_.encoded_packets, stats_.forced_gops);
+}
+
+void GopSplicer::CloseGop() {
+  if (current_.packets.empty())
+    return;
+  closed_.push_back(std::move(current_));
+  current_ = Gop();
+}
+
+void GopSplicer::Decide(bool force) {
+  while (!closed_.empty()) {
+    Gop &gop = closed_.front();
+    // 音频还没走到 GOP 末尾：覆盖它的斜坡可能还没锚定
+    const bool waiting = audio_clock_ != AV_NOPTS_VALUE && gop.end_pts != AV_NOPTS_VALUE &&
+                         audio_clock_ < gop.end_pts;
+    if (waiting && !force) {
+      if (buffered_ <= kMaxBufferedPackets)
+        break;
+      stats_.forced_gops++;
+      LOG_EVERY_N(warn, 100, "GopSplicer audio clock stalled, deciding GOP at pts={} "
+                  "buffered={}", gop.begin_pts, buffered_);
+    }
+    buffered_ -= gop.packets.size();
+    if (gop.keyframe && Overlaps(gop) && Reencode(gop)) {
+      FreePackets(&gop.packets);
+      resend_params_ = true;
+    } else {
+      EmitCopy(&gop);
+    }
+
+    // 斜坡在这个 GOP 之内就结束了，之后的 GOP 不会再用到
+    const int64_t end = gop.end_pts;
+    fades_.erase(std::remove_if(fades_.begin(), fades_.end(),
+                                [&](const VideoFade &fade) {
+                                  return fade.Finished(end, time_base_);
+                                }),
+                 fades_.end());
+    closed_.pop_front();
+  }
+  if (fades_.empty() && dec_ctx_)
+    avcodec_free_context(&dec_ctx_);
+}
+
+bool GopSplicer::Overlaps(const Gop &gop) const {
+  if (gop.begin_pts == AV_NOPTS_VALUE)
+    return false;
+  for (const auto &fade : fades_) {
+    if (fade.Overlaps(gop.begin_pts, gop.end_pts, time_base_))
+      return true;
+  }
+  return false;
+}
+
+void GopSplicer::EmitCopy(Gop *gop) {
+  // 重编码 GOP 的带内参数集替换了解码器里的源参数集，回到直通时在关键帧前补回来
+  if (resend_params_ && gop->keyframe) {
+    resend_params_ = false;
+    if (!param_sets_.empty() && !PrependParamSets(gop->packets.front()))
+      LOG_ERROR("GopSplicer resend parameter sets failed pts={}", gop->begin_pts);
+  }
+  stats_.copied_gops++;
+  stats_.copied_packets += gop->packets.size();
+  for (auto *pkt : gop->packets)
+    out_.push_back(pkt);
+  gop->packets.clear();
+}
+
+bool GopSplicer::Reencode(const Gop &gop) {
+  if (!dec_ctx_ && !OpenDecoder())
+    return false;
+  std::vector<AVFrame *> frames;
+  bool ok = DecodeGop(gop, &frames);
+  int faded = 0;
+  if (ok) {
+    for (auto &fade : fades_)
+      faded += fade.ProcessBatch(frames.data(), static_cast<int>(frames.size()), time_base_);
+    ok = EncodeGop(gop, frames);
+  }
+  for (auto *frame : frames)
+    av_frame_free(&frame);
+  if (ok) {
+    stats_.reencoded_gops++;
+    LOG_INFO("GopSplicer re-encoded GOP pts=[{}, {}) frames={} faded={}", gop.begin_pts,
+             gop.end_pts, gop.packets.size(), faded);
+  }
+  return ok;
+}
+
+bool GopSplicer::OpenDecoder() {
+  if (!par_)
+    return false;
+  const AVCodec *codec = avcodec_find_decoder(par_->codec_id);
+  if (!codec) {
+    LOG_ERROR("GopSplicer no decoder for codec_id={}", par_->codec_id);
+    return false;
+  }
+  dec_ctx_ = avcodec_alloc_context3(codec);
+  if (!dec_ctx_ || avcodec_parameters_to_context(dec_ctx_, par_) < 0) {
+    LOG_ERROR("GopSplicer alloc decoder context failed");
+    avcodec_free_context(&dec_ctx_);
+    return false;
+  }
+  dec_ctx_->pkt_timebase = time_base_;
+  int ret = avcodec_open2(dec_ctx_, codec, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("GopSplicer open decoder failed: {}", AvError(ret));
+    avcodec_free_context(&dec_ctx_);
+    return false;
+  }
+  return true;
+}
+
+bool GopSplicer::DecodeGop(const Gop &gop, std::vector<AVFrame *> *frames) {
+  AVFrame *frame = av_frame_alloc();
+  if (!frame)
+    return false;
+  auto drain = [&]() {
+    while (true) {
+      int ret = avcodec_receive_frame(dec_ctx_, frame);
+      if (ret < 0)
+        return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+      AVFrame *decoded = av_frame_alloc();
+      if (!decoded) {
+        av_frame_unref(frame);
+        return false;
+      }
+      av_frame_move_ref(decoded, frame);
+      if (decoded->pts == AV_NOPTS_VALUE)
+        decoded->pts = decoded->best_effort_timestamp;
+      frames->push_back(decoded);
+    }
+  };
+
+  bool ok = true;
+  for (const auto *pkt : gop.packets) {
+    int ret = avcodec_send_packet(dec_ctx_, pkt);
+    if (ret < 0 || !drain()) {
+      LOG_WARN("GopSplicer decode failed pts={}: {}", pkt->pts, AvError(ret));
+      ok = false;
+      break;
+    }
+  }
+  if (ok)
+    ok = avcodec_send_packet(dec_ctx_, nullptr) >= 0 && drain();
+  // 冲刷到 EOF 后复位，下一个 GOP 从关键帧重新开始
+  avcodec_flush_buffers(dec_ctx_);
+  av_frame_free(&frame);
+
+  if (ok && frames->size() != gop.packets.size()) {
+    LOG_WARN("GopSplicer decoded {} frames from {} packets (open GOP?), copy instead",
+             frames->size(), gop.packets.size());
+    ok = false;
+  }
+  return ok;
+}
+
+bool GopSplicer::EncodeGop(const Gop &gop, const std::vector<AVFrame *> &frames) {
+  const AVCodec *codec = avcodec_find_encoder(par_->codec_id);
+  if (!codec) {
+    LOG_ERROR("GopSplicer no encoder for codec_id={}", par_->codec_id);
+    return false;
+  }
+  AVCodecContext *enc_ctx = avcodec_alloc_context3(codec);
+  if (!enc_ctx) {
+    LOG_ERROR("GopSplicer alloc encoder context failed");
+    return false;
+  }
+  const AVFrame *first = frames.front();
+  enc_ctx->width = first->width;
+  enc_ctx->height = first->height;
+  enc_ctx->pix_fmt = static_cast<AVPixelFormat>(first->format);
+  enc_ctx->time_base = time_base_;
+  enc_ctx->framerate = frame_rate_;
+  enc_ctx->sample_aspect_ratio = dec_ctx_->sample_aspect_ratio;
+  enc_ctx->color_range = dec_ctx_->color_range;
+  // 整个 GOP 只有开头一个 IDR，没有 B 帧，输出顺序即显示顺序
+  enc_ctx->gop_size = static_cast<int>(frames.size()) + 1;
+  enc_ctx->max_b_frames = 0;
+  // 按原 GOP 的实际码率编码，拼接处码率不跳变；到黑的帧自然更省
+  enc_ctx->bit_rate = par_->bit_rate > 0 ? par_->bit_rate : kDefaultBitRate;
+  int64_t bytes = 0;
+  for (const auto *pkt : gop.packets)
+    bytes += pkt->size;
+  if (gop.end_pts > gop.begin_pts)
+    enc_ctx->bit_rate = av_rescale(bytes * 8, time_base_.den,
+                                   (gop.end_pts - gop.begin_pts) * time_base_.num);
+  // 不设 AV_CODEC_FLAG_GLOBAL_HEADER：参数集随 IDR 带在码流里，解码器在拼接点无需换 extradata
+
+  int ret = avcodec_open2(enc_ctx, codec, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("GopSplicer open encoder failed {}x{} fmt={}: {}", enc_ctx->width,
+              enc_ctx->height, first->format, AvError(ret));
+    avcodec_free_context(&enc_ctx);
+    return false;
+  }
+
+  std::vector<AVPacket *> encoded;
+  AVPacket *pkt = av_packet_alloc();
+  auto drain = [&]() {
+    while (true) {
+      int r = avcodec_receive_packet(enc_ctx, pkt);
+      if (r < 0)
+        return r == AVERROR(EAGAIN) || r == AVERROR_EOF;
+      AVPacket *p = av_packet_alloc();
+      if (!p) {
+        av_packet_unref(pkt);
+        return false;
+      }
+      av_packet_move_ref(p, pkt);
+      encoded.push_back(p);
+    }
+  };
+  bool ok = pkt != nullptr;
+  for (size_t i = 0; ok && i < frames.size(); i++) {
+    frames[i]->pict_type = i == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    ret = avcodec_send_frame(enc_ctx, frames[i]);
+    ok = ret >= 0 && drain();
+  }
+  if (ok) {
+    ret = avcodec_send_frame(enc_ctx, nullptr);
+    ok = ret >= 0 && drain();
+  }
+  av_packet_free(&pkt);
+  avcodec_free_context(&enc_ctx);
+  if (!ok || encoded.empty()) {
+    LOG_ERROR("GopSplicer encode GOP pts={} failed: {}", gop.begin_pts, AvError(ret));
+    FreePackets(&encoded);
+    return false;
+  }
+
+  // dts 从原 GOP 首包的 dts 开始，保持原来的解码延迟：与前一个直通 GOP 的 dts 单调衔接，
+  // 且最后一包的 dts 与原 GOP 相同，也不会越过下一个 GOP
+  int64_t min_pts = encoded.front()->pts;
+  for (const auto *p : encoded)
+    min_pts = std::min(min_pts, p->pts);
+  const AVPacket *head = gop.packets.front();
+  const int64_t first_dts = head->dts != AV_NOPTS_VALUE ? head->dts : PacketPts(head);
+  const int64_t delay = std::max<int64_t>(0, min_pts - first_dts);
+  // 编码器输出 Annex B，源码流为 avcC/hvcC 时改写成同样长度的长度前缀
+  if (nal_length_size_ > 0) {
+    std::vector<uint8_t> data;
+    for (auto *p : encoded) {
+      data.clear();
+      for (const auto &nal : SplitAnnexB(p->data, p->size))
+        AppendNal(nal, nal_length_size_, &data);
+      if (!ReplacePayload(p, data)) {
+        LOG_ERROR("GopSplicer convert GOP pts={} to length-prefixed failed", gop.begin_pts);
+        FreePackets(&encoded);
+        return false;
+      }
+    }
+  }
+  for (auto *p : encoded) {
+    p->dts = p->pts - delay;
+    p->stream_index = head->stream_index;
+    if (p->duration <= 0)
+      p->duration = frame_duration_;
+    out_.push_back(p);
+  }
+  stats_.encoded_packets += encoded.size();
+  return true;
+}
+
+bool GopSplicer::PrependParamSets(AVPacket *pkt) {
+  std::vector<uint8_t> data(param_sets_);
+  data.insert(data.end(), pkt->data, pkt->data + pkt->size);
+  return ReplacePayload(pkt, data);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/rational.h>
+}
+
+#include "video_fade.h"
+
+// 视频直通：平时以 GOP 为单位用 av_packet_ref 原样转发输入包（不拷数据），
+// 只有与视频淡入淡出斜坡重叠的 GOP 才解码 -> VideoFade -> 重新编码，在关键帧处拼接。
+// 一个 GOP 在下一个关键帧到来时收齐；斜坡要等第一个淡入淡出音频包才锚定，
+// 所以还要等音频时钟越过 GOP 末尾（SetAudioClock）才决定它直通还是重编码。
+// 重编码的 GOP 各用一个新编码器：首帧强制 IDR、不含 B 帧、参数集放在码流里；
+// 输出按源码流的封装写（extradata 为 avcC/hvcC 时转成长度前缀，否则 Annex B），
+// 重编码 GOP 之后的第一个直通关键帧前补上源参数集，解码器切回源参数。dts 沿用原 GOP 首包的解码延迟，
+// 与前后直通的包单调衔接。开放 GOP 的前导 B 帧解不出时该 GOP 退回直通（不做效果）。
+// 非线程安全，与 RoomPipeline 同在一个线程上使用。
+class GopSplicer {
+public:
+  struct Stats {
+    uint64_t copied_gops = 0;
+    uint64_t reencoded_gops = 0;
+    uint64_t copied_packets = 0;
+    uint64_t encoded_packets = 0;
+    uint64_t forced_gops = 0; // 缓冲超限、未等到音频时钟就决定的 GOP
+  };
+
+  // par 为输入视频流参数，time_base 为输入包的时间基；frame_rate 用于估算缺失的包时长
+  GopSplicer(const AVCodecParameters *par, AVRational time_base, AVRational frame_rate);
+  ~GopSplicer();
+  GopSplicer(const GopSplicer &) = delete;
+  GopSplicer &operator=(const GopSplicer &) = delete;
+
+  // 已锚定的视频斜坡（拷贝一份，调用方的实例可随时释放）
+  void AddFade(const VideoFade &fade);
+  // 已处理到的音频 pts；从未设置时 GOP 收齐即决定（纯视频）
+  void SetAudioClock(int64_t pts, AVRational time_base);
+
+  // 输入一个视频包（引用，不拷贝数据）；失败返回 false
+  bool Push(const AVPacket *pkt);
+  // 取出一个待写出的包（时间基同输入），调用方负责 unref；没有返回 false
+  bool Receive(AVPacket *out);
+  // 输入结束：剩余的 GOP 全部决定，之后可继续 Receive
+  void Flush();
+
+  const Stats &stats() const { return stats_; }
+  size_t buffered_packets() const { return buffered_; }
+
+private:
+  struct Gop {
+    std::vector<AVPacket *> packets;
+    int64_t begin_pts = AV_NOPTS_VALUE;
+    int64_t end_pts = AV_NOPTS_VALUE; // 最后一帧的结束时刻
+    bool keyframe = false;            // 以关键帧开头；流开头缺关键帧的残段只能直通
+  };
+
+  void CloseGop();
+  void Decide(bool force);
+  bool Overlaps(const Gop &gop) const;
+  void EmitCopy(Gop *gop);
+  bool Reencode(const Gop &gop);
+  bool OpenDecoder();
+  bool DecodeGop(const Gop &gop, std::vector<AVFrame *> *frames);
+  bool EncodeGop(const Gop &gop, const std::vector<AVFrame *> &frames);
+  bool PrependParamSets(AVPacket *pkt);
+  static void FreePackets(std::vector<AVPacket *> *packets);
+
+  // 约 10 秒 @30fps：音频长时间停滞时不无限缓冲视频
+  static constexpr size_t kMaxBufferedPackets = 300;
+
+  AVCodecParameters *par_ = nullptr;
+  AVRational time_base_;
+  AVRational frame_rate_;
+  int64_t frame_duration_; // time_base_ 下一帧的时长
+
+  std::deque<VideoFade> fades_;
+  int64_t audio_clock_ = AV_NOPTS_VALUE; // time_base_
+  Gop current_;
+  std::deque<Gop> closed_;
+  std::deque<AVPacket *> out_;
+  size_t buffered_ = 0; // current_ + closed_ 中的包数
+
+  int nal_length_size_ = 0;          // 源码流 NAL 长度前缀的字节数，0 为 Annex B
+  std::vector<uint8_t> param_sets_;  // 源参数集（取自 extradata），已按源封装编码
+  bool resend_params_ = false;       // 上一个决定的 GOP 是重编码的
+
+  AVCodecContext *dec_ctx_ = nullptr; // 有斜坡时才打开，斜坡用完即释放
+  Stats stats_;
+};
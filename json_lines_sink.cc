@@ -0,0 +1,72 @@
+#include "json_lines_sink.h"
+
+#include "log_context.h"
+
+namespace libmagic {
+
+namespace {
+
+void AppendEscaped(spdlog::memory_buf_t& dest, spdlog::string_view_t s) {
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        dest.append(spdlog::string_view_t("\\\""));
+        break;
+      case '\\':
+        dest.append(spdlog::string_view_t("\\\\"));
+        break;
+      case '\n':
+        dest.append(spdlog::string_view_t("\\n"));
+        break;
+      case '\r':
+        dest.append(spdlog::string_view_t("\\r"));
+        break;
+      case '\t':
+        dest.append(spdlog::string_view_t("\\t"));
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          fmt::format_to(fmt::appender(dest), "\\u{:04x}", c);
+        } else {
+          dest.push_back(c);
+        }
+    }
+  }
+}
+
+void AppendString(spdlog::memory_buf_t& dest, const char* key,
+                  spdlog::string_view_t value) {
+  fmt::format_to(fmt::appender(dest), ",\"{}\":\"", key);
+  AppendEscaped(dest, value);
+  dest.push_back('"');
+}
+
+}  // namespace
+
+JsonLinesSink::JsonLinesSink(const std::string& path) { file_.open(path, false); }
+
+void JsonLinesSink::sink_it_(const spdlog::details::log_msg& msg) {
+  buf_.clear();
+  const int64_t ts_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            msg.time.time_since_epoch())
+                            .count();
+  fmt::format_to(fmt::appender(buf_), "{{\"ts_us\":{},\"tid\":{}", ts_us,
+                 msg.thread_id);
+  AppendString(buf_, "level", spdlog::level::to_string_view(msg.level));
+  if (!msg.source.empty()) {
+    AppendString(buf_, "file", msg.source.filename);
+    fmt::format_to(fmt::appender(buf_), ",\"line\":{}", msg.source.line);
+  }
+  if (const LogContext* ctx = FormattingLogContext()) {
+    if (ctx->room) AppendString(buf_, "room", LogRoomName(ctx->room));
+    if (ctx->stream >= 0) fmt::format_to(fmt::appender(buf_), ",\"stream\":{}", ctx->stream);
+    if (ctx->fade) fmt::format_to(fmt::appender(buf_), ",\"fade\":{}", ctx->fade);
+  }
+  AppendString(buf_, "msg", msg.payload);
+  buf_.append(spdlog::string_view_t("}\n"));
+  file_.write(buf_);
+}
+
+void JsonLinesSink::flush_() { file_.flush(); }
+
+}  // namespace libmagic
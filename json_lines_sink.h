@@ -0,0 +1,30 @@
+#ifndef UTILS_JSON_LINES_SINK_H_
+#define UTILS_JSON_LINES_SINK_H_
+
+// JSON-lines sink：每条日志一行 JSON，供日志采集系统直接解析。
+// 日志上下文（room / stream / fade）作为独立字段输出，不拼进 msg。
+
+#include <mutex>
+#include <string>
+
+#include "spdlog/details/file_helper.h"
+#include "spdlog/sinks/base_sink.h"
+
+namespace libmagic {
+
+class JsonLinesSink : public spdlog::sinks::base_sink<std::mutex> {
+ public:
+  explicit JsonLinesSink(const std::string& path);
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg& msg) override;
+  void flush_() override;
+
+ private:
+  spdlog::details::file_helper file_;
+  spdlog::memory_buf_t buf_;
+};
+
+}  // namespace libmagic
+
+#endif  // UTILS_JSON_LINES_SINK_H_
@@ -0,0 +1,439 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "load_generator.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "av_metrics.h"
+#include "edf_scheduler.h"
+#include "logger.h"
+#include "numa_topology.h"
+#include "room_pipeline.h"
+#include "synthetic_aac.h"
+
+using namespace std::chrono;
+
+namespace {
+
+// 合成输入循环使用的帧数（约 11 秒）
+constexpr int kSourceFrames = 500;
+constexpr int kSamplesPerFrame = 1024;
+// edf 不限速时最多积压的任务数（每个工作线程）
+constexpr int kUnpacedQueueDepth = 4;
+
+struct WorkerStats {
+  std::vector<float> latency_us;
+  uint64_t frames = 0;
+  uint64_t fades = 0;
+  uint64_t misses = 0;
+  uint64_t pool_allocations = 0;
+  uint64_t hibernations = 0;
+  uint64_t resident_bytes = 0;
+  uint64_t degrade_transitions = 0;
+  int degraded_rooms = 0;
+};
+
+struct LoadRoom {
+  std::unique_ptr<RoomPipeline> pipeline;
+  int64_t next_frame = 0;
+  int64_t stagger = 0; // 错开各房间的淡入淡出计划
+  std::chrono::nanoseconds latency_target{0};
+};
+
+// edf 模式下一个房间的全部状态；同一房间的任务串行执行，统计不需要加锁
+struct EdfRoom {
+  const LoadOptions *opt = nullptr;
+  const std::vector<std::string> *source = nullptr;
+  LoadRoom room;
+  WorkerStats st;
+  AVPacket out;
+  EdfScheduler::Room *handle = nullptr;
+};
+
+RoomPipeline::Config MakeRoomConfig(const LoadOptions &opt, int r, int numa_node) {
+  RoomPipeline::Config cfg;
+  cfg.room_id = "load_" + std::to_string(r);
+  cfg.sample_rate = opt.sample_rate;
+  cfg.channels = opt.channels;
+  cfg.time_base = {1, opt.sample_rate};
+  cfg.pool_arena_bytes = opt.pool_arena_kb << 10;
+  cfg.hibernate_after_ms = opt.hibernate_after_ms;
+  cfg.lag_budget_ms = opt.lag_budget_ms;
+  cfg.numa_node = numa_node;
+  return cfg;
+}
+
+nanoseconds LatencyTarget(const LoadOptions &opt, int r, nanoseconds period) {
+  if (opt.latency_ms.empty())
+    return period;
+  return milliseconds(opt.latency_ms[r % opt.latency_ms.size()]);
+}
+
+// 处理房间的第 n 帧（按计划先触发淡入淡出），返回处理完成时刻
+steady_clock::time_point ProcessFrame(const LoadOptions &opt,
+                                      const std::vector<std::string> &source,
+                                      LoadRoom &lr, int64_t n, AVPacket *out,
+                                      WorkerStats &st) {
+  RoomPipeline &room = *lr.pipeline;
+  // 从触发淡入淡出开始计时：建滤镜图、冲刷上一个编码器都算进这一帧的延迟
+  auto t0 = steady_clock::now();
+  if (opt.fade_every_frames > 0 && (n + lr.stagger * 37) % opt.fade_every_frames == 0 &&
+      n > 0) {
+    bool fade_in = (n / opt.fade_every_frames) % 2 == 0;
+    if (room.StartFade(fade_in ? AudioAfade::FADE_IN : AudioAfade::FADE_OUT,
+                       opt.fade_frames))
+      st.fades++;
+  }
+
+  const std::string &frame = source[n % source.size()];
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = reinterpret_cast<uint8_t *>(const_cast<char *>(frame.data()));
+  pkt.size = static_cast<int>(frame.size());
+  pkt.pts = pkt.dts = n * kSamplesPerFrame;
+
+  bool has_out = room.ProcessAudio(&pkt, out);
+  while (has_out) {
+    av_packet_unref(out);
+    has_out = room.ReceiveAudio(out);
+  }
+  auto t1 = steady_clock::now();
+  st.latency_us.push_back(duration<float, std::micro>(t1 - t0).count());
+  st.frames++;
+  return t1;
+}
+
+void CollectRoom(RoomPipeline &room, WorkerStats &st) {
+  st.pool_allocations += room.pool().allocations();
+  st.hibernations += room.hibernations();
+  st.resident_bytes += room.ResidentBytes();
+  st.degrade_transitions += room.degrade_transitions();
+  st.degraded_rooms += room.degrade_level() != RoomPipeline::DEGRADE_NONE;
+  AvMetrics::Instance().RemoveRoom(room.config().room_id);
+}
+
+double CpuSeconds() {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+double Percentile(const std::vector<float> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+void WriteReport(const std::string &path, const LoadReport &r) {
+  std::ofstream f(path);
+  f << fmt::format(
+      "{{\"rooms\": {}, \"threads\": {}, \"scheduler\": \"{}\", \"target_speed\": {}, "
+      "\"wall_seconds\": {:.3f}, \"cpu_seconds\": {:.3f}, \"frames\": {}, "
+      "\"fades\": {}, \"deadline_misses\": {}, \"steals\": {}, \"numa_nodes\": {}, \"remote_tasks\": {}, "
+      "\"pool_allocations\": {}, "
+      "\"hibernations\": {}, \"resident_bytes_per_room\": {:.0f}, "
+      "\"degrade_transitions\": {}, \"degraded_rooms\": {}, "
+      "\"realtime_factor\": {:.4f}, \"rooms_per_core\": {:.2f}, \"p50_us\": {:.1f}, "
+      "\"p99_us\": {:.1f}, \"p999_us\": {:.1f}, \"max_us\": {:.1f}}}\n",
+      r.rooms, r.threads, r.scheduler, r.target_speed, r.wall_seconds, r.cpu_seconds,
+      r.frames, r.fades, r.deadline_misses, r.steals, r.numa_nodes, r.remote_tasks,
+      r.pool_allocations, r.hibernations,
+      r.resident_bytes_per_room, r.degrade_transitions, r.degraded_rooms,
+      r.realtime_factor, r.rooms_per_core, r.p50_us, r.p99_us, r.p999_us, r.max_us);
+}
+
+} // namespace
+
+bool ParseLoadOptions(int argc, char **argv, int first, LoadOptions *options) {
+  // std::stoi 等遇到非数字或越界会抛异常，当作参数错误由调用方打印用法
+  try {
+    for (int i = first; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc)
+        return false;
+      std::string val = argv[++i];
+      if (arg == "--rooms") {
+        options->rooms = std::max(1, std::stoi(val));
+      } else if (arg == "--speed") {
+        options->speed = std::max(0.0, std::stod(val));
+      } else if (arg == "--seconds") {
+        options->seconds = std::stod(val);
+      } else if (arg == "--threads") {
+        options->threads = std::max(0, std::stoi(val));
+      } else if (arg == "--fade-every") {
+        options->fade_every_frames = std::max(0, std::stoi(val));
+      } else if (arg == "--fade-frames") {
+        options->fade_frames = std::max(1, std::stoi(val));
+      } else if (arg == "--lag-budget-ms") {
+        options->lag_budget_ms = std::stoi(val);
+      } else if (arg == "--hibernate-ms") {
+        options->hibernate_after_ms = std::stoi(val);
+      } else if (arg == "--arena-kb") {
+        options->pool_arena_kb = std::stoul(val);
+      } else if (arg == "--scheduler") {
+        if (val != "threads" && val != "edf")
+          return false;
+        options->scheduler = val;
+      } else if (arg == "--latency-ms") {
+        options->latency_ms.clear();
+        size_t pos = 0;
+        while (pos <= val.size()) {
+          size_t comma = std::min(val.find(',', pos), val.size());
+          options->latency_ms.push_back(std::max(0, std::stoi(val.substr(pos, comma - pos))));
+          pos = comma + 1;
+        }
+      } else if (arg == "--cpus") {
+        if (NumaTopology::ParseCpuList(val).empty())
+          return false;
+        options->cpus = val;
+      } else if (arg == "--report") {
+        options->report_path = val;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  } catch (const std::logic_error &) {
+    return false;
+  }
+}
+
+bool LoadGenerator::Run(LoadReport *report) {
+  const LoadOptions &opt = options_;
+  std::vector<std::string> source =
+      GenerateAdtsFrames(opt.sample_rate, opt.channels, kSourceFrames);
+  if (source.empty()) {
+    LOG_ERROR("LoadGenerator synthesize AAC input failed");
+    return false;
+  }
+
+  int threads = opt.threads > 0 ? opt.threads
+                                : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, opt.rooms);
+  // 倍速下帧间隔按比例缩短；不限速时不等待、不统计截止时间
+  const bool paced = opt.speed > 0;
+  const nanoseconds period(
+      paced ? static_cast<int64_t>(1e9 * kSamplesPerFrame / opt.sample_rate / opt.speed)
+            : 0);
+  const bool edf = opt.scheduler == "edf";
+
+  LOG_INFO("LoadGenerator start rooms={} threads={} speed={} seconds={} "
+           "fade_every={} fade_frames={} scheduler={}",
+           opt.rooms, threads, opt.speed, opt.seconds, opt.fade_every_frames,
+           opt.fade_frames, opt.scheduler);
+
+  // threads 模式按工作线程统计，edf 模式按房间统计
+  std::vector<WorkerStats> stats(edf ? opt.rooms : threads);
+  uint64_t steals = 0;
+  const auto start = steady_clock::now() + milliseconds(100);
+  const auto end = start + duration_cast<nanoseconds>(duration<double>(opt.seconds));
+  const double cpu_begin = CpuSeconds();
+
+  // 指定了 CPU 集合时各工作线程按节点分组绑核
+  const NumaTopology &numa = NumaTopology::Instance();
+  const std::vector<int> cpus = NumaTopology::ParseCpuList(opt.cpus);
+  const std::vector<int> placed = numa.SortByNode(cpus);
+  uint64_t remote_tasks = 0;
+
+  auto worker = [&](int w) {
+    int node = -1;
+    if (!cpus.empty()) {
+      int cpu = placed[static_cast<size_t>(w) * placed.size() / threads % placed.size()];
+      if (NumaTopology::PinCurrentThread({cpu}))
+        node = numa.NodeOfCpu(cpu);
+      else
+        LOG_WARN("LoadGenerator pin worker {} to cpu {} failed", w, cpu);
+    }
+    // 本线程负责的房间：room % threads == w；在本线程上构造，状态按首次写入落在本节点
+    std::vector<LoadRoom> rooms;
+    for (int r = w; r < opt.rooms; r += threads) {
+      LoadRoom lr;
+      lr.pipeline = std::make_unique<RoomPipeline>(MakeRoomConfig(opt, r, node));
+      lr.stagger = static_cast<int64_t>(rooms.size());
+      lr.latency_target = LatencyTarget(opt, r, period);
+      rooms.push_back(std::move(lr));
+    }
+
+    // 按到达时间排序的小顶堆；各房间相位错开，避免同时到达
+    using Due = std::pair<steady_clock::time_point, size_t>;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+    for (size_t i = 0; i < rooms.size(); i++) {
+      due.push({start + period * (w + i * threads) / opt.rooms, i});
+    }
+
+    WorkerStats &st = stats[w];
+    AVPacket out;
+    av_init_packet(&out);
+    std::this_thread::sleep_until(start);
+    while (true) {
+      auto [arrive, idx] = due.top();
+      due.pop();
+      if (paced) {
+        if (arrive >= end)
+          break;
+        std::this_thread::sleep_until(arrive);
+      } else if (steady_clock::now() >= end) {
+        break;
+      }
+
+      LoadRoom &lr = rooms[idx];
+      auto done = ProcessFrame(opt, source, lr, lr.next_frame++, &out, st);
+      if (paced && done > arrive + lr.latency_target)
+        st.misses++;
+      // 不限速时步进 1ns，只用来让各房间轮流处理
+      due.push({arrive + (paced ? period : nanoseconds(1)), idx});
+    }
+    for (auto &lr : rooms)
+      CollectRoom(*lr.pipeline, st);
+  };
+
+  // edf：本线程只负责按到达时间投递，处理交给调度器的工作线程
+  auto run_edf = [&]() {
+    std::vector<std::unique_ptr<EdfRoom>> rooms;
+    // 调度器声明在房间之后、先析构：先停工作线程，再释放房间
+    EdfScheduler::Options so;
+    so.threads = threads;
+    so.cpus = cpus;
+    EdfScheduler sched(so);
+    for (int r = 0; r < opt.rooms; r++) {
+      auto er = std::make_unique<EdfRoom>();
+      er->opt = &opt;
+      er->source = &source;
+      er->room.stagger = r;
+      er->room.latency_target = LatencyTarget(opt, r, period);
+      av_init_packet(&er->out);
+      er->handle = sched.AddRoom("load_" + std::to_string(r), er->room.latency_target);
+      // 管线作为该房间的第一个任务在其主线程上构造，首次写入落在房间所在节点
+      int node = sched.node(er->handle);
+      sched.SubmitAt(er->handle, steady_clock::now(), [er = er.get(), r, node] {
+        er->room.pipeline =
+            std::make_unique<RoomPipeline>(MakeRoomConfig(*er->opt, r, node));
+      });
+      rooms.push_back(std::move(er));
+    }
+    sched.Drain();
+
+    using Due = std::pair<steady_clock::time_point, size_t>;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+    for (size_t i = 0; i < rooms.size(); i++)
+      due.push({start + period * i / opt.rooms, i});
+
+    std::this_thread::sleep_until(start);
+    while (true) {
+      auto [arrive, idx] = due.top();
+      due.pop();
+      if (paced) {
+        if (arrive >= end)
+          break;
+        std::this_thread::sleep_until(arrive);
+      } else {
+        if (steady_clock::now() >= end)
+          break;
+        while (sched.inflight() > threads * kUnpacedQueueDepth)
+          std::this_thread::yield();
+      }
+
+      EdfRoom *er = rooms[idx].get();
+      int64_t n = er->room.next_frame++;
+      // 压测时钟按倍速缩放，截止时间直接按到达时刻给出，不从 PTS 推算
+      auto deadline = (paced ? arrive : steady_clock::now()) + er->room.latency_target;
+      sched.SubmitAt(er->handle, deadline, [er, n] {
+        ProcessFrame(*er->opt, *er->source, er->room, n, &er->out, er->st);
+      });
+      due.push({arrive + (paced ? period : nanoseconds(1)), idx});
+    }
+    sched.Drain();
+
+    steals = sched.steals();
+    remote_tasks = sched.remote_tasks();
+    for (size_t i = 0; i < rooms.size(); i++) {
+      WorkerStats &st = stats[i];
+      st = std::move(rooms[i]->st);
+      st.misses = paced ? sched.deadline_misses(rooms[i]->handle) : 0;
+      CollectRoom(*rooms[i]->room.pipeline, st);
+    }
+  };
+
+  if (edf) {
+    run_edf();
+  } else {
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; w++)
+      workers.emplace_back(worker, w);
+    for (auto &t : workers)
+      t.join();
+  }
+
+  LoadReport r;
+  r.rooms = opt.rooms;
+  r.threads = threads;
+  r.target_speed = opt.speed;
+  r.scheduler = opt.scheduler;
+  r.steals = steals;
+  r.numa_nodes = numa.nodes();
+  r.remote_tasks = remote_tasks;
+  r.wall_seconds = duration<double>(std::min(steady_clock::now(), end) - start).count();
+  r.cpu_seconds = CpuSeconds() - cpu_begin;
+  std::vector<float> all;
+  for (auto &st : stats) {
+    r.frames += st.frames;
+    r.fades += st.fades;
+    r.deadline_misses += st.misses;
+    r.pool_allocations += st.pool_allocations;
+    r.hibernations += st.hibernations;
+    r.degrade_transitions += st.degrade_transitions;
+    r.degraded_rooms += st.degraded_rooms;
+    r.resident_bytes_per_room += st.resident_bytes;
+    all.insert(all.end(), st.latency_us.begin(), st.latency_us.end());
+  }
+  r.resident_bytes_per_room /= opt.rooms;
+  std::sort(all.begin(), all.end());
+  const double media_seconds =
+      static_cast<double>(r.frames) * kSamplesPerFrame / opt.sample_rate;
+  if (r.wall_seconds > 0)
+    r.realtime_factor = media_seconds / opt.rooms / r.wall_seconds;
+  if (r.cpu_seconds > 0)
+    r.rooms_per_core = media_seconds / r.cpu_seconds;
+  r.p50_us = Percentile(all, 0.5);
+  r.p99_us = Percentile(all, 0.99);
+  r.p999_us = Percentile(all, 0.999);
+  r.max_us = all.empty() ? 0 : all.back();
+
+  LOG_INFO("LoadGenerator done rooms={} frames={} fades={} misses={} rtf={:.3f} "
+           "rooms_per_core={:.1f} p50={:.1f}us p99={:.1f}us p999={:.1f}us",
+           r.rooms, r.frames, r.fades, r.deadline_misses, r.realtime_factor,
+           r.rooms_per_core, r.p50_us, r.p99_us, r.p999_us);
+  std::cout << fmt::format(
+                   "rooms={} threads={} scheduler={} speed={} frames={} fades={} "
+                   "deadline_misses={} ({:.3f}%) steals={} numa_nodes={} remote_tasks={}\n"
+                   "realtime_factor={:.3f} rooms_per_core={:.1f} "
+                   "cpu={:.2f}s wall={:.2f}s pool_allocations={}\n"
+                   "hibernations={} resident_bytes_per_room={:.0f} "
+                   "degrade_transitions={} degraded_rooms={}\nlatency p50={:.1f}us p99={:.1f}us "
+                   "p999={:.1f}us max={:.1f}us",
+                   r.rooms, r.threads, r.scheduler, r.target_speed, r.frames, r.fades,
+                   r.deadline_misses,
+                   r.frames ? 100.0 * r.deadline_misses / r.frames : 0.0, r.steals,
+                   r.numa_nodes, r.remote_tasks,
+                   r.realtime_factor, r.rooms_per_core, r.cpu_seconds,
+                   r.wall_seconds, r.pool_allocations, r.hibernations,
+                   r.resident_bytes_per_room, r.degrade_transitions,
+                   r.degraded_rooms, r.p50_us, r.p99_us, r.p999_us, r.max_us)
+            << std::endl;
+  if (!opt.report_path.empty())
+    WriteReport(opt.report_path, r);
+  if (report)
+    *report = r;
+  return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 多房间压测：合成 N 路 AAC 房间流，按实时或 N 倍速送入 RoomPipeline，
+// 按计划触发淡入/淡出，统计可持续的实时倍率、逐帧截止时间丢失和处理延迟分位数，
+// 用于评估单机/单核可承载的房间数，以及在上线前发现性能回退。
+struct LoadOptions {
+  int rooms = 100;
+  double speed = 1.0;          // 1 = 实时，N = N 倍速，0 = 不限速
+  double seconds = 60;         // 压测时长（墙钟）
+  int threads = 0;             // 工作线程数，0 = 硬件线程数
+  int fade_every_frames = 500; // 每个房间每隔多少帧触发一次淡入/淡出，0 不触发
+  int fade_frames = 200;       // 每次淡入/淡出持续帧数
+  int sample_rate = 44100;
+  int channels = 2;
+  size_t pool_arena_kb = 0;    // 每个房间缓冲池的预映射内存区，0 = 直接用堆
+  int hibernate_after_ms = 5000; // 房间空闲多久后休眠，小于 0 不休眠
+  int lag_budget_ms = 200;       // 过载降级的滞后预算，小于等于 0 关闭
+  // threads：房间按序号静态分给工作线程，各线程按到达顺序处理；
+  // edf：所有房间交给 EdfScheduler，按截止时间最早优先跨线程调度
+  std::string scheduler = "threads";
+  // 各房间的输出延迟目标（毫秒），按房间序号轮流取值；截止时间 = 到达时刻 + 目标。
+  // 为空时取一个帧间隔，即下一帧到达前必须处理完
+  std::vector<int> latency_ms;
+  // 工作线程可用的 CPU 列表，如 "0-7,16-23"；非空时各工作线程按 NUMA 节点分组绑核，
+  // 房间状态在所在节点上分配。空 = 不绑核（edf 模式下绑到进程可用的全部 CPU）
+  std::string cpus;
+  std::string report_path;     // 非空时把结果写成 JSON
+};
+
+struct LoadReport {
+  int rooms = 0;
+  int threads = 0;
+  double target_speed = 0;
+  double wall_seconds = 0;
+  double cpu_seconds = 0;
+  uint64_t frames = 0;
+  uint64_t fades = 0;
+  std::string scheduler;
+  uint64_t deadline_misses = 0; // 帧处理完成时已晚于截止时间
+  uint64_t steals = 0;          // edf：跨线程窃取的任务数
+  int numa_nodes = 0;
+  uint64_t remote_tasks = 0;    // edf：跑在房间节点之外的任务数
+  uint64_t pool_allocations = 0; // 各房间缓冲池新建缓冲总数，稳态下应与时长无关
+  uint64_t hibernations = 0;
+  uint64_t degrade_transitions = 0;
+  int degraded_rooms = 0; // 结束时仍处于降级状态的房间数
+  double resident_bytes_per_room = 0; // 结束时各房间常驻内存估算的平均值
+  double realtime_factor = 0;   // 每个房间平均每秒墙钟处理的媒体秒数
+  double rooms_per_core = 0;    // 每个 CPU 核可承载的实时房间数
+  double p50_us = 0;
+  double p99_us = 0;
+  double p999_us = 0;
+  double max_us = 0;
+};
+
+// 解析 "--rooms N --speed X ..." 形式的参数，从 argv[first] 开始；
+// --latency-ms 接受逗号分隔的列表，如 "20,80"
+bool ParseLoadOptions(int argc, char **argv, int first, LoadOptions *options);
+
+class LoadGenerator {
+public:
+  explicit LoadGenerator(const LoadOptions &options) : options_(options) {}
+
+  // 阻塞运行到结束；合成输入失败返回 false
+  bool Run(LoadReport *report);
+
+private:
+  LoadOptions options_;
+};
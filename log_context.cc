@@ -0,0 +1,113 @@
+#include "log_context.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace libmagic {
+
+namespace {
+
+std::mutex g_rooms_mu;
+std::unordered_map<std::string, uint32_t> g_room_ids;
+// 下标为 ID，只增不删，sink 线程无锁读取
+std::atomic<const std::string*> g_room_names[kMaxLogRooms];
+uint32_t g_next_room = 1;
+
+std::atomic<uint32_t> g_next_fade{1};
+
+thread_local const LogContext* tls_formatting_ctx = nullptr;
+
+const std::string kEmpty;
+
+}  // namespace
+
+uint32_t InternLogRoom(const std::string& room_id) {
+  if (room_id.empty()) return 0;
+  std::lock_guard<std::mutex> lk(g_rooms_mu);
+  auto it = g_room_ids.find(room_id);
+  if (it != g_room_ids.end()) return it->second;
+  if (g_next_room >= kMaxLogRooms) return 0;
+
+  uint32_t id = g_next_room++;
+  g_room_ids.emplace(room_id, id);
+  g_room_names[id].store(new std::string(room_id), std::memory_order_release);
+  return id;
+}
+
+uint32_t FindLogRoom(const std::string& room_id) {
+  std::lock_guard<std::mutex> lk(g_rooms_mu);
+  auto it = g_room_ids.find(room_id);
+  return it == g_room_ids.end() ? 0 : it->second;
+}
+
+const std::string& LogRoomName(uint32_t id) {
+  if (id == 0 || id >= kMaxLogRooms) return kEmpty;
+  const std::string* name = g_room_names[id].load(std::memory_order_acquire);
+  return name ? *name : kEmpty;
+}
+
+uint32_t NextLogFadeId() {
+  return g_next_fade.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ---- LogRoomFilter ----
+
+std::atomic<bool> LogRoomFilter::enabled_{false};
+std::atomic<uint64_t> LogRoomFilter::bits_[kMaxLogRooms / 64];
+
+void LogRoomFilter::Set(const std::vector<std::string>& rooms) {
+  if (rooms.empty()) {
+    Clear();
+    return;
+  }
+  // 先登记房间名，过滤条件可以早于房间创建
+  std::vector<uint64_t> bits(kMaxLogRooms / 64, 0);
+  bits[0] = 1;  // room == 0 始终放行
+  for (const auto& room : rooms) {
+    uint32_t id = InternLogRoom(room);
+    if (id) bits[id >> 6] |= uint64_t(1) << (id & 63);
+  }
+  for (size_t i = 0; i < bits.size(); i++) {
+    bits_[i].store(bits[i], std::memory_order_relaxed);
+  }
+  enabled_.store(true, std::memory_order_release);
+}
+
+void LogRoomFilter::Clear() { enabled_.store(false, std::memory_order_release); }
+
+// ---- sink 侧格式化 ----
+
+const LogContext* FormattingLogContext() { return tls_formatting_ctx; }
+
+void SetFormattingLogContext(const LogContext* ctx) { tls_formatting_ctx = ctx; }
+
+void FormatLogContext(const LogContext& ctx, spdlog::memory_buf_t& dest) {
+  if (ctx.empty()) return;
+  dest.push_back('[');
+  const char* sep = "";
+  if (ctx.room) {
+    fmt::format_to(fmt::appender(dest), "room={}", LogRoomName(ctx.room));
+    sep = " ";
+  }
+  if (ctx.stream >= 0) {
+    fmt::format_to(fmt::appender(dest), "{}stream={}", sep, ctx.stream);
+    sep = " ";
+  }
+  if (ctx.fade) fmt::format_to(fmt::appender(dest), "{}fade={}", sep, ctx.fade);
+  dest.push_back(']');
+  dest.push_back(' ');
+}
+
+void LogContextFlag::format(const spdlog::details::log_msg&, const std::tm&,
+                            spdlog::memory_buf_t& dest) {
+  // 非延迟模式下 sink 不在后台线程，拿不到记录的上下文，输出为空
+  if (const LogContext* ctx = FormattingLogContext()) FormatLogContext(*ctx, dest);
+}
+
+std::unique_ptr<spdlog::formatter> NewLogFormatter(const std::string& pattern) {
+  auto formatter = std::make_unique<spdlog::pattern_formatter>();
+  formatter->add_flag<LogContextFlag>('&').set_pattern(pattern);
+  return formatter;
+}
+
+}  // namespace libmagic
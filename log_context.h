@@ -0,0 +1,97 @@
+#ifndef UTILS_LOG_CONTEXT_H_
+#define UTILS_LOG_CONTEXT_H_
+
+// 日志上下文：room_id / stream_index / fade id 以整数 ID 的形式挂在线程上，
+// 随每条记录写入环形缓冲区，只在 sink 格式化时才还原成文本。
+// 业务代码用 ScopedLogContext 设置，LOG_* 调用处无需再拼接 room_id。
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "spdlog/pattern_formatter.h"
+
+namespace libmagic {
+
+struct LogContext {
+  uint32_t room = 0;    // InternLogRoom 返回的 ID，0 表示未设置
+  int32_t stream = -1;  // 流索引，-1 表示未设置
+  uint32_t fade = 0;    // 淡入淡出实例 ID，0 表示未设置
+
+  bool empty() const { return room == 0 && stream < 0 && fade == 0; }
+};
+
+// room ID 上限（同时是过滤位图的大小）；超出后新房间不再带上下文
+constexpr uint32_t kMaxLogRooms = 1 << 16;
+
+// 房间名 -> ID，同名返回同一个 ID；ID 不回收
+uint32_t InternLogRoom(const std::string& room_id);
+// 只查不建，未登记返回 0
+uint32_t FindLogRoom(const std::string& room_id);
+// ID -> 房间名，未知 ID 返回空串
+const std::string& LogRoomName(uint32_t id);
+// 分配一个新的淡入淡出实例 ID
+uint32_t NextLogFadeId();
+
+inline thread_local LogContext tls_log_context;
+
+inline const LogContext& CurrentLogContext() { return tls_log_context; }
+
+// 作用域内覆盖当前线程的上下文；ctx 中未设置的字段沿用外层的值
+class ScopedLogContext {
+ public:
+  explicit ScopedLogContext(const LogContext& ctx) : saved_(tls_log_context) {
+    if (ctx.room) tls_log_context.room = ctx.room;
+    if (ctx.stream >= 0) tls_log_context.stream = ctx.stream;
+    if (ctx.fade) tls_log_context.fade = ctx.fade;
+  }
+  ~ScopedLogContext() { tls_log_context = saved_; }
+
+  ScopedLogContext(const ScopedLogContext&) = delete;
+  ScopedLogContext& operator=(const ScopedLogContext&) = delete;
+
+ private:
+  LogContext saved_;
+};
+
+// 按房间过滤输出：未开启时全部放行；开启后只放行位图中的房间，
+// 不属于任何房间的记录（room == 0）始终放行
+class LogRoomFilter {
+ public:
+  static bool Allowed(uint32_t room) {
+    if (!enabled_.load(std::memory_order_relaxed)) return true;
+    return (bits_[room >> 6].load(std::memory_order_relaxed) >> (room & 63)) & 1;
+  }
+  static void Set(const std::vector<std::string>& rooms);
+  static void Clear();
+
+ private:
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint64_t> bits_[kMaxLogRooms / 64];
+};
+
+// sink 侧：正在格式化的记录所带的上下文（由后台线程在写 sink 前设置）
+const LogContext* FormattingLogContext();
+void SetFormattingLogContext(const LogContext* ctx);
+
+// 把上下文追加成 "[room=xx stream=1 fade=3] "，空上下文不输出
+void FormatLogContext(const LogContext& ctx, spdlog::memory_buf_t& dest);
+
+// pattern 中的 %& 标志：输出当前记录的上下文
+class LogContextFlag : public spdlog::custom_flag_formatter {
+ public:
+  void format(const spdlog::details::log_msg& msg, const std::tm& tm_time,
+              spdlog::memory_buf_t& dest) override;
+  std::unique_ptr<custom_flag_formatter> clone() const override {
+    return std::make_unique<LogContextFlag>();
+  }
+};
+
+// 创建支持 %& 的 pattern formatter
+std::unique_ptr<spdlog::formatter> NewLogFormatter(const std::string& pattern);
+
+}  // namespace libmagic
+
+#endif  // UTILS_LOG_CONTEXT_H_
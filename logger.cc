@@ -1,15 +1,56 @@
 #include "logger.h"
 
+#include "json_lines_sink.h"
+
 #ifdef _WIN32
 #include <direct.h>
 #endif
 #include <time.h>
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
 namespace libmagic {
 
+std::atomic<int> Logger::module_levels_[static_cast<int>(LogModule::kCount)];
+std::atomic<int> Logger::gate_levels_[static_cast<int>(LogModule::kCount)];
+
+// %& 为日志上下文（room / stream / fade），未设置时为空
+const char* const kLogPattern = "%Y-%m-%d %H:%M:%S.%f <tid:%t> [%l] [%s:%#] %&%v";
+
+namespace {
+
+const char* const kModuleNames[] = {"default", "main", "afade", "metrics"};
+static_assert(sizeof(kModuleNames) / sizeof(kModuleNames[0]) ==
+                  static_cast<size_t>(LogModule::kCount),
+              "kModuleNames must match LogModule");
+
+// 接受 spdlog 的全部级别名：trace debug info warn/warning err/error critical off
+bool ParseLevel(const std::string& name, spdlog::level::level_enum* level) {
+  // from_str 对不认识的名字也返回 off，要和真正的 "off" 区分开
+  spdlog::level::level_enum lvl = spdlog::level::from_str(name);
+  if (lvl == spdlog::level::off && name != "off") return false;
+  *level = lvl;
+  return true;
+}
+
+bool ParseModule(const std::string& name, LogModule* module) {
+  for (int i = 0; i < static_cast<int>(LogModule::kCount); i++) {
+    if (name == kModuleNames[i]) {
+      *module = static_cast<LogModule>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+const char* LogModuleName(LogModule module) {
+  return kModuleNames[static_cast<int>(module)];
+}
+
 inline int NowDateToInt() {
   time_t now;
   time(&now);
@@ -53,7 +94,7 @@ inline std::string GetCurrentLogPath() {
 }
 
 bool Logger::Init(const string& level, const string& path,
-                   int port, bool console, bool reopen) {
+                   int port, bool console, bool reopen, bool deferred) {
   // should create the folder if not exist
   const std::string log_dir = path;
   const std::string logger_name_prefix =
@@ -62,22 +103,7 @@ bool Logger::Init(const string& level, const string& path,
   try {
     if (logger_ && !reopen) {
       // 只更新日志等级
-      if (level == "trace") {
-        logger_->set_level(spdlog::level::trace);
-        logger_->flush_on(spdlog::level::trace);
-      } else if (level == "debug") {
-        logger_->set_level(spdlog::level::debug);
-        logger_->flush_on(spdlog::level::debug);
-      } else if (level == "info") {
-        logger_->set_level(spdlog::level::info);
-        logger_->flush_on(spdlog::level::info);
-      } else if (level == "warn") {
-        logger_->set_level(spdlog::level::warn);
-        logger_->flush_on(spdlog::level::warn);
-      } else if (level == "error") {
-        logger_->set_level(spdlog::level::err);
-        logger_->flush_on(spdlog::level::err);
-      }
+      SetLevels(level);
 
       std::cout << "Logger config updated without reopening file." << std::endl;
       return true;
@@ -89,45 +115,57 @@ bool Logger::Init(const string& level, const string& path,
     const std::string logger_name =
         logger_name_prefix + std::to_string(date) + "_" + std::to_string(time);
 
-    if (console)
-      // logger_ = spdlog::stdout_color_st(logger_name); // single thread
-      // console output faster
-      logger_ = spdlog::stdout_logger_st(
-          logger_name);  // single thread console output faster
-    else
+    // 先让后台线程把旧 logger 的记录写完
+    deferred::Backend::Instance().Stop();
+
+    RotatingFileOptions file_options = file_options_;
+    file_options.dir = log_dir;
+    file_options.base_name = logger_name;
+    file_options.archive_prefix = logger_name_prefix;
+
+    // 实际的 sink 都挂在一个 dist_sink 下，AddJsonSink 可以在别的线程写日志时加 sink
+    spdlog::sink_ptr sink;
+    if (console) {
+      sink = std::make_shared<spdlog::sinks::stdout_sink_mt>();
+    } else {
       // m_logger =
       // spdlog::create_async<spdlog::sinks::basic_file_sink_mt>(logger_name,
       // log_dir + "/" + logger_name + ".log"); // only one log file
-      logger_ = spdlog::create_async<spdlog::sinks::rotating_file_sink_mt>(
-          logger_name, log_dir + "/" + logger_name + ".log", 100 * 1024 * 1024,
-          10);  // multi part log files, with every part 500M, max 10 files
-
-    // custom format
-    std::ostringstream oss;
-    oss << "%Y-%m-%d %H:%M:%S.%f <tid:%t> [%l] [%s:%#] %v";
-    logger_->set_pattern(oss.str());  // with
-                                                                    // timestamp,
-                                                                    // thread_id,
-                                                                    // filename
-                                                                    // and line
-                                                                    // number
-
-    if (level == "trace") {
-      logger_->set_level(spdlog::level::trace);
-      logger_->flush_on(spdlog::level::trace);
-    } else if (level == "debug") {
-      logger_->set_level(spdlog::level::debug);
-      logger_->flush_on(spdlog::level::debug);
-    } else if (level == "info") {
-      logger_->set_level(spdlog::level::info);
-      logger_->flush_on(spdlog::level::info);
-    } else if (level == "warn") {
-      logger_->set_level(spdlog::level::warn);
-      logger_->flush_on(spdlog::level::warn);
-    } else if (level == "error") {
-      logger_->set_level(spdlog::level::err);
-      logger_->flush_on(spdlog::level::err);
+      // multi part log files, rotated parts are gzipped in the background
+      sink = std::make_shared<BufferedRotatingSink>(file_options);
     }
+    std::vector<spdlog::sink_ptr> sinks{sink};
+
+    if (deferred) {
+      // 只有后台日志线程写 sink，logger 本身无需异步
+      sinks_ = std::make_shared<spdlog::sinks::dist_sink_mt>(sinks);
+      logger_ = std::make_shared<spdlog::logger>(logger_name, sinks_);
+    } else {
+      // 默认不让业务线程阻塞在日志 I/O 上：队列满时覆盖最旧的消息
+      const deferred::OverflowPolicy policy = queue_options_.async_overflow;
+      if (policy == deferred::OverflowPolicy::kBlock) {
+        logger_ = spdlog::create_async<spdlog::sinks::dist_sink_mt>(logger_name, sinks);
+      } else {
+        if (policy == deferred::OverflowPolicy::kDropNewest)
+          std::cerr << "Async logger cannot drop newest, overwriting oldest instead"
+                    << std::endl;
+        logger_ = spdlog::create_async_nb<spdlog::sinks::dist_sink_mt>(logger_name,
+                                                                       sinks);
+      }
+      sinks_ = std::static_pointer_cast<spdlog::sinks::dist_sink_mt>(
+          logger_->sinks().front());
+    }
+
+    // custom format: with timestamp, thread_id, filename and line number
+    logger_->set_formatter(NewLogFormatter(kLogPattern));
+    // 只有 error 立即刷盘，其余攒在 sink 的写缓冲里：延迟模式由后台线程空闲时写出，
+    // 非延迟模式每秒 flush 一次。flush 级别不随日志级别变化
+    logger_->flush_on(spdlog::level::err);
+    if (!deferred) spdlog::flush_every(std::chrono::seconds(1));
+
+    SetLevels(level);
+
+    if (deferred) deferred::Backend::Instance().Start(logger_, queue_options_);
   } catch (const spdlog::spdlog_ex& ex) {
     std::cout << "Log initialization failed: " << ex.what() << std::endl;
     return false;
@@ -136,9 +174,106 @@ bool Logger::Init(const string& level, const string& path,
   return true;
 }
 
-Logger::Logger() {}
+bool Logger::SetLevels(const string& spec) {
+  bool ok = true;
+  std::istringstream iss(spec);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    if (item.empty()) continue;
+    size_t eq = item.find('=');
+    spdlog::level::level_enum lvl;
+    if (eq == std::string::npos) {
+      // 全局级别：更新所有未单独设置的模块
+      if (!ParseLevel(item, &lvl)) {
+        ok = false;
+        continue;
+      }
+      for (int i = 0; i < static_cast<int>(LogModule::kCount); i++) {
+        if (!module_overridden_[i].load(std::memory_order_relaxed))
+          module_levels_[i].store(lvl, std::memory_order_relaxed);
+      }
+    } else {
+      LogModule module;
+      if (!ParseModule(item.substr(0, eq), &module) ||
+          !ParseLevel(item.substr(eq + 1), &lvl)) {
+        ok = false;
+        continue;
+      }
+      SetModuleLevel(module, lvl);
+    }
+  }
+  if (!ok) std::cout << "Invalid log level spec: " << spec << std::endl;
+  ApplyLoggerLevel();
+  return ok;
+}
+
+void Logger::SetModuleLevel(LogModule module, spdlog::level::level_enum level) {
+  int idx = static_cast<int>(module);
+  module_overridden_[idx].store(true, std::memory_order_relaxed);
+  module_levels_[idx].store(level, std::memory_order_relaxed);
+  ApplyLoggerLevel();
+}
+
+void Logger::ApplyLoggerLevel() {
+  int min_level = spdlog::level::off;
+  const int recorder_level = FlightRecorder::level();
+  for (int i = 0; i < static_cast<int>(LogModule::kCount); i++) {
+    int lvl = module_levels_[i].load(std::memory_order_relaxed);
+    min_level = std::min(min_level, lvl);
+    gate_levels_[i].store(std::min(lvl, recorder_level), std::memory_order_relaxed);
+  }
+  if (logger_) logger_->set_level(static_cast<spdlog::level::level_enum>(min_level));
+}
+
+bool Logger::EnableFlightRecorder(const string& dir, size_t slots,
+                                  const string& level) {
+  spdlog::level::level_enum lvl;
+  if (!ParseLevel(level, &lvl)) {
+    std::cout << "Invalid flight recorder level: " << level << std::endl;
+    return false;
+  }
+  bool ok = FlightRecorder::Instance().Open(dir, slots, lvl);
+  ApplyLoggerLevel();
+  return ok;
+}
+
+std::string Logger::DumpRecent(const std::string& room_id) {
+  return FlightRecorder::Instance().DumpRecent(room_id);
+}
+
+bool Logger::AddJsonSink(const string& path) {
+  if (!logger_) return false;
+  try {
+    // dist_sink 加 sink 与写日志持同一把锁，无需停后台线程
+    sinks_->add_sink(std::make_shared<JsonLinesSink>(path));
+  } catch (const spdlog::spdlog_ex& ex) {
+    std::cout << "Add json sink failed: " << ex.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void Logger::SetRoomFilter(const string& rooms) {
+  std::vector<std::string> list;
+  std::istringstream iss(rooms);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    if (!item.empty()) list.push_back(item);
+  }
+  LogRoomFilter::Set(list);
+}
+
+// 静态对象按构造的逆序析构：先构造 Backend、FlightRecorder 和 spdlog 的 registry，
+// 保证 ~Logger 里 Stop / Close / shutdown 时它们还活着
+Logger::Logger() {
+  spdlog::details::registry::instance();
+  deferred::Backend::Instance();
+  FlightRecorder::Instance();
+}
 
 Logger::~Logger() {
+  FlightRecorder::Instance().Close();
+  deferred::Backend::Instance().Stop();
   spdlog::flush_every(std::chrono::seconds(3));
 #ifndef _WIN32
   spdlog::shutdown();
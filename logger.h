@@ -5,17 +5,47 @@
 #include <android/log.h>
 #endif
 
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
 #include <memory>
 
+// 编译期日志下限：低于该级别的 LOG_* 直接展开为空，参数不会求值。
+// 由 CMake 的 LOG_ACTIVE_LEVEL 选项设置，默认保留全部级别
+#ifndef SPDLOG_ACTIVE_LEVEL
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
 #include "spdlog/async.h"
 #include "spdlog/sinks/basic_file_sink.h"
+#include "spdlog/sinks/dist_sink.h"
 #include "spdlog/sinks/rotating_file_sink.h"
 #include "spdlog/sinks/stdout_sinks.h"
 #include "spdlog/spdlog.h"
+#include "buffered_rotating_sink.h"
+#include "deferred_log.h"
+#include "flight_recorder.h"
+#include "log_context.h"
 using namespace std;
 
 namespace libmagic {
 
+// 日志模块，各模块可单独设置运行期级别。
+// 源文件在 include logger.h 之前 #define LOG_MODULE 选择所属模块
+enum class LogModule : int {
+  kDefault = 0,
+  kMain,
+  kAfade,
+  kMetrics,
+  kCount
+};
+
+const char* LogModuleName(LogModule module);
+
 class Logger {
  public:
   static Logger* Instance() {
@@ -23,10 +53,49 @@ class Logger {
     return &logger;
   }
 
+  // level 为全局级别，可附带模块级别，如 "info,afade=warn,metrics=info"
+  // deferred 为 true 时业务线程只拷贝参数，格式化和写入由后台日志线程完成
   bool Init(const string& level, const string& path, int port,
-            bool console = true, bool reopen = true);
+            bool console = true, bool reopen = true, bool deferred = true);
   spdlog::logger* logger() const { return logger_.get(); }
 
+  // 队列大小和溢出策略（延迟模式与非延迟模式各自的），在 Init 之前设置
+  void SetQueueOptions(const deferred::QueueOptions& options) {
+    queue_options_ = options;
+  }
+
+  // 日志文件的缓冲、sync 策略、压缩和总大小，在 Init 之前设置；
+  // dir / base_name 由 Init 填写
+  void SetFileOptions(const RotatingFileOptions& options) {
+    file_options_ = options;
+  }
+
+  // 运行期修改模块级别，spec 格式同 Init 的 level
+  bool SetLevels(const string& spec);
+  void SetModuleLevel(LogModule module, spdlog::level::level_enum level);
+
+  // 开启飞行记录仪：在 dir 下保留最近 slots 条 level 及以上的日志（不落盘），
+  // 致命信号、DumpRecent 或 error 日志时才写出
+  bool EnableFlightRecorder(const string& dir, size_t slots, const string& level);
+  // 把最近的记录写到文件，返回文件路径；room_id 非空时只写该房间
+  std::string DumpRecent(const std::string& room_id);
+
+  // 额外输出一份 JSON-lines 日志（仅延迟模式带上下文字段），在 Init 之后调用
+  bool AddJsonSink(const string& path);
+  // 只输出指定房间的日志，如 "room1,room2"；空串取消过滤
+  void SetRoomFilter(const string& rooms);
+
+  // 热路径判断，只有一次 relaxed 原子读（sink 级别与飞行记录仪级别取低者）
+  static bool ShouldLog(LogModule module, spdlog::level::level_enum level) {
+    return level >= gate_levels_[static_cast<int>(module)].load(
+                        std::memory_order_relaxed);
+  }
+  // 是否写入 sink
+  static bool ShouldSink(LogModule module, spdlog::level::level_enum level) {
+    return level >= module_levels_[static_cast<int>(module)].load(
+                        std::memory_order_relaxed);
+  }
+
  private:
   Logger();
   ~Logger();
@@ -35,24 +104,208 @@ class Logger {
 
   // void* operator new(size_t size) { return nullptr; }
 
+  // 按模块级别刷新 spdlog logger 自身的级别（取各模块最低值）和入口级别
+  void ApplyLoggerLevel();
+
  private:
   std::shared_ptr<spdlog::logger> logger_;
+  // logger_ 唯一的 sink，下挂文件 / 控制台 sink 和 AddJsonSink 加的 sink
+  std::shared_ptr<spdlog::sinks::dist_sink_mt> sinks_;
+  deferred::QueueOptions queue_options_;
+  RotatingFileOptions file_options_;
+
+  static std::atomic<int> module_levels_[static_cast<int>(LogModule::kCount)];
+  static std::atomic<int> gate_levels_[static_cast<int>(LogModule::kCount)];
+  // 单独设置过级别的模块，不随全局级别变化
+  std::atomic<bool> module_overridden_[static_cast<int>(LogModule::kCount)]{};
+};
+
+// 限频日志的调用点状态（GCRA 令牌桶），静态存储、常量初始化。
+// tat_ 为理论到达时间（100us 为单位），suppressed_ 为上次输出后被抑制的次数；
+// 被抑制的调用只有一次读和一次 fetch_add
+class LogRateGate {
+ public:
+  static constexpr int64_t kUnitsPerSec = 10000;
+
+  // interval：每条日志消耗的时间（单位 100us）；burst：允许的突发条数
+  // 返回 true 表示本次输出，*suppressed 为此前被抑制的次数（超出 uint32 时饱和）
+  bool Allow(int64_t interval, int64_t burst, uint32_t* suppressed) {
+    const int64_t now = NowUnits();
+    const int64_t limit = now + (burst - 1) * interval;
+    int64_t tat = tat_.load(std::memory_order_relaxed);
+    while (true) {
+      if (tat > limit) {
+        // 包括被其他线程抢先输出的情况
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (tat_.compare_exchange_weak(tat, std::max(tat, now) + interval,
+                                     std::memory_order_relaxed)) {
+        uint64_t n = suppressed_.exchange(0, std::memory_order_relaxed);
+        *suppressed = static_cast<uint32_t>(
+            std::min<uint64_t>(n, std::numeric_limits<uint32_t>::max()));
+        return true;
+      }
+    }
+  }
+
+ private:
+  static int64_t NowUnits() {
+#ifdef __linux__
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * kUnitsPerSec + ts.tv_nsec / 100000 + 1;
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+                   .count() / 100 + 1;
+#endif
+  }
+
+  std::atomic<int64_t> tat_{0};
+  std::atomic<uint64_t> suppressed_{0};
+};
+
+// 按次数限频的调用点状态
+struct LogCountGate {
+  std::atomic<uint64_t> count{0};
 };
 
+extern const char* const kLogPattern;
+
+// LOG_* 宏的落点：先写飞行记录仪，再按 sink 级别交给延迟后端或 spdlog
+template <size_t N, typename... Args>
+inline void LogDispatch(LogModule module, const spdlog::source_loc& loc,
+                        spdlog::level::level_enum level, const char (&fmt)[N],
+                        const Args&... args) {
+  if (FlightRecorder::Accepts(level)) {
+    FlightRecorder::Instance().Append(loc, level, fmt, args...);
+    if (level >= spdlog::level::err)
+      FlightRecorder::Instance().RequestDump(LogRoomName(CurrentLogContext().room));
+  }
+  if (!Logger::ShouldSink(module, level) ||
+      !LogRoomFilter::Allowed(CurrentLogContext().room))
+    return;
+
+  if (deferred::Backend::Running()) {
+    deferred::Backend::Instance().Capture(loc, level, fmt, args...);
+  } else if constexpr (sizeof...(Args) == 0) {
+    Logger::Instance()->logger()->log(loc, level, fmt);
+  } else {
+    Logger::Instance()->logger()->log(loc, level, fmt::runtime(fmt), args...);
+  }
+}
+
 }  // namespace libmagic
 
 #define LOGGER_INS (libmagic::Logger::Instance())
 
-#define LOG_TRACE(...) \
-  SPDLOG_LOGGER_CALL(LOGGER_INS->logger(), spdlog::level::trace, __VA_ARGS__)
-#define LOG_DEBUG(...) \
-  SPDLOG_LOGGER_CALL(LOGGER_INS->logger(), spdlog::level::debug, __VA_ARGS__)
-#define LOG_INFO(...) \
-  SPDLOG_LOGGER_CALL(LOGGER_INS->logger(), spdlog::level::info, __VA_ARGS__)
-#define LOG_WARN(...) \
-  SPDLOG_LOGGER_CALL(LOGGER_INS->logger(), spdlog::level::warn, __VA_ARGS__)
-#define LOG_ERROR(...) \
-  SPDLOG_LOGGER_CALL(LOGGER_INS->logger(), spdlog::level::err, __VA_ARGS__)
+#ifndef LOG_MODULE
+#define LOG_MODULE libmagic::LogModule::kDefault
+#endif
+
+#define LOG_ENABLED(level) libmagic::Logger::ShouldLog(LOG_MODULE, level)
+
+// 级别未开启时不会对参数求值（如 PrintHexPreview）
+#define LOG_CALL(level, ...)                                               \
+  do {                                                                     \
+    if (LOG_ENABLED(level))                                                \
+      libmagic::LogDispatch(                                               \
+          LOG_MODULE,                                                      \
+          spdlog::source_loc{__FILE__, __LINE__, SPDLOG_FUNCTION}, level,  \
+          __VA_ARGS__);                                                    \
+  } while (0)
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_CALL(spdlog::level::trace, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) (void)0
+#endif
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_CALL(spdlog::level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) (void)0
+#endif
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_CALL(spdlog::level::info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) (void)0
+#endif
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_CALL(spdlog::level::warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) (void)0
+#endif
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_CALL(spdlog::level::err, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) (void)0
+#endif
+
+// ---- 限频 / 采样日志 ----
+// level 取 spdlog::level 的枚举名：trace / debug / info / warn / err
+// 每个调用点一份静态原子状态；被抑制的调用不做格式化，
+// 下一条输出的日志带上 "[suppressed N]" 前缀
+#define LOG_GATED_EMIT_(lvl, suppressed, fmt, ...)                            \
+  do {                                                                        \
+    spdlog::source_loc loc__{__FILE__, __LINE__, SPDLOG_FUNCTION};            \
+    if ((suppressed) > 0)                                                     \
+      libmagic::LogDispatch(LOG_MODULE, loc__, lvl, "[suppressed {}] " fmt,   \
+                            (suppressed), ##__VA_ARGS__);                     \
+    else                                                                      \
+      libmagic::LogDispatch(LOG_MODULE, loc__, lvl, fmt, ##__VA_ARGS__);      \
+  } while (0)
+
+#define LOG_GATE_ENABLED_(lvl) \
+  (spdlog::level::lvl >= SPDLOG_ACTIVE_LEVEL && LOG_ENABLED(spdlog::level::lvl))
+
+// 每 n 次输出一次（n 小于 1 时按 1）
+#define LOG_EVERY_N(lvl, n, fmt, ...)                                         \
+  do {                                                                        \
+    if (LOG_GATE_ENABLED_(lvl)) {                                             \
+      static libmagic::LogCountGate gate__;                                   \
+      const uint64_t n__ = std::max<uint64_t>((n), 1);                        \
+      uint64_t c__ = gate__.count.fetch_add(1, std::memory_order_relaxed);    \
+      if (c__ % n__ == 0)                                                     \
+        LOG_GATED_EMIT_(spdlog::level::lvl, c__ == 0 ? 0 : n__ - 1, fmt,      \
+                        ##__VA_ARGS__);                                       \
+    }                                                                         \
+  } while (0)
+
+// 只输出前 n 次
+#define LOG_FIRST_N(lvl, n, fmt, ...)                                         \
+  do {                                                                        \
+    if (LOG_GATE_ENABLED_(lvl)) {                                             \
+      static libmagic::LogCountGate gate__;                                   \
+      if (gate__.count.fetch_add(1, std::memory_order_relaxed) < (uint64_t)(n)) \
+        LOG_GATED_EMIT_(spdlog::level::lvl, 0, fmt, ##__VA_ARGS__);           \
+    }                                                                         \
+  } while (0)
+
+// 令牌桶：平均每秒 per_sec 条，允许 burst 条突发（两者都至少按 1 算）
+#define LOG_RATE_LIMIT(lvl, per_sec, burst, fmt, ...)                         \
+  do {                                                                        \
+    if (LOG_GATE_ENABLED_(lvl)) {                                             \
+      static libmagic::LogRateGate gate__;                                    \
+      uint32_t suppressed__ = 0;                                              \
+      if (gate__.Allow(libmagic::LogRateGate::kUnitsPerSec /                  \
+                           std::max<int64_t>((per_sec), 1),                   \
+                       std::max<int64_t>((burst), 1), &suppressed__))         \
+        LOG_GATED_EMIT_(spdlog::level::lvl, suppressed__, fmt, ##__VA_ARGS__); \
+    }                                                                         \
+  } while (0)
+
+// 每 ms 毫秒最多输出一次
+#define LOG_EVERY_MS(lvl, ms, fmt, ...)                                       \
+  do {                                                                        \
+    if (LOG_GATE_ENABLED_(lvl)) {                                             \
+      static libmagic::LogRateGate gate__;                                    \
+      uint32_t suppressed__ = 0;                                              \
+      if (gate__.Allow((ms) * libmagic::LogRateGate::kUnitsPerSec / 1000, 1,  \
+                       &suppressed__))                                        \
+        LOG_GATED_EMIT_(spdlog::level::lvl, suppressed__, fmt, ##__VA_ARGS__); \
+    }                                                                         \
+  } while (0)
 
 #ifdef ANDROID
 #define LOGD(LOG_TAG, ...) \
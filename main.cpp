@@ -1,14 +1,24 @@
+#define LOG_MODULE libmagic::LogModule::kMain
 #include "av_metrics.h"
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 extern "C" {
 #include <libavformat/avformat.h>
 }
+#include "afade_warm_pool.h"
 #include "audio_afade.h"
+#include "audio_crossfade.h"
+#include "flv_aac.h"
+#include "load_generator.h"
 #include "logger.h"
+#include "media_input.h"
+#include "replay.h"
+#include "resource_metrics.h"
+#include "room_pipeline.h"
 
 using namespace std::chrono;
 
@@ -30,6 +40,8 @@ int testAvMetrics() {
       {"roomA", 48, 24, 0, 0},
       {"roomB", 50, 25, 0, 0},
   };
+  for (auto &r : rooms)
+    AvMetrics::Instance().AddRoom(r.id);
 
   // 3) 每秒模拟一次上报（帧率=每秒帧数，PTS 每秒 +1000ms）
   auto last = steady_clock::now();
@@ -68,23 +80,370 @@ int initLog() {
   if (!LOGGER_INS->Init("info", "./log", 0, true, true)) {
     return -1;
   }
+  // 最近 64k 条 debug 日志只进飞行记录仪，出错或崩溃时再写出
+  LOGGER_INS->EnableFlightRecorder("./log", 65536, "debug");
 }
 
-int main() {
+// 压测模式：myapp --load [--rooms N] [--speed X] [--seconds S] [--threads T]
+//                   [--fade-every F] [--fade-frames K] [--arena-kb A]
+//                   [--hibernate-ms H] [--lag-budget-ms L]
+//                   [--scheduler threads|edf] [--latency-ms M[,M...]] [--cpus LIST]
+//                   [--report FILE]
+int runLoad(int argc, char **argv) {
+  LoadOptions options;
+  if (!ParseLoadOptions(argc, argv, 2, &options)) {
+    std::cout << "usage: " << argv[0]
+              << " --load [--rooms N] [--speed X] [--seconds S] [--threads T]"
+                 " [--fade-every F] [--fade-frames K] [--arena-kb A]"
+                 " [--hibernate-ms H] [--lag-budget-ms L]"
+                 " [--scheduler threads|edf] [--latency-ms M[,M...]] [--cpus LIST]"
+                 " [--report FILE]"
+              << std::endl;
+    return -1;
+  }
+  // 逐帧日志会淹没压测结果
+  LOGGER_INS->SetLevels("info,afade=warn");
+  AvMetrics::Instance().Init("0.0.0.0:8099");
+  ResourceMetrics::Instance().Init(AvMetrics::Instance().registry());
+  AfadeWarmPool::Instance().Start();
+
+  bool ok = LoadGenerator(options).Run(nullptr);
+
+  AfadeWarmPool::Instance().Stop();
+  ResourceMetrics::Instance().Shutdown();
+  AvMetrics::Instance().Shutdown();
+  return ok ? 0 : -1;
+}
+
+// 回放模式：myapp --replay FILE [--speed X] [--start-ms T] [--report FILE]
+int runReplay(int argc, char **argv) {
+  ReplayOptions options;
+  if (argc < 3 || !ParseReplayOptions(argc, argv, 3, &options)) {
+    std::cout << "usage: " << argv[0]
+              << " --replay FILE [--speed X] [--start-ms T] [--report FILE]"
+              << std::endl;
+    return -1;
+  }
+  options.path = argv[2];
+  LOGGER_INS->SetLevels("info,afade=warn");
+  AvMetrics::Instance().Init("0.0.0.0:8099");
+  ResourceMetrics::Instance().Init(AvMetrics::Instance().registry());
+  AfadeWarmPool::Instance().Start();
+
+  bool ok = Replayer(options).Run(nullptr);
+
+  AfadeWarmPool::Instance().Stop();
+  ResourceMetrics::Instance().Shutdown();
+  AvMetrics::Instance().Shutdown();
+  return ok ? 0 : -1;
+}
+
+// 切换模式：myapp --crossfade A_FILE B_FILE [--at-ms T] [--fade-ms D] [--out FILE]
+// 从 A 在 T 毫秒处交叉淡化到 B（B 从头开始），只重编码重叠的几帧，输出 ADTS AAC
+int runCrossfade(int argc, char **argv) {
+  if (argc < 4) {
+    std::cout << "usage: " << argv[0]
+              << " --crossfade A_FILE B_FILE [--at-ms T] [--fade-ms D] [--out FILE]"
+              << std::endl;
+    return -1;
+  }
+  int64_t at_ms = 10000;
+  int64_t fade_ms = 2000;
+  std::string out_path = "output_crossfade.aac";
+  for (int i = 4; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    if (arg == "--at-ms") {
+      at_ms = std::stoll(argv[i + 1]);
+    } else if (arg == "--fade-ms") {
+      fade_ms = std::stoll(argv[i + 1]);
+    } else if (arg == "--out") {
+      out_path = argv[i + 1];
+    }
+  }
+
+  AVFormatContext *in_fmt[2] = {};
+  int stream_index[2] = {-1, -1};
+  for (int side = 0; side < 2; side++) {
+    const char *path = argv[2 + side];
+    if (avformat_open_input(&in_fmt[side], path, nullptr, nullptr) < 0) {
+      LOG_ERROR("❌ Failed to open input file: {}", path);
+      return -1;
+    }
+    avformat_find_stream_info(in_fmt[side], nullptr);
+    stream_index[side] =
+        av_find_best_stream(in_fmt[side], AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (stream_index[side] < 0) {
+      LOG_ERROR("❌ No audio stream found in file: {}", path);
+      return -1;
+    }
+  }
+  AVStream *in_a = in_fmt[0]->streams[stream_index[0]];
+  AVStream *in_b = in_fmt[1]->streams[stream_index[1]];
+
+  // 输出沿用 A 的格式，A 在切换点之前可以整段直通
+  AudioCrossfade::Options xf_options;
+  xf_options.sample_rate = in_a->codecpar->sample_rate;
+  xf_options.channels = in_a->codecpar->channels;
+  const int sample_rate = xf_options.sample_rate;
+  AudioCrossfade crossfade(xf_options);
+  if (!crossfade.SetSource(AudioCrossfade::SIDE_A, in_a->codecpar, in_a->time_base) ||
+      !crossfade.SetSource(AudioCrossfade::SIDE_B, in_b->codecpar, in_b->time_base) ||
+      !crossfade.Schedule(at_ms * sample_rate / 1000, fade_ms * sample_rate / 1000)) {
+    return -1;
+  }
+  LOG_INFO("Crossfade at {}ms for {}ms, copy A={} B={}", at_ms, fade_ms,
+           crossfade.copyable(AudioCrossfade::SIDE_A),
+           crossfade.copyable(AudioCrossfade::SIDE_B));
+
+  AVFormatContext *out_fmt = nullptr;
+  avformat_alloc_output_context2(&out_fmt, nullptr, "adts", out_path.c_str());
+  if (!out_fmt) {
+    LOG_ERROR("❌ Could not create output context");
+    return -1;
+  }
+  AVStream *out_stream = avformat_new_stream(out_fmt, nullptr);
+  out_stream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+  out_stream->codecpar->codec_id = AV_CODEC_ID_AAC;
+  out_stream->codecpar->sample_rate = sample_rate;
+  out_stream->codecpar->channels = xf_options.channels;
+  out_stream->codecpar->channel_layout = av_get_default_channel_layout(xf_options.channels);
+  out_stream->time_base = {1, sample_rate};
+  if (avio_open(&out_fmt->pb, out_path.c_str(), AVIO_FLAG_WRITE) < 0) {
+    LOG_ERROR("❌ Could not open output file: {}", out_path);
+    return -1;
+  }
+  avformat_write_header(out_fmt, nullptr);
+
+  auto drain = [&]() {
+    AVPacket out;
+    av_init_packet(&out);
+    while (crossfade.Receive(&out)) {
+      out.stream_index = out_stream->index;
+      av_packet_rescale_ts(&out, {1, sample_rate}, out_stream->time_base);
+      int ret = av_interleaved_write_frame(out_fmt, &out);
+      if (ret < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        LOG_ERROR("Write packet failed: {}", errbuf);
+      }
+      av_packet_unref(&out);
+    }
+  };
+
+  // 两个输入按输出时间线交替读：A 从 0 起，B 从 at 起；A 过了淡化终点就不再读
+  const int64_t fade_end_ms = at_ms + fade_ms;
+  int64_t start[2] = {AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+  int64_t pos_ms[2] = {0, at_ms};
+  bool eof[2] = {false, false};
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  while (!eof[0] || !eof[1]) {
+    const int side = eof[0] ? 1 : eof[1] ? 0 : (pos_ms[0] <= pos_ms[1] ? 0 : 1);
+    if (av_read_frame(in_fmt[side], &pkt) < 0) {
+      eof[side] = true;
+      crossfade.EndSource(static_cast<AudioCrossfade::Side>(side));
+      drain();
+      continue;
+    }
+    AVStream *st = in_fmt[side]->streams[pkt.stream_index];
+    if (pkt.stream_index != stream_index[side] || pkt.pts == AV_NOPTS_VALUE) {
+      av_packet_unref(&pkt);
+      continue;
+    }
+    if (start[side] == AV_NOPTS_VALUE)
+      start[side] = pkt.pts;
+    pos_ms[side] = (side == 0 ? 0 : at_ms) +
+                   av_rescale_q(pkt.pts - start[side], st->time_base, {1, 1000});
+    crossfade.Push(static_cast<AudioCrossfade::Side>(side), &pkt);
+    av_packet_unref(&pkt);
+    drain();
+    if (side == 0 && pos_ms[0] >= fade_end_ms) {
+      eof[0] = true;
+      crossfade.EndSource(AudioCrossfade::SIDE_A);
+      drain();
+    }
+  }
+  crossfade.Flush();
+  drain();
+  av_write_trailer(out_fmt);
+
+  const AudioCrossfade::Stats &stats = crossfade.stats();
+  LOG_INFO("✅ Crossfade done: {} copied_a={} copied_b={} encoded={} dropped={}", out_path,
+           stats.copied_a, stats.copied_b, stats.encoded, stats.dropped);
+  for (auto &fmt : in_fmt)
+    avformat_close_input(&fmt);
+  avio_closep(&out_fmt->pb);
+  avformat_free_context(out_fmt);
+  return 0;
+}
+
+// FLV 模式：myapp --flv IN_FILE [--out FILE]
+// 直播接入路径：不经 avformat，文件按块读进内存交给 FlvAacDemuxer（与 HTTP-FLV 收包相同），
+// 第 100 帧起淡入 200 帧，输出 FLV（只含音频）
+int runFlv(int argc, char **argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " --flv IN_FILE [--out FILE]" << std::endl;
+    return -1;
+  }
+  std::string out_path = "output.flv";
+  for (int i = 3; i + 1 < argc; i += 2) {
+    if (std::string(argv[i]) == "--out")
+      out_path = argv[i + 1];
+  }
+  std::ifstream in(argv[2], std::ios::binary);
+  if (!in) {
+    LOG_ERROR("❌ Failed to open input file: {}", argv[2]);
+    return -1;
+  }
+  std::ofstream out(out_path, std::ios::binary);
+  if (!out) {
+    LOG_ERROR("❌ Could not open output file: {}", out_path);
+    return -1;
+  }
+
+  // 淡入淡出实例由后台线程预建，不在转封装循环里初始化编解码器
+  AfadeWarmPool::Instance().Start();
+
+  constexpr int kChunkBytes = 64 << 10;
+  FlvAacDemuxer demuxer;
+  std::unique_ptr<RoomPipeline> pipeline;
+  std::unique_ptr<FlvAacMuxer> muxer;
+  std::string out_buf;
+  FlvAacMuxer::WriteFileHeader(&out_buf);
+  FlvTag tag;
+  int frame_count = 0;
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  AVPacket out_pkt;
+  av_init_packet(&out_pkt);
+
+  while (in) {
+    AVBufferRef *chunk = av_buffer_alloc(kChunkBytes);
+    if (!chunk) {
+      LOG_ERROR("Alloc input chunk failed");
+      break;
+    }
+    in.read(reinterpret_cast<char *>(chunk->data), kChunkBytes);
+    chunk->size = static_cast<int>(in.gcount()); // 最后一块只用读到的部分
+    demuxer.Feed(chunk);
+    av_buffer_unref(&chunk);
+
+    while (demuxer.Receive(&pkt)) {
+      if (demuxer.TakeConfigChange() && pipeline)
+        LOG_WARN("FLV AAC config changed mid-stream, keeping the first one");
+      if (!pipeline) {
+        const AacConfig &aac = demuxer.config();
+        RoomPipeline::Config room_cfg;
+        room_cfg.room_id = "flv";
+        room_cfg.sample_rate = aac.sample_rate;
+        room_cfg.channels = aac.channels > 0 ? aac.channels : 2;
+        room_cfg.time_base = {1, 1000};
+        room_cfg.pool_arena_bytes = 2 << 20;
+        room_cfg.audio_specific_config = aac.asc;
+        pipeline = std::make_unique<RoomPipeline>(room_cfg);
+        muxer = std::make_unique<FlvAacMuxer>(aac);
+        muxer->SequenceHeader(0, &tag);
+        tag.AppendTo(&out_buf);
+      }
+      if (++frame_count == 100) {
+        LOG_INFO("🎬 Fade-in triggered at frame {}", frame_count);
+        pipeline->StartFade(AudioAfade::FADE_IN, 200);
+      }
+      // 淡入淡出期间一个输入包可能对应多个输出包
+      bool has_out = pipeline->ProcessAudio(&pkt, &out_pkt);
+      while (has_out) {
+        const int64_t ts_ms =
+            av_rescale(out_pkt.pts, 1000, pipeline->config().sample_rate);
+        if (muxer->Frame(&out_pkt, ts_ms, &tag))
+          tag.AppendTo(&out_buf);
+        av_packet_unref(&out_pkt);
+        has_out = pipeline->ReceiveAudio(&out_pkt);
+      }
+      av_packet_unref(&pkt);
+    }
+    out.write(out_buf.data(), out_buf.size());
+    out_buf.clear();
+  }
+
+  const FlvAacDemuxer::Stats &stats = demuxer.stats();
+  LOG_INFO("✅ FLV done: {} tags={} frames={} seq_headers={} skipped={} joined={} errors={}",
+           out_path, stats.tags, stats.audio_frames, stats.sequence_headers,
+           stats.skipped_tags, stats.joined_tags, stats.errors);
+  AvMetrics::Instance().RemoveRoom("flv");
+  AfadeWarmPool::Instance().Stop();
+  return pipeline ? 0 : -1;
+}
+
+// 飞行记录仪：myapp --flight RING_FILE
+// 把崩溃时写出的 flight_crash_*.ring 按时间顺序打印
+int runFlight(int argc, char **argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " --flight RING_FILE" << std::endl;
+    return -1;
+  }
+  if (!libmagic::FlightRecorder::Decode(argv[2], STDOUT_FILENO)) {
+    std::cout << "not a flight recorder file: " << argv[2] << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  // 只读取已有文件，不打开新的日志和飞行记录仪
+  if (argc > 1 && std::string(argv[1]) == "--flight") {
+    return runFlight(argc, argv);
+  }
   initLog();
   av_log_set_level(AV_LOG_ERROR);
+  if (argc > 1 && std::string(argv[1]) == "--load") {
+    return runLoad(argc, argv);
+  }
+  if (argc > 1 && std::string(argv[1]) == "--replay") {
+    return runReplay(argc, argv);
+  }
+  if (argc > 1 && std::string(argv[1]) == "--crossfade") {
+    return runCrossfade(argc, argv);
+  }
+  if (argc > 1 && std::string(argv[1]) == "--flv") {
+    return runFlv(argc, argv);
+  }
+  // myapp [--capture FILE] [--mux FILE]
+  // --capture：把本次输入录制下来，之后可用 --replay 复现
+  // --mux：输入带视频时音视频一起输出为 MPEG-TS，视频直通，只重编码淡入淡出覆盖的 GOP
+  std::string capture_path;
+  std::string mux_path;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    if (arg == "--capture") {
+      capture_path = argv[i + 1];
+    } else if (arg == "--mux") {
+      mux_path = argv[i + 1];
+    }
+  }
+
+  // metrics：用真实包的 PTS 计算音画漂移和停滞
+  const std::string room_id = "local";
+  // 之后本线程的日志都带上 room，无需在每条日志里拼接
+  libmagic::ScopedLogContext room_scope({libmagic::InternLogRoom(room_id)});
+  AvMetrics::Instance().Init("0.0.0.0:8099");
+  ResourceMetrics::Instance().Init(AvMetrics::Instance().registry());
+  AfadeWarmPool::Instance().Start();
+  AvMetrics::Instance().SetSyncCallback([](const AvMetrics::SyncEvent &ev) {
+    LOG_WARN("A/V sync event room={} type={} kind={} value_ms={:.1f}",
+             ev.room_id, ev.type, ev.kind, ev.value_ms);
+  });
 
   const char *input_file = "/data1/lijinwang/ctest/build/input.aac";
   // const char *input_file = "/data1/lijinwang/ctest/build/input2.mp3";
   const char *output_file = "output_my1.aac";
 
-  // 打开输入文件
+  // 打开输入文件：整个映射进内存，avformat 走自定义 I/O，本地文件这一类来源的探测结果缓存复用
+  std::unique_ptr<MediaInput> input = MediaInput::MapFile(input_file);
   AVFormatContext *in_fmt = nullptr;
-  if (avformat_open_input(&in_fmt, input_file, nullptr, nullptr) < 0) {
+  if (!input || !input->Open("local-file", &in_fmt)) {
     LOG_ERROR("❌ Failed to open input file: {}", input_file);
     return -1;
   }
-  avformat_find_stream_info(in_fmt, nullptr);
 
   // 找到音频流
   int audio_stream_index = -1;
@@ -94,6 +453,13 @@ int main() {
       break;
     }
   }
+  int video_stream_index = -1;
+  for (unsigned int i = 0; i < in_fmt->nb_streams; i++) {
+    if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+      video_stream_index = i;
+      break;
+    }
+  }
   if (audio_stream_index < 0) {
     LOG_ERROR("❌ No audio stream found in file: {}", input_file);
     return -1;
@@ -111,9 +477,16 @@ int main() {
   // ✅ 初始化 AudioAfade（前 200 帧淡入）
   // AudioAfade afade(sample_rate, channels, AudioAfade::FADE_IN, 200);
 
-  // 初始化输出封装
+  // 初始化输出封装；重编码的 GOP 参数集在码流里，选能承载带内参数集的 MPEG-TS
+  const bool mux_video = !mux_path.empty() && video_stream_index >= 0;
+  if (mux_video) {
+    output_file = mux_path.c_str();
+  } else if (!mux_path.empty()) {
+    LOG_WARN("No video stream in {}, --mux ignored", input_file);
+  }
   AVFormatContext *out_fmt = nullptr;
-  avformat_alloc_output_context2(&out_fmt, nullptr, "adts", output_file);
+  avformat_alloc_output_context2(&out_fmt, nullptr, mux_video ? "mpegts" : "adts",
+                                 output_file);
   if (!out_fmt) {
     LOG_ERROR("❌ Could not create output context");
     return -1;
@@ -131,6 +504,22 @@ int main() {
       av_get_default_channel_layout(channels);
   out_stream->codecpar->format = AV_SAMPLE_FMT_FLTP;
   out_stream->codecpar->bit_rate = 128000;
+  out_stream->time_base = {1, sample_rate};
+
+  AVStream *out_video = nullptr;
+  AVStream *in_video = mux_video ? in_fmt->streams[video_stream_index] : nullptr;
+  if (mux_video) {
+    // 冲刷编码器时写出的是不带 ADTS 头的 AAC，MPEG-TS 据 extradata 补头
+    out_stream->codecpar->extradata =
+        static_cast<uint8_t *>(av_mallocz(2 + AV_INPUT_BUFFER_PADDING_SIZE));
+    out_stream->codecpar->extradata_size = 2;
+    AudioAfade::WriteAudioSpecificConfig(out_stream->codecpar->extradata, 2,
+                                         sample_rate, channels);
+    out_video = avformat_new_stream(out_fmt, nullptr);
+    avcodec_parameters_copy(out_video->codecpar, in_video->codecpar);
+    out_video->codecpar->codec_tag = 0;
+    out_video->time_base = in_video->time_base;
+  }
 
   // 打开输出文件
   if (!(out_fmt->oformat->flags & AVFMT_NOFILE)) {
@@ -142,114 +531,110 @@ int main() {
 
   avformat_write_header(out_fmt, nullptr);
 
-  int frame_count = 0;
-  int test_frame_count = 0;
-  bool fading = false;
-  std::unique_ptr<AudioAfade> afade;
+  RoomPipeline::Config room_cfg;
+  room_cfg.room_id = room_id;
+  room_cfg.sample_rate = sample_rate;
+  room_cfg.channels = channels;
+  room_cfg.sample_fmt = sample_fmt;
+  room_cfg.time_base = in_stream->time_base;
+  room_cfg.pool_arena_bytes = 2 << 20; // 一个大页
+  RoomPipeline pipeline(room_cfg);
+  // 音频输出 pts 从 0 起、以采样点为单位；视频按输入音频的起点对齐到同一条时间线
+  int64_t video_offset = 0;
+  if (mux_video) {
+    pipeline.EnableVideoPassthrough(in_video->codecpar, in_video->time_base,
+                                    in_video->avg_frame_rate);
+    if (in_stream->start_time != AV_NOPTS_VALUE)
+      video_offset =
+          av_rescale_q(in_stream->start_time, in_stream->time_base, in_video->time_base);
+  }
+  auto write_packet = [&](AVPacket *out, AVRational src_tb, AVStream *st) {
+    out->stream_index = st->index;
+    av_packet_rescale_ts(out, src_tb, st->time_base);
+    int ret = av_interleaved_write_frame(out_fmt, out);
+    if (ret < 0) {
+      char errbuf[128];
+      av_strerror(ret, errbuf, sizeof(errbuf));
+      LOG_ERROR("Write packet failed stream={}: {}", st->index, errbuf);
+    }
+    av_packet_unref(out);
+  };
+  auto write_video = [&]() {
+    AVPacket vout;
+    av_init_packet(&vout);
+    while (pipeline.ReceiveVideo(&vout)) {
+      if (vout.pts != AV_NOPTS_VALUE)
+        vout.pts -= video_offset;
+      if (vout.dts != AV_NOPTS_VALUE)
+        vout.dts -= video_offset;
+      write_packet(&vout, in_video->time_base, out_video);
+    }
+  };
+  capture::CaptureWriter capture;
+  if (!capture_path.empty() && capture.Open(capture_path)) {
+    pipeline.SetCapture(&capture);
+  }
 
+  int frame_count = 0;
   AVPacket pkt;
   av_init_packet(&pkt);
 
-  int64_t next_pts = 0;               // 以采样点为单位
-  const int samples_per_frame = 1024; // AAC 每帧固定 1024 采样点
-
-  while (av_read_frame(in_fmt, &pkt) >= 0) {
+  // 纯 ADTS 输入不经 avformat 读包：直接从映射按帧切片，包引用映射内存
+  auto read_packet = [&](AVPacket *p) {
+    if (!input->is_adts())
+      return av_read_frame(in_fmt, p) >= 0;
+    if (!input->ReadAdts(p, in_stream->time_base))
+      return false;
+    p->stream_index = audio_stream_index;
+    return true;
+  };
+  while (read_packet(&pkt)) {
     if (pkt.stream_index != audio_stream_index) {
+      if (pkt.stream_index == video_stream_index && mux_video) {
+        pipeline.PushVideo(&pkt, in_video->time_base);
+        write_video();
+      } else if (pkt.stream_index == video_stream_index) {
+        pipeline.OnVideoPacket(&pkt, in_fmt->streams[pkt.stream_index]->time_base);
+      }
       av_packet_unref(&pkt);
       continue;
     }
+    libmagic::ScopedLogContext stream_scope({0, pkt.stream_index});
 
     frame_count++;
     if (frame_count == 100) {
       LOG_INFO("🎬 Fade-in triggered at frame {}", frame_count);
-      afade = std::make_unique<AudioAfade>(sample_rate, channels, sample_fmt,
-                                           AudioAfade::FADE_IN, 200);
-      fading = true;
+      pipeline.StartFade(AudioAfade::FADE_IN, 200);
     }
 
-    if (fading && afade) {
-      test_frame_count++;
-      AVPacket faded_pkt;
-      av_init_packet(&faded_pkt);
-
-      LOG_INFO("🎧 Write before packet: size={}, pts={}, dts={}", pkt.size,
-               pkt.pts, pkt.dts);
-
-      if (afade->Process(&pkt, &faded_pkt) && faded_pkt.size > 0) {
-        faded_pkt.stream_index = 0;
-        faded_pkt.pts = next_pts;
-        faded_pkt.dts = next_pts;
-        next_pts += samples_per_frame;
-
-        LOG_INFO("🎧 Write faded packet: size={}, pts={}, dts={}",
-                 faded_pkt.size, faded_pkt.pts, faded_pkt.dts);
-
-        afade->PrintPacketHex(&faded_pkt);
-
-        uint8_t adts_header[7];
-        afade->WriteAdtsHeader(adts_header, faded_pkt.size, 2, sample_rate,
-                               channels);
-        // 拼接ADTS头 + AAC帧
-        int total_size = faded_pkt.size + 7;
-        std::vector<uint8_t> full_buf(total_size);
-        memcpy(full_buf.data(), adts_header, 7);
-        memcpy(full_buf.data() + 7, faded_pkt.data, faded_pkt.size);
-
-        // 构造新的 AVPacket 用于写入
-        AVPacket out_pkt;
-        av_init_packet(&out_pkt);
-        out_pkt.data = full_buf.data();
-        out_pkt.size = total_size;
-        out_pkt.pts = faded_pkt.pts;
-        out_pkt.dts = faded_pkt.dts;
-        out_pkt.stream_index = faded_pkt.stream_index;
-
-        afade->PrintPacketHex(&out_pkt);
-
-        int ret = av_interleaved_write_frame(out_fmt, &out_pkt);
-        if (ret < 0) {
-          char errbuf[128];
-          av_strerror(ret, errbuf, sizeof(errbuf));
-          LOG_ERROR("Write faded packet failed: {}", errbuf);
-        } else {
-          LOG_INFO("Wrote ADTS AAC frame ({} bytes) pts={}, dts={}",
-                   out_pkt.size, out_pkt.pts, out_pkt.dts);
-        }
-
-        av_packet_unref(&faded_pkt);
-      }
-
-      // 当淡入200帧后销毁
-      if (test_frame_count >= 200) {
-        LOG_INFO(" Fade-in finished at frame {}", frame_count);
-        fading = false;
-        // afade.reset();
-      }
-    } else {
-      pkt.stream_index = 0;
-      pkt.pts = next_pts;
-      pkt.dts = next_pts;
-      next_pts += samples_per_frame;
-
-      LOG_INFO("🎧 Write original packet: size={}, pts={}, dts={}", pkt.size,
-               pkt.pts, pkt.dts);
-
-      afade->PrintPacketHex(&pkt);
-      int ret = av_interleaved_write_frame(out_fmt, &pkt);
-      if (ret < 0) {
-        char errbuf[128];
-        av_strerror(ret, errbuf, sizeof(errbuf));
-        LOG_ERROR(" Write common packet failed: {}", errbuf);
+    const bool faded = pipeline.fading();
+    AVPacket out_pkt;
+    av_init_packet(&out_pkt);
+    bool has_out = pipeline.ProcessAudio(&pkt, &out_pkt);
+    while (has_out) {
+      if (faded) {
+        LOG_EVERY_MS(info, 1000, "🎧 Write faded packet: size={}, pts={}, dts={}",
+                     out_pkt.size, out_pkt.pts, out_pkt.dts);
+      } else {
+        LOG_EVERY_MS(info, 1000, "🎧 Write original packet: size={}, pts={}, dts={}",
+                     out_pkt.size, out_pkt.pts, out_pkt.dts);
       }
+      write_packet(&out_pkt, {1, sample_rate}, out_stream);
+      has_out = pipeline.ReceiveAudio(&out_pkt);
     }
+    // 音频时钟前进后，等它的 GOP 可能已经放出
+    if (mux_video)
+      write_video();
 
     av_packet_unref(&pkt);
   }
 
-  if (afade) {
-    afade->FlushEncoder(out_fmt, next_pts);
-    afade.reset();
+  if (mux_video) {
+    pipeline.FlushVideo();
+    write_video();
   }
+  pipeline.Flush(out_fmt);
+  capture.Close();
 
   av_write_trailer(out_fmt);
 
@@ -260,6 +645,10 @@ int main() {
 
   avformat_free_context(out_fmt);
 
+  AvMetrics::Instance().RemoveRoom(room_id);
+  AfadeWarmPool::Instance().Stop();
+  ResourceMetrics::Instance().Shutdown();
+
   LOG_INFO("✅ 输出完成: {}（已应用前 200 帧淡入效果）", output_file);
   return 0;
 }
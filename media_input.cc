@@ -0,0 +1,399 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "media_input.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "logger.h"
+
+namespace {
+
+constexpr int kAdtsHeaderSize = 7;
+// ring 读空时先让出 CPU 这么多次，之后每次短睡
+constexpr int kRingSpins = 64;
+constexpr auto kRingSleep = std::chrono::microseconds(200);
+
+const int kSampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                            22050, 16000, 12000, 11025, 8000,  7350};
+
+std::string AvError(int ret) {
+  char errbuf[128];
+  av_strerror(ret, errbuf, sizeof(errbuf));
+  return errbuf;
+}
+
+// 一种来源上次完整探测的结果：输入格式和各流参数
+struct ProbeEntry {
+  const AVInputFormat *format = nullptr;
+  std::vector<AVCodecParameters *> params;
+
+  ~ProbeEntry() {
+    for (AVCodecParameters *par : params)
+      avcodec_parameters_free(&par);
+  }
+};
+
+struct ProbeCache {
+  std::mutex mu;
+  std::map<std::string, std::shared_ptr<const ProbeEntry>> entries;
+  MediaInput::ProbeStats stats;
+};
+
+ProbeCache &GetProbeCache() {
+  static ProbeCache cache;
+  return cache;
+}
+
+// 流数和类型都对得上才套用；头里还没给出类型的流（UNKNOWN）按缓存的算
+bool ApplyProbe(const ProbeEntry &entry, AVFormatContext *ctx) {
+  if (ctx->nb_streams != entry.params.size())
+    return false;
+  for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+    const AVCodecParameters *cur = ctx->streams[i]->codecpar;
+    const AVCodecParameters *want = entry.params[i];
+    if (cur->codec_type != AVMEDIA_TYPE_UNKNOWN && cur->codec_type != want->codec_type)
+      return false;
+    if (cur->codec_id != AV_CODEC_ID_NONE && cur->codec_id != want->codec_id)
+      return false;
+  }
+  for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+    if (avcodec_parameters_copy(ctx->streams[i]->codecpar, entry.params[i]) < 0)
+      return false;
+  }
+  return true;
+}
+
+// 探测完整（每个流都识别出编码）才缓存
+std::shared_ptr<const ProbeEntry> CaptureProbe(const AVFormatContext *ctx) {
+  auto entry = std::make_shared<ProbeEntry>();
+  entry->format = ctx->iformat;
+  for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+    const AVCodecParameters *par = ctx->streams[i]->codecpar;
+    if (par->codec_id == AV_CODEC_ID_NONE)
+      return nullptr;
+    AVCodecParameters *copy = avcodec_parameters_alloc();
+    if (!copy || avcodec_parameters_copy(copy, par) < 0) {
+      avcodec_parameters_free(&copy);
+      return nullptr;
+    }
+    entry->params.push_back(copy);
+  }
+  return entry;
+}
+
+void UnmapBuffer(void *opaque, uint8_t *data) {
+  munmap(data, static_cast<size_t>(reinterpret_cast<uintptr_t>(opaque)));
+}
+
+bool IsAdtsSync(const uint8_t *p) { return p[0] == 0xFF && (p[1] & 0xF6) == 0xF0; }
+
+int AdtsFrameLength(const uint8_t *p) {
+  return ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+}
+
+} // namespace
+
+ByteRing::ByteRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  buf_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t ByteRing::Write(const uint8_t *data, size_t n) {
+  if (closed())
+    return 0;
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  const uint64_t tail = tail_.load(std::memory_order_acquire);
+  n = std::min<size_t>(n, buf_.size() - (head - tail));
+  const size_t offset = head & mask_;
+  const size_t first = std::min(n, buf_.size() - offset);
+  memcpy(buf_.data() + offset, data, first);
+  memcpy(buf_.data(), data + first, n - first);
+  head_.store(head + n, std::memory_order_release);
+  return n;
+}
+
+size_t ByteRing::Read(uint8_t *dst, size_t n) {
+  const uint64_t tail = tail_.load(std::memory_order_relaxed);
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  n = std::min<size_t>(n, head - tail);
+  const size_t offset = tail & mask_;
+  const size_t first = std::min(n, buf_.size() - offset);
+  memcpy(dst, buf_.data() + offset, first);
+  memcpy(dst + first, buf_.data(), n - first);
+  tail_.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+bool ByteRing::WaitReadable() {
+  for (int spins = 0;; spins++) {
+    if (head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_relaxed))
+      return true;
+    // 先看关闭标记再看一次数据：Close 之前写入的字节不会漏掉
+    if (closed())
+      return head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_relaxed);
+    if (spins < kRingSpins)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(kRingSleep);
+  }
+}
+
+std::unique_ptr<MediaInput> MediaInput::FromBuffer(AVBufferRef *buf, const std::string &name) {
+  if (!buf || buf->size <= 0)
+    return nullptr;
+  std::unique_ptr<MediaInput> input(new MediaInput());
+  input->name_ = name;
+  input->buf_ = av_buffer_ref(buf);
+  if (!input->buf_ || !input->InitAvio(true))
+    return nullptr;
+  input->DetectAdts();
+  return input;
+}
+
+std::unique_ptr<MediaInput> MediaInput::MapFile(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR("MediaInput open {} failed: {}", path, strerror(errno));
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > INT_MAX) {
+    LOG_ERROR("MediaInput {} unsupported size {}", path, static_cast<int64_t>(st.st_size));
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = st.st_size;
+  void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR("MediaInput mmap {} failed: {}", path, strerror(errno));
+    return nullptr;
+  }
+  madvise(addr, size, MADV_SEQUENTIAL);
+  AVBufferRef *buf = av_buffer_create(static_cast<uint8_t *>(addr), static_cast<int>(size),
+                                      UnmapBuffer, reinterpret_cast<void *>(size),
+                                      AV_BUFFER_FLAG_READONLY);
+  if (!buf) {
+    munmap(addr, size);
+    return nullptr;
+  }
+  std::unique_ptr<MediaInput> input = FromBuffer(buf, path);
+  av_buffer_unref(&buf);
+  return input;
+}
+
+std::unique_ptr<MediaInput> MediaInput::FromRing(ByteRing *ring, const std::string &name) {
+  if (!ring)
+    return nullptr;
+  std::unique_ptr<MediaInput> input(new MediaInput());
+  input->name_ = name;
+  input->ring_ = ring;
+  if (!input->InitAvio(false))
+    return nullptr;
+  return input;
+}
+
+MediaInput::~MediaInput() {
+  if (avio_) {
+    av_freep(&avio_->buffer);
+    avio_context_free(&avio_);
+  }
+  av_buffer_unref(&buf_);
+}
+
+bool MediaInput::InitAvio(bool seekable) {
+  uint8_t *iobuf = static_cast<uint8_t *>(av_malloc(kAvioBufferSize));
+  if (!iobuf)
+    return false;
+  avio_ = avio_alloc_context(iobuf, kAvioBufferSize, 0, this, ring_ ? ReadRing : ReadBuffer,
+                             nullptr, seekable ? SeekBuffer : nullptr);
+  if (!avio_) {
+    av_free(iobuf);
+    LOG_ERROR("MediaInput {} alloc AVIOContext failed", name_);
+    return false;
+  }
+  return true;
+}
+
+void MediaInput::DetectAdts() {
+  const uint8_t *data = buf_->data;
+  const int64_t size = buf_->size;
+  int64_t pos = 0;
+  // ID3v2 标签：10 字节头 + syncsafe 长度，带 footer 时再加 10
+  if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+    pos = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 | (data[8] & 0x7f) << 7 |
+                (data[9] & 0x7f));
+    if (data[5] & 0x10)
+      pos += 10;
+  }
+  if (pos + kAdtsHeaderSize > size || !IsAdtsSync(data + pos))
+    return;
+  // 下一帧也要对得上同步字（或正好到结尾），避免把别的格式误认成 ADTS
+  const int64_t next = pos + AdtsFrameLength(data + pos);
+  if (next != size && (next + 2 > size || !IsAdtsSync(data + next)))
+    return;
+  adts_pos_ = pos;
+}
+
+bool MediaInput::ReadAdts(AVPacket *out, AVRational time_base) {
+  if (adts_pos_ < 0)
+    return false;
+  const uint8_t *data = buf_->data;
+  const int64_t size = buf_->size;
+  bool lost = false;
+  int len = 0;
+  for (;; adts_pos_++) {
+    if (adts_pos_ + kAdtsHeaderSize > size)
+      return false;
+    const uint8_t *p = data + adts_pos_;
+    if (IsAdtsSync(p) && ((p[2] >> 2) & 0x0F) < 13) {
+      len = AdtsFrameLength(p);
+      if (len >= kAdtsHeaderSize && adts_pos_ + len <= size)
+        break;
+    }
+    if (!lost) {
+      LOG_EVERY_N(warn, 100, "MediaInput {} lost ADTS sync at {}", name_, adts_pos_);
+      lost = true;
+    }
+  }
+
+  const uint8_t *p = data + adts_pos_;
+  // 解码器要求负载后有 AV_INPUT_BUFFER_PADDING_SIZE 字节可读，最后一帧只能拷贝
+  if (adts_pos_ + len + AV_INPUT_BUFFER_PADDING_SIZE <= size) {
+    out->buf = av_buffer_ref(buf_);
+    if (!out->buf)
+      return false;
+    out->data = const_cast<uint8_t *>(p);
+    out->size = len;
+  } else {
+    if (av_new_packet(out, len) < 0)
+      return false;
+    memcpy(out->data, p, len);
+  }
+  const int sample_rate = kSampleRates[(p[2] >> 2) & 0x0F];
+  const int samples = ((p[6] & 0x03) + 1) * 1024;
+  out->stream_index = 0;
+  out->pts = out->dts = av_rescale_q(adts_samples_, {1, sample_rate}, time_base);
+  out->duration = av_rescale_q(samples, {1, sample_rate}, time_base);
+  out->flags |= AV_PKT_FLAG_KEY;
+  adts_samples_ += samples;
+  adts_pos_ += len;
+  return true;
+}
+
+bool MediaInput::Open(const std::string &probe_key, AVFormatContext **fmt) {
+  ProbeCache &cache = GetProbeCache();
+  std::shared_ptr<const ProbeEntry> cached;
+  if (!probe_key.empty()) {
+    std::lock_guard<std::mutex> lk(cache.mu);
+    auto it = cache.entries.find(probe_key);
+    if (it != cache.entries.end())
+      cached = it->second;
+  }
+
+  AVFormatContext *ctx = avformat_alloc_context();
+  if (!ctx)
+    return false;
+  ctx->pb = avio_;
+  ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+  // 命中时直接指定输入格式，跳过格式探测；失败时 avformat_open_input 会释放 ctx
+  // FFmpeg 5 之前 avformat_open_input 的 fmt 参数不带 const，只读使用
+  int ret = avformat_open_input(
+      &ctx, name_.c_str(),
+      cached ? const_cast<AVInputFormat *>(cached->format) : nullptr, nullptr);
+  if (ret < 0) {
+    LOG_ERROR("MediaInput open {} failed: {}", name_, AvError(ret));
+    return false;
+  }
+
+  const bool applied = cached && ApplyProbe(*cached, ctx);
+  if (!applied) {
+    ret = avformat_find_stream_info(ctx, nullptr);
+    if (ret < 0)
+      LOG_WARN("MediaInput {} find stream info failed: {}", name_, AvError(ret));
+  }
+  if (!probe_key.empty()) {
+    std::shared_ptr<const ProbeEntry> fresh = applied ? nullptr : CaptureProbe(ctx);
+    std::lock_guard<std::mutex> lk(cache.mu);
+    if (applied)
+      cache.stats.hits++;
+    else if (cached)
+      cache.stats.mismatches++;
+    else
+      cache.stats.misses++;
+    if (fresh)
+      cache.entries[probe_key] = fresh;
+  }
+  LOG_INFO("MediaInput open {} format={} streams={} probe={} adts_direct={}", name_,
+           ctx->iformat->name, ctx->nb_streams, applied ? "cached" : "full", is_adts());
+  *fmt = ctx;
+  return true;
+}
+
+int MediaInput::ReadBuffer(void *opaque, uint8_t *buf, int buf_size) {
+  auto *self = static_cast<MediaInput *>(opaque);
+  const int64_t left = self->buf_->size - self->read_pos_;
+  if (left <= 0)
+    return AVERROR_EOF;
+  const int n = static_cast<int>(std::min<int64_t>(left, buf_size));
+  memcpy(buf, self->buf_->data + self->read_pos_, n);
+  self->read_pos_ += n;
+  return n;
+}
+
+int64_t MediaInput::SeekBuffer(void *opaque, int64_t offset, int whence) {
+  auto *self = static_cast<MediaInput *>(opaque);
+  const int64_t size = self->buf_->size;
+  if (whence & AVSEEK_SIZE)
+    return size;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = self->read_pos_ + offset;
+    break;
+  case SEEK_END:
+    pos = size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+  if (pos < 0 || pos > size)
+    return AVERROR(EINVAL);
+  self->read_pos_ = pos;
+  return pos;
+}
+
+int MediaInput::ReadRing(void *opaque, uint8_t *buf, int buf_size) {
+  auto *self = static_cast<MediaInput *>(opaque);
+  if (!self->ring_->WaitReadable())
+    return AVERROR_EOF;
+  return static_cast<int>(self->ring_->Read(buf, buf_size));
+}
+
+MediaInput::ProbeStats MediaInput::probe_stats() {
+  ProbeCache &cache = GetProbeCache();
+  std::lock_guard<std::mutex> lk(cache.mu);
+  return cache.stats;
+}
+
+void MediaInput::ClearProbeCache() {
+  ProbeCache &cache = GetProbeCache();
+  std::lock_guard<std::mutex> lk(cache.mu);
+  cache.entries.clear();
+}
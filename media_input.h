@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/buffer.h>
+}
+
+// 单生产者单消费者字节环：接收线程 Write，处理线程经 MediaInput 的 AVIOContext 读。
+// 无锁，读空时消费者先让出 CPU、再短睡等待，生产者 Close 后读完即 EOF
+class ByteRing {
+public:
+  // 容量向上取 2 的幂
+  explicit ByteRing(size_t capacity);
+
+  // 生产者：写入尽量多的字节，返回实际写入数（满时少于 n）；Close 之后返回 0
+  size_t Write(const uint8_t *data, size_t n);
+  void Close() { closed_.store(true, std::memory_order_release); }
+  // 消费者：读出最多 n 字节，不阻塞
+  size_t Read(uint8_t *dst, size_t n);
+  // 消费者：等到有数据或已关闭；有数据返回 true
+  bool WaitReadable();
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+  size_t capacity() const { return buf_.size(); }
+
+private:
+  std::vector<uint8_t> buf_;
+  size_t mask_;
+  alignas(64) std::atomic<uint64_t> head_{0}; // 已写入总字节数，生产者推进
+  alignas(64) std::atomic<uint64_t> tail_{0}; // 已读出总字节数，消费者推进
+  std::atomic<bool> closed_{false};
+};
+
+// 输入源：一段内存、一个 mmap 的文件或一个 ByteRing，对 avformat 提供自定义 AVIOContext，
+// 不走 file 协议的小块 read 系统调用。内存/映射源的 avformat 读取只有一次从映射到 AVIO 缓冲的
+// memcpy；纯 ADTS 源还可以跳过 avformat，ReadAdts 直接按帧切片，包引用底层内存，零拷贝。
+// 映射在最后一个引用（包括送出去的包）释放后才解除。
+// Open 按调用方给的来源类型（同一种接入、同一种编码参数）缓存探测结果：命中时跳过格式探测
+// 和 avformat_find_stream_info，直接套用上次的流参数。非线程安全，与使用它的房间同线程
+class MediaInput {
+public:
+  struct ProbeStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t mismatches = 0; // 命中但流数或类型对不上，重新探测
+  };
+
+  // 内存：buf 加引用，调用方的引用可以随即释放
+  static std::unique_ptr<MediaInput> FromBuffer(AVBufferRef *buf, const std::string &name);
+  // 只读映射整个文件
+  static std::unique_ptr<MediaInput> MapFile(const std::string &path);
+  // 另一线程写入的 ring，须比本对象活得久；不可 seek，不能 ReadAdts
+  static std::unique_ptr<MediaInput> FromRing(ByteRing *ring, const std::string &name);
+  ~MediaInput();
+  MediaInput(const MediaInput &) = delete;
+  MediaInput &operator=(const MediaInput &) = delete;
+
+  // 用本对象的 I/O 打开 avformat。probe_key 为空时每次完整探测。
+  // 返回的 fmt 由调用方 avformat_close_input，且须在本对象析构之前
+  bool Open(const std::string &probe_key, AVFormatContext **fmt);
+  AVIOContext *avio() const { return avio_; }
+
+  // 内存/映射源的整块数据（如整块交给 FlvAacDemuxer::Feed），ring 源为 nullptr
+  AVBufferRef *buffer() const { return buf_; }
+  // 内存/映射源且内容为 ADTS（可带 ID3v2 头）
+  bool is_adts() const { return adts_pos_ >= 0; }
+  // 下一帧 ADTS（含头，与 avformat 的 aac 解复用输出一致），pts/dts 按 time_base；
+  // 包引用底层缓冲。结束返回 false
+  bool ReadAdts(AVPacket *out, AVRational time_base);
+  const std::string &name() const { return name_; }
+
+  static ProbeStats probe_stats();
+  static void ClearProbeCache();
+
+private:
+  // AVIO 缓冲大小：内存源每次只是一次 memcpy，取大一些减少回调次数
+  static constexpr int kAvioBufferSize = 64 << 10;
+
+  MediaInput() = default;
+  bool InitAvio(bool seekable);
+  void DetectAdts();
+
+  static int ReadBuffer(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t SeekBuffer(void *opaque, int64_t offset, int whence);
+  static int ReadRing(void *opaque, uint8_t *buf, int buf_size);
+
+  std::string name_;
+  AVBufferRef *buf_ = nullptr;
+  ByteRing *ring_ = nullptr;
+  AVIOContext *avio_ = nullptr;
+  int64_t read_pos_ = 0;   // AVIO 读位置
+  int64_t adts_pos_ = -1;  // ReadAdts 读位置，-1 = 不是 ADTS
+  int64_t adts_samples_ = 0;
+};
@@ -0,0 +1,150 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "numa_topology.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "logger.h"
+
+namespace {
+
+// <numaif.h> 中 MPOL_PREFERRED 的取值，避免为一个常量引入 libnuma
+constexpr int kMpolPreferred = 1;
+constexpr unsigned long kMaxNodes = 1024;
+
+std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+} // namespace
+
+const NumaTopology &NumaTopology::Instance() {
+  static NumaTopology inst;
+  return inst;
+}
+
+NumaTopology::NumaTopology() {
+  DIR *dir = opendir("/sys/devices/system/node");
+  if (dir) {
+    std::vector<std::pair<int, std::vector<int>>> found;
+    while (dirent *ent = readdir(dir)) {
+      if (strncmp(ent->d_name, "node", 4) != 0 || ent->d_name[4] < '0' ||
+          ent->d_name[4] > '9')
+        continue;
+      int node = atoi(ent->d_name + 4);
+      std::ifstream f(std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist");
+      std::string list;
+      std::getline(f, list);
+      found.emplace_back(node, ParseCpuList(list));
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    // 节点编号可能不连续（热插拔、无内存节点），按实际编号摆放
+    for (auto &[node, cpus] : found) {
+      if (node >= static_cast<int>(node_cpus_.size()))
+        node_cpus_.resize(node + 1);
+      node_cpus_[node] = std::move(cpus);
+    }
+  }
+  if (node_cpus_.empty()) {
+    node_cpus_.push_back(AllowedCpus());
+  }
+  for (int node = 0; node < nodes(); node++) {
+    for (int cpu : node_cpus_[node]) {
+      if (cpu >= static_cast<int>(cpu_node_.size()))
+        cpu_node_.resize(cpu + 1, -1);
+      cpu_node_[cpu] = node;
+    }
+  }
+  LOG_INFO("NumaTopology nodes={} cpus={}", nodes(), cpu_node_.size());
+}
+
+int NumaTopology::NodeOfCpu(int cpu) const {
+  if (cpu < 0 || cpu >= static_cast<int>(cpu_node_.size()))
+    return -1;
+  return cpu_node_[cpu];
+}
+
+int NumaTopology::CurrentNode() const { return NodeOfCpu(sched_getcpu()); }
+
+std::vector<int> NumaTopology::SortByNode(std::vector<int> cpus) const {
+  if (cpus.empty())
+    cpus = AllowedCpus();
+  std::sort(cpus.begin(), cpus.end(), [this](int a, int b) {
+    int na = NodeOfCpu(a), nb = NodeOfCpu(b);
+    return na != nb ? na < nb : a < b;
+  });
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::vector<int> NumaTopology::ParseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t comma = std::min(list.find(',', pos), list.size());
+    std::string item = list.substr(pos, comma - pos);
+    pos = comma + 1;
+    if (item.empty() || item == "\n")
+      continue;
+    char *end = nullptr;
+    long lo = strtol(item.c_str(), &end, 10);
+    long hi = lo;
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    if (end == item.c_str() || (*end && *end != '\n') || lo < 0 || hi < lo ||
+        hi >= CPU_SETSIZE)
+      return {};
+    for (long cpu = lo; cpu <= hi; cpu++)
+      cpus.push_back(static_cast<int>(cpu));
+  }
+  return cpus;
+}
+
+bool NumaTopology::PinCurrentThread(const std::vector<int> &cpus) {
+  if (cpus.empty())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool NumaTopology::PinCurrentThreadToNode(int node) const {
+  if (node < 0 || node >= nodes())
+    return false;
+  return PinCurrentThread(node_cpus_[node]);
+}
+
+bool NumaTopology::PreferNode(void *addr, size_t len, int node) const {
+  if (nodes() <= 1 || node < 0)
+    return true;
+  unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+  if (node >= static_cast<int>(kMaxNodes))
+    return false;
+  mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_mbind, addr, len, kMpolPreferred, mask, kMaxNodes, 0) != 0) {
+    LOG_WARN("NumaTopology mbind node={} len={} failed: {}", node, len, strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// 本机 NUMA 拓扑（读 /sys/devices/system/node），以及把线程、内存放到指定节点的工具。
+// 不依赖 libnuma：内存策略直接走 mbind 系统调用。
+// 读不到 sysfs（容器、非 NUMA 内核）时退化为包含全部 CPU 的单节点 0。
+class NumaTopology {
+public:
+  static const NumaTopology &Instance();
+
+  int nodes() const { return static_cast<int>(node_cpus_.size()); }
+  // 节点上的 CPU（升序）
+  const std::vector<int> &cpus(int node) const { return node_cpus_[node]; }
+  // CPU 所在节点，未知返回 -1
+  int NodeOfCpu(int cpu) const;
+  // 当前线程所在 CPU 的节点
+  int CurrentNode() const;
+
+  // 把 CPU 集合按 (节点, CPU) 排序，同一节点的 CPU 相邻；空集合表示本进程可用的全部 CPU
+  std::vector<int> SortByNode(std::vector<int> cpus) const;
+
+  // 解析 "0-7,16-23" 形式的 CPU 列表，格式错误返回空
+  static std::vector<int> ParseCpuList(const std::string &list);
+  // 当前线程绑到 cpus 中的任一 CPU
+  static bool PinCurrentThread(const std::vector<int> &cpus);
+  // 当前线程绑到节点上的全部 CPU；node < 0 时不改动
+  bool PinCurrentThreadToNode(int node) const;
+  // [addr, addr + len) 的页优先从 node 分配，须在首次写入前调用；单节点时直接返回 true
+  bool PreferNode(void *addr, size_t len, int node) const;
+
+private:
+  NumaTopology();
+
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<int> cpu_node_; // 下标为 CPU 编号
+};
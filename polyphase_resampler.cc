@@ -0,0 +1,201 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
+#include "polyphase_resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define POLYPHASE_X86 1
+#endif
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#include "logger.h"
+
+namespace {
+
+// Kaiser 窗 β，阻带约 -80dB
+constexpr double kKaiserBeta = 8.0;
+// 截止频率取两边奈奎斯特较小者的 95%，留出过渡带
+constexpr double kCutoff = 0.95;
+
+using DotFn = float (*)(const float *x, const float *h, int n);
+
+float DotC(const float *x, const float *h, int n) {
+  float acc = 0;
+  for (int i = 0; i < n; i++)
+    acc += x[i] * h[i];
+  return acc;
+}
+
+#ifdef POLYPHASE_X86
+// n 为 8 的倍数（FilterBank::taps 保证）
+__attribute__((target("avx2,fma"))) float DotAvx2(const float *x, const float *h, int n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(h + i + 8), acc1);
+  }
+  for (; i < n; i += 8)
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), acc0);
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+#endif
+
+bool HaveAvx2() {
+#ifdef POLYPHASE_X86
+  const int flags = av_get_cpu_flags();
+  return (flags & AV_CPU_FLAG_AVX2) && (flags & AV_CPU_FLAG_FMA3);
+#else
+  return false;
+#endif
+}
+
+DotFn PickDot() {
+#ifdef POLYPHASE_X86
+  if (HaveAvx2())
+    return DotAvx2;
+#endif
+  return DotC;
+}
+
+// 第一类零阶修正贝塞尔函数，级数展开
+double BesselI0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+std::shared_ptr<PolyphaseResampler::FilterBank> BuildFilterBank(int up, int down, int taps) {
+  auto bank = std::make_shared<PolyphaseResampler::FilterBank>();
+  bank->up = up;
+  bank->down = down;
+  bank->taps = taps;
+  bank->coeffs.resize(static_cast<size_t>(up) * taps);
+  // 以输入采样为单位的连续核：c·sinc(c·t)·kaiser(t / half)，降采样时 c < 1
+  const double c = kCutoff * std::min(1.0, static_cast<double>(up) / down);
+  const int half = taps / 2;
+  const double i0_beta = BesselI0(kKaiserBeta);
+  for (int p = 0; p < up; p++) {
+    float *h = &bank->coeffs[static_cast<size_t>(p) * taps];
+    double sum = 0;
+    for (int j = 0; j < taps; j++) {
+      // 第 j 个系数乘输入 x[n - half + 1 + j]，与输出时刻相距 t = p/L + half - 1 - j
+      const double t = static_cast<double>(p) / up + half - 1 - j;
+      const double r = t / half;
+      const double w = r * r < 1 ? BesselI0(kKaiserBeta * std::sqrt(1 - r * r)) / i0_beta : 0;
+      const double x = M_PI * c * t;
+      const double sinc = t == 0 ? 1 : std::sin(x) / x;
+      h[j] = static_cast<float>(c * sinc * w);
+      sum += h[j];
+    }
+    // 每一相的直流增益归一，避免相位间增益起伏成为 L 倍频的调制
+    for (int j = 0; j < taps; j++)
+      h[j] = static_cast<float>(h[j] / sum);
+  }
+  return bank;
+}
+
+} // namespace
+
+std::shared_ptr<const PolyphaseResampler::FilterBank>
+PolyphaseResampler::GetFilterBank(int in_rate, int out_rate) {
+  static std::mutex mu;
+  static std::map<std::pair<int, int>, std::weak_ptr<const FilterBank>> banks;
+  const int g = std::gcd(in_rate, out_rate);
+  const std::pair<int, int> key(out_rate / g, in_rate / g);
+  std::lock_guard<std::mutex> lk(mu);
+  std::weak_ptr<const FilterBank> &slot = banks[key];
+  std::shared_ptr<const FilterBank> bank = slot.lock();
+  if (!bank) {
+    bank = BuildFilterBank(key.first, key.second, kTaps);
+    slot = bank;
+    LOG_INFO("PolyphaseResampler filter bank {}/{}: {} phases x {} taps, {} bytes", key.first,
+             key.second, key.first, kTaps, bank->coeffs.size() * sizeof(float));
+  }
+  return bank;
+}
+
+PolyphaseResampler::PolyphaseResampler(int in_rate, int out_rate, int channels)
+    : in_rate_(in_rate), out_rate_(out_rate),
+      channels_(std::clamp(channels, 1, kMaxChannels)),
+      bank_(GetFilterBank(in_rate, out_rate)) {
+  // 输入开头之前按静音处理：第一个输出样本的窗口从 x[1 - half] 起
+  const int half = bank_->taps / 2;
+  history_begin_ = 1 - half;
+  for (int c = 0; c < channels_; c++)
+    history_[c].assign(half - 1, 0.0f);
+}
+
+void PolyphaseResampler::Push(const float *const *in, int nb) {
+  if (flushed_ || nb <= 0)
+    return;
+  for (int c = 0; c < channels_; c++)
+    history_[c].insert(history_[c].end(), in[c], in[c] + nb);
+  in_count_ += nb;
+}
+
+void PolyphaseResampler::Flush() {
+  if (flushed_)
+    return;
+  // 补 half 个零，最后一个输出样本的窗口也能凑满
+  for (int c = 0; c < channels_; c++)
+    history_[c].insert(history_[c].end(), bank_->taps / 2, 0.0f);
+  flushed_ = true;
+}
+
+int PolyphaseResampler::Pull(float *const *out, int cap, float gain, float step) {
+  const FilterBank &bank = *bank_;
+  const int taps = bank.taps;
+  const int half = taps / 2;
+  const int64_t available = history_begin_ + static_cast<int64_t>(history_[0].size());
+  // 输出 k 的时刻不能超过输入末尾（Flush 后按 ceil(输入数·L/M) 截止）
+  const int64_t out_limit = (in_count_ * bank.up + bank.down - 1) / bank.down;
+  const DotFn dot = PickDot();
+  int produced = 0;
+  while (produced < cap && out_count_ < out_limit) {
+    const int64_t num = out_count_ * bank.down;
+    const int64_t n = num / bank.up;
+    const int phase = static_cast<int>(num % bank.up);
+    // 窗口为 x[n - half + 1, n + half]
+    if (n + half >= available)
+      break;
+    const size_t offset = static_cast<size_t>(n - half + 1 - history_begin_);
+    const float *h = &bank.coeffs[static_cast<size_t>(phase) * taps];
+    const float g = gain + step * produced;
+    for (int c = 0; c < channels_; c++)
+      out[c][produced] = dot(history_[c].data() + offset, h, taps) * g;
+    produced++;
+    out_count_++;
+  }
+
+  // 下一个输出窗口之前的样本不再需要
+  const int64_t next_n = out_count_ * bank.down / bank.up;
+  const int64_t drop = next_n - half + 1 - history_begin_;
+  if (drop >= kTrimSamples) {
+    for (int c = 0; c < channels_; c++)
+      history_[c].erase(history_[c].begin(), history_[c].begin() + drop);
+    history_begin_ += drop;
+  }
+  return produced;
+}
+
+bool PolyphaseResampler::UsingAvx2() { return PickDot() != DotC; }
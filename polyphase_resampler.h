@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// 多相 FIR 重采样（44.1kHz <-> 48kHz 等有理比例）。同一 L/M 比例的滤波器组进程内只算一次，
+// 各房间共享只读系数表，每个实例只保存自己的历史样本和相位。
+// 输出第 k 个样本对应输入时刻 k·M/L，核以该时刻为中心（零相位），第一个输出样本与第一个
+// 输入样本对齐；Flush 后累计输出数为 ceil(输入数·L/M)，PTS 按采样率直接换算即可。
+// 输出时可带线性增益（淡入淡出与重采样在同一遍完成）。
+// 点积内核按 av_get_cpu_flags 选 AVX2+FMA 或标量。非线程安全，与房间同线程使用。
+class PolyphaseResampler {
+public:
+  struct FilterBank {
+    int up = 1;   // L = out_rate / gcd
+    int down = 1; // M = in_rate / gcd
+    int taps = 0; // 每相系数个数，8 的倍数
+    // 第 p 相（小数延迟 p/L）从 coeffs[p * taps] 起，按输入时间正序，与历史样本直接做点积
+    std::vector<float> coeffs;
+  };
+
+  static constexpr int kMaxChannels = 8;
+  static constexpr int kTaps = 32;
+
+  // 取（必要时计算）in_rate -> out_rate 的滤波器组；比例相同的采样率对共享同一份
+  static std::shared_ptr<const FilterBank> GetFilterBank(int in_rate, int out_rate);
+
+  PolyphaseResampler(int in_rate, int out_rate, int channels);
+
+  // 追加 nb 个输入样本（FLTP），数据会被拷进内部历史
+  void Push(const float *const *in, int nb);
+  // 输入结束：补零放出尾部样本，之后只能 Pull
+  void Flush();
+  // 取出最多 cap 个输出样本，第 i 个乘以 gain + step·i；返回实际个数，
+  // 输入不够时少于 cap（剩下的等下一次 Push）
+  int Pull(float *const *out, int cap, float gain = 1.0f, float step = 0.0f);
+
+  int in_rate() const { return in_rate_; }
+  int out_rate() const { return out_rate_; }
+  int channels() const { return channels_; }
+  int64_t output_samples() const { return out_count_; }
+  const FilterBank &bank() const { return *bank_; }
+
+  // 是否使用 AVX2+FMA 内核（可用 av_force_cpu_flags 关闭做对比）
+  static bool UsingAvx2();
+
+private:
+  // 已消费的历史攒够这么多再从缓冲前端删除，避免每次搬移
+  static constexpr int kTrimSamples = 4096;
+
+  int in_rate_;
+  int out_rate_;
+  int channels_;
+  std::shared_ptr<const FilterBank> bank_;
+  std::vector<float> history_[kMaxChannels];
+  int64_t history_begin_; // history_[c][0] 对应的输入样本下标（开头补的零为负）
+  int64_t in_count_ = 0;  // 已 Push 的输入样本数（不含 Flush 补的零）
+  int64_t out_count_ = 0; // 已输出的样本数 k
+  bool flushed_ = false;
+};
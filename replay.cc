@@ -0,0 +1,206 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "av_metrics.h"
+#include "capture_file.h"
+#include "logger.h"
+#include "room_pipeline.h"
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr uint64_t kFnvOffset = 1469598103934665603ULL;
+constexpr uint64_t kFnvPrime = 1099511628211ULL;
+// 晚于计划时刻超过这个值计为 late（约一个 AAC 帧）
+constexpr int64_t kLateNs = 23 * 1000000;
+
+uint64_t Fnv1a(uint64_t h, const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= kFnvPrime;
+  }
+  return h;
+}
+
+double Percentile(const std::vector<float> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+void WriteReport(const std::string &path, const ReplayReport &r) {
+  std::ofstream f(path);
+  f << fmt::format(
+      "{{\"rooms\": {}, \"packets\": {}, \"audio_frames\": {}, \"fades\": {}, "
+      "\"late\": {}, \"wall_seconds\": {:.3f}, \"media_seconds\": {:.3f}, "
+      "\"p50_us\": {:.1f}, \"p99_us\": {:.1f}, \"p999_us\": {:.1f}, "
+      "\"max_us\": {:.1f}, \"output_digest\": \"{:016x}\"}}\n",
+      r.rooms, r.packets, r.audio_frames, r.fades, r.late, r.wall_seconds,
+      r.media_seconds, r.p50_us, r.p99_us, r.p999_us, r.max_us, r.output_digest);
+}
+
+} // namespace
+
+bool ParseReplayOptions(int argc, char **argv, int first, ReplayOptions *options) {
+  // std::stod 等遇到非数字或越界会抛异常，当作参数错误由调用方打印用法
+  try {
+    for (int i = first; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc)
+        return false;
+      std::string val = argv[++i];
+      if (arg == "--speed") {
+        options->speed = std::max(0.0, std::stod(val));
+      } else if (arg == "--start-ms") {
+        options->start_ms = std::max<int64_t>(0, std::stoll(val));
+      } else if (arg == "--report") {
+        options->report_path = val;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  } catch (const std::logic_error &) {
+    return false;
+  }
+}
+
+bool Replayer::Run(ReplayReport *report) {
+  const ReplayOptions &opt = options_;
+  capture::CaptureReader reader;
+  if (!reader.Open(opt.path))
+    return false;
+  if (opt.start_ms > 0)
+    reader.SeekMs(opt.start_ms);
+
+  // 房间在第一次用到时按录制的参数创建
+  std::vector<std::unique_ptr<RoomPipeline>> rooms;
+  auto room_at = [&](uint32_t idx) -> RoomPipeline * {
+    if (idx >= reader.rooms().size())
+      return nullptr;
+    if (rooms.size() <= idx)
+      rooms.resize(idx + 1);
+    if (!rooms[idx]) {
+      const capture::RoomInfo &info = reader.rooms()[idx];
+      RoomPipeline::Config cfg;
+      cfg.room_id = info.name;
+      cfg.sample_rate = info.sample_rate;
+      cfg.channels = info.channels;
+      cfg.sample_fmt = info.sample_fmt;
+      cfg.time_base = info.time_base;
+      // 降级取决于回放机器的负载，关掉才能逐位复现输出
+      cfg.lag_budget_ms = 0;
+      rooms[idx] = std::make_unique<RoomPipeline>(cfg);
+    }
+    return rooms[idx].get();
+  };
+
+  LOG_INFO("Replayer start file={} speed={} start_ms={}", opt.path, opt.speed,
+           opt.start_ms);
+
+  const bool paced = opt.speed > 0;
+  ReplayReport r;
+  std::vector<float> latency_us;
+  uint64_t digest = kFnvOffset;
+  int64_t first_t_ns = -1, last_t_ns = 0;
+  const auto start = steady_clock::now();
+
+  capture::Record rec;
+  AVPacket out;
+  av_init_packet(&out);
+  while (reader.Next(&rec)) {
+    if (first_t_ns < 0)
+      first_t_ns = rec.t_ns;
+    last_t_ns = rec.t_ns;
+    RoomPipeline *room = room_at(rec.room);
+    if (!room)
+      continue;
+
+    if (paced) {
+      auto due = start + nanoseconds(static_cast<int64_t>((rec.t_ns - first_t_ns) /
+                                                          opt.speed));
+      auto now = steady_clock::now();
+      if (now < due)
+        std::this_thread::sleep_until(due);
+      else if (now - due > nanoseconds(kLateNs))
+        r.late++;
+    }
+
+    if (rec.type == capture::kFade) {
+      if (room->StartFade(static_cast<AudioAfade::FadeType>(rec.fade_type), rec.frames))
+        r.fades++;
+      continue;
+    }
+
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = const_cast<uint8_t *>(rec.data);
+    pkt.size = rec.size;
+    pkt.pts = rec.pts;
+    pkt.dts = rec.dts;
+    pkt.flags = rec.flags;
+    pkt.stream_index = rec.stream_index;
+    r.packets++;
+    if (rec.kind == capture::kVideo) {
+      room->OnVideoPacket(&pkt, rec.time_base);
+      continue;
+    }
+
+    auto t0 = steady_clock::now();
+    bool has_out = room->ProcessAudio(&pkt, &out);
+    auto t1 = steady_clock::now();
+    latency_us.push_back(duration<float, std::micro>(t1 - t0).count());
+    r.audio_frames++;
+    while (has_out) {
+      digest = Fnv1a(digest, &rec.room, sizeof(rec.room));
+      digest = Fnv1a(digest, &out.pts, sizeof(out.pts));
+      digest = Fnv1a(digest, out.data, out.size);
+      av_packet_unref(&out);
+      has_out = room->ReceiveAudio(&out);
+    }
+  }
+
+  for (auto &room : rooms) {
+    if (room)
+      AvMetrics::Instance().RemoveRoom(room->config().room_id);
+  }
+
+  std::sort(latency_us.begin(), latency_us.end());
+  r.rooms = static_cast<int>(reader.rooms().size());
+  r.wall_seconds = duration<double>(steady_clock::now() - start).count();
+  r.media_seconds = first_t_ns < 0 ? 0 : (last_t_ns - first_t_ns) / 1e9;
+  r.p50_us = Percentile(latency_us, 0.5);
+  r.p99_us = Percentile(latency_us, 0.99);
+  r.p999_us = Percentile(latency_us, 0.999);
+  r.max_us = latency_us.empty() ? 0 : latency_us.back();
+  r.output_digest = digest;
+
+  LOG_INFO("Replayer done packets={} audio_frames={} fades={} late={} p50={:.1f}us "
+           "p99={:.1f}us p999={:.1f}us digest={:016x}",
+           r.packets, r.audio_frames, r.fades, r.late, r.p50_us, r.p99_us,
+           r.p999_us, r.output_digest);
+  std::cout << fmt::format("rooms={} packets={} audio_frames={} fades={} late={}\n"
+                           "media={:.2f}s wall={:.2f}s\nlatency p50={:.1f}us "
+                           "p99={:.1f}us p999={:.1f}us max={:.1f}us\n"
+                           "output_digest={:016x}",
+                           r.rooms, r.packets, r.audio_frames, r.fades, r.late,
+                           r.media_seconds, r.wall_seconds, r.p50_us, r.p99_us,
+                           r.p999_us, r.max_us, r.output_digest)
+            << std::endl;
+  if (!opt.report_path.empty())
+    WriteReport(opt.report_path, r);
+  if (report)
+    *report = r;
+  return true;
+}
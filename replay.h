@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// 回放录制文件：按录制时的时间间隔（可倍速或不限速）把包和淡入淡出命令
+// 重新送入 RoomPipeline，统计处理延迟，并对输出做摘要，
+// 同一份录制在同一构建上多次回放摘要应一致，用于定位回退和长尾延迟。
+struct ReplayOptions {
+  std::string path;
+  double speed = 1.0;      // 1 = 原速，N = N 倍速，0 = 不限速
+  int64_t start_ms = 0;    // 从录制的第几毫秒开始
+  std::string report_path; // 非空时把结果写成 JSON
+};
+
+struct ReplayReport {
+  int rooms = 0;
+  uint64_t packets = 0;
+  uint64_t audio_frames = 0;
+  uint64_t fades = 0;
+  uint64_t late = 0; // 送入时已晚于计划时刻一个帧间隔以上
+  double wall_seconds = 0;
+  double media_seconds = 0; // 回放覆盖的录制时长
+  double p50_us = 0;
+  double p99_us = 0;
+  double p999_us = 0;
+  double max_us = 0;
+  uint64_t output_digest = 0; // 输出包数据和时间戳的 FNV-1a
+};
+
+// 解析 "--speed X --start-ms T --report FILE"，从 argv[first] 开始
+bool ParseReplayOptions(int argc, char **argv, int first, ReplayOptions *options);
+
+class Replayer {
+public:
+  explicit Replayer(const ReplayOptions &options) : options_(options) {}
+
+  // 阻塞运行到文件结束；打开文件失败返回 false
+  bool Run(ReplayReport *report);
+
+private:
+  ReplayOptions options_;
+};
@@ -0,0 +1,255 @@
+#define LOG_MODULE libmagic::LogModule::kMetrics
+#include "resource_metrics.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "audio_afade.h"
+#include "logger.h"
+
+std::atomic<int64_t> ResourceMetrics::tracked_bytes_{0};
+
+namespace {
+
+// 累计值 now 相对上次采样的增量（乘以 scale 换算单位）计入计数器；
+// 来源换了（如日志后端切换）导致回退时重新起算
+void AdvanceCounter(prometheus::Counter* counter, uint64_t now, uint64_t* last,
+                    double scale = 1.0) {
+  if (now > *last) counter->Increment(static_cast<double>(now - *last) * scale);
+  *last = now;
+}
+
+}  // namespace
+
+ResourceMetrics& ResourceMetrics::Instance() {
+  static ResourceMetrics inst;
+  return inst;
+}
+
+void ResourceMetrics::Init(std::shared_ptr<prometheus::Registry> registry, int interval_ms) {
+  if (inited_ || !registry) return;
+  registry_ = std::move(registry);
+  interval_ms_ = interval_ms;
+
+  log_queue_family_ = &prometheus::BuildGauge()
+                           .Name("libpush_log_queue_depth")
+                           .Help("Messages waiting in the async log queue")
+                           .Register(*registry_);
+  log_overrun_family_ = &prometheus::BuildCounter()
+                             .Name("libpush_log_queue_overruns_total")
+                             .Help("Messages overwritten because the async log queue was full")
+                             .Register(*registry_);
+  log_dropped_family_ = &prometheus::BuildCounter()
+                            .Name("libpush_log_dropped_records_total")
+                            .Help("Log records dropped or overwritten by the queue overflow policy")
+                            .Register(*registry_);
+  log_sink_errors_family_ = &prometheus::BuildCounter()
+                                .Name("libpush_log_sink_errors_total")
+                                .Help("Exceptions thrown by log sinks on the deferred backend thread")
+                                .Register(*registry_);
+  log_high_water_family_ = &prometheus::BuildGauge()
+                               .Name("libpush_log_queue_high_water_bytes")
+                               .Help("Highest per-thread log ring occupancy observed")
+                               .Register(*registry_);
+  afade_family_ = &prometheus::BuildGauge()
+                       .Name("libpush_afade_instances")
+                       .Help("Live AudioAfade instances by state")
+                       .Register(*registry_);
+  pool_family_ = &prometheus::BuildGauge()
+                      .Name("libpush_pool_objects")
+                      .Help("Frame / packet pool occupancy")
+                      .Register(*registry_);
+  buffer_bytes_family_ = &prometheus::BuildGauge()
+                              .Name("libpush_room_buffer_bytes")
+                              .Help("Bytes held by room buffer pools: heap buffers and arenas")
+                              .Register(*registry_);
+  thread_cpu_family_ = &prometheus::BuildCounter()
+                            .Name("libpush_thread_cpu_seconds_total")
+                            .Help("CPU time consumed per thread name, read from /proc/self/task")
+                            .Register(*registry_);
+
+  log_queue_depth_ = &log_queue_family_->Add({});
+  log_overruns_ = &log_overrun_family_->Add({});
+  log_dropped_ = &log_dropped_family_->Add({});
+  log_sink_errors_ = &log_sink_errors_family_->Add({});
+  log_high_water_ = &log_high_water_family_->Add({});
+  buffer_bytes_ = &buffer_bytes_family_->Add({});
+
+  stop_ = false;
+  sampler_ = std::thread(&ResourceMetrics::SamplerLoop, this);
+  inited_ = true;
+}
+
+void ResourceMetrics::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lk(sampler_mu_);
+    stop_ = true;
+  }
+  sampler_cv_.notify_all();
+  if (sampler_.joinable()) sampler_.join();
+}
+
+ResourceMetrics::~ResourceMetrics() { Shutdown(); }
+
+void ResourceMetrics::RegisterPool(const std::string& name, PoolStatsFn fn) {
+  std::lock_guard<std::mutex> lk(pools_mu_);
+  auto& pg = pools_[name];
+  pg.fn = std::move(fn);
+  if (inited_ && !pg.in_use) {
+    pg.in_use = &pool_family_->Add({{"pool", name}, {"state", "in_use"}});
+    pg.free = &pool_family_->Add({{"pool", name}, {"state", "free"}});
+  }
+}
+
+void ResourceMetrics::UnregisterPool(const std::string& name) {
+  std::lock_guard<std::mutex> lk(pools_mu_);
+  auto it = pools_.find(name);
+  if (it == pools_.end()) return;
+  if (it->second.in_use) {
+    pool_family_->Remove(it->second.in_use);
+    pool_family_->Remove(it->second.free);
+  }
+  pools_.erase(it);
+}
+
+AVBufferRef* ResourceMetrics::AllocTrackedBuffer(int size) {
+  if (size < 0 || size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) return nullptr;
+  uint8_t* data = static_cast<uint8_t*>(av_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE));
+  if (!data) return nullptr;
+  memset(data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  AVBufferRef* buf = av_buffer_create(data, size, &ResourceMetrics::FreeTrackedBuffer,
+                                      reinterpret_cast<void*>(static_cast<intptr_t>(size)), 0);
+  if (!buf) {
+    av_free(data);
+    return nullptr;
+  }
+  tracked_bytes_.fetch_add(size, std::memory_order_relaxed);
+  return buf;
+}
+
+void ResourceMetrics::FreeTrackedBuffer(void* opaque, uint8_t* data) {
+  tracked_bytes_.fetch_sub(static_cast<int64_t>(reinterpret_cast<intptr_t>(opaque)),
+                           std::memory_order_relaxed);
+  av_free(data);
+}
+
+void ResourceMetrics::AddTrackedBytes(int64_t delta) {
+  tracked_bytes_.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int64_t ResourceMetrics::TrackedBufferBytes() {
+  return tracked_bytes_.load(std::memory_order_relaxed);
+}
+
+void ResourceMetrics::SamplerLoop() {
+  pthread_setname_np(pthread_self(), "res_sampler");
+  std::unique_lock<std::mutex> lk(sampler_mu_);
+  while (!stop_) {
+    SampleLogQueue();
+    SampleAfade();
+    SamplePools();
+    SampleThreads();
+    buffer_bytes_->Set(static_cast<double>(TrackedBufferBytes()));
+    sampler_cv_.wait_for(lk, std::chrono::milliseconds(interval_ms_));
+  }
+}
+
+void ResourceMetrics::SampleLogQueue() {
+  if (libmagic::deferred::Backend::Running()) {
+    auto st = libmagic::deferred::Backend::Instance().stats();
+    log_queue_depth_->Set(static_cast<double>(st.pending_records));
+    AdvanceCounter(log_dropped_, st.dropped_records, &last_log_dropped_);
+    AdvanceCounter(log_sink_errors_, st.sink_errors, &last_log_sink_errors_);
+    log_high_water_->Set(static_cast<double>(st.high_water_bytes));
+    return;
+  }
+  // 控制台模式下没有异步线程池
+  auto tp = spdlog::thread_pool();
+  if (!tp) return;
+  log_queue_depth_->Set(static_cast<double>(tp->queue_size()));
+  AdvanceCounter(log_overruns_, tp->overrun_counter(), &last_log_overruns_);
+  AdvanceCounter(log_dropped_, tp->overrun_counter(), &last_log_dropped_);
+}
+
+void ResourceMetrics::SampleAfade() {
+  for (int s = 0; s < AudioAfade::STATE_COUNT; s++) {
+    auto state = static_cast<AudioAfade::State>(s);
+    afade_family_->Add({{"state", AudioAfade::StateName(state)}})
+        .Set(AudioAfade::InstanceCount(state));
+  }
+}
+
+void ResourceMetrics::SamplePools() {
+  std::lock_guard<std::mutex> lk(pools_mu_);
+  for (auto& kv : pools_) {
+    auto& pg = kv.second;
+    if (!pg.in_use) {
+      pg.in_use = &pool_family_->Add({{"pool", kv.first}, {"state", "in_use"}});
+      pg.free = &pool_family_->Add({{"pool", kv.first}, {"state", "free"}});
+    }
+    PoolStats st = pg.fn();
+    pg.in_use->Set(static_cast<double>(st.in_use));
+    pg.free->Set(static_cast<double>(st.free));
+  }
+}
+
+void ResourceMetrics::SampleThreads() {
+  static const double kSecondsPerTick = 1.0 / static_cast<double>(sysconf(_SC_CLK_TCK));
+
+  for (auto& kv : threads_) kv.second.alive = false;
+
+  DIR* dir = opendir("/proc/self/task");
+  if (!dir) return;
+  while (dirent* ent = readdir(dir)) {
+    if (ent->d_name[0] == '.') continue;
+    int tid = atoi(ent->d_name);
+    std::string task = std::string("/proc/self/task/") + ent->d_name;
+
+    std::ifstream stat_file(task + "/stat");
+    std::string stat;
+    if (!std::getline(stat_file, stat)) continue;
+    // comm 可能包含空格，从最后一个 ')' 之后开始解析：state 为第 3 个字段
+    size_t rparen = stat.rfind(')');
+    if (rparen == std::string::npos) continue;
+    std::istringstream iss(stat.substr(rparen + 2));
+    std::vector<std::string> fields;
+    std::string f;
+    while (fields.size() < 13 && iss >> f) fields.push_back(f);
+    if (fields.size() < 13) continue;
+    uint64_t utime = strtoull(fields[11].c_str(), nullptr, 10);  // 第 14 个字段
+    uint64_t stime = strtoull(fields[12].c_str(), nullptr, 10);  // 第 15 个字段
+
+    // 每次重读线程名：线程启动后才改名的，之后的 CPU 计入新名字
+    std::ifstream comm_file(task + "/comm");
+    std::string name;
+    std::getline(comm_file, name);
+    auto& counters = thread_cpu_[name];
+    if (!counters.user) {
+      counters.user = &thread_cpu_family_->Add({{"name", name}, {"mode", "user"}});
+      counters.system = &thread_cpu_family_->Add({{"name", name}, {"mode", "system"}});
+    }
+    // 新出现的线程从 0 起算，两次采样之间的 CPU 不会漏计
+    auto& sample = threads_[tid];
+    AdvanceCounter(counters.user, utime, &sample.user_ticks, kSecondsPerTick);
+    AdvanceCounter(counters.system, stime, &sample.system_ticks, kSecondsPerTick);
+    sample.alive = true;
+  }
+  closedir(dir);
+
+  // 已退出的线程：计数器按名字保留，只丢掉线程自己的采样
+  for (auto it = threads_.begin(); it != threads_.end();) {
+    if (!it->second.alive) {
+      it = threads_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
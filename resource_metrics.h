@@ -0,0 +1,110 @@
+#pragma once
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <prometheus/registry.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// 进程内部资源监控：日志队列、AudioAfade 实例、对象池、房间缓冲池内存、线程 CPU
+// 与 AvMetrics 共用同一个 registry，由后台线程定时采样
+class ResourceMetrics {
+public:
+  struct PoolStats {
+    int64_t in_use{0};
+    int64_t free{0};
+  };
+  using PoolStatsFn = std::function<PoolStats()>;
+
+  static ResourceMetrics& Instance();
+
+  // registry 通常取 AvMetrics::Instance().registry()
+  void Init(std::shared_ptr<prometheus::Registry> registry, int interval_ms = 1000);
+  void Shutdown();
+
+  // 对象池在创建时注册，销毁前注销；采样线程会调用 fn，需保证线程安全
+  void RegisterPool(const std::string& name, PoolStatsFn fn);
+  void UnregisterPool(const std::string& name);
+
+  // 分配一块计入 libpush_room_buffer_bytes 的缓冲区，释放时自动扣减。RoomBufferPool 的堆上
+  // 分配（解码帧、编码包、输出包）都走这里；FFmpeg 内部（滤镜图、编解码器私有状态）的分配不计入。
+  // 数据后另有 AV_INPUT_BUFFER_PADDING_SIZE 字节清零的填充（不计入 size），可直接作包缓冲
+  static AVBufferRef* AllocTrackedBuffer(int size);
+  static int64_t TrackedBufferBytes();
+  // 房间缓冲池的预映射内存区整块计入同一指标
+  static void AddTrackedBytes(int64_t delta);
+
+private:
+  ResourceMetrics() = default;
+  ~ResourceMetrics();
+
+  void SamplerLoop();
+  void SampleLogQueue();
+  void SampleAfade();
+  void SamplePools();
+  void SampleThreads();
+
+  static void FreeTrackedBuffer(void* opaque, uint8_t* data);
+
+  std::shared_ptr<prometheus::Registry> registry_;
+  prometheus::Family<prometheus::Gauge>* log_queue_family_{nullptr};    // libpush_log_queue_depth
+  prometheus::Family<prometheus::Counter>* log_overrun_family_{nullptr}; // libpush_log_queue_overruns_total
+  prometheus::Family<prometheus::Counter>* log_dropped_family_{nullptr}; // libpush_log_dropped_records_total
+  prometheus::Family<prometheus::Counter>* log_sink_errors_family_{nullptr}; // libpush_log_sink_errors_total
+  prometheus::Family<prometheus::Gauge>* log_high_water_family_{nullptr}; // libpush_log_queue_high_water_bytes
+  prometheus::Family<prometheus::Gauge>* afade_family_{nullptr};        // libpush_afade_instances{state}
+  prometheus::Family<prometheus::Gauge>* pool_family_{nullptr};         // libpush_pool_objects{pool,state}
+  prometheus::Family<prometheus::Gauge>* buffer_bytes_family_{nullptr}; // libpush_room_buffer_bytes
+  prometheus::Family<prometheus::Counter>* thread_cpu_family_{nullptr}; // libpush_thread_cpu_seconds_total{name,mode}
+
+  prometheus::Gauge* log_queue_depth_{nullptr};
+  prometheus::Counter* log_overruns_{nullptr};
+  prometheus::Counter* log_dropped_{nullptr};
+  // 日志队列给出的是累计值，按差值推进计数器；仅采样线程访问
+  uint64_t last_log_overruns_{0};
+  uint64_t last_log_dropped_{0};
+  uint64_t last_log_sink_errors_{0};
+  prometheus::Counter* log_sink_errors_{nullptr};
+  prometheus::Gauge* log_high_water_{nullptr};
+  prometheus::Gauge* buffer_bytes_{nullptr};
+
+  struct PoolGauges {
+    PoolStatsFn fn;
+    prometheus::Gauge* in_use{nullptr};
+    prometheus::Gauge* free{nullptr};
+  };
+  std::mutex pools_mu_;
+  std::map<std::string, PoolGauges> pools_;
+
+  // 同名线程合计到一组计数器，序列数只随线程名增长，不随线程创建退出增长
+  struct ThreadCpuCounters {
+    prometheus::Counter* user{nullptr};
+    prometheus::Counter* system{nullptr};
+  };
+  // 每个线程上次采样的累计 CPU（单位 clock tick），按差值推进所属名字的计数器
+  struct ThreadSample {
+    uint64_t user_ticks{0};
+    uint64_t system_ticks{0};
+    bool alive{false};
+  };
+  std::map<std::string, ThreadCpuCounters> thread_cpu_; // 仅采样线程访问
+  std::map<int, ThreadSample> threads_;                 // 仅采样线程访问
+
+  static std::atomic<int64_t> tracked_bytes_;
+
+  int interval_ms_{1000};
+  std::thread sampler_;
+  std::mutex sampler_mu_;
+  std::condition_variable sampler_cv_;
+  bool stop_{false};
+  bool inited_{false};
+};
@@ -0,0 +1,217 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "room_buffer_pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/avassert.h>
+}
+
+#include "logger.h"
+#include "numa_topology.h"
+#include "resource_metrics.h"
+
+namespace {
+
+constexpr size_t kHugePageBytes = 2 << 20;
+constexpr size_t kSliceAlign = 64;
+
+void NoopFree(void *, uint8_t *) {}
+
+} // namespace
+
+// 预映射内存区 + 分配计数；由 RoomBufferPool 和它建立的每个 AVBufferPool 共同持有
+struct RoomBufferPool::Backing {
+  uint8_t *base = nullptr;
+  size_t capacity = 0;
+  std::atomic<size_t> used{0};
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<size_t> packet_heap_bytes{0};
+  std::atomic<size_t> frame_heap_bytes{0};
+  std::atomic<int> refs{1};
+
+  void Ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+  void Release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+    if (base) {
+      munmap(base, capacity);
+      ResourceMetrics::AddTrackedBytes(-static_cast<int64_t>(capacity));
+    }
+    delete this;
+  }
+};
+
+RoomBufferPool::RoomBufferPool(const Options &options) : backing_(new Backing) {
+  if (options.arena_bytes > 0) {
+    size_t bytes = (options.arena_bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    void *p = MAP_FAILED;
+    bool huge = false;
+    if (options.huge_pages) {
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      huge = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+      if (p != MAP_FAILED && options.huge_pages)
+        madvise(p, bytes, MADV_HUGEPAGE);
+    }
+    if (p == MAP_FAILED) {
+      LOG_WARN("RoomBufferPool mmap arena {} bytes failed, using heap", bytes);
+    } else {
+      // 还没有页被写过，策略对整块内存区生效
+      NumaTopology::Instance().PreferNode(p, bytes, options.numa_node);
+      backing_->base = static_cast<uint8_t *>(p);
+      backing_->capacity = bytes;
+      ResourceMetrics::AddTrackedBytes(static_cast<int64_t>(bytes));
+      LOG_DEBUG("RoomBufferPool arena {} bytes huge_pages={} node={}", bytes, huge,
+                options.numa_node);
+    }
+  }
+  packet_pool_ = NewPool(kPacketBytes + AV_INPUT_BUFFER_PADDING_SIZE,
+                         &RoomBufferPool::PacketAlloc);
+}
+
+RoomBufferPool::~RoomBufferPool() {
+  // 仍在外面的缓冲归还后 AVBufferPool 才真正释放，并通过 PoolFree 放掉 backing
+  av_buffer_pool_uninit(&packet_pool_);
+  av_buffer_pool_uninit(&frame_pool_);
+  backing_->Release();
+}
+
+AVBufferPool *RoomBufferPool::NewPool(int size,
+                                      AVBufferRef *(*alloc)(void *opaque, int size)) {
+  AVBufferPool *pool =
+      av_buffer_pool_init2(size, backing_, alloc, &RoomBufferPool::PoolFree);
+  if (pool)
+    backing_->Ref();
+  return pool;
+}
+
+AVBufferRef *RoomBufferPool::PacketAlloc(void *opaque, int size) {
+  auto *backing = static_cast<Backing *>(opaque);
+  return Alloc(backing, size, &backing->packet_heap_bytes);
+}
+
+AVBufferRef *RoomBufferPool::FrameAlloc(void *opaque, int size) {
+  auto *backing = static_cast<Backing *>(opaque);
+  return Alloc(backing, size, &backing->frame_heap_bytes);
+}
+
+AVBufferRef *RoomBufferPool::Alloc(Backing *backing, int size,
+                                   std::atomic<size_t> *heap_bytes) {
+  backing->allocations.fetch_add(1, std::memory_order_relaxed);
+  if (backing->base) {
+    // 与堆上分配一样在切片内留出填充，解析器越读不会碰到下一个切片
+    size_t need = (static_cast<size_t>(size) + AV_INPUT_BUFFER_PADDING_SIZE + kSliceAlign - 1) &
+                  ~(kSliceAlign - 1);
+    size_t off = backing->used.fetch_add(need, std::memory_order_relaxed);
+    // 内存区随 backing 整块释放，单个缓冲的释放回调什么也不做
+    if (off + need <= backing->capacity)
+      return av_buffer_create(backing->base + off, size, &NoopFree, nullptr, 0);
+  }
+  heap_bytes->fetch_add(size, std::memory_order_relaxed);
+  return ResourceMetrics::AllocTrackedBuffer(size);
+}
+
+void RoomBufferPool::PoolFree(void *opaque) { static_cast<Backing *>(opaque)->Release(); }
+
+AVBufferRef *RoomBufferPool::GetPacketBuffer(int size) {
+  if (packet_pool_ && size >= 0 && size <= kPacketBytes)
+    return av_buffer_pool_get(packet_pool_);
+  return ResourceMetrics::AllocTrackedBuffer(size);
+}
+
+AVBufferPool *RoomBufferPool::FramePool(int size) {
+  if (!frame_pool_) {
+    frame_pool_ = NewPool(size, &RoomBufferPool::FrameAlloc);
+    frame_pool_size_ = size;
+  }
+  // AAC 帧长固定，大小变化（如切换编码参数）时交还默认分配器
+  return size == frame_pool_size_ ? frame_pool_ : nullptr;
+}
+
+void RoomBufferPool::TrimFrames() {
+  if (backing_->base || !frame_pool_)
+    return;
+  av_buffer_pool_uninit(&frame_pool_);
+  backing_->frame_heap_bytes.store(0, std::memory_order_relaxed);
+  frame_pool_size_ = 0;
+}
+
+void RoomBufferPool::AttachDecoder(AVCodecContext *ctx) {
+  ctx->opaque = this;
+  ctx->get_buffer2 = &RoomBufferPool::GetBuffer2;
+}
+
+void RoomBufferPool::AttachEncoder(AVCodecContext *ctx) {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 134, 100)
+  ctx->opaque = this;
+  ctx->get_encode_buffer = &RoomBufferPool::GetEncodeBuffer;
+#else
+  (void)ctx;
+#endif
+}
+
+int RoomBufferPool::GetBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags) {
+  auto *self = static_cast<RoomBufferPool *>(ctx->opaque);
+  const AVSampleFormat fmt = static_cast<AVSampleFormat>(frame->format);
+  const int planes = av_sample_fmt_is_planar(fmt) ? frame->channels : 1;
+  if (ctx->codec_type != AVMEDIA_TYPE_AUDIO || planes > AV_NUM_DATA_POINTERS)
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+
+  int linesize = 0;
+  if (av_samples_get_buffer_size(&linesize, frame->channels, frame->nb_samples, fmt,
+                                 0) < 0)
+    return AVERROR(EINVAL);
+  AVBufferPool *pool = self->FramePool(linesize);
+  if (!pool)
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+
+  for (int i = 0; i < planes; i++) {
+    frame->buf[i] = av_buffer_pool_get(pool);
+    if (!frame->buf[i]) {
+      for (int j = 0; j < i; j++)
+        av_buffer_unref(&frame->buf[j]);
+      return AVERROR(ENOMEM);
+    }
+    frame->data[i] = frame->buf[i]->data;
+  }
+  // 超过 AV_NUM_DATA_POINTERS 个平面的帧在上面已交给默认分配器，extended_data 才能直接指向 data
+  av_assert0(planes <= AV_NUM_DATA_POINTERS);
+  frame->extended_data = frame->data;
+  frame->linesize[0] = linesize;
+  return 0;
+}
+
+int RoomBufferPool::GetEncodeBuffer(AVCodecContext *ctx, AVPacket *pkt, int /*flags*/) {
+  auto *self = static_cast<RoomBufferPool *>(ctx->opaque);
+  AVBufferRef *buf = self->GetPacketBuffer(pkt->size);
+  if (!buf)
+    return AVERROR(ENOMEM);
+  pkt->buf = buf;
+  pkt->data = buf->data;
+  memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  return 0;
+}
+
+uint64_t RoomBufferPool::allocations() const {
+  return backing_->allocations.load(std::memory_order_relaxed);
+}
+
+size_t RoomBufferPool::resident_bytes() const {
+  if (backing_->base)
+    return backing_->capacity;
+  return backing_->packet_heap_bytes.load(std::memory_order_relaxed) +
+         backing_->frame_heap_bytes.load(std::memory_order_relaxed);
+}
+
+size_t RoomBufferPool::arena_used() const {
+  return std::min(backing_->used.load(std::memory_order_relaxed), backing_->capacity);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+// 单个房间的缓冲池：输出包和解码帧的数据缓冲由 AVBufferPool 复用，
+// 可选地从一块预先映射的（大页）内存区切分。稳态下不再向通用堆申请数据缓冲，
+// 每个房间独占一个池，房间线程之间不争用同一分配器。
+// 池中缓冲可以比池对象活得久：最后一个引用释放时底层内存才归还。
+class RoomBufferPool {
+public:
+  struct Options {
+    size_t arena_bytes = 0; // 0 = 不预映射内存区，缓冲直接 av_malloc
+    bool huge_pages = true; // 内存区优先 MAP_HUGETLB，失败退回普通页 + MADV_HUGEPAGE
+    int numa_node = -1;     // 内存区的页优先从该节点分配，-1 = 按首次写入的线程
+  };
+  // ADTS 帧长字段 13 位，单包不超过 8191 字节
+  static constexpr int kPacketBytes = 8192;
+
+  RoomBufferPool() : RoomBufferPool(Options()) {}
+  explicit RoomBufferPool(const Options &options);
+  ~RoomBufferPool();
+  RoomBufferPool(const RoomBufferPool &) = delete;
+  RoomBufferPool &operator=(const RoomBufferPool &) = delete;
+
+  // 取一块可容纳 size 字节外加输入填充的包缓冲；放不下时退回通用堆
+  AVBufferRef *GetPacketBuffer(int size);
+
+  // 让解码器的帧缓冲从本池取（get_buffer2），须在 avcodec_open2 之前调用
+  void AttachDecoder(AVCodecContext *ctx);
+  // 让编码器的输出包从本池取（get_encode_buffer，仅对支持 DR1 的编码器生效）
+  void AttachEncoder(AVCodecContext *ctx);
+
+  // 放掉解码帧缓冲池（房间休眠时调用）；已取出的缓冲归还后释放。
+  // 使用预映射内存区时不释放，切出去的区域无法回收再用
+  void TrimFrames();
+
+  // 池新建底层缓冲的累计次数，稳态下不应再增长
+  uint64_t allocations() const;
+  // 池持有的内存：预映射内存区大小，或从堆上新建的缓冲总字节数
+  size_t resident_bytes() const;
+  // 内存区已切出的字节数
+  size_t arena_used() const;
+
+private:
+  struct Backing;
+
+  static AVBufferRef *PacketAlloc(void *opaque, int size);
+  static AVBufferRef *FrameAlloc(void *opaque, int size);
+  static AVBufferRef *Alloc(Backing *backing, int size, std::atomic<size_t> *heap_bytes);
+  static void PoolFree(void *opaque);
+  static int GetBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags);
+  static int GetEncodeBuffer(AVCodecContext *ctx, AVPacket *pkt, int flags);
+  AVBufferPool *NewPool(int size, AVBufferRef *(*alloc)(void *opaque, int size));
+  AVBufferPool *FramePool(int size);
+
+  Backing *backing_ = nullptr; // 各 AVBufferPool 共享，引用计数释放
+  AVBufferPool *packet_pool_ = nullptr;
+  AVBufferPool *frame_pool_ = nullptr; // 按第一次请求的平面大小建立
+  int frame_pool_size_ = 0;
+};
@@ -0,0 +1,468 @@
+#define LOG_MODULE libmagic::LogModule::kMain
+#include "room_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "afade_warm_pool.h"
+#include "av_metrics.h"
+#include "logger.h"
+
+namespace {
+
+// 滞后回到预算一半以下持续约 1 秒才降一档，避免在阈值附近来回切换
+constexpr int kRecoverFrames = 50;
+constexpr int kLagReportFrames = 50;
+// 相邻包媒体时间跳变超过 10 秒视为时间戳重置，重新定基线
+constexpr int64_t kMediaJumpNs = 10LL * 1000000000;
+
+RoomBufferPool::Options PoolOptions(const RoomPipeline::Config &config) {
+  RoomBufferPool::Options options;
+  options.arena_bytes = config.pool_arena_bytes;
+  options.numa_node = config.numa_node;
+  return options;
+}
+
+} // namespace
+
+RoomPipeline::RoomPipeline(const Config &config)
+    : config_(config), pool_(PoolOptions(config)) {
+  log_ctx_.room = libmagic::InternLogRoom(config_.room_id);
+  // 对应的 RemoveRoom 由房间的所有者在房间结束时调用
+  if (!config_.room_id.empty())
+    AvMetrics::Instance().AddRoom(config_.room_id);
+  if (config_.hibernate_after_ms >= 0) {
+    hibernate_frames_ = int64_t(config_.hibernate_after_ms) * config_.sample_rate /
+                        1000 / config_.samples_per_frame;
+  }
+  for (auto &pkt : preroll_) {
+    av_init_packet(&pkt);
+    pkt.data = nullptr;
+    pkt.size = 0;
+  }
+}
+
+const char *RoomPipeline::DegradeLevelName(DegradeLevel level) {
+  switch (level) {
+  case DEGRADE_NONE:
+    return "none";
+  case DEGRADE_SHORT_FADE:
+    return "short_fade";
+  case DEGRADE_STEPPED_GAIN:
+    return "stepped_gain";
+  case DEGRADE_PASSTHROUGH:
+    return "passthrough";
+  default:
+    return "unknown";
+  }
+}
+
+RoomPipeline::~RoomPipeline() {
+  afade_.reset();
+  for (auto &pkt : audio_tail_)
+    av_packet_unref(&pkt);
+  ClearPreroll();
+}
+
+bool RoomPipeline::StartFade(AudioAfade::FadeType type, int frames) {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  // 录下原始命令，回放时按原样重放
+  if (capture_)
+    capture_->TapFade(capture_room_, type, frames);
+  if (degrade_ >= DEGRADE_PASSTHROUGH) {
+    LOG_WARN("StartFade skipped under overload type={} frames={} lag={:.1f}ms", type,
+             frames, lag_ms_);
+    fade_left_ = 0;
+    video_fade_.reset();
+    return true;
+  }
+  if (degrade_ >= DEGRADE_SHORT_FADE)
+    frames = std::max(1, frames / 4);
+
+  AfadeWarmPool::Key key{config_.sample_rate, config_.channels, config_.sample_fmt, type,
+                         frames, config_.numa_node};
+  AfadeWarmPool &warm = AfadeWarmPool::Instance();
+  std::unique_ptr<AudioAfade> afade = warm.Take(key);
+  const bool warm_hit = afade != nullptr;
+  if (!afade)
+    afade = warm.Create(key);
+  if (afade->state() == AudioAfade::STATE_FAILED) {
+    LOG_ERROR("StartFade create AudioAfade failed type={} frames={}", type, frames);
+    return false;
+  }
+  afade->AttachBufferPool(&pool_);
+  const std::vector<uint8_t> &asc = config_.audio_specific_config;
+  if (!asc.empty() && !afade->SetDecoderConfig(asc.data(), static_cast<int>(asc.size()))) {
+    LOG_ERROR("StartFade configure AAC decoder failed type={} frames={}", type, frames);
+    return false;
+  }
+  afade->SetMetricsRoom(config_.room_id, config_.time_base);
+  afade->SetSteppedGain(degrade_ >= DEGRADE_STEPPED_GAIN);
+  // 从最旧的包开始补齐解码器历史
+  int prerolled = 0;
+  for (int i = 0; i < kPrerollPackets; i++) {
+    const AVPacket &pkt = preroll_[(preroll_next_ + i) % kPrerollPackets];
+    if (pkt.size > 0) {
+      afade->Preroll(&pkt);
+      prerolled++;
+    }
+  }
+  ClearPreroll();
+
+  const bool was_hibernated = !afade_;
+  // 打断进行中的淡入淡出时，旧编码器里的尾包先冲刷出来，排在新实例的输出前面
+  RetireAfade();
+  afade_ = std::move(afade);
+  afade_bytes_ = warm.FootprintBytes(key);
+  fade_left_ = frames;
+  // 视频斜坡与音频同长，起点等第一个淡入淡出音频包的 PTS
+  video_fade_ = std::make_unique<VideoFade>(
+      type, int64_t(frames) * config_.samples_per_frame,
+      AVRational{1, config_.sample_rate});
+  idle_frames_ = 0;
+  LOG_INFO("StartFade type={} frames={} at frame {} warm={} preroll={} wake={} "
+           "degrade={}",
+           type, frames, frames_in_, warm_hit, prerolled, was_hibernated,
+           DegradeLevelName(degrade_));
+  ReportResidentBytes();
+  return true;
+}
+
+bool RoomPipeline::ProcessAudio(AVPacket *pkt, AVPacket *out) {
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  frames_in_++;
+  if (capture_)
+    capture_->TapPacket(capture_room_, capture::kAudio, pkt, config_.time_base);
+  UpdateLag(pkt);
+
+  if (fade_left_ > 0 && afade_) {
+    if (video_fade_ && !video_fade_->anchored()) {
+      video_fade_->Anchor(
+          pkt->pts != AV_NOPTS_VALUE
+              ? av_rescale_q(pkt->pts, config_.time_base, {1, config_.sample_rate})
+              : (frames_in_ - 1) * config_.samples_per_frame);
+      if (splicer_)
+        splicer_->AddFade(*video_fade_);
+    }
+    // Process 失败时本包没有输出，但之前编码的包照常取出
+    afade_->Process(pkt);
+
+    if (--fade_left_ == 0) {
+      LOG_INFO("Fade finished at frame {}", frames_in_);
+      idle_frames_ = 0;
+      // 编码器还压着最后一两帧，在透传接上之前冲刷出来，随本包的输出按顺序取走
+      afade_->DrainEncoder();
+    }
+    AdvanceVideoClock(pkt);
+    return ReceiveAudio(out);
+  }
+
+  // 透传；淡入淡出期间的 pts 由 AudioAfade 上报
+  if (pkt->pts != AV_NOPTS_VALUE && !config_.room_id.empty()) {
+    AvMetrics::Instance().UpdateAudioPtsMs(
+        config_.room_id, av_rescale_q(pkt->pts, config_.time_base, {1, 1000}));
+  }
+  if (pkt->buf) {
+    if (av_packet_ref(out, pkt) < 0) {
+      LOG_ERROR("ProcessAudio ref packet failed");
+      return false;
+    }
+  } else {
+    // 非引用计数的输入（压测、回放）拷进池缓冲，不走 av_packet_ref 的堆分配
+    AVBufferRef *buf = pool_.GetPacketBuffer(pkt->size);
+    if (!buf) {
+      LOG_ERROR("ProcessAudio alloc packet buffer failed: {} bytes", pkt->size);
+      return false;
+    }
+    memcpy(buf->data, pkt->data, pkt->size);
+    av_init_packet(out);
+    out->buf = buf;
+    out->data = buf->data;
+    out->size = pkt->size;
+    out->flags = pkt->flags;
+  }
+  out->stream_index = 0;
+  out->pts = next_pts_;
+  out->dts = next_pts_;
+  next_pts_ += config_.samples_per_frame;
+
+  KeepPreroll(*out);
+  if (afade_ && hibernate_frames_ >= 0 && ++idle_frames_ > hibernate_frames_)
+    Hibernate();
+  AdvanceVideoClock(pkt);
+  return true;
+}
+
+bool RoomPipeline::ReceiveAudio(AVPacket *out) {
+  if (!audio_tail_.empty()) {
+    av_packet_move_ref(out, &audio_tail_.front());
+    audio_tail_.pop_front();
+    return true;
+  }
+  return ReceiveFaded(out);
+}
+
+void RoomPipeline::RetireAfade() {
+  if (!afade_)
+    return;
+  // 淡入淡出正常结束时已经冲刷过，这里通常没有包
+  afade_->DrainEncoder();
+  AVPacket tail;
+  av_init_packet(&tail);
+  while (ReceiveFaded(&tail)) {
+    audio_tail_.push_back(tail);
+    av_init_packet(&tail);
+  }
+  afade_.reset();
+}
+
+bool RoomPipeline::ReceiveFaded(AVPacket *out) {
+  if (!afade_)
+    return false;
+  AVPacket faded_pkt;
+  av_init_packet(&faded_pkt);
+  while (afade_->ReceivePacket(&faded_pkt)) {
+    if (faded_pkt.size <= 0) {
+      av_packet_unref(&faded_pkt);
+      continue;
+    }
+    bool ok = config_.audio_specific_config.empty() ? WrapAdts(faded_pkt, out)
+                                                    : TakeRaw(&faded_pkt, out);
+    av_packet_unref(&faded_pkt);
+    if (ok)
+      return true;
+  }
+  return false;
+}
+
+void RoomPipeline::AdvanceVideoClock(const AVPacket *pkt) {
+  if (splicer_ && pkt->pts != AV_NOPTS_VALUE)
+    splicer_->SetAudioClock(pkt->pts, config_.time_base);
+}
+
+void RoomPipeline::UpdateLag(const AVPacket *pkt) {
+  if (config_.lag_budget_ms <= 0)
+    return;
+  const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now().time_since_epoch())
+                             .count();
+  const int64_t media_ns =
+      pkt->pts != AV_NOPTS_VALUE
+          ? av_rescale_q(pkt->pts, config_.time_base, {1, 1000000000})
+          : av_rescale(frames_in_ * config_.samples_per_frame, 1000000000,
+                       config_.sample_rate);
+  if (!lag_anchored_ || std::abs(media_ns - last_media_ns_) > kMediaJumpNs) {
+    lag_anchor_ns_ = now_ns - media_ns;
+    lag_anchored_ = true;
+  }
+  last_media_ns_ = media_ns;
+  int64_t lag_ns = now_ns - (lag_anchor_ns_ + media_ns);
+  if (lag_ns < 0) {
+    // 比基线到得早（突发到达），基线前移
+    lag_anchor_ns_ += lag_ns;
+    lag_ns = 0;
+  }
+  lag_ms_ = lag_ns / 1e6;
+
+  const double budget = config_.lag_budget_ms;
+  DegradeLevel target = lag_ms_ > 4 * budget   ? DEGRADE_PASSTHROUGH
+                        : lag_ms_ > 2 * budget ? DEGRADE_STEPPED_GAIN
+                        : lag_ms_ > budget     ? DEGRADE_SHORT_FADE
+                                               : DEGRADE_NONE;
+  if (target > degrade_) {
+    recover_frames_ = 0;
+    SetDegrade(target);
+  } else if (degrade_ > DEGRADE_NONE && lag_ms_ < budget / 2) {
+    if (++recover_frames_ >= kRecoverFrames) {
+      recover_frames_ = 0;
+      SetDegrade(static_cast<DegradeLevel>(degrade_ - 1));
+    }
+  } else {
+    recover_frames_ = 0;
+  }
+
+  if (++lag_report_frames_ >= kLagReportFrames && !config_.room_id.empty()) {
+    lag_report_frames_ = 0;
+    AvMetrics::Instance().SetProcessingLagMs(config_.room_id, lag_ms_);
+  }
+}
+
+void RoomPipeline::SetDegrade(DegradeLevel level) {
+  LOG_WARN("Degrade {} -> {} lag={:.1f}ms budget={}ms", DegradeLevelName(degrade_),
+           DegradeLevelName(level), lag_ms_, config_.lag_budget_ms);
+  degrade_ = level;
+  degrade_transitions_++;
+  if (!config_.room_id.empty())
+    AvMetrics::Instance().OnDegradeTransition(config_.room_id, level,
+                                              DegradeLevelName(level));
+  // 进行中的淡入淡出：切到阶梯增益，或直接结束改为透传
+  if (afade_ && fade_left_ > 0) {
+    if (level >= DEGRADE_PASSTHROUGH) {
+      LOG_WARN("Fade abandoned under overload, {} frames left", fade_left_);
+      fade_left_ = 0;
+      idle_frames_ = 0;
+      video_fade_.reset();
+    } else {
+      afade_->SetSteppedGain(level >= DEGRADE_STEPPED_GAIN);
+    }
+  }
+}
+
+void RoomPipeline::KeepPreroll(const AVPacket &pkt) {
+  AVPacket &slot = preroll_[preroll_next_];
+  av_packet_unref(&slot);
+  if (av_packet_ref(&slot, &pkt) < 0)
+    return;
+  preroll_next_ = (preroll_next_ + 1) % kPrerollPackets;
+}
+
+void RoomPipeline::ClearPreroll() {
+  for (auto &pkt : preroll_)
+    av_packet_unref(&pkt);
+  preroll_next_ = 0;
+}
+
+void RoomPipeline::Hibernate() {
+  if (!afade_ || fade_left_ > 0)
+    return;
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  RetireAfade();
+  video_fade_.reset();
+  afade_bytes_ = 0;
+  pool_.TrimFrames();
+  hibernations_++;
+  LOG_DEBUG("Room hibernated at frame {} after {} idle frames", frames_in_,
+            idle_frames_);
+  ReportResidentBytes();
+}
+
+size_t RoomPipeline::ResidentBytes() const {
+  size_t bytes = sizeof(*this) + config_.room_id.capacity();
+  for (const auto &pkt : preroll_) {
+    if (pkt.buf)
+      bytes += pkt.buf->size;
+  }
+  for (const auto &pkt : audio_tail_) {
+    if (pkt.buf)
+      bytes += pkt.buf->size;
+  }
+  return bytes + pool_.resident_bytes() + afade_bytes_;
+}
+
+void RoomPipeline::ReportResidentBytes() {
+  if (!config_.room_id.empty())
+    AvMetrics::Instance().SetResidentBytes(config_.room_id,
+                                           static_cast<int64_t>(ResidentBytes()));
+}
+
+bool RoomPipeline::WrapAdts(const AVPacket &faded, AVPacket *out) {
+  // 拼接ADTS头 + AAC帧（缓冲区取自房间缓冲池，由最后一个引用归还）
+  int total_size = faded.size + 7;
+  AVBufferRef *full_buf = pool_.GetPacketBuffer(total_size);
+  if (!full_buf) {
+    LOG_ERROR("Alloc ADTS output buffer failed: {} bytes", total_size);
+    return false;
+  }
+  AudioAfade::WriteAdtsHeader(full_buf->data, faded.size, 2, config_.sample_rate,
+                              config_.channels);
+  memcpy(full_buf->data + 7, faded.data, faded.size);
+
+  av_init_packet(out);
+  out->buf = full_buf;
+  out->data = full_buf->data;
+  out->size = total_size;
+  out->stream_index = 0;
+  out->pts = next_pts_;
+  out->dts = next_pts_;
+  next_pts_ += config_.samples_per_frame;
+  return true;
+}
+
+bool RoomPipeline::TakeRaw(AVPacket *faded, AVPacket *out) {
+  av_packet_move_ref(out, faded);
+  out->stream_index = 0;
+  out->pts = next_pts_;
+  out->dts = next_pts_;
+  next_pts_ += config_.samples_per_frame;
+  return true;
+}
+
+void RoomPipeline::OnVideoPacket(const AVPacket *pkt, AVRational time_base) {
+  if (capture_)
+    capture_->TapPacket(capture_room_, capture::kVideo, pkt, time_base);
+  if (pkt->pts == AV_NOPTS_VALUE || config_.room_id.empty())
+    return;
+  AvMetrics::Instance().UpdateVideoPtsMs(
+      config_.room_id, av_rescale_q(pkt->pts, time_base, {1, 1000}));
+}
+
+bool RoomPipeline::ProcessVideoFrame(AVFrame *frame, AVRational time_base) {
+  if (!video_fade_)
+    return false;
+  const int64_t pts =
+      frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+  if (video_fade_->Finished(pts, time_base)) {
+    video_fade_.reset();
+    return false;
+  }
+  return video_fade_->Process(frame, time_base);
+}
+
+bool RoomPipeline::EnableVideoPassthrough(const AVCodecParameters *par,
+                                          AVRational time_base, AVRational frame_rate) {
+  if (!par)
+    return false;
+  splicer_ = std::make_unique<GopSplicer>(par, time_base, frame_rate);
+  // 正在进行的淡入淡出已锚定时补上，之后的 GOP 照样重编码
+  if (video_fade_ && video_fade_->anchored())
+    splicer_->AddFade(*video_fade_);
+  return true;
+}
+
+bool RoomPipeline::PushVideo(const AVPacket *pkt, AVRational time_base) {
+  OnVideoPacket(pkt, time_base);
+  if (!splicer_)
+    return false;
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  return splicer_->Push(pkt);
+}
+
+bool RoomPipeline::ReceiveVideo(AVPacket *out) { return splicer_ && splicer_->Receive(out); }
+
+void RoomPipeline::FlushVideo() {
+  if (!splicer_)
+    return;
+  libmagic::ScopedLogContext log_scope(log_ctx_);
+  splicer_->Flush();
+}
+
+void RoomPipeline::SetCapture(capture::CaptureWriter *writer) {
+  capture_ = writer;
+  if (!capture_)
+    return;
+  capture::RoomInfo info;
+  info.name = config_.room_id;
+  info.sample_rate = config_.sample_rate;
+  info.channels = config_.channels;
+  info.sample_fmt = config_.sample_fmt;
+  info.time_base = config_.time_base;
+  capture_room_ = capture_->AddRoom(info);
+}
+
+void RoomPipeline::Flush(AVFormatContext *out_fmt) {
+  if (!out_fmt)
+    return;
+  for (auto &pkt : audio_tail_) {
+    pkt.stream_index = 0;
+    av_packet_rescale_ts(&pkt, {1, config_.sample_rate}, out_fmt->streams[0]->time_base);
+    av_interleaved_write_frame(out_fmt, &pkt);
+    av_packet_unref(&pkt);
+  }
+  audio_tail_.clear();
+  if (!afade_)
+    return;
+  afade_->FlushEncoder(out_fmt, next_pts_);
+  afade_.reset();
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_afade.h"
+#include "capture_file.h"
+#include "gop_splicer.h"
+#include "log_context.h"
+#include "room_buffer_pool.h"
+#include "video_fade.h"
+
+// 单个房间的音频处理链路：平时透传 ADTS AAC 包，收到淡入/淡出命令后
+// 经 AudioAfade 解码-滤镜-编码，输出重新封装成 ADTS（输入为裸 AAC 时输出也不加头）。
+// 输出包的 pts/dts 以采样点为单位连续递增。main、压测和回放共用这条链路。
+// 淡入淡出结束后连续透传超过 hibernate_after_ms 即进入休眠：释放 AudioAfade
+// （编解码器和滤镜图）与解码帧缓冲，只留配置、计数和最近几个输入包；
+// 下次淡入淡出从预热池取实例，用留下的包做 pre-roll 后接着处理。
+// 过载时按处理滞后（处理时刻晚于 PTS 对应墙钟时刻多少）逐级降级，
+// 保证按时出包优先于淡入淡出效果：缩短淡入淡出 -> 阶梯增益 -> 纯透传。
+// 调用方解码出的视频帧可交给 ProcessVideoFrame，按同一条斜坡到黑/从黑；
+// 或开启视频直通（EnableVideoPassthrough），只重编码与斜坡重叠的 GOP。
+class RoomPipeline {
+public:
+  enum DegradeLevel {
+    DEGRADE_NONE,
+    DEGRADE_SHORT_FADE,   // 新的淡入淡出缩短为 1/4
+    DEGRADE_STEPPED_GAIN, // 不经滤镜图，阶梯增益
+    DEGRADE_PASSTHROUGH,  // 放弃效果，直接透传
+  };
+  static const char *DegradeLevelName(DegradeLevel level);
+
+  struct Config {
+    std::string room_id;
+    int sample_rate = 44100;
+    int channels = 2;
+    AVSampleFormat sample_fmt = AV_SAMPLE_FMT_FLTP;
+    AVRational time_base{1, 44100}; // 输入包 pts 的时间基
+    int samples_per_frame = 1024;   // AAC 每帧固定 1024 采样点
+    size_t pool_arena_bytes = 0;    // 房间缓冲池预映射内存区大小，0 = 直接用堆
+    int hibernate_after_ms = 5000;  // 按媒体时间计；小于 0 不休眠
+    // 处理滞后预算，超过 1/2/4 倍依次升一档；小于等于 0 关闭降级
+    int lag_budget_ms = 200;
+    // 房间所在的 NUMA 节点：缓冲池内存区绑到该节点，预热的 AudioAfade 也在该节点上构建。
+    // 其余状态按首次写入分配，应在该节点的线程上构造 RoomPipeline。-1 = 不指定
+    int numa_node = -1;
+    // 非空表示输入为不带 ADTS 头的裸 AAC（FLV/RTMP 的 AAC 帧），内容为序列头里的
+    // AudioSpecificConfig：淡入淡出时交给解码器作 extradata，输出也是裸 AAC 帧
+    std::vector<uint8_t> audio_specific_config;
+  };
+
+  explicit RoomPipeline(const Config &config);
+  ~RoomPipeline();
+
+  // 开始淡入/淡出，持续 frames 帧；创建 AudioAfade 失败返回 false
+  bool StartFade(AudioAfade::FadeType type, int frames);
+  bool fading() const { return fade_left_ > 0; }
+
+  // 处理一个音频包；有输出时填充 out（调用方负责 unref）并返回 true。
+  // 淡入淡出期间一个输入包可能编码出多个包，之后须循环 ReceiveAudio 直到返回 false
+  bool ProcessAudio(AVPacket *pkt, AVPacket *out);
+  // 取出本次 ProcessAudio 剩余的输出包（调用方负责 unref），没有了返回 false
+  bool ReceiveAudio(AVPacket *out);
+  // 同房间的视频包，目前只用其 pts 做音画同步监控
+  void OnVideoPacket(const AVPacket *pkt, AVRational time_base);
+  // 同房间解码后的视频帧：对配对的淡入淡出原地到黑/从黑。
+  // 斜坡起点锁定在音频开始淡入淡出的那个包的 PTS 上；像素被修改返回 true
+  bool ProcessVideoFrame(AVFrame *frame, AVRational time_base);
+
+  // 视频直通：PushVideo 输入压缩包（同时做 OnVideoPacket 的监控），ReceiveVideo 取出
+  // 输出包（输入时间基，原样引用或淡入淡出 GOP 的重编码结果）。输出会比输入晚约一个
+  // GOP，并等音频处理到 GOP 末尾才放出；音频与视频输出交给 av_interleaved_write_frame 交织
+  bool EnableVideoPassthrough(const AVCodecParameters *par, AVRational time_base,
+                              AVRational frame_rate);
+  bool PushVideo(const AVPacket *pkt, AVRational time_base);
+  bool ReceiveVideo(AVPacket *out);
+  // 输入结束时调用，剩余 GOP 全部放出
+  void FlushVideo();
+  const GopSplicer *video_splicer() const { return splicer_.get(); }
+
+  // 录制本房间的输入包和淡入淡出命令（writer 生命周期由调用方管理）
+  void SetCapture(capture::CaptureWriter *writer);
+
+  // 冲刷淡入淡出编码器中剩余的帧（以及休眠时冲刷出、还没取走的尾包）到 out_fmt
+  void Flush(AVFormatContext *out_fmt);
+
+  // 立即释放处理状态（长时间收不到包的房间由上层调用）；淡入淡出中不休眠
+  void Hibernate();
+  bool hibernated() const { return !afade_; }
+  uint64_t hibernations() const { return hibernations_; }
+  // 本房间常驻内存估算：描述符 + pre-roll 包 + 缓冲池 + AudioAfade
+  size_t ResidentBytes() const;
+
+  DegradeLevel degrade_level() const { return degrade_; }
+  uint64_t degrade_transitions() const { return degrade_transitions_; }
+  double lag_ms() const { return lag_ms_; }
+
+  const Config &config() const { return config_; }
+  int64_t frames_in() const { return frames_in_; }
+  const RoomBufferPool &pool() const { return pool_; }
+
+private:
+  // 从 AudioAfade 取下一个输出包并封装（不含 audio_tail_）
+  bool ReceiveFaded(AVPacket *out);
+  // 冲刷并释放当前 AudioAfade，没取走的包封装好留在 audio_tail_
+  void RetireAfade();
+  bool WrapAdts(const AVPacket &faded, AVPacket *out);
+  // 裸 AAC 输出：直接接过编码器的包，只改时间戳
+  bool TakeRaw(AVPacket *faded, AVPacket *out);
+  void KeepPreroll(const AVPacket &pkt);
+  void ClearPreroll();
+  void ReportResidentBytes();
+  void UpdateLag(const AVPacket *pkt);
+  // 音频处理进度推给视频直通，决定已收齐的 GOP
+  void AdvanceVideoClock(const AVPacket *pkt);
+  void SetDegrade(DegradeLevel level);
+
+  // AAC 解码依赖前一帧的 MDCT 重叠，新解码器先吃进 2 个包
+  static constexpr int kPrerollPackets = 2;
+
+  Config config_;
+  libmagic::LogContext log_ctx_;
+  RoomBufferPool pool_; // 须在 afade_ 之前声明：AudioAfade 析构时还会归还缓冲
+  std::unique_ptr<AudioAfade> afade_;
+  // 被替换的 AudioAfade 冲刷出的尾包，已封装好、带 pts，ReceiveAudio 先取这里
+  std::deque<AVPacket> audio_tail_;
+  std::unique_ptr<VideoFade> video_fade_; // 第一个淡入淡出音频包到来时锚定
+  std::unique_ptr<GopSplicer> splicer_;   // 视频直通，未开启为空
+  int fade_left_ = 0;    // 剩余淡入淡出帧数
+  int64_t next_pts_ = 0; // 以采样点为单位
+  int64_t frames_in_ = 0;
+  int64_t idle_frames_ = 0; // 淡入淡出结束后连续透传的帧数
+  int64_t hibernate_frames_ = -1;
+  uint64_t hibernations_ = 0;
+  size_t afade_bytes_ = 0;  // 当前 AudioAfade 的常驻内存估算
+
+  AVPacket preroll_[kPrerollPackets]; // 环形，preroll_next_ 为最旧的
+  int preroll_next_ = 0;
+
+  // 滞后以最早到达的包为基线：lag = 现在 - (基线 + 包的媒体时间)
+  DegradeLevel degrade_ = DEGRADE_NONE;
+  bool lag_anchored_ = false;
+  int64_t lag_anchor_ns_ = 0;
+  int64_t last_media_ns_ = 0;
+  double lag_ms_ = 0;
+  int recover_frames_ = 0; // 滞后连续低于预算一半的帧数，够了降一档
+  int lag_report_frames_ = 0;
+  uint64_t degrade_transitions_ = 0;
+
+  capture::CaptureWriter *capture_ = nullptr;
+  uint32_t capture_room_ = 0;
+};
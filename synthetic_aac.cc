@@ -0,0 +1,67 @@
+#include "synthetic_aac.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "audio_afade.h"
+
+std::vector<std::string> GenerateAdtsFrames(int sample_rate, int channels,
+                                            int count, double freq_hz) {
+  std::vector<std::string> frames;
+  const AVCodec *enc = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  if (!enc)
+    return frames;
+  AVCodecContext *ctx = avcodec_alloc_context3(enc);
+  ctx->sample_rate = sample_rate;
+  ctx->channels = channels;
+  ctx->channel_layout = av_get_default_channel_layout(channels);
+  ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  ctx->bit_rate = 128000;
+  if (avcodec_open2(ctx, enc, nullptr) < 0) {
+    avcodec_free_context(&ctx);
+    return frames;
+  }
+
+  AVFrame *frame = av_frame_alloc();
+  frame->nb_samples = ctx->frame_size;
+  frame->format = ctx->sample_fmt;
+  frame->channels = channels;
+  frame->channel_layout = ctx->channel_layout;
+  av_frame_get_buffer(frame, 0);
+
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = nullptr;
+  pkt.size = 0;
+  int64_t pts = 0;
+  auto drain = [&] {
+    while (avcodec_receive_packet(ctx, &pkt) == 0) {
+      uint8_t adts[7];
+      AudioAfade::WriteAdtsHeader(adts, pkt.size, 2, sample_rate, channels);
+      std::string buf(reinterpret_cast<char *>(adts), 7);
+      buf.append(reinterpret_cast<char *>(pkt.data), pkt.size);
+      frames.push_back(std::move(buf));
+      av_packet_unref(&pkt);
+    }
+  };
+  // 编码器有几帧延迟，多送一些直到凑够 count
+  for (int n = 0; static_cast<int>(frames.size()) < count && n < count * 2; n++) {
+    av_frame_make_writable(frame);
+    for (int c = 0; c < channels; c++) {
+      float *dst = reinterpret_cast<float *>(frame->data[c]);
+      for (int s = 0; s < frame->nb_samples; s++) {
+        dst[s] = 0.5f * std::sin(2 * M_PI * freq_hz * (pts + s) / sample_rate);
+      }
+    }
+    frame->pts = pts;
+    pts += frame->nb_samples;
+    if (avcodec_send_frame(ctx, frame) < 0)
+      break;
+    drain();
+  }
+  frames.resize(std::min<size_t>(frames.size(), count));
+
+  av_frame_free(&frame);
+  avcodec_free_context(&ctx);
+  return frames;
+}
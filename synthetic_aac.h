@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// 合成 AAC 输入：用 FFmpeg 的 AAC 编码器把正弦波编码成带 ADTS 头的帧，
+// 供基准测试和压测使用，不依赖外部文件。失败（如没有 AAC 编码器）返回空
+std::vector<std::string> GenerateAdtsFrames(int sample_rate, int channels,
+                                            int count, double freq_hz = 440.0);
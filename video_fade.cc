@@ -0,0 +1,313 @@
+#define LOG_MODULE libmagic::LogModule::kAfade
+#include "video_fade.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VIDEO_FADE_X86 1
+#endif
+
+extern "C" {
+#include <libavutil/cpu.h>
+#include <libavutil/mathematics.h>
+}
+
+#include "logger.h"
+
+namespace {
+
+// Q15 增益，与 _mm256_mulhrs_epi16 的定点格式一致
+constexpr int kGainOne = 32767;
+// 每个切片至少这么多亮度行，小帧不拆
+constexpr int kMinRowsPerSlice = 64;
+constexpr int kMaxPlanes = 3;
+
+using RowFn = void (*)(uint8_t *p, int n, int offset, int gain);
+
+// p = offset + (p - offset) * gain，舍入与 mulhrs 相同：(x * g + 2^14) >> 15
+void ScaleRowC(uint8_t *p, int n, int offset, int gain) {
+  for (int i = 0; i < n; i++) {
+    int v = offset + (((p[i] - offset) * gain + 0x4000) >> 15);
+    p[i] = static_cast<uint8_t>(std::clamp(v, 0, 255));
+  }
+}
+
+#ifdef VIDEO_FADE_X86
+__attribute__((target("avx2"))) void ScaleRowAvx2(uint8_t *p, int n, int offset,
+                                                  int gain) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i off = _mm256_set1_epi16(static_cast<int16_t>(offset));
+  const __m256i g = _mm256_set1_epi16(static_cast<int16_t>(gain));
+  int i = 0;
+  // unpack / packus 都按 128 位通道进行，两次交错互相抵消，字节顺序不变
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(v, zero), off);
+    __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(v, zero), off);
+    lo = _mm256_add_epi16(_mm256_mulhrs_epi16(lo, g), off);
+    hi = _mm256_add_epi16(_mm256_mulhrs_epi16(hi, g), off);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + i), _mm256_packus_epi16(lo, hi));
+  }
+  ScaleRowC(p + i, n - i, offset, gain);
+}
+#endif
+
+RowFn PickRowFn() {
+#ifdef VIDEO_FADE_X86
+  if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+    return ScaleRowAvx2;
+#endif
+  return ScaleRowC;
+}
+
+struct Plane {
+  uint8_t *data;
+  int linesize;
+  int bytes; // 每行需要处理的字节数
+  int rows;
+  int offset; // 亮度为黑电平，色度为 128
+};
+
+struct FrameJob {
+  Plane planes[kMaxPlanes];
+  int nb_planes = 0;
+  int gain = kGainOne;
+  int slices = 1;
+};
+
+// 按像素格式拆出各平面；不支持的格式返回 false
+bool DescribeFrame(const AVFrame *frame, FrameJob *job) {
+  const int w = frame->width, h = frame->height;
+  const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+  const bool full_range =
+      frame->format == AV_PIX_FMT_YUVJ420P || frame->color_range == AVCOL_RANGE_JPEG;
+  const int black = full_range ? 0 : 16;
+  switch (frame->format) {
+  case AV_PIX_FMT_YUV420P:
+  case AV_PIX_FMT_YUVJ420P:
+    job->planes[0] = {frame->data[0], frame->linesize[0], w, h, black};
+    job->planes[1] = {frame->data[1], frame->linesize[1], cw, ch, 128};
+    job->planes[2] = {frame->data[2], frame->linesize[2], cw, ch, 128};
+    job->nb_planes = 3;
+    return true;
+  case AV_PIX_FMT_NV12:
+    // UV 交错，两个分量都以 128 为中性值，一起处理
+    job->planes[0] = {frame->data[0], frame->linesize[0], w, h, black};
+    job->planes[1] = {frame->data[1], frame->linesize[1], cw * 2, ch, 128};
+    job->nb_planes = 2;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// 第 slice 个切片：各平面按相同比例取一段行
+void RunSlice(const FrameJob &job, int slice, RowFn row_fn) {
+  for (int p = 0; p < job.nb_planes; p++) {
+    const Plane &pl = job.planes[p];
+    const int begin = pl.rows * slice / job.slices;
+    const int end = pl.rows * (slice + 1) / job.slices;
+    for (int y = begin; y < end; y++) {
+      uint8_t *row = pl.data + static_cast<ptrdiff_t>(y) * pl.linesize;
+      if (job.gain == 0)
+        memset(row, pl.offset, pl.bytes);
+      else
+        row_fn(row, pl.bytes, pl.offset, job.gain);
+    }
+  }
+}
+
+// 进程共享的切片线程。调用线程也参与处理；别的调用方正在用时不等待，
+// 直接在调用线程上跑完，避免各房间线程互相阻塞
+class SliceRunner {
+public:
+  static SliceRunner &Instance() {
+    static SliceRunner inst;
+    return inst;
+  }
+
+  ~SliceRunner() { Stop(); }
+
+  int threads() const { return static_cast<int>(threads_.size()); }
+
+  void SetThreads(int n) {
+    std::lock_guard<std::mutex> run_lk(run_mu_);
+    Stop();
+    stop_ = false;
+    for (int i = 0; i < n; i++)
+      threads_.emplace_back(&SliceRunner::Loop, this);
+  }
+
+  void Run(int slices, const std::function<void(int)> &fn) {
+    std::unique_lock<std::mutex> run_lk(run_mu_, std::try_to_lock);
+    if (slices <= 1 || !run_lk.owns_lock() || threads_.empty()) {
+      for (int i = 0; i < slices; i++)
+        fn(i);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      job_ = &fn;
+      slices_ = slices;
+      done_ = 0;
+      next_.store(0, std::memory_order_relaxed);
+      generation_++;
+    }
+    cv_.notify_all();
+    int did = 0;
+    for (int i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < slices; did++)
+      fn(i);
+    // 等所有切片完成且没有线程还拿着 fn，之后 fn 才能析构
+    std::unique_lock<std::mutex> lk(mu_);
+    done_ += did;
+    done_cv_.wait(lk, [&] { return done_ == slices_ && active_ == 0; });
+    job_ = nullptr;
+  }
+
+private:
+  SliceRunner() {
+    unsigned hw = std::thread::hardware_concurrency();
+    SetThreads(static_cast<int>(std::min(4u, hw / 2)));
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_)
+      t.join();
+    threads_.clear();
+  }
+
+  void Loop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+      cv_.wait(lk, [&] { return stop_ || (job_ && generation_ != seen); });
+      if (stop_)
+        return;
+      seen = generation_;
+      const std::function<void(int)> *job = job_;
+      const int slices = slices_;
+      active_++;
+      lk.unlock();
+      int did = 0;
+      for (int i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < slices; did++)
+        (*job)(i);
+      lk.lock();
+      active_--;
+      done_ += did;
+      if (done_ == slices_ && active_ == 0)
+        done_cv_.notify_all();
+    }
+  }
+
+  std::mutex run_mu_; // 同一时刻只服务一个 Run
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(int)> *job_ = nullptr;
+  int slices_ = 0;
+  int done_ = 0;
+  int active_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::atomic<int> next_{0};
+  std::vector<std::thread> threads_;
+};
+
+int64_t FramePts(const AVFrame *frame) {
+  return frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+}
+
+} // namespace
+
+VideoFade::VideoFade(AudioAfade::FadeType type, int64_t duration, AVRational time_base)
+    : type_(type), duration_(std::max<int64_t>(1, duration)), time_base_(time_base) {}
+
+VideoFade::VideoFade(AudioAfade::FadeType type, int64_t start_pts, int64_t duration,
+                     AVRational time_base)
+    : type_(type), start_pts_(start_pts), duration_(std::max<int64_t>(1, duration)),
+      time_base_(time_base) {}
+
+double VideoFade::GainAt(int64_t pts, AVRational frame_tb) const {
+  if (type_ == AudioAfade::FADE_NONE || !anchored() || pts == AV_NOPTS_VALUE)
+    return 1.0;
+  const int64_t t = av_rescale_q(pts, frame_tb, time_base_) - start_pts_;
+  if (t < 0 || t >= duration_)
+    return 1.0;
+  // 与 afade 默认的线性曲线一致
+  const double progress = static_cast<double>(t) / duration_;
+  return type_ == AudioAfade::FADE_IN ? progress : 1.0 - progress;
+}
+
+bool VideoFade::Finished(int64_t pts, AVRational frame_tb) const {
+  return anchored() && pts != AV_NOPTS_VALUE &&
+         av_rescale_q(pts, frame_tb, time_base_) >= start_pts_ + duration_;
+}
+
+bool VideoFade::Overlaps(int64_t begin, int64_t end, AVRational frame_tb) const {
+  if (type_ == AudioAfade::FADE_NONE || !anchored())
+    return false;
+  return av_rescale_q(begin, frame_tb, time_base_) < start_pts_ + duration_ &&
+         av_rescale_q(end, frame_tb, time_base_) > start_pts_;
+}
+
+bool VideoFade::Process(AVFrame *frame, AVRational frame_tb) {
+  return ProcessBatch(&frame, 1, frame_tb) == 1;
+}
+
+int VideoFade::ProcessBatch(AVFrame *const *frames, int count, AVRational frame_tb) {
+  std::vector<FrameJob> jobs;
+  std::vector<int> first_slice; // 每帧第一个切片在全部切片中的序号
+  const int max_slices = SliceRunner::Instance().threads() + 1;
+  int total = 0;
+  for (int i = 0; i < count; i++) {
+    AVFrame *frame = frames[i];
+    const double gain = GainAt(FramePts(frame), frame_tb);
+    if (gain >= 1.0)
+      continue; // 斜坡外，原样跳过
+    FrameJob job;
+    if (!DescribeFrame(frame, &job)) {
+      LOG_EVERY_N(warn, 1000, "VideoFade unsupported pixel format {}", frame->format);
+      continue;
+    }
+    if (av_frame_make_writable(frame) < 0) {
+      LOG_ERROR("VideoFade make frame writable failed pts={}", frame->pts);
+      continue;
+    }
+    DescribeFrame(frame, &job); // 可能换了缓冲
+    job.gain = static_cast<int>(std::lround(gain * kGainOne));
+    job.slices = std::clamp(frame->height / kMinRowsPerSlice, 1, max_slices);
+    first_slice.push_back(total);
+    total += job.slices;
+    jobs.push_back(job);
+  }
+  if (jobs.empty())
+    return 0;
+
+  const RowFn row_fn = PickRowFn();
+  SliceRunner::Instance().Run(total, [&](int s) {
+    size_t j = std::upper_bound(first_slice.begin(), first_slice.end(), s) -
+               first_slice.begin() - 1;
+    RunSlice(jobs[j], s - first_slice[j], row_fn);
+  });
+  return static_cast<int>(jobs.size());
+}
+
+void VideoFade::SetThreads(int threads) {
+  SliceRunner::Instance().SetThreads(std::max(0, threads));
+}
+
+bool VideoFade::UsingAvx2() { return PickRowFn() != ScaleRowC; }
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+#include "audio_afade.h"
+
+// 视频淡入淡出（从黑/到黑），与 AudioAfade 配对：原地把亮度向黑电平缩放、
+// 色度向中性值（128）收拢，不经 libavfilter。支持 YUV420P / YUVJ420P / NV12。
+// 曲线与音频一致：斜坡内按 PTS 线性变化，斜坡外的帧原样跳过。
+// 斜坡起点由配对的音频包 PTS 锁定（Anchor），视频帧按自身时间基换算后比较。
+// 大帧按行切片、批量时按帧并行，跑在进程共享的切片线程上（SetThreads）。
+class VideoFade {
+public:
+  // duration 与 start_pts 同一时间基 time_base
+  VideoFade(AudioAfade::FadeType type, int64_t duration, AVRational time_base);
+  VideoFade(AudioAfade::FadeType type, int64_t start_pts, int64_t duration,
+            AVRational time_base);
+
+  // 斜坡起点：配对音频开始淡入淡出的那个包的 PTS
+  void Anchor(int64_t start_pts) { start_pts_ = start_pts; }
+  bool anchored() const { return start_pts_ != AV_NOPTS_VALUE; }
+  // pts（frame_tb）已越过斜坡终点，之后的帧都会被跳过
+  bool Finished(int64_t pts, AVRational frame_tb) const;
+  // [begin, end)（frame_tb）与斜坡有交集；未锚定返回 false
+  bool Overlaps(int64_t begin, int64_t end, AVRational frame_tb) const;
+
+  // 原地处理一帧；像素被修改返回 true。斜坡外、未锚定、格式不支持时返回 false
+  bool Process(AVFrame *frame, AVRational frame_tb);
+  // 一批帧（如同一 GOP 解码出的帧）按帧和行并行处理，返回被修改的帧数
+  int ProcessBatch(AVFrame *const *frames, int count, AVRational frame_tb);
+
+  // 该 PTS 处的亮度增益 [0, 1]；斜坡外返回 1
+  double GainAt(int64_t pts, AVRational frame_tb) const;
+
+  // 进程共享的切片线程数（不含调用线程），0 = 只在调用线程上处理
+  static void SetThreads(int threads);
+  // 是否使用 AVX2 内核（按 av_get_cpu_flags，可用 av_force_cpu_flags 关闭做对比）
+  static bool UsingAvx2();
+
+private:
+  AudioAfade::FadeType type_;
+  int64_t start_pts_ = AV_NOPTS_VALUE;
+  int64_t duration_;
+  AVRational time_base_;
+};